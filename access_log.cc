@@ -1,18 +1,37 @@
 #include "access_log.h"
 
+#include <algorithm>
+#include <cstdio>
 #include <cstring>
 #include <fcntl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <glog/logging.h>
+#include "fuse_include.h"
+#include "request_arena.h"
 
 namespace logfs_fuse {
 
-AccessLog::AccessLog(const std::string& log_path) : fd_(0) {
-  fd_ = open(log_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC);
-  LOG_IF(FATAL, fd_ == 0) << "Failed to open access log '" << log_path
-                          << "' for write, [" << errno
-                          << "] : " << strerror(errno);
+const uint64_t AccessLog::kAllOps;
+
+AccessLog::AccessLog(const std::string& log_path, SegmentWriter* segments,
+                     EventRing* events, AccessSummary* summary,
+                     ProcessTable* processes)
+    : fd_(0),
+      segments_(log_path.empty() ? segments : NULL),
+      events_(events),
+      summary_(summary),
+      processes_(processes),
+      active_(false),
+      enabled_(true),
+      filter_(kAllOps) {
+  if (!log_path.empty()) {
+    fd_ = open(log_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC);
+    LOG_IF(FATAL, fd_ == 0) << "Failed to open access log '" << log_path
+                            << "' for write, [" << errno
+                            << "] : " << strerror(errno);
+  }
+  active_ = fd_ || segments_ || events_ || summary_;
 }
 
 AccessLog::~AccessLog() {
@@ -21,13 +40,82 @@ AccessLog::~AccessLog() {
   }
 }
 
-void AccessLog::AddEntry(const std::string& access_type,
-                         const std::string& log_path) {
-  if (fd_) {
-    write(fd_, access_type.c_str(), access_type.size());
-    write(fd_, " : ", 2);
-    write(fd_, log_path.c_str(), log_path.size());
-    write(fd_, "\n", 1);
+void AccessLog::Record(Op op, const char* log_path, size_t size) {
+  if (events_) {
+    fuse_context* context = fuse_get_context();
+    events_->Publish(op, log_path, size, context ? context->pid : 0);
+  }
+
+  ProcessInfo process;
+  bool attributed = processes_ && LookupCaller(&process);
+
+  if (summary_) {
+    summary_->Count(op, log_path,
+                    attributed ? SummaryGroup(process) : std::string());
+  }
+
+  if (fd_ || segments_) {
+    // build the whole line so that it is written in one piece, in a
+    // scratch string so that logging doesn't allocate
+    ScratchString line;
+    line->assign(OpName(op));
+    line->append(" :");
+    line->append(log_path, size);
+    if (processes_) {
+      char suffix[64];
+      int suffix_size = 0;
+      if (attributed) {
+        suffix_size =
+            snprintf(suffix, sizeof(suffix), "\t%s\t%d\t%d",
+                     process.command.c_str(), process.pid, process.sid);
+      } else {
+        suffix_size = snprintf(suffix, sizeof(suffix), "\t?\t0\t0");
+      }
+      line->append(suffix,
+                   std::min<size_t>(suffix_size, sizeof(suffix) - 1));
+    }
+    line->push_back('\n');
+
+    // the segment writer syncs every flush interval rather than every line
+    if (segments_) {
+      segments_->Append(line->data(), line->size());
+    } else {
+      write(fd_, line->data(), line->size());
+      fsync(fd_);
+    }
+  }
+}
+
+bool AccessLog::LookupCaller(ProcessInfo* info) {
+  fuse_context* context = fuse_get_context();
+  return context && processes_->Lookup(context->pid, info);
+}
+
+std::string AccessLog::SummaryGroup(const ProcessInfo& info) const {
+  switch (summary_->group()) {
+    case AccessSummary::kGroupCommand:
+      return info.command;
+    case AccessSummary::kGroupSession:
+      return std::to_string(info.sid);
+    default:
+      return std::string();
+  }
+}
+
+void AccessLog::AddSummaryBytes(Op op, const char* path, uint64_t bytes) {
+  ProcessInfo process;
+  bool attributed = processes_ &&
+                    summary_->group() != AccessSummary::kGroupNone &&
+                    LookupCaller(&process);
+  summary_->AddBytes(op, path,
+                     attributed ? SummaryGroup(process) : std::string(),
+                     bytes);
+}
+
+void AccessLog::Flush() {
+  if (segments_) {
+    segments_->Flush(true);
+  } else if (fd_) {
     fsync(fd_);
   }
 }
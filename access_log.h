@@ -1,17 +1,115 @@
 #pragma once
 
+#include <atomic>
+#include <cstdint>
+#include <cstring>
 #include <string>
 
+#include "access_summary.h"
+#include "event_ring.h"
+#include "op.h"
+#include "process_table.h"
+#include "segment_log.h"
+
 namespace logfs_fuse {
 
+/// Records accesses to the mirror
+/**
+ *  Each access is written as a line to the log file or the segmented log,
+ *  if there is one, published to the shared-memory event ring, if there is
+ *  one, and counted in the per-path summary, if there is one.
+ *
+ *  With a process table, each line ends with the command, pid and session
+ *  of the process which made the access, separated by tabs, and a summary
+ *  split by command or session uses them as its groups.
+ */
 class AccessLog {
  public:
-  explicit AccessLog(const std::string& log_path);
+  /// Bit mask which lets every op through the filter
+  static const uint64_t kAllOps = (uint64_t(1) << kNumOps) - 1;
+
+  /// Write lines to @p log_path unless it is empty, or else to
+  /// @p segments unless it is NULL, publish accesses to @p events unless
+  /// it is NULL, count accesses in @p summary unless it is NULL, attribute
+  /// accesses to processes using @p processes unless it is NULL
+  AccessLog(const std::string& log_path, SegmentWriter* segments,
+            EventRing* events, AccessSummary* summary,
+            ProcessTable* processes);
   ~AccessLog();
-  void AddEntry(const std::string& access_type, const std::string& path);
+
+  /// Return whether an entry for @p op would be recorded anywhere, so that
+  /// callers only build paths for entries someone wants
+  bool Wants(Op op) const {
+    return active_ && enabled() && (filter() & (uint64_t(1) << op));
+  }
+
+  void AddEntry(Op op, const char* path) {
+    if (Wants(op)) {
+      Record(op, path, strlen(path));
+    }
+  }
+
+  void AddEntry(Op op, const std::string& path) {
+    if (Wants(op)) {
+      Record(op, path.c_str(), path.size());
+    }
+  }
+
+  /// Add @p bytes moved by @p op to the summary of @p path. Transfers
+  /// through open handles are not logged as lines.
+  void AddTransfer(Op op, const char* path, uint64_t bytes) {
+    if (summary_ && bytes && enabled()) {
+      AddSummaryBytes(op, path, bytes);
+    }
+  }
+
+  /// Turn logging on or off without closing the log
+  void SetEnabled(bool enabled) {
+    enabled_.store(enabled, std::memory_order_relaxed);
+  }
+
+  bool enabled() const {
+    return enabled_.load(std::memory_order_relaxed);
+  }
+
+  /// Only log ops whose bit (1 << op) is set in @p mask
+  void SetFilter(uint64_t mask) {
+    filter_.store(mask, std::memory_order_relaxed);
+  }
+
+  uint64_t filter() const {
+    return filter_.load(std::memory_order_relaxed);
+  }
+
+  /// Sync everything logged so far to disk
+  void Flush();
+
+  /// Return the segmented log lines are written to, or NULL
+  const SegmentWriter* segments() const {
+    return segments_;
+  }
 
  private:
+  /// Record an entry for the NUL-terminated @p path of @p size bytes
+  void Record(Op op, const char* path, size_t size);
+
+  /// Resolve the process making the current request into @p info
+  bool LookupCaller(ProcessInfo* info);
+
+  /// Return the summary group of @p info
+  std::string SummaryGroup(const ProcessInfo& info) const;
+
+  void AddSummaryBytes(Op op, const char* path, uint64_t bytes);
+
   int fd_;
+  SegmentWriter* segments_;
+  EventRing* events_;
+  AccessSummary* summary_;
+  ProcessTable* processes_;
+  /// Whether there is anywhere to record entries
+  bool active_;
+  std::atomic<bool> enabled_;
+  std::atomic<uint64_t> filter_;
 };
 
 }  // namespace logfs_fuse
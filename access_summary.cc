@@ -0,0 +1,265 @@
+#include "access_summary.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>  // NOLINT(build/c++11)
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+#include <glog/logging.h>
+
+#include "clock.h"
+#include "replacing_file.h"
+
+namespace logfs_fuse {
+
+struct AccessSummary::Entry {
+  uint64_t hash;
+  std::string path;
+  std::string group;
+  std::atomic<uint64_t> ops;  ///< bit (1 << op) for every op seen
+  std::atomic<uint64_t> count;
+  std::atomic<uint64_t> bytes_read;
+  std::atomic<uint64_t> bytes_written;
+  int64_t first_ns;  ///< written before the entry is published
+  std::atomic<int64_t> last_ns;
+
+  Entry(uint64_t hash, const char* path, const std::string& group,
+        int64_t now_ns)
+      : hash(hash),
+        path(path),
+        group(group),
+        ops(0),
+        count(0),
+        bytes_read(0),
+        bytes_written(0),
+        first_ns(now_ns),
+        last_ns(now_ns) {}
+};
+
+// 64 bit FNV-1a of the path, then the group
+static uint64_t HashKey(const char* path, const std::string& group) {
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (const char* c = path; *c; c++) {
+    hash ^= static_cast<unsigned char>(*c);
+    hash *= 0x100000001b3ULL;
+  }
+  for (char c : group) {
+    hash ^= static_cast<unsigned char>(c);
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+AccessSummary::AccessSummary(size_t max_paths, const std::string& output_path,
+                             double interval_seconds, Group group)
+    : max_paths_(max_paths),
+      group_(group),
+      size_(0),
+      overflow_(0),
+      output_path_(output_path),
+      interval_seconds_(interval_seconds),
+      stopping_(false) {
+  // keep the table at most half full so probe sequences stay short
+  size_t num_slots = 16;
+  while (num_slots < 2 * max_paths_) {
+    num_slots *= 2;
+  }
+  mask_ = num_slots - 1;
+  slots_.reset(new std::atomic<Entry*>[num_slots]);
+  for (size_t i = 0; i < num_slots; i++) {
+    slots_[i].store(NULL, std::memory_order_relaxed);
+  }
+}
+
+AccessSummary::~AccessSummary() {
+  Stop();
+  for (size_t i = 0; i <= mask_; i++) {
+    delete slots_[i].load(std::memory_order_relaxed);
+  }
+}
+
+AccessSummary::Entry* AccessSummary::Find(const char* path,
+                                          const std::string& group) {
+  uint64_t hash = HashKey(path, group);
+  Entry* fresh = NULL;
+  for (size_t i = hash & mask_;; i = (i + 1) & mask_) {
+    Entry* entry = slots_[i].load(std::memory_order_acquire);
+    if (entry == NULL) {
+      if (fresh == NULL) {
+        // reserve room before building the entry
+        if (size_.fetch_add(1, std::memory_order_relaxed) >= max_paths_) {
+          size_.fetch_sub(1, std::memory_order_relaxed);
+          overflow_.fetch_add(1, std::memory_order_relaxed);
+          return NULL;
+        }
+        // coarse is plenty for the first and last access
+        fresh = new Entry(hash, path, group, CoarseWallClockNs());
+      }
+      if (slots_[i].compare_exchange_strong(entry, fresh,
+                                            std::memory_order_acq_rel)) {
+        return fresh;
+      }
+      // somebody else claimed the slot, entry is now what they put there
+    }
+    if (entry->hash == hash && entry->path == path && entry->group == group) {
+      if (fresh) {
+        // lost a race to add the same path
+        delete fresh;
+        size_.fetch_sub(1, std::memory_order_relaxed);
+      }
+      return entry;
+    }
+  }
+}
+
+void AccessSummary::Count(Op op, const char* path, const std::string& group) {
+  Entry* entry = Find(path, group);
+  if (entry == NULL) {
+    return;
+  }
+
+  uint64_t bit = uint64_t(1) << op;
+  if (!(entry->ops.load(std::memory_order_relaxed) & bit)) {
+    entry->ops.fetch_or(bit, std::memory_order_relaxed);
+  }
+  entry->count.fetch_add(1, std::memory_order_relaxed);
+  entry->last_ns.store(CoarseWallClockNs(), std::memory_order_relaxed);
+}
+
+void AccessSummary::AddBytes(Op op, const char* path,
+                             const std::string& group, uint64_t bytes) {
+  Entry* entry = Find(path, group);
+  if (entry == NULL) {
+    return;
+  }
+
+  if (op == kOpWrite) {
+    entry->bytes_written.fetch_add(bytes, std::memory_order_relaxed);
+  } else {
+    entry->bytes_read.fetch_add(bytes, std::memory_order_relaxed);
+  }
+  entry->last_ns.store(CoarseWallClockNs(), std::memory_order_relaxed);
+}
+
+// write @p value as a CSV field, quoted if it needs to be
+static void WriteCsvField(const std::string& value, std::ostream* out) {
+  if (value.find_first_of(",\"\n\r") == std::string::npos) {
+    *out << value;
+    return;
+  }
+  *out << '"';
+  for (char c : value) {
+    if (c == '"') {
+      *out << '"';
+    }
+    *out << c;
+  }
+  *out << '"';
+}
+
+// write @p ns since the epoch as seconds with millisecond precision
+static void WriteTime(int64_t ns, std::ostream* out) {
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%lld.%03lld",
+           static_cast<long long>(ns / 1000000000),
+           static_cast<long long>(ns % 1000000000 / 1000000));
+  *out << buf;
+}
+
+int AccessSummary::Write() {
+  std::lock_guard<std::mutex> lock(write_mutex_);
+
+  std::vector<const Entry*> entries;
+  entries.reserve(size_.load(std::memory_order_relaxed));
+  for (size_t i = 0; i <= mask_; i++) {
+    const Entry* entry = slots_[i].load(std::memory_order_acquire);
+    if (entry) {
+      entries.push_back(entry);
+    }
+  }
+  std::sort(entries.begin(), entries.end(),
+            [](const Entry* a, const Entry* b) {
+              return a->path < b->path ||
+                     (a->path == b->path && a->group < b->group);
+            });
+
+  ReplacingFile file(output_path_);
+  if (file.error() < 0) {
+    return file.error();
+  }
+  std::ostream& out = file.out();
+
+  static const char* kGroupColumns[] = {"", "command,", "session,"};
+  out << "path," << kGroupColumns[group_]
+      << "ops,count,bytes_read,bytes_written,first_access,last_access\n";
+  for (const Entry* entry : entries) {
+    WriteCsvField(entry->path, &out);
+    out << ",";
+    if (group_ != kGroupNone) {
+      WriteCsvField(entry->group, &out);
+      out << ",";
+    }
+    uint64_t ops = entry->ops.load(std::memory_order_relaxed);
+    const char* separator = "";
+    for (int i = 0; i < kNumOps; i++) {
+      if (ops & (uint64_t(1) << i)) {
+        out << separator << OpName(static_cast<Op>(i));
+        separator = "|";
+      }
+    }
+    out << "," << entry->count.load(std::memory_order_relaxed) << ","
+        << entry->bytes_read.load(std::memory_order_relaxed) << ","
+        << entry->bytes_written.load(std::memory_order_relaxed) << ",";
+    WriteTime(entry->first_ns, &out);
+    out << ",";
+    WriteTime(entry->last_ns.load(std::memory_order_relaxed), &out);
+    out << "\n";
+  }
+  int result = file.Commit();
+  if (result < 0) {
+    return result;
+  }
+  LOG_IF(WARNING, overflow() > 0)
+      << "Access summary is full, " << overflow()
+      << " accesses to further paths were not recorded";
+  return 0;
+}
+
+void AccessSummary::Start() {
+  if (interval_seconds_ <= 0 || writer_.joinable()) {
+    return;
+  }
+  stopping_ = false;
+  writer_ = std::thread(&AccessSummary::WriterMain, this);
+}
+
+void AccessSummary::Stop() {
+  if (!writer_.joinable()) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(writer_mutex_);
+    stopping_ = true;
+  }
+  writer_cv_.notify_all();
+  writer_.join();
+}
+
+void AccessSummary::WriterMain() {
+  std::chrono::milliseconds interval(
+      static_cast<int64_t>(interval_seconds_ * 1000));
+  std::unique_lock<std::mutex> lock(writer_mutex_);
+  while (!writer_cv_.wait_for(lock, interval, [this] { return stopping_; })) {
+    lock.unlock();
+    int result = Write();
+    LOG_IF(WARNING, result < 0) << "Failed to write access summary '"
+                                << output_path_ << "', [" << -result
+                                << "] : " << strerror(-result);
+    lock.lock();
+  }
+}
+
+}  // namespace logfs_fuse
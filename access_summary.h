@@ -0,0 +1,106 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>  // NOLINT(build/c++11)
+#include <cstdint>
+#include <memory>
+#include <mutex>  // NOLINT(build/c++11)
+#include <string>
+#include <thread>  // NOLINT(build/c++11)
+
+#include "op.h"
+
+namespace logfs_fuse {
+
+/// Per-path totals of every access, in place of one log line per access
+/**
+ *  For each path this keeps the set of ops which touched it, the number of
+ *  logged accesses, the bytes read and written, and the times of the first
+ *  and last access. Paths are interned in a fixed-size open addressing
+ *  table which is never resized and never deleted from, so lookups take no
+ *  lock: a slot, once published with a compare-and-swap, always holds the
+ *  same path. Counters are updated with relaxed atomics.
+ *
+ *  The table holds at most max_paths paths. Accesses to further paths are
+ *  only counted as overflow, since silently merging them would make the
+ *  summary lie about which files were used.
+ *
+ *  Totals can be split by the command or session of the process which made
+ *  each access, in which case each row is keyed by the path and that group.
+ *
+ *  Write() saves the summary as CSV sorted by path, replacing the previous
+ *  file atomically. It runs on unmount, and can also run periodically from
+ *  a background thread and on SIGUSR1.
+ */
+class AccessSummary {
+ public:
+  /// What the totals of each path are split by
+  enum Group {
+    kGroupNone = 0,
+    kGroupCommand,  ///< the command name of the accessing process
+    kGroupSession,  ///< the session id of the accessing process
+  };
+
+  /// Summarize up to @p max_paths paths, or path and group pairs, written
+  /// to @p output_path every @p interval_seconds if that is positive
+  AccessSummary(size_t max_paths, const std::string& output_path,
+                double interval_seconds, Group group);
+
+  /// Stops the periodic writer, does not write the summary
+  ~AccessSummary();
+
+  Group group() const {
+    return group_;
+  }
+
+  /// Count one access to @p path by @p op, from a process in @p group
+  void Count(Op op, const char* path, const std::string& group);
+
+  /// Add @p bytes read or written by @p op to the totals of @p path
+  void AddBytes(Op op, const char* path, const std::string& group,
+                uint64_t bytes);
+
+  /// Start the periodic writer thread, if there is an interval
+  void Start();
+
+  /// Stop the periodic writer thread
+  void Stop();
+
+  /// Write the summary to the output path, return 0 or -errno
+  int Write();
+
+  /// Number of accesses to paths which did not fit in the table
+  uint64_t overflow() const {
+    return overflow_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  AccessSummary(const AccessSummary&);
+  AccessSummary& operator=(const AccessSummary&);
+
+  struct Entry;
+
+  /// Return the entry for @p path, adding it if need be, or NULL if the
+  /// table is full
+  Entry* Find(const char* path, const std::string& group);
+
+  void WriterMain();
+
+  size_t max_paths_;
+  Group group_;
+  size_t mask_;  ///< number of slots minus one, slots are a power of two
+  std::unique_ptr<std::atomic<Entry*>[]> slots_;
+  std::atomic<size_t> size_;
+  std::atomic<uint64_t> overflow_;
+
+  std::string output_path_;
+  double interval_seconds_;
+  std::mutex write_mutex_;  ///< serializes Write()
+
+  std::mutex writer_mutex_;
+  std::condition_variable writer_cv_;
+  bool stopping_;
+  std::thread writer_;
+};
+
+}  // namespace logfs_fuse
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+
+namespace logfs_fuse {
+
+/// Recycles blocks big enough for a @p T through a free list per thread
+/**
+ *  Objects made and destroyed once per request, such as file handles and
+ *  the shared descriptor table entries behind them, would otherwise cost a
+ *  malloc and a free each. A freed block goes on the freeing thread's list,
+ *  up to kMaxFree of them, and the next allocation on that thread takes it
+ *  back. Blocks may be freed on a different thread to the one which took
+ *  them; they simply move to that thread's list.
+ */
+template <typename T>
+class BlockPool {
+ public:
+  static const size_t kMaxFree = 1024;
+
+  static void* Allocate() {
+    FreeList& list = Local();
+    if (list.head == NULL) {
+      return ::operator new(sizeof(Block));
+    }
+    Block* block = list.head;
+    list.head = block->next;
+    list.size--;
+    return block;
+  }
+
+  static void Free(void* pointer) {
+    FreeList& list = Local();
+    if (list.size >= kMaxFree) {
+      ::operator delete(pointer);
+      return;
+    }
+    Block* block = static_cast<Block*>(pointer);
+    block->next = list.head;
+    list.head = block;
+    list.size++;
+  }
+
+ private:
+  union Block {
+    Block* next;
+    typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+  };
+
+  struct FreeList {
+    Block* head;
+    size_t size;
+
+    ~FreeList() {
+      while (head) {
+        Block* next = head->next;
+        ::operator delete(head);
+        head = next;
+      }
+    }
+  };
+
+  static FreeList& Local() {
+    static thread_local FreeList list = {NULL, 0};
+    return list;
+  }
+};
+
+template <typename T>
+const size_t BlockPool<T>::kMaxFree;
+
+/// Standard allocator which takes single objects from a BlockPool, for the
+/// nodes of node-based containers
+template <typename T>
+struct PoolAllocator {
+  typedef T value_type;
+
+  PoolAllocator() {}
+
+  template <typename U>
+  PoolAllocator(const PoolAllocator<U>&) {}  // NOLINT(runtime/explicit)
+
+  T* allocate(size_t n) {
+    if (n == 1) {
+      return static_cast<T*>(BlockPool<T>::Allocate());
+    }
+    return static_cast<T*>(::operator new(n * sizeof(T)));
+  }
+
+  void deallocate(T* pointer, size_t n) {
+    if (n == 1) {
+      BlockPool<T>::Free(pointer);
+    } else {
+      ::operator delete(pointer);
+    }
+  }
+};
+
+template <typename T, typename U>
+bool operator==(const PoolAllocator<T>&, const PoolAllocator<U>&) {
+  return true;
+}
+
+template <typename T, typename U>
+bool operator!=(const PoolAllocator<T>&, const PoolAllocator<U>&) {
+  return false;
+}
+
+}  // namespace logfs_fuse
@@ -0,0 +1,108 @@
+#include "completion_pool.h"
+
+#include <utility>
+
+namespace logfs_fuse {
+
+// number of tasks a worker takes off the queue per lock acquisition
+static const size_t kMaxBatch = 32;
+
+CompletionPool::CompletionPool(size_t num_threads, size_t max_queue)
+    : max_queue_(max_queue),
+      queue_(num_threads > 0 ? max_queue : 0),
+      head_(0),
+      queue_size_(0),
+      active_(0),
+      stopping_(false),
+      queued_(0),
+      inlined_(0),
+      completed_(0) {
+  for (size_t i = 0; i < num_threads; i++) {
+    threads_.push_back(std::thread(&CompletionPool::WorkerMain, this));
+  }
+}
+
+CompletionPool::~CompletionPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  work_cv_.notify_all();
+  for (std::thread& thread : threads_) {
+    thread.join();
+  }
+}
+
+void CompletionPool::Run(Task task) {
+  if (!threads_.empty()) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (queue_size_ < max_queue_ && !stopping_) {
+      queue_[(head_ + queue_size_) % max_queue_] = std::move(task);
+      queue_size_++;
+      lock.unlock();
+      queued_++;
+      work_cv_.notify_one();
+      return;
+    }
+  }
+
+  inlined_++;
+  task();
+}
+
+void CompletionPool::Drain() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (queue_size_ > 0 || active_ > 0) {
+    idle_cv_.wait(lock);
+  }
+}
+
+void CompletionPool::WorkerMain() {
+  std::vector<Task> batch;
+  batch.reserve(kMaxBatch);
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    while (queue_size_ == 0 && !stopping_) {
+      work_cv_.wait(lock);
+    }
+    if (queue_size_ == 0) {
+      // stopping, and everything that was queued has been taken
+      return;
+    }
+
+    while (queue_size_ > 0 && batch.size() < kMaxBatch) {
+      batch.push_back(PopLocked());
+    }
+    active_ += batch.size();
+    lock.unlock();
+
+    for (Task& task : batch) {
+      task();
+    }
+    completed_ += batch.size();
+
+    lock.lock();
+    active_ -= batch.size();
+    batch.clear();
+    idle_cv_.notify_all();
+  }
+}
+
+CompletionPool::Task CompletionPool::PopLocked() {
+  Task task;
+  task.swap(queue_[head_]);
+  head_ = (head_ + 1) % max_queue_;
+  queue_size_--;
+  return task;
+}
+
+CompletionPool::Stats CompletionPool::GetStats() const {
+  Stats stats;
+  stats.queued = queued_.load();
+  stats.inlined = inlined_.load();
+  stats.completed = completed_.load();
+  return stats;
+}
+
+}  // namespace logfs_fuse
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>  // NOLINT(build/c++11)
+#include <cstdint>
+#include <functional>
+#include <mutex>  // NOLINT(build/c++11)
+#include <thread>  // NOLINT(build/c++11)
+#include <vector>
+
+namespace logfs_fuse {
+
+/// Small pool of background threads for work that nobody waits on
+/**
+ *  On slow or network-backed real trees close(2), fdatasync(2) and friends
+ *  can stall for tens of milliseconds, and while they do a fuse worker is
+ *  blocked. Work whose result the caller doesn't need, like the close in
+ *  release(), is handed to this pool instead.
+ *
+ *  The queue is bounded. When it is full, or when the pool has no threads,
+ *  Run() executes the task on the calling thread, which throttles callers
+ *  to the speed of the real tree rather than queueing without limit. It is
+ *  a ring allocated up front, so queueing a task whose captures fit in a
+ *  Task doesn't allocate.
+ */
+class CompletionPool {
+ public:
+  typedef std::function<void()> Task;
+
+  /// Snapshot of the pool counters
+  struct Stats {
+    uint64_t queued;     ///< tasks handed to a background thread
+    uint64_t inlined;    ///< tasks run by the caller, pool full or disabled
+    uint64_t completed;  ///< queued tasks that have finished
+  };
+
+  /// A pool with zero @p num_threads runs every task inline
+  CompletionPool(size_t num_threads, size_t max_queue);
+
+  /// Runs any remaining queued tasks and joins the threads
+  ~CompletionPool();
+
+  /// Queue @p task, or run it now if the queue is full
+  void Run(Task task);
+
+  /// Wait until every task queued so far has finished
+  void Drain();
+
+  Stats GetStats() const;
+
+ private:
+  CompletionPool(const CompletionPool&);
+  CompletionPool& operator=(const CompletionPool&);
+
+  void WorkerMain();
+
+  /// Take the oldest task off the queue, which must not be empty
+  Task PopLocked();
+
+  size_t max_queue_;
+  std::mutex mutex_;
+  std::condition_variable work_cv_;  ///< signalled when a task is queued
+  std::condition_variable idle_cv_;  ///< signalled when a batch finishes
+  std::vector<Task> queue_;  ///< ring of max_queue_ slots
+  size_t head_;              ///< slot of the oldest queued task
+  size_t queue_size_;        ///< tasks in the ring
+  size_t active_;  ///< tasks taken off the queue but not yet finished
+  bool stopping_;
+  std::vector<std::thread> threads_;
+
+  std::atomic<uint64_t> queued_;
+  std::atomic<uint64_t> inlined_;
+  std::atomic<uint64_t> completed_;
+};
+
+}  // namespace logfs_fuse
@@ -0,0 +1,315 @@
+#include "content_hasher.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <utility>
+
+#include "clock.h"
+#include "path_prefix.h"
+#include "replacing_file.h"
+#include "snapshot.h"
+#include "xxhash64.h"
+
+namespace logfs_fuse {
+
+// size of each read while hashing, large so the disk sees sequential I/O
+static const size_t kReadSize = 1 << 20;
+
+ContentHasher::ContentHasher(size_t num_threads, size_t max_queue,
+                             const std::string& manifest_path)
+    : max_queue_(max_queue),
+      manifest_path_(manifest_path),
+      stopping_(false),
+      next_generation_(1),
+      queued_(0),
+      hashed_(0),
+      reused_(0),
+      skipped_(0),
+      bytes_(0) {
+  for (size_t i = 0; i < num_threads; i++) {
+    threads_.push_back(std::thread(&ContentHasher::WorkerMain, this));
+  }
+}
+
+ContentHasher::~ContentHasher() {
+  Stop();
+}
+
+void ContentHasher::SubmitImpl(const char* mirror_path,
+                               const std::string& real_path) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (seen_.count(mirror_path) || stopping_) {
+      return;
+    }
+    if (queue_.size() >= max_queue_) {
+      // not marked as seen, so the next open tries again
+      skipped_++;
+      return;
+    }
+
+    Job job;
+    job.mirror_path = mirror_path;
+    job.real_path = real_path;
+    job.generation = next_generation_++;
+    seen_[mirror_path] = job.generation;
+    queue_.push_back(std::move(job));
+  }
+  queued_++;
+  work_cv_.notify_one();
+}
+
+void ContentHasher::ForgetImpl(const char* mirror_path) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  seen_.erase(mirror_path);
+  results_.erase(mirror_path);
+}
+
+void ContentHasher::ForgetBelowImpl(const std::string& mirror_dir) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (auto seen = seen_.begin(); seen != seen_.end();) {
+    if (IsBelow(seen->first.data(), seen->first.size(), mirror_dir)) {
+      seen = seen_.erase(seen);
+    } else {
+      ++seen;
+    }
+  }
+  // results are sorted, the paths below are the ones after "<dir>/"
+  auto result = results_.lower_bound(mirror_dir + "/");
+  while (result != results_.end() &&
+         IsBelow(result->first.data(), result->first.size(), mirror_dir)) {
+    result = results_.erase(result);
+  }
+}
+
+void ContentHasher::ForgetAllImpl() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  // queued and running jobs find they are no longer seen and drop their
+  // results, files reused by inode are still checked against size and mtime
+  seen_.clear();
+  results_.clear();
+}
+
+void ContentHasher::Stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  work_cv_.notify_all();
+  for (std::thread& thread : threads_) {
+    if (thread.joinable()) {
+      thread.join();
+    }
+  }
+}
+
+bool ContentHasher::HashFile(const std::string& real_path,
+                             std::vector<char>* buffer, Content* content) {
+  int fd = ::open(real_path.c_str(), O_RDONLY | O_CLOEXEC | O_NOATIME);
+  if (fd < 0 && errno == EPERM) {
+    // O_NOATIME is only allowed on files we own
+    fd = ::open(real_path.c_str(), O_RDONLY | O_CLOEXEC);
+  }
+  if (fd < 0) {
+    return false;
+  }
+
+  struct stat before;
+  if (::fstat(fd, &before) < 0 || !S_ISREG(before.st_mode)) {
+    ::close(fd);
+    return false;
+  }
+  content->size = before.st_size;
+  content->mtime_ns = MtimeNs(before);
+
+  // hard links and repeated paths to an unchanged inode share a hash
+  InodeKey inode(before);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto found = by_inode_.find(inode);
+    if (found != by_inode_.end() && found->second.size == content->size &&
+        found->second.mtime_ns == content->mtime_ns) {
+      content->hash = found->second.hash;
+      ::close(fd);
+      reused_++;
+      return true;
+    }
+  }
+
+  ::posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+  Xxhash64 hash;
+  for (off_t offset = 0;;) {
+    ssize_t result = ::pread(fd, buffer->data(), buffer->size(), offset);
+    if (result < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      ::close(fd);
+      return false;
+    }
+    if (result == 0) {
+      break;
+    }
+    hash.Update(buffer->data(), result);
+    offset += result;
+    bytes_ += result;
+  }
+
+  struct stat after;
+  bool unchanged = ::fstat(fd, &after) == 0 &&
+                   after.st_size == before.st_size &&
+                   MtimeNs(after) == content->mtime_ns;
+  ::close(fd);
+  if (!unchanged) {
+    return false;
+  }
+
+  content->hash = hash.Digest();
+  hashed_++;
+  std::lock_guard<std::mutex> lock(mutex_);
+  by_inode_[inode] = *content;
+  return true;
+}
+
+void ContentHasher::WorkerMain() {
+  std::vector<char> buffer(kReadSize);
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    while (queue_.empty() && !stopping_) {
+      work_cv_.wait(lock);
+    }
+    if (queue_.empty()) {
+      // stopping, and everything that was queued has been taken
+      return;
+    }
+
+    Job job = std::move(queue_.front());
+    queue_.pop_front();
+    lock.unlock();
+
+    Content content;
+    bool ok = HashFile(job.real_path, &buffer, &content);
+
+    lock.lock();
+    auto found = seen_.find(job.mirror_path);
+    bool current = found != seen_.end() && found->second == job.generation;
+    if (ok && current) {
+      results_[job.mirror_path] = content;
+    } else {
+      skipped_++;
+      if (current) {
+        // let the next open try again
+        seen_.erase(found);
+      }
+    }
+  }
+}
+
+void ContentHasher::Save(SnapshotWriter* out) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  out->PutU64(results_.size());
+  for (const auto& result : results_) {
+    out->PutString(result.first);
+    out->PutU64(result.second.hash);
+    out->PutU64(result.second.size);
+    out->PutU64(result.second.mtime_ns);
+  }
+  out->PutU64(by_inode_.size());
+  for (const auto& inode : by_inode_) {
+    out->PutU64(inode.first.dev);
+    out->PutU64(inode.first.ino);
+    out->PutU64(inode.second.hash);
+    out->PutU64(inode.second.size);
+    out->PutU64(inode.second.mtime_ns);
+  }
+}
+
+bool ContentHasher::Load(SnapshotReader* in) {
+  loaded_results_.clear();
+  loaded_inodes_.clear();
+  uint64_t count = 0;
+  if (!in->GetU64(&count)) {
+    return false;
+  }
+  for (uint64_t i = 0; i < count; i++) {
+    std::string path;
+    uint64_t hash = 0, size = 0, mtime_ns = 0;
+    if (!in->GetString(&path) || !in->GetU64(&hash) || !in->GetU64(&size) ||
+        !in->GetU64(&mtime_ns)) {
+      loaded_results_.clear();
+      return false;
+    }
+    Content content;
+    content.hash = hash;
+    content.size = size;
+    content.mtime_ns = mtime_ns;
+    loaded_results_.push_back(std::make_pair(path, content));
+  }
+
+  if (!in->GetU64(&count)) {
+    loaded_results_.clear();
+    return false;
+  }
+  for (uint64_t i = 0; i < count; i++) {
+    uint64_t dev = 0, ino = 0, hash = 0, size = 0, mtime_ns = 0;
+    if (!in->GetU64(&dev) || !in->GetU64(&ino) || !in->GetU64(&hash) ||
+        !in->GetU64(&size) || !in->GetU64(&mtime_ns)) {
+      loaded_results_.clear();
+      loaded_inodes_.clear();
+      return false;
+    }
+    Content content;
+    content.hash = hash;
+    content.size = size;
+    content.mtime_ns = mtime_ns;
+    loaded_inodes_.push_back(std::make_pair(InodeKey(dev, ino), content));
+  }
+  return true;
+}
+
+void ContentHasher::FinishLoad(bool keep) {
+  if (keep) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    // hashed since we started, which is fresher
+    results_.insert(loaded_results_.begin(), loaded_results_.end());
+    by_inode_.insert(loaded_inodes_.begin(), loaded_inodes_.end());
+  }
+  loaded_results_.clear();
+  loaded_inodes_.clear();
+}
+
+int ContentHasher::WriteManifest() {
+  ReplacingFile file(manifest_path_);
+  if (file.error() < 0) {
+    return file.error();
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto& result : results_) {
+      char hash[17];
+      snprintf(hash, sizeof(hash), "%016" PRIx64, result.second.hash);
+      file.out() << hash << " " << result.second.size << " " << result.first
+                 << "\n";
+    }
+  }
+  return file.Commit();
+}
+
+ContentHasher::Stats ContentHasher::GetStats() const {
+  Stats stats;
+  stats.queued = queued_.load();
+  stats.hashed = hashed_.load();
+  stats.reused = reused_.load();
+  stats.skipped = skipped_.load();
+  stats.bytes = bytes_.load();
+  return stats;
+}
+
+}  // namespace logfs_fuse
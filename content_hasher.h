@@ -0,0 +1,175 @@
+#pragma once
+
+#include <sys/types.h>
+
+#include <atomic>
+#include <condition_variable>  // NOLINT(build/c++11)
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <mutex>  // NOLINT(build/c++11)
+#include <string>
+#include <thread>  // NOLINT(build/c++11)
+#include <unordered_map>
+#include <vector>
+
+#include "inode_key.h"
+
+namespace logfs_fuse {
+
+class SnapshotReader;
+class SnapshotWriter;
+
+/// Hashes the contents of files as they are opened, off the request path
+/**
+ *  Submit() queues a file opened for reading to a small pool of threads,
+ *  which read it in large sequential chunks and hash it with XXH64. Each
+ *  path is queued at most once until Forget() is called for it, which the
+ *  fuse context does whenever the file may have changed. Files which are
+ *  the same inode with the same size and mtime, e.g. hard links, are only
+ *  read once.
+ *
+ *  If the queue is full the file is skipped and will be queued again on
+ *  its next open, so hashing never holds up a request. A file which
+ *  changes while it is being hashed is skipped too, rather than recording
+ *  a hash of contents which never existed.
+ *
+ *  WriteManifest() writes "<hash> <size> <path>" for every hashed file,
+ *  sorted by path, which together with the access log lets the pruned tree
+ *  be content addressed.
+ */
+class ContentHasher {
+ public:
+  /// Snapshot of the hasher counters
+  struct Stats {
+    uint64_t queued;   ///< files handed to the pool
+    uint64_t hashed;   ///< files read and hashed
+    uint64_t reused;   ///< files whose inode had already been hashed
+    uint64_t skipped;  ///< files not hashed: queue full, changed or failed
+    uint64_t bytes;    ///< bytes read for hashing
+  };
+
+  /// A hasher with zero @p num_threads is disabled
+  ContentHasher(size_t num_threads, size_t max_queue,
+                const std::string& manifest_path);
+
+  /// Finishes hashing any queued files
+  ~ContentHasher();
+
+  bool enabled() const {
+    return !threads_.empty();
+  }
+
+  /// Queue the file at @p mirror_path, found at @p real_path, to be hashed
+  /// unless it already has been
+  void Submit(const char* mirror_path, const std::string& real_path) {
+    if (enabled()) {
+      SubmitImpl(mirror_path, real_path);
+    }
+  }
+
+  /// Drop the hash of @p mirror_path, it may have changed
+  void Forget(const char* mirror_path) {
+    if (enabled()) {
+      ForgetImpl(mirror_path);
+    }
+  }
+
+  /// Drop the hashes of every path below the directory @p mirror_dir,
+  /// after it was renamed
+  void ForgetBelow(const std::string& mirror_dir) {
+    if (enabled()) {
+      ForgetBelowImpl(mirror_dir);
+    }
+  }
+
+  /// Drop every hash, after changes to the tree were missed
+  void ForgetAll() {
+    if (enabled()) {
+      ForgetAllImpl();
+    }
+  }
+
+  /// Finish hashing any queued files and stop the threads
+  void Stop();
+
+  /// Write the manifest, return 0 or -errno
+  int WriteManifest();
+
+  /// Write the hashes so far to @p out, for a process taking over
+  void Save(SnapshotWriter* out);
+
+  /// Read back the hashes a Save() wrote, return false if @p in was
+  /// truncated
+  /**
+   *  Nothing is added until FinishLoad(), so that the caller can drop what
+   *  was read if the rest of the snapshot turns out to be bad.
+   */
+  bool Load(SnapshotReader* in);
+
+  /// Add what the last Load() read if @p keep, and drop it either way
+  /**
+   *  The hashes go into the manifest, and files whose inode, size and
+   *  mtime match are not read again, but every path is still hashed on its
+   *  next open in case it changed in between.
+   */
+  void FinishLoad(bool keep);
+
+  Stats GetStats() const;
+
+ private:
+  ContentHasher(const ContentHasher&);
+  ContentHasher& operator=(const ContentHasher&);
+
+  struct Job {
+    std::string mirror_path;
+    std::string real_path;
+    uint64_t generation;  ///< of the submission, see seen_
+  };
+
+  struct Content {
+    uint64_t hash;
+    off_t size;
+    int64_t mtime_ns;
+  };
+
+  void SubmitImpl(const char* mirror_path, const std::string& real_path);
+  void ForgetImpl(const char* mirror_path);
+  void ForgetBelowImpl(const std::string& mirror_dir);
+  void ForgetAllImpl();
+  void WorkerMain();
+
+  /// Hash the file at @p real_path into @p content, return false if it
+  /// isn't a regular file, can't be read or changed while being read
+  bool HashFile(const std::string& real_path, std::vector<char>* buffer,
+                Content* content);
+
+  size_t max_queue_;
+  std::string manifest_path_;
+
+  std::mutex mutex_;
+  std::condition_variable work_cv_;
+  std::deque<Job> queue_;
+  bool stopping_;
+  uint64_t next_generation_;
+
+  /// paths submitted since they were last forgotten, with the generation
+  /// of the submission so that a stale result is not recorded
+  std::unordered_map<std::string, uint64_t> seen_;
+  std::map<std::string, Content> results_;  ///< by mirror path
+  std::unordered_map<InodeKey, Content, InodeKeyHash> by_inode_;
+
+  /// read by Load(), not yet added
+  std::vector<std::pair<std::string, Content>> loaded_results_;
+  std::vector<std::pair<InodeKey, Content>> loaded_inodes_;
+
+  std::vector<std::thread> threads_;
+
+  std::atomic<uint64_t> queued_;
+  std::atomic<uint64_t> hashed_;
+  std::atomic<uint64_t> reused_;
+  std::atomic<uint64_t> skipped_;
+  std::atomic<uint64_t> bytes_;
+};
+
+}  // namespace logfs_fuse
@@ -0,0 +1,322 @@
+#include "control_dir.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+
+#include "access_log.h"
+#include "fuse_context.h"
+#include "op.h"
+
+namespace logfs_fuse {
+
+struct ControlFile {
+  const char* name;
+  mode_t mode;
+};
+
+// indexed by ControlDir::File
+static const ControlFile kFiles[] = {
+    {"stats", 0444},
+    {"stats.json", 0444},
+    {"handles", 0444},
+    {"logging", 0644},
+    {"log_filter", 0644},
+    {"flush", 0200},
+    {"drop_caches", 0200},
+    {"trace", 0644},
+};
+
+struct ControlDir::Handle {
+  File file;
+  std::string contents;  ///< generated on open for readable files
+};
+
+ControlDir::ControlDir(const std::string& name, bool listed,
+                       FuseContext* context, AccessLog* access_log)
+    : name_(name),
+      path_(name.empty() ? "" : "/" + name),
+      listed_(listed),
+      context_(context),
+      access_log_(access_log),
+      created_(time(NULL)) {
+  static_assert(sizeof(kFiles) / sizeof(kFiles[0]) == kNumFiles,
+                "every control file needs a name and mode");
+}
+
+int ControlDir::Lookup(const char* path) const {
+  const char* rest = path + path_.size();
+  if (*rest == '\0') {
+    return kNumFiles;
+  }
+  for (int i = 0; i < kNumFiles; i++) {
+    if (strcmp(rest + 1, kFiles[i].name) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+void ControlDir::FillRoot(void* buf, fuse_fill_dir_t filler) const {
+  if (enabled() && listed_) {
+    filler(buf, name_.c_str(), NULL, 0);
+  }
+}
+
+int ControlDir::Getattr(const char* path, struct stat* out) const {
+  int file = Lookup(path);
+  if (file < 0) {
+    return -ENOENT;
+  }
+
+  memset(out, 0, sizeof(*out));
+  if (file == kNumFiles) {
+    out->st_mode = S_IFDIR | 0755;
+    out->st_nlink = 2;
+  } else {
+    // readers get whatever was generated on open, regardless of st_size,
+    // since opens use direct_io
+    out->st_mode = S_IFREG | kFiles[file].mode;
+    out->st_nlink = 1;
+  }
+  out->st_uid = getuid();
+  out->st_gid = getgid();
+  out->st_atime = out->st_mtime = out->st_ctime = created_;
+  return 0;
+}
+
+int ControlDir::Access(const char* path, int mode) const {
+  int file = Lookup(path);
+  if (file < 0) {
+    return -ENOENT;
+  }
+  if (file == kNumFiles) {
+    return (mode & W_OK) ? -EACCES : 0;
+  }
+
+  mode_t allowed = kFiles[file].mode;
+  if (((mode & R_OK) && !(allowed & S_IRUSR)) ||
+      ((mode & W_OK) && !(allowed & S_IWUSR)) || (mode & X_OK)) {
+    return -EACCES;
+  }
+  return 0;
+}
+
+int ControlDir::Open(const char* path, struct fuse_file_info* fi) {
+  int file = Lookup(path);
+  if (file < 0) {
+    return -ENOENT;
+  }
+  if (file == kNumFiles) {
+    return -EISDIR;
+  }
+
+  int access_mode = fi->flags & O_ACCMODE;
+  bool reading = access_mode != O_WRONLY;
+  bool writing = access_mode != O_RDONLY;
+  mode_t allowed = kFiles[file].mode;
+  if ((reading && !(allowed & S_IRUSR)) || (writing && !(allowed & S_IWUSR))) {
+    return -EACCES;
+  }
+
+  // we are not mounted with default_permissions, so check the writer here
+  if (writing) {
+    uid_t uid = fuse_get_context()->uid;
+    if (uid != 0 && uid != getuid()) {
+      return -EACCES;
+    }
+  }
+
+  Handle* handle = new Handle;
+  handle->file = static_cast<File>(file);
+  if (reading) {
+    handle->contents = Generate(handle->file);
+  }
+  fi->fh = reinterpret_cast<uint64_t>(handle);
+  fi->direct_io = 1;
+  return 0;
+}
+
+int ControlDir::Opendir(const char* path) const {
+  int file = Lookup(path);
+  if (file < 0) {
+    return -ENOENT;
+  }
+  return file == kNumFiles ? 0 : -ENOTDIR;
+}
+
+int ControlDir::Read(const char* path, char* buf, size_t bufsize,
+                     off_t offset, struct fuse_file_info* fi) {
+  Handle* handle = GetHandle(fi);
+  if (handle == NULL) {
+    return -EBADF;
+  }
+
+  const std::string& contents = handle->contents;
+  if (offset >= static_cast<off_t>(contents.size())) {
+    return 0;
+  }
+  size_t count = std::min(bufsize, contents.size() - offset);
+  memcpy(buf, contents.data() + offset, count);
+  return count;
+}
+
+int ControlDir::Write(const char* path, const char* buf, size_t bufsize,
+                      struct fuse_file_info* fi) {
+  Handle* handle = GetHandle(fi);
+  if (handle == NULL) {
+    return -EBADF;
+  }
+
+  int result = Apply(handle->file, std::string(buf, bufsize));
+  if (result < 0) {
+    return result;
+  }
+  return bufsize;
+}
+
+int ControlDir::Release(struct fuse_file_info* fi) {
+  delete GetHandle(fi);
+  fi->fh = 0;
+  return 0;
+}
+
+int ControlDir::Readdir(const char* path, void* buf,
+                        fuse_fill_dir_t filler) const {
+  if (Lookup(path) != kNumFiles) {
+    return -ENOTDIR;
+  }
+
+  filler(buf, ".", NULL, 0);
+  filler(buf, "..", NULL, 0);
+  for (int i = 0; i < kNumFiles; i++) {
+    filler(buf, kFiles[i].name, NULL, 0);
+  }
+  return 0;
+}
+
+int ControlDir::Truncate(const char* path) const {
+  int file = Lookup(path);
+  if (file < 0) {
+    return -ENOENT;
+  }
+  if (file == kNumFiles) {
+    return -EISDIR;
+  }
+  return (kFiles[file].mode & S_IWUSR) ? 0 : -EACCES;
+}
+
+std::string ControlDir::Generate(File file) const {
+  std::ostringstream out;
+  switch (file) {
+    case kStats:
+      return context_->FormatStats(false);
+
+    case kStatsJson:
+      return context_->FormatStats(true);
+
+    case kHandles:
+      out << "files " << context_->open_files() << "\n"
+          << "dirs " << context_->open_dirs() << "\n";
+      break;
+
+    case kLogging:
+      out << (access_log_->enabled() ? 1 : 0) << "\n";
+      break;
+
+    case kTrace:
+      if (!context_->traceable()) {
+        return "unavailable, mount with --trace_control to trace from here\n";
+      }
+      return context_->tracer()->Status();
+
+    case kLogFilter: {
+      uint64_t filter = access_log_->filter();
+      if (filter == AccessLog::kAllOps) {
+        out << "all\n";
+        break;
+      }
+      for (int i = 0; i < kNumOps; i++) {
+        if (filter & (uint64_t(1) << i)) {
+          out << OpName(static_cast<Op>(i)) << "\n";
+        }
+      }
+      break;
+    }
+
+    default:
+      break;
+  }
+  return out.str();
+}
+
+int ControlDir::Apply(File file, const std::string& input) {
+  switch (file) {
+    case kLogging: {
+      std::istringstream in(input);
+      int enabled = -1;
+      in >> enabled;
+      if (enabled != 0 && enabled != 1) {
+        return -EINVAL;
+      }
+      access_log_->SetEnabled(enabled);
+      return 0;
+    }
+
+    case kLogFilter: {
+      // op names separated by whitespace or commas
+      std::string names = input;
+      std::replace(names.begin(), names.end(), ',', ' ');
+      std::istringstream in(names);
+      uint64_t filter = 0;
+      bool any = false;
+      for (std::string name; in >> name;) {
+        any = true;
+        if (name == "all") {
+          filter = AccessLog::kAllOps;
+          continue;
+        }
+        Op op = OpFromName(name.c_str());
+        if (op == kNumOps) {
+          return -EINVAL;
+        }
+        filter |= uint64_t(1) << op;
+      }
+      access_log_->SetFilter(any ? filter : AccessLog::kAllOps);
+      return 0;
+    }
+
+    case kFlush:
+      access_log_->Flush();
+      return 0;
+
+    case kDropCaches:
+      context_->DropCaches();
+      return 0;
+
+    case kTrace: {
+      if (!context_->traceable()) {
+        return -EPERM;
+      }
+      std::istringstream in(input);
+      int tracing = -1;
+      in >> tracing;
+      if (tracing == 1) {
+        context_->tracer()->Start();
+        return 0;
+      } else if (tracing == 0) {
+        return context_->tracer()->Stop();
+      }
+      return -EINVAL;
+    }
+
+    default:
+      return -EACCES;
+  }
+}
+
+}  // namespace logfs_fuse
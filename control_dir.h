@@ -0,0 +1,114 @@
+#pragma once
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <cstring>
+#include <ctime>
+#include <string>
+
+#include "fuse_include.h"
+
+namespace logfs_fuse {
+
+class AccessLog;
+class FuseContext;
+
+/// A virtual directory inside the mount for inspecting and tuning the mirror
+/**
+ *  The directory (by default /.logfs) is served entirely from memory and
+ *  never touches the real tree or the access log. It contains:
+ *
+ *    file         | access | contents
+ *    -------------|--------|----------------------------------------------
+ *    stats        | r      | op latencies and cache counters as text
+ *    stats.json   | r      | the same as JSON
+ *    handles      | r      | number of open file and directory handles
+ *    logging      | rw     | 1 if the access log is enabled, write 0 or 1
+ *    log_filter   | rw     | ops which are logged, or "all"
+ *    flush        | w      | any write syncs the access log
+ *    drop_caches  | w      | any write empties the fd and xattr caches,
+ *                 |        | and forgets content hashes and pack entries
+ *    trace        | rw     | tracer state, write 1 to start a trace and
+ *                 |        | 0 to stop it and write it out, if mounted
+ *                 |        | with trace_control or trace
+ *
+ *  Readable files are generated when they are opened, so a reader sees one
+ *  consistent report. Writes are applied as they arrive, so each command
+ *  has to be written with a single write(2), as `echo` does. Only the user
+ *  running the mirror, or root, may open files for writing.
+ *
+ *  The directory is not listed in the root unless asked for, so tree walks
+ *  of the mirror look the same as walks of the real tree.
+ */
+class ControlDir {
+ public:
+  /// @p name is the entry in the root, empty disables the directory
+  ControlDir(const std::string& name, bool listed, FuseContext* context,
+             AccessLog* access_log);
+
+  bool enabled() const {
+    return !path_.empty();
+  }
+
+  /// Return true if @p path is the control directory or inside it
+  bool Owns(const char* path) const {
+    return enabled() && strncmp(path, path_.c_str(), path_.size()) == 0 &&
+           (path[path_.size()] == '\0' || path[path_.size()] == '/');
+  }
+
+  /// Add the control directory to a listing of the root, if it is listed
+  void FillRoot(void* buf, fuse_fill_dir_t filler) const;
+
+  const std::string& name() const {
+    return name_;
+  }
+
+  int Getattr(const char* path, struct stat* out) const;
+  int Access(const char* path, int mode) const;
+  int Open(const char* path, struct fuse_file_info* fi);
+  int Opendir(const char* path) const;
+  int Read(const char* path, char* buf, size_t bufsize, off_t offset,
+           struct fuse_file_info* fi);
+  int Write(const char* path, const char* buf, size_t bufsize,
+            struct fuse_file_info* fi);
+  int Release(struct fuse_file_info* fi);
+  int Readdir(const char* path, void* buf, fuse_fill_dir_t filler) const;
+
+  /// Writes only ever replace the contents, so truncation is a no-op
+  int Truncate(const char* path) const;
+
+ private:
+  enum File {
+    kStats = 0,
+    kStatsJson,
+    kHandles,
+    kLogging,
+    kLogFilter,
+    kFlush,
+    kDropCaches,
+    kTrace,
+    kNumFiles
+  };
+
+  struct Handle;
+
+  static Handle* GetHandle(const struct fuse_file_info* fi) {
+    return reinterpret_cast<Handle*>(fi->fh);
+  }
+
+  /// Return the file at @p path, kNumFiles for the directory itself, or -1
+  int Lookup(const char* path) const;
+
+  std::string Generate(File file) const;
+  int Apply(File file, const std::string& input);
+
+  std::string name_;
+  std::string path_;  ///< "/" + name_
+  bool listed_;
+  FuseContext* context_;
+  AccessLog* access_log_;
+  time_t created_;  ///< reported as the time of every entry
+};
+
+}  // namespace logfs_fuse
@@ -0,0 +1,198 @@
+#include "event_ring.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include "clock.h"
+
+namespace logfs_fuse {
+
+const char kEventRingMagic[8] = {'L', 'O', 'G', 'F', 'S', 'E', 'V', '1'};
+
+EventRing::EventRing()
+    : header_(NULL), slots_(NULL), mask_(0), mapped_size_(0) {}
+
+EventRing::~EventRing() {
+  if (header_) {
+    ::munmap(header_, mapped_size_);
+    ::shm_unlink(name_.c_str());
+  }
+}
+
+int EventRing::Create(const std::string& name, uint64_t capacity) {
+  if (capacity == 0 || (capacity & (capacity - 1)) != 0) {
+    return -EINVAL;
+  }
+
+  // a fresh object, so readers of a previous mount see it go away rather
+  // than their ring being reset underneath them
+  ::shm_unlink(name.c_str());
+  int fd = ::shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC,
+                      0640);
+  if (fd < 0) {
+    return -errno;
+  }
+  size_t size = sizeof(EventRingHeader) + capacity * sizeof(EventSlot);
+  void* mapped = MAP_FAILED;
+  if (::ftruncate(fd, size) == 0) {
+    mapped =
+        ::mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  int error = errno;
+  ::close(fd);
+  if (mapped == MAP_FAILED) {
+    ::shm_unlink(name.c_str());
+    return -error;
+  }
+
+  // the object starts zeroed, which is an empty ring apart from the header
+  name_ = name;
+  header_ = static_cast<EventRingHeader*>(mapped);
+  slots_ = reinterpret_cast<EventSlot*>(header_ + 1);
+  mask_ = capacity - 1;
+  mapped_size_ = size;
+  header_->version = kEventRingVersion;
+  header_->slot_size = sizeof(EventSlot);
+  header_->capacity = capacity;
+  header_->created_ns = WallClockNs();
+  std::atomic_thread_fence(std::memory_order_release);
+  memcpy(header_->magic, kEventRingMagic, sizeof(header_->magic));
+  return 0;
+}
+
+void EventRing::Publish(Op op, const char* path, size_t size, int32_t pid) {
+  uint64_t sequence = header_->head.fetch_add(1, std::memory_order_relaxed);
+  EventSlot& slot = slots_[sequence & mask_];
+
+  slot.sequence.store(0, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  slot.time_ns = WallClockNs();
+  slot.pid = pid;
+  slot.op = op;
+  slot.flags = size > kEventPathSize ? kEventTruncated : 0;
+  slot.path_size = std::min(size, kEventPathSize);
+  memcpy(slot.path, path, slot.path_size);
+  slot.sequence.store(sequence + 1, std::memory_order_release);
+}
+
+EventRingReader::EventRingReader()
+    : header_(NULL),
+      slots_(NULL),
+      mask_(0),
+      mapped_size_(0),
+      position_(0),
+      lost_(0) {}
+
+EventRingReader::~EventRingReader() {
+  if (header_) {
+    ::munmap(const_cast<EventRingHeader*>(header_), mapped_size_);
+  }
+}
+
+int EventRingReader::Open(const std::string& name) {
+  int fd = ::shm_open(name.c_str(), O_RDONLY | O_CLOEXEC, 0);
+  if (fd < 0) {
+    return -errno;
+  }
+  struct stat st;
+  if (::fstat(fd, &st) < 0) {
+    int error = errno;
+    ::close(fd);
+    return -error;
+  }
+  size_t size = st.st_size;
+  if (size < sizeof(EventRingHeader)) {
+    ::close(fd);
+    return -EPROTO;
+  }
+  void* mapped = ::mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+  int error = errno;
+  ::close(fd);
+  if (mapped == MAP_FAILED) {
+    return -error;
+  }
+
+  const EventRingHeader* header = static_cast<EventRingHeader*>(mapped);
+  bool valid =
+      memcmp(header->magic, kEventRingMagic, sizeof(header->magic)) == 0;
+  std::atomic_thread_fence(std::memory_order_acquire);
+  uint64_t capacity = header->capacity;
+  if (!valid || header->version != kEventRingVersion ||
+      header->slot_size != sizeof(EventSlot) || capacity == 0 ||
+      (capacity & (capacity - 1)) != 0 ||
+      capacity > (size - sizeof(EventRingHeader)) / sizeof(EventSlot)) {
+    ::munmap(mapped, size);
+    return -EPROTO;
+  }
+
+  header_ = header;
+  slots_ = reinterpret_cast<const EventSlot*>(header_ + 1);
+  mask_ = capacity - 1;
+  mapped_size_ = size;
+  position_ = header_->head.load(std::memory_order_acquire);
+  return 0;
+}
+
+void EventRingReader::SeekToOldest() {
+  uint64_t head = header_->head.load(std::memory_order_acquire);
+  position_ = head > header_->capacity ? head - header_->capacity : 0;
+}
+
+uint64_t EventRingReader::backlog() const {
+  uint64_t head = header_->head.load(std::memory_order_acquire);
+  return head > position_ ? std::min(head - position_, header_->capacity) : 0;
+}
+
+bool EventRingReader::Next(Event* event) {
+  while (true) {
+    uint64_t head = header_->head.load(std::memory_order_acquire);
+    if (position_ >= head) {
+      return false;
+    }
+    if (head - position_ > header_->capacity) {
+      // everything before the last capacity events is already overwritten
+      uint64_t skipped = head - position_ - header_->capacity;
+      lost_ += skipped;
+      position_ += skipped;
+    }
+
+    const EventSlot& slot = slots_[position_ & mask_];
+    uint64_t before = slot.sequence.load(std::memory_order_acquire);
+    if (before != position_ + 1) {
+      if (before == 0 || before < position_ + 1) {
+        // claimed but still being written
+        return false;
+      }
+      lost_++;
+      position_++;
+      continue;
+    }
+
+    event->sequence = position_;
+    event->time_ns = slot.time_ns;
+    event->pid = slot.pid;
+    event->op = static_cast<Op>(slot.op);
+    event->truncated = (slot.flags & kEventTruncated) != 0;
+    event->path_size = std::min<size_t>(slot.path_size, kEventPathSize);
+    memcpy(event->path, slot.path, event->path_size);
+    event->path[event->path_size] = '\0';
+
+    // the copy is only good if the writer didn't come round again during it
+    std::atomic_thread_fence(std::memory_order_acquire);
+    uint64_t after = slot.sequence.load(std::memory_order_relaxed);
+    position_++;
+    if (after != before || event->op >= kNumOps) {
+      lost_++;
+      continue;
+    }
+    return true;
+  }
+}
+
+}  // namespace logfs_fuse
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "op.h"
+
+namespace logfs_fuse {
+
+/// Layout of the shared-memory event ring
+/**
+ *  The ring is a named POSIX shared-memory object holding an
+ *  EventRingHeader followed by a power of two of fixed-size EventSlots.
+ *  Every access the log records gets the next sequence number, counted
+ *  from zero, and is written to the slot at that number modulo the
+ *  capacity, so the newest events overwrite the oldest.
+ *
+ *  A slot's sequence field is zero while the slot is being written and
+ *  its event's sequence number plus one once it is complete. A reader
+ *  checks it before and after copying a slot, like a seqlock: a slot
+ *  holding a later event, or one which changed while it was copied, means
+ *  the writer lapped the reader. Reading an event takes no system calls
+ *  and never blocks the writer.
+ */
+struct EventRingHeader {
+  char magic[8];  ///< kEventRingMagic, set once the ring is ready
+  uint32_t version;
+  uint32_t slot_size;  ///< sizeof(EventSlot)
+  uint64_t capacity;   ///< number of slots, a power of two
+  int64_t created_ns;  ///< wall clock time the ring was created
+  alignas(64) std::atomic<uint64_t> head;  ///< sequence of the next event
+};
+
+/// Bytes of a path kept in a slot, longer paths are cut short
+static const size_t kEventPathSize = 228;
+
+/// Set in EventSlot::flags when the path was cut short
+static const uint16_t kEventTruncated = 1;
+
+struct EventSlot {
+  std::atomic<uint64_t> sequence;  ///< event sequence + 1, 0 while written
+  int64_t time_ns;                 ///< wall clock time of the access
+  int32_t pid;                     ///< of the accessing process, or 0
+  uint16_t op;                     ///< an Op
+  uint16_t flags;
+  uint32_t path_size;  ///< bytes of path used
+  char path[kEventPathSize];
+};
+
+static_assert(sizeof(EventSlot) == 256, "event slots should be 256 bytes");
+
+extern const char kEventRingMagic[8];
+static const uint32_t kEventRingVersion = 1;
+
+/// One event copied out of the ring
+struct Event {
+  uint64_t sequence;
+  int64_t time_ns;
+  int32_t pid;
+  Op op;
+  bool truncated;       ///< path holds only the start of the path
+  size_t path_size;
+  char path[kEventPathSize + 1];  ///< NUL terminated
+};
+
+/// Publishes access events to a shared-memory ring, see EventRingHeader
+/**
+ *  Any number of threads may publish, each claims its sequence number
+ *  with one atomic increment. Readers are other processes using
+ *  EventRingReader. The shared-memory object is removed when the ring is
+ *  destroyed, readers which still have it mapped can finish reading it.
+ */
+class EventRing {
+ public:
+  EventRing();
+  ~EventRing();
+
+  /// Create the ring named @p name, replacing any existing one, with
+  /// @p capacity slots, a power of two. Return 0 or -errno.
+  int Create(const std::string& name, uint64_t capacity);
+
+  /// Publish an access by @p op, from process @p pid, to the @p size bytes
+  /// of @p path
+  void Publish(Op op, const char* path, size_t size, int32_t pid);
+
+  /// Number of events published
+  uint64_t published() const {
+    return header_ ? header_->head.load(std::memory_order_relaxed) : 0;
+  }
+
+ private:
+  EventRing(const EventRing&);
+  EventRing& operator=(const EventRing&);
+
+  std::string name_;
+  EventRingHeader* header_;
+  EventSlot* slots_;
+  uint64_t mask_;
+  size_t mapped_size_;
+};
+
+/// Reads events from a ring published by another process
+class EventRingReader {
+ public:
+  EventRingReader();
+  ~EventRingReader();
+
+  /// Map the ring named @p name, return 0 or -errno, -EPROTO if it isn't
+  /// an event ring. Reading starts with the next event published.
+  int Open(const std::string& name);
+
+  /// Start reading from the oldest event still in the ring instead
+  void SeekToOldest();
+
+  /// Copy the next event to @p event, return false if there is none yet
+  bool Next(Event* event);
+
+  /// Number of events which were overwritten before they could be read
+  uint64_t lost() const {
+    return lost_;
+  }
+
+  /// Number of events published but not yet read, at most the capacity
+  uint64_t backlog() const;
+
+  uint64_t capacity() const {
+    return header_->capacity;
+  }
+
+ private:
+  EventRingReader(const EventRingReader&);
+  EventRingReader& operator=(const EventRingReader&);
+
+  const EventRingHeader* header_;
+  const EventSlot* slots_;
+  uint64_t mask_;
+  size_t mapped_size_;
+  uint64_t position_;  ///< sequence of the next event to read
+  uint64_t lost_;
+};
+
+}  // namespace logfs_fuse
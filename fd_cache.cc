@@ -0,0 +1,158 @@
+#include "fd_cache.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+
+#include "path_prefix.h"
+#include "request_arena.h"
+
+namespace logfs_fuse {
+
+CachedFd::~CachedFd() {
+  ::close(fd_);
+}
+
+const size_t FdCache::kStripes;
+
+FdCache::FdCache(size_t capacity)
+    : capacity_(capacity) {
+  std::fill(generations_, generations_ + kStripes, 0);
+}
+
+FdCache::~FdCache() {}
+
+void FdCache::MakeKey(const std::string& path, int access_mode,
+                      std::string* key) {
+  // access mode first so that the key can't be confused with a path
+  key->assign(1, static_cast<char>('0' + (access_mode & O_ACCMODE)));
+  key->append(path);
+}
+
+FdCache::Lease FdCache::Acquire(const std::string& path, int access_mode,
+                                int* error) {
+  access_mode &= O_ACCMODE;
+  ScratchString scratch;
+  MakeKey(path, access_mode, &*scratch);
+  const std::string& key = *scratch;
+
+  uint64_t generation = 0;
+  if (capacity_ > 0) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    generation = generations_[Stripe(path)];
+    auto found = index_.find(key);
+    if (found != index_.end()) {
+      lru_.splice(lru_.begin(), lru_, found->second);
+      hits_.Add(1);
+      return found->second->second;
+    }
+  }
+
+  // don't hold the lock across the open, it may block on the real tree
+  misses_.Add(1);
+  int fd = ::open(path.c_str(), access_mode);
+  if (fd < 0) {
+    *error = errno;
+    return Lease();
+  }
+  Lease lease = std::make_shared<const CachedFd>(fd);
+  if (capacity_ == 0) {
+    return lease;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto found = index_.find(key);
+  if (found != index_.end()) {
+    // somebody else opened it while we were unlocked, use theirs and let
+    // ours close when we return
+    lru_.splice(lru_.begin(), lru_, found->second);
+    return found->second->second;
+  }
+  if (generations_[Stripe(path)] != generation) {
+    // the path was invalidated while we opened it, what we have may be the
+    // file it replaced
+    return lease;
+  }
+
+  lru_.push_front(Entry(key, lease));
+  index_[key] = lru_.begin();
+  while (lru_.size() > capacity_) {
+    index_.erase(lru_.back().first);
+    lru_.pop_back();
+    evictions_.Add(1);
+  }
+  return lease;
+}
+
+bool FdCache::EraseLocked(const std::string& key) {
+  auto found = index_.find(key);
+  if (found == index_.end()) {
+    return false;
+  }
+  lru_.erase(found->second);
+  index_.erase(found);
+  return true;
+}
+
+void FdCache::Invalidate(const std::string& path) {
+  if (capacity_ == 0) {
+    return;
+  }
+
+  ScratchString key;
+  std::lock_guard<std::mutex> lock(mutex_);
+  generations_[Stripe(path)]++;
+  for (int access_mode : {O_RDONLY, O_WRONLY, O_RDWR}) {
+    MakeKey(path, access_mode, &*key);
+    if (EraseLocked(*key)) {
+      invalidations_.Add(1);
+    }
+  }
+}
+
+void FdCache::InvalidateBelow(const std::string& dir) {
+  if (capacity_ == 0) {
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  // the paths below aren't known, so every stripe changes
+  for (uint64_t& generation : generations_) {
+    generation++;
+  }
+  for (auto entry = lru_.begin(); entry != lru_.end();) {
+    // keys start with the access mode
+    const std::string& key = entry->first;
+    if (IsBelow(key.data() + 1, key.size() - 1, dir)) {
+      index_.erase(key);
+      entry = lru_.erase(entry);
+      invalidations_.Add(1);
+    } else {
+      ++entry;
+    }
+  }
+}
+
+void FdCache::Clear() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (uint64_t& generation : generations_) {
+    generation++;
+  }
+  invalidations_.Add(lru_.size());
+  index_.clear();
+  lru_.clear();
+}
+
+FdCache::Stats FdCache::GetStats() const {
+  Stats stats;
+  stats.hits = hits_.value();
+  stats.misses = misses_.value();
+  stats.evictions = evictions_.value();
+  stats.invalidations = invalidations_.value();
+  stats.opens_avoided = stats.hits;
+  return stats;
+}
+
+}  // namespace logfs_fuse
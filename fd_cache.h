@@ -0,0 +1,122 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>  // NOLINT(build/c++11)
+#include <string>
+#include <unordered_map>
+
+#include "sharded.h"
+
+namespace logfs_fuse {
+
+/// An open descriptor for a file in the real tree, closed on destruction
+class CachedFd {
+ public:
+  explicit CachedFd(int fd) : fd_(fd) {}
+  ~CachedFd();
+
+  int fd() const {
+    return fd_;
+  }
+
+ private:
+  CachedFd(const CachedFd&);
+  CachedFd& operator=(const CachedFd&);
+
+  int fd_;
+};
+
+/// Bounded LRU cache of descriptors for handle-less read and write calls
+/**
+ *  When fuse calls read() or write() without a file handle we would
+ *  otherwise have to open(), pread()/pwrite() and close() the real file for
+ *  every request. Instead we keep up to @p capacity descriptors open, keyed
+ *  by the real path and the access mode they were opened with.
+ *
+ *  Descriptors are handed out as a Lease. An evicted or invalidated
+ *  descriptor stays open until the last lease on it is dropped, so it is
+ *  safe for a caller to keep using a lease while another thread evicts the
+ *  entry.
+ *
+ *  Each hit avoids one open(2)/close(2) pair on the real tree.
+ */
+class FdCache {
+ public:
+  typedef std::shared_ptr<const CachedFd> Lease;
+
+  /// Snapshot of the cache counters
+  struct Stats {
+    uint64_t hits;           ///< lookups satisfied by an open descriptor
+    uint64_t misses;         ///< lookups which had to open the file
+    uint64_t evictions;      ///< descriptors dropped to stay under capacity
+    uint64_t invalidations;  ///< descriptors dropped by Invalidate()
+    uint64_t opens_avoided;  ///< open/close pairs saved, same as hits
+  };
+
+  /// A @p capacity of zero disables caching, every Acquire() opens the file
+  explicit FdCache(size_t capacity);
+  ~FdCache();
+
+  /// Return a lease on a descriptor for @p path opened with @p access_mode
+  /**
+   *  @p access_mode is one of O_RDONLY, O_WRONLY or O_RDWR. On failure
+   *  returns an empty lease and stores the errno of the failed open(2) in
+   *  @p error.
+   */
+  Lease Acquire(const std::string& path, int access_mode, int* error);
+
+  /// Drop any cached descriptors for @p path, in all access modes
+  /**
+   *  Must be called whenever the file at @p path may have been replaced or
+   *  removed, i.e. after unlink, rename and truncate. A descriptor being
+   *  opened for @p path at the same time is not cached, since it may be of
+   *  the file that was replaced.
+   */
+  void Invalidate(const std::string& path);
+
+  /// Drop the cached descriptors of every path below the directory @p dir,
+  /// after it was renamed
+  void InvalidateBelow(const std::string& dir);
+
+  /// Drop all cached descriptors
+  void Clear();
+
+  Stats GetStats() const;
+
+ private:
+  typedef std::pair<std::string, Lease> Entry;
+  typedef std::list<Entry> LruList;
+
+  /// Build the key of @p path opened with @p access_mode in @p key
+  static void MakeKey(const std::string& path, int access_mode,
+                      std::string* key);
+
+  /// Erase the entry for @p key, if any. Caller must hold mutex_
+  bool EraseLocked(const std::string& key);
+
+  /// Number of stripes of generations_
+  static const size_t kStripes = 64;
+
+  /// Return the generation stripe of @p path
+  static size_t Stripe(const std::string& path) {
+    return std::hash<std::string>()(path) % kStripes;
+  }
+
+  size_t capacity_;
+  std::mutex mutex_;
+  LruList lru_;  ///< most recently used at the front
+  std::unordered_map<std::string, LruList::iterator> index_;
+  /// bumped by every invalidation of the paths in each stripe, so that an
+  /// open which raced with one isn't cached
+  uint64_t generations_[kStripes];
+
+  ShardedCounter hits_;
+  ShardedCounter misses_;
+  ShardedCounter evictions_;
+  ShardedCounter invalidations_;
+};
+
+}  // namespace logfs_fuse
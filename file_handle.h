@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstddef>
+
+#include "block_pool.h"
+#include "fuse_include.h"
+#include "inode_key.h"
+#include "pack_file.h"
+
+namespace logfs_fuse {
+
+class WriteBuffer;
+
+/// State for an open file
+/**
+ *  A pointer to one of these is stored in fuse_file_info::fh by open() and
+ *  create(), in the same way that opendir() stores the DIR pointer. This
+ *  means that a zero fh unambiguously means "no handle", even if the real
+ *  file happens to be open as descriptor zero. Handles come from a
+ *  BlockPool, since one is made and destroyed for every open.
+ */
+struct FileHandle {
+  int fd;          ///< descriptor of the file in the real tree
+  bool shared;     ///< fd is owned by the SharedFdTable, not this handle
+  InodeKey inode;  ///< key of the shared descriptor, if shared
+  bool dirty;      ///< the file has been written through this handle
+  WriteBuffer* buffer;  ///< write-back buffer, or NULL if unbuffered
+  const PackFile::Entry* pack;  ///< serves reads if set and not stale
+
+  explicit FileHandle(int fd)
+      : fd(fd), shared(false), dirty(false), buffer(NULL), pack(NULL) {}
+
+  static void* operator new(size_t size) {
+    return BlockPool<FileHandle>::Allocate();
+  }
+
+  static void operator delete(void* pointer) {
+    BlockPool<FileHandle>::Free(pointer);
+  }
+};
+
+/// Return the file handle stored in @p fi, or NULL if there is none
+inline FileHandle* GetFileHandle(const struct fuse_file_info* fi) {
+  if (fi == NULL) {
+    return NULL;
+  }
+  return reinterpret_cast<FileHandle*>(fi->fh);
+}
+
+}  // namespace logfs_fuse
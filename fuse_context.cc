@@ -12,6 +12,7 @@
 
 #include <algorithm>
 #include <cstdio>
+#include <cstring>
 #include <ctime>
 #include <iostream>
 #include <sstream>
@@ -20,6 +21,11 @@
 #include <boost/filesystem.hpp>
 #include <glog/logging.h>
 #include "access_log.h"
+#include "file_handle.h"
+#include "snapshot.h"
+#include "stats.h"
+#include "write_buffer.h"
+#include "xattr_cache.h"
 
 namespace logfs_fuse {
 
@@ -34,88 +40,438 @@ std::string BoolStr(bool value) {
   return value ? "true" : "false";
 }
 
-FuseContext::FuseContext(const std::string& real_root, AccessLog* access_log)
-    : access_log_(access_log), real_root_(real_root) {}
+FuseContext::FuseContext(const std::string& real_root, AccessLog* access_log,
+                         const Options& options)
+    : FuseContext(new MirrorTree(real_root, options), access_log, options) {
+  own_tree_.reset(tree_);
+}
+
+FuseContext::FuseContext(MirrorTree* tree, AccessLog* access_log,
+                         const Options& options)
+    : access_log_(access_log),
+      real_root_(tree->real_root()),
+      options_(options),
+      tree_(tree),
+      fd_cache_(*tree->fd_cache()),
+      shared_fds_(*tree->shared_fds()),
+      completions_(*tree->completions()),
+      write_buffers_(*tree->write_buffers()),
+      xattr_cache_(*tree->xattr_cache()),
+      hasher_(*tree->hasher()),
+      pack_(*tree->pack()),
+      watcher_(*tree->watcher()),
+      prefetcher_(tree->real_root(), &xattr_cache_,
+                  options.prefetch_log.empty() ? 0 : options.prefetch_threads,
+                  options.prefetch_contents ? options.prefetch_max_bytes : -1),
+      tracer_(options.trace_path, options.trace_max_events),
+      control_(options.control_dir, options.list_control_dir, this,
+               access_log),
+      workers_(options.worker_cpus) {
+  if (options.trace) {
+    tracer_.Start();
+  }
+}
+
+FuseContext::~FuseContext() {
+  prefetcher_.Stop();
+  // a shared tree is stopped once every mount of it is gone
+  if (own_tree_) {
+    own_tree_->Stop();
+  }
+  LOG(INFO) << "final stats:\n" << FormatStats(false);
+}
+
+void FuseContext::DropCaches() {
+  tree_->DropCaches();
+}
+
+void FuseContext::InvalidatePath(const std::string& path, bool below) {
+  tree_->InvalidatePath(path, below);
+}
+
+// identifies what SaveSnapshot() writes, bumped whenever that changes
+static const char kSnapshotMagic[] = "logfs_fuse snapshot 1";
+
+std::string FuseContext::SaveSnapshot() {
+  SnapshotWriter out;
+  out.PutString(kSnapshotMagic);
+  out.PutString(real_root_.native());
+  xattr_cache_.Save(&out);
+  hasher_.Save(&out);
+  return out.data();
+}
+
+bool FuseContext::LoadSnapshot(const std::string& snapshot) {
+  SnapshotReader in(snapshot);
+  std::string magic, real_root;
+  if (!in.GetString(&magic) || magic != kSnapshotMagic ||
+      !in.GetString(&real_root) || real_root != real_root_.native()) {
+    return false;
+  }
+  // all or nothing, a snapshot cut short mustn't leave half of it loaded
+  bool loaded = xattr_cache_.Load(&in) && hasher_.Load(&in) && in.done();
+  xattr_cache_.FinishLoad(loaded);
+  hasher_.FinishLoad(loaded);
+  return loaded;
+}
+
+std::string FuseContext::FormatStats(bool json) {
+  StatsSnapshot ops = stats_.Snapshot();
+  FdCache::Stats fds = fd_cache_.GetStats();
+  SharedFdTable::Stats shared = shared_fds_.GetStats();
+  XattrCache::Stats xattrs = xattr_cache_.GetStats();
+  WriteBufferPool::Stats buffers = write_buffers_.GetStats();
+  CompletionPool::Stats completions = completions_.GetStats();
+  ContentHasher::Stats hashes = hasher_.GetStats();
+  Prefetcher::Stats prefetch = prefetcher_.GetStats();
+  PackFile::Stats pack = pack_.GetStats();
+  TreeWatcher::Stats watcher = watcher_.GetStats();
+  SegmentWriter::Stats segments = SegmentWriter::Stats();
+  if (access_log_->segments()) {
+    segments = access_log_->segments()->GetStats();
+  }
+
+  std::ostringstream out;
+  if (json) {
+    out << "{\"ops\": ";
+    ops.FormatJson(&out);
+    out << ", \"fd_cache\": {\"hits\": " << fds.hits
+        << ", \"misses\": " << fds.misses
+        << ", \"evictions\": " << fds.evictions
+        << ", \"invalidations\": " << fds.invalidations
+        << ", \"opens_avoided\": " << fds.opens_avoided << "}"
+        << ", \"shared_fds\": {\"acquires\": " << shared.acquires
+        << ", \"shared\": " << shared.shared
+        << ", \"backing_opens\": " << shared.backing_opens
+        << ", \"open_fds\": " << shared.open_fds << "}"
+        << ", \"xattr_cache\": {\"hits\": " << xattrs.hits
+        << ", \"negative_hits\": " << xattrs.negative_hits
+        << ", \"misses\": " << xattrs.misses
+        << ", \"invalidations\": " << xattrs.invalidations << "}"
+        << ", \"write_buffers\": {\"buffers\": " << buffers.buffers
+        << ", \"bytes_reserved\": " << buffers.bytes_reserved
+        << ", \"refused\": " << buffers.refused << "}"
+        << ", \"completion_pool\": {\"queued\": " << completions.queued
+        << ", \"inlined\": " << completions.inlined
+        << ", \"completed\": " << completions.completed << "}"
+        << ", \"content_hasher\": {\"queued\": " << hashes.queued
+        << ", \"hashed\": " << hashes.hashed
+        << ", \"reused\": " << hashes.reused
+        << ", \"skipped\": " << hashes.skipped
+        << ", \"bytes\": " << hashes.bytes << "}"
+        << ", \"prefetch\": {\"paths\": " << prefetch.paths
+        << ", \"missing\": " << prefetch.missing
+        << ", \"xattrs\": " << prefetch.xattrs
+        << ", \"files\": " << prefetch.files
+        << ", \"bytes\": " << prefetch.bytes
+        << ", \"skipped\": " << prefetch.skipped << "}"
+        << ", \"pack\": {\"opens\": " << pack.opens
+        << ", \"mismatches\": " << pack.mismatches
+        << ", \"reads\": " << pack.reads << ", \"bytes\": " << pack.bytes
+        << ", \"readahead\": " << pack.readahead << "}"
+        << ", \"watcher\": {\"watches\": " << watcher.watches
+        << ", \"unwatched\": " << watcher.unwatched
+        << ", \"events\": " << watcher.events
+        << ", \"batches\": " << watcher.batches
+        << ", \"invalidated\": " << watcher.invalidated
+        << ", \"flushes\": " << watcher.flushes
+        << ", \"overflows\": " << watcher.overflows << "}"
+        << ", \"log_segments\": {\"segments\": " << segments.segments
+        << ", \"raw_bytes\": " << segments.raw_bytes
+        << ", \"stored_bytes\": " << segments.stored_bytes
+        << ", \"deleted\": " << segments.deleted
+        << ", \"dropped\": " << segments.dropped << "}"
+        << ", \"handles\": {\"files\": " << open_files()
+        << ", \"dirs\": " << open_dirs() << "}"
+        << ", \"workers\": {\"pinned\": " << workers_.workers()
+        << "}}\n";
+  } else {
+    ops.FormatText(&out);
+    out << "fd_cache: hits=" << fds.hits << " misses=" << fds.misses
+        << " evictions=" << fds.evictions
+        << " invalidations=" << fds.invalidations
+        << " opens_avoided=" << fds.opens_avoided << "\n"
+        << "shared_fds: acquires=" << shared.acquires
+        << " shared=" << shared.shared
+        << " backing_opens=" << shared.backing_opens
+        << " open_fds=" << shared.open_fds << "\n"
+        << "xattr_cache: hits=" << xattrs.hits
+        << " negative_hits=" << xattrs.negative_hits
+        << " misses=" << xattrs.misses
+        << " invalidations=" << xattrs.invalidations << "\n"
+        << "write_buffers: buffers=" << buffers.buffers
+        << " bytes_reserved=" << buffers.bytes_reserved
+        << " refused=" << buffers.refused << "\n"
+        << "completion_pool: queued=" << completions.queued
+        << " inlined=" << completions.inlined
+        << " completed=" << completions.completed << "\n"
+        << "content_hasher: queued=" << hashes.queued
+        << " hashed=" << hashes.hashed << " reused=" << hashes.reused
+        << " skipped=" << hashes.skipped << " bytes=" << hashes.bytes << "\n"
+        << "prefetch: paths=" << prefetch.paths
+        << " missing=" << prefetch.missing << " xattrs=" << prefetch.xattrs
+        << " files=" << prefetch.files << " bytes=" << prefetch.bytes
+        << " skipped=" << prefetch.skipped << "\n"
+        << "pack: opens=" << pack.opens << " mismatches=" << pack.mismatches
+        << " reads=" << pack.reads << " bytes=" << pack.bytes
+        << " readahead=" << pack.readahead << "\n"
+        << "watcher: watches=" << watcher.watches
+        << " unwatched=" << watcher.unwatched
+        << " events=" << watcher.events << " batches=" << watcher.batches
+        << " invalidated=" << watcher.invalidated
+        << " flushes=" << watcher.flushes
+        << " overflows=" << watcher.overflows << "\n"
+        << "log_segments: segments=" << segments.segments
+        << " raw_bytes=" << segments.raw_bytes
+        << " stored_bytes=" << segments.stored_bytes
+        << " deleted=" << segments.deleted
+        << " dropped=" << segments.dropped << "\n"
+        << "handles: files=" << open_files() << " dirs=" << open_dirs()
+        << "\n"
+        << "workers: pinned=" << workers_.workers() << "\n";
+  }
+  return out.str();
+}
+
+void FuseContext::PrepareHandle(FileHandle* handle, int flags) {
+  const int kUnbufferedFlags = O_APPEND | O_DIRECT;
+  bool writable = (flags & O_ACCMODE) != O_RDONLY;
+  bool buffered =
+      write_buffers_.enabled() && writable && !(flags & kUnbufferedFlags);
+  bool flush_others = write_buffers_.HasBuffers();
+  if (!buffered && !flush_others) {
+    return;
+  }
+
+  if (!handle->shared) {
+    struct stat st;
+    if (::fstat(handle->fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+      return;
+    }
+    handle->inode = InodeKey(st);
+  }
+
+  if (flush_others) {
+    write_buffers_.FlushInode(handle->inode);
+  }
+  if (buffered) {
+    handle->buffer = write_buffers_.Attach(handle->fd, handle->inode);
+  }
+}
+
+void FuseContext::FlushWritesTo(int fd, InodeKey inode) {
+  if (inode == InodeKey()) {
+    struct stat st;
+    if (::fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+      return;
+    }
+    inode = InodeKey(st);
+  }
+  // the errors of other handles' buffers are theirs to report
+  write_buffers_.FlushInode(inode);
+}
+
+void FuseContext::UsePack(FileHandle* handle, const char* path) {
+  struct stat st;
+  if (TimeBacking([&] { return ::fstat(handle->fd, &st); }) == 0) {
+    handle->pack = pack_.Find(path, st);
+  }
+}
 
-FuseContext::~FuseContext() {}
+void FuseContext::RetireFd(int fd, bool dirty) {
+  bool sync = dirty && options_.deferred_sync;
+  bool dontneed = options_.fadvise_dontneed_on_close;
+  completions_.Run([fd, sync, dontneed]() {
+    // sync first, DONTNEED can't drop pages that are still dirty
+    if (sync && ::fdatasync(fd) < 0) {
+      LOG(WARNING) << "deferred fdatasync of fd " << fd << " failed, ["
+                   << errno << "] : " << strerror(errno);
+    }
+    if (dontneed) {
+      ::posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    }
+    if (::close(fd) < 0) {
+      LOG(WARNING) << "background close of fd " << fd << " failed, ["
+                   << errno << "] : " << strerror(errno);
+    }
+  });
+}
 
 int FuseContext::mknod(const char* path, mode_t mode, dev_t dev) {
-  access_log_->AddEntry("mknod", path);
-  namespace fs = boost::filesystem;
+  if (control_.Owns(path)) {
+    return -EPERM;
+  }
+
+  access_log_->AddEntry(kOpMknod, path);
 
-  Path wrapped = (real_root_ / path);
+  ScratchString wrapped;
+  RealPath(path, &wrapped);
+  xattr_cache_.Invalidate(*wrapped);
 
   // we do not allow special files
   if (mode & (S_IFCHR | S_IFBLK))
     return -EINVAL;
 
   // create the local version of the file
-  int result = ::mknod(wrapped.c_str(), mode, 0);
+  int result = TimeBacking([&] { return ::mknod(wrapped->c_str(), mode, 0); });
   if (result) {
     return -errno;
   }
 
+  Changed(path);
   return 0;
 }
 
 int FuseContext::create(const char* path, mode_t mode,
                         struct fuse_file_info* fi) {
-  access_log_->AddEntry("create", path);
-  namespace fs = boost::filesystem;
+  if (control_.Owns(path)) {
+    return -EPERM;
+  }
+
+  access_log_->AddEntry(kOpCreate, path);
 
-  Path wrapped = (real_root_ / path);
-  int fd = ::creat(wrapped.c_str(), mode);
+  ScratchString wrapped;
+  RealPath(path, &wrapped);
+  xattr_cache_.Invalidate(*wrapped);
+  hasher_.Forget(path);
+  pack_.Invalidate(path);
+  int fd = TimeBacking([&] { return ::creat(wrapped->c_str(), mode); });
   if (fd < 0) {
     return -errno;
   }
+  Changed(path);
 
-  fi->fh = fd;
+  FileHandle* handle = new FileHandle(fd);
+  PrepareHandle(handle, O_WRONLY);
+  fi->fh = reinterpret_cast<uint64_t>(handle);
+  open_files_.Add(1);
   return 0;
 }
 
 int FuseContext::open(const char* path, struct fuse_file_info* fi) {
-  access_log_->AddEntry("open", path);
-  namespace fs = boost::filesystem;
+  if (control_.Owns(path)) {
+    return control_.Open(path, fi);
+  }
+
+  access_log_->AddEntry(kOpOpen, path);
 
-  Path wrapped = real_root_ / path;
-  int fd = ::open(wrapped.c_str(), fi->flags);
+  ScratchString wrapped;
+  RealPath(path, &wrapped);
+
+  // writes may clear security.capability
+  bool writable = (fi->flags & O_ACCMODE) != O_RDONLY;
+  if (writable) {
+    xattr_cache_.Invalidate(*wrapped);
+    hasher_.Forget(path);
+    pack_.Invalidate(path);
+  }
+
+  // reads are positional, so read-only opens of the same inode can all use
+  // one descriptor
+  if (options_.share_readonly_fds && SharedFdTable::IsShareable(fi->flags)) {
+    InodeKey inode;
+    bool shared = false;
+    int fd = TimeBacking([&] {
+      return shared_fds_.Acquire(*wrapped, fi->flags, &inode, &shared);
+    });
+    if (fd < 0) {
+      return fd;
+    }
+
+    FileHandle* handle = new FileHandle(fd);
+    handle->shared = shared;
+    handle->inode = inode;
+    PrepareHandle(handle, fi->flags);
+    if (pack_.enabled()) {
+      UsePack(handle, path);
+    }
+    fi->fh = reinterpret_cast<uint64_t>(handle);
+    open_files_.Add(1);
+    hasher_.Submit(path, *wrapped);
+    return 0;
+  }
+
+  int fd = TimeBacking([&] { return ::open(wrapped->c_str(), fi->flags); });
   if (fd < 0) {
     return -errno;
   }
+  if (writable) {
+    Changed(path);
+  }
 
-  fi->fh = fd;
+  FileHandle* handle = new FileHandle(fd);
+  PrepareHandle(handle, fi->flags);
+  if (!writable && pack_.enabled()) {
+    UsePack(handle, path);
+  }
+  fi->fh = reinterpret_cast<uint64_t>(handle);
+  open_files_.Add(1);
+  if (!writable) {
+    hasher_.Submit(path, *wrapped);
+  }
   return 0;
 }
 
 int FuseContext::read(const char* path, char* buf, size_t bufsize, off_t offset,
                       struct fuse_file_info* fi) {
-  namespace fs = boost::filesystem;
-  Path wrapped = (real_root_ / path);
+  if (control_.Owns(path)) {
+    return control_.Read(path, buf, bufsize, offset, fi);
+  }
+
+  ScratchString wrapped;
+  RealPath(path, &wrapped);
 
   // if fi has a file handle then we simply read from the file handle
-  if (fi->fh) {
-    int result = ::pread(fi->fh, buf, bufsize, offset);
+  FileHandle* handle = GetFileHandle(fi);
+  if (handle) {
+    // buffered writes which overlap the read have to reach the file first
+    if (handle->buffer) {
+      int result = handle->buffer->FlushRange(offset, bufsize);
+      if (result < 0) {
+        return result;
+      }
+    }
+    // and so do those of other handles, which getattr already counts
+    if (write_buffers_.HasBuffers()) {
+      FlushWritesTo(handle->fd, handle->inode);
+    }
+
+    int result;
+    if (handle->pack && !handle->pack->stale) {
+      result = TimeBacking([&] {
+        return pack_.Read(*handle->pack, buf, bufsize, offset);
+      });
+    } else {
+      result = ResultOrErrno(TimeBacking([&] {
+        return ::pread(handle->fd, buf, bufsize, offset);
+      }));
+    }
     if (result < 0) {
-      return -errno;
+      return result;
     } else {
+      access_log_->AddTransfer(kOpRead, path, result);
       return result;
     }
   } else {
-    access_log_->AddEntry("read", path);
+    access_log_->AddEntry(kOpRead, path);
 
-    // otherwise we open the file and perform the read
-    // open the local version of the file
-    int fd = ::open(wrapped.c_str(), O_RDONLY);
-    if (fd < 0) {
-      return -errno;
+    // otherwise we borrow a descriptor for the local version of the file
+    int error = 0;
+    FdCache::Lease fd = fd_cache_.Acquire(*wrapped, O_RDONLY, &error);
+    if (!fd) {
+      return -error;
+    }
+    if (write_buffers_.HasBuffers()) {
+      FlushWritesTo(fd->fd(), InodeKey());
     }
 
-    int result = ::pread(fd, buf, bufsize, offset);
-    ::close(fd);
-
+    int result = TimeBacking([&] {
+      return ::pread(fd->fd(), buf, bufsize, offset);
+    });
     if (result < 0) {
       return -errno;
     } else {
+      access_log_->AddTransfer(kOpRead, path, result);
       return result;
     }
   }
@@ -123,67 +479,123 @@ int FuseContext::read(const char* path, char* buf, size_t bufsize, off_t offset,
 
 int FuseContext::write(const char* path, const char* buf, size_t bufsize,
                        off_t offset, struct fuse_file_info* fi) {
-  namespace fs = boost::filesystem;
-  Path wrapped = (real_root_ / path);
+  if (control_.Owns(path)) {
+    return control_.Write(path, buf, bufsize, fi);
+  }
 
-  // if fi has a file handle then we simply read from the file handle
-  if (fi->fh) {
-    int result = ::pwrite(fi->fh, buf, bufsize, offset);
-    if (result < 0) {
-      return -errno;
+  ScratchString wrapped;
+  RealPath(path, &wrapped);
+
+  // if fi has a file handle then we simply write to the file handle
+  FileHandle* handle = GetFileHandle(fi);
+  if (handle) {
+    handle->dirty = true;
+    int result = 0;
+    if (handle->buffer) {
+      result = handle->buffer->Write(buf, bufsize, offset);
     } else {
-      return result;
+      result = ResultOrErrno(TimeBacking([&] {
+        return ::pwrite(handle->fd, buf, bufsize, offset);
+      }));
+    }
+    if (result > 0) {
+      access_log_->AddTransfer(kOpWrite, path, result);
     }
+    return result;
   } else {
-    access_log_->AddEntry("write", path);
-
-    // otherwise open the file
-    int fd = ::open(wrapped.c_str(), O_WRONLY);
-    if (fd < 0) {
-      return -errno;
+    access_log_->AddEntry(kOpWrite, path);
+    hasher_.Forget(path);
+    pack_.Invalidate(path);
+
+    // otherwise borrow a descriptor for the file, the lease closes it if it
+    // isn't cached, including when the write fails
+    int error = 0;
+    FdCache::Lease fd = fd_cache_.Acquire(*wrapped, O_WRONLY, &error);
+    if (!fd) {
+      return -error;
     }
 
     // perform the write
-    for (ssize_t bytes_written = 0; bytes_written < bufsize;) {
-      ssize_t result =
-          ::pwrite(fd, buf + bytes_written, bufsize - bytes_written,
-                   offset + bytes_written);
+    for (size_t bytes_written = 0; bytes_written < bufsize;) {
+      ssize_t result = TimeBacking([&] {
+        return ::pwrite(fd->fd(), buf + bytes_written,
+                        bufsize - bytes_written, offset + bytes_written);
+      });
       if (result < 0) {
         return -errno;
       }
       bytes_written += result;
     }
 
-    // close the file
-    ::close(fd);
+    access_log_->AddTransfer(kOpWrite, path, bufsize);
+    Changed(path);
     return bufsize;
   }
 }
 
 int FuseContext::truncate(const char* path, off_t length) {
-  access_log_->AddEntry("truncate", path);
-  namespace fs = boost::filesystem;
+  if (control_.Owns(path)) {
+    return control_.Truncate(path);
+  }
+
+  access_log_->AddEntry(kOpTruncate, path);
 
-  Path wrapped = (real_root_ / path).string();
-  int result = ::truncate(wrapped.c_str(), length);
+  ScratchString wrapped;
+  RealPath(path, &wrapped);
+  fd_cache_.Invalidate(*wrapped);
+  xattr_cache_.Invalidate(*wrapped);
+  hasher_.Forget(path);
+  pack_.Invalidate(path);
+
+  // buffered writes must not land after the truncate and extend the file
+  struct stat st;
+  if (write_buffers_.HasBuffers() && ::stat(wrapped->c_str(), &st) == 0) {
+    write_buffers_.FlushInode(InodeKey(st));
+  }
+
+  int result = TimeBacking([&] {
+    return ::truncate(wrapped->c_str(), length);
+  });
   if (result < 0) {
     return -errno;
   }
 
+  Changed(path);
   return 0;
 }
 
 int FuseContext::ftruncate(const char* path, off_t length,
                            struct fuse_file_info* fi) {
-  namespace fs = boost::filesystem;
+  if (control_.Owns(path)) {
+    return control_.Truncate(path);
+  }
 
-  Path wrapped = (real_root_ / path).string();
-  if (fi->fh) {
-    int result = ::ftruncate(fi->fh, length);
+  FileHandle* handle = GetFileHandle(fi);
+  if (handle) {
+    // buffered writes, through this handle or any other on the file, must
+    // not land after the truncate and extend the file again
+    if (handle->buffer) {
+      int result = handle->buffer->WriteOut();
+      if (result < 0) {
+        return result;
+      }
+    }
+    if (write_buffers_.HasBuffers()) {
+      InodeKey inode = handle->inode;
+      struct stat st;
+      if (inode == InodeKey() && ::fstat(handle->fd, &st) == 0) {
+        inode = InodeKey(st);
+      }
+      // the errors of other handles' buffers are theirs to report
+      write_buffers_.FlushInode(inode);
+    }
+
+    int result = TimeBacking([&] { return ::ftruncate(handle->fd, length); });
     if (result < 0) {
       return -errno;
     }
 
+    Changed(path);
     return 0;
   } else {
     return -EBADF;
@@ -192,13 +604,25 @@ int FuseContext::ftruncate(const char* path, off_t length,
 
 int FuseContext::fsync(const char* path, int datasync,
                        struct fuse_file_info* fi) {
-  Path wrapped = real_root_ / path;
+  if (control_.Owns(path)) {
+    return 0;
+  }
+
+  FileHandle* handle = GetFileHandle(fi);
+  if (handle) {
+    if (handle->buffer) {
+      int result = handle->buffer->Flush();
+      if (result < 0) {
+        return result;
+      }
+    }
 
-  if (fi->fh) {
     if (datasync) {
-      return ResultOrErrno(::fdatasync(fi->fh));
+      return ResultOrErrno(TimeBacking([&] {
+        return ::fdatasync(handle->fd);
+      }));
     } else {
-      return ResultOrErrno(::fsync(fi->fh));
+      return ResultOrErrno(TimeBacking([&] { return ::fsync(handle->fd); }));
     }
   } else {
     return -EBADF;
@@ -206,37 +630,94 @@ int FuseContext::fsync(const char* path, int datasync,
 }
 
 int FuseContext::flush(const char* path, struct fuse_file_info* fi) {
-  Path wrapped = real_root_ / path;
+  if (control_.Owns(path)) {
+    return 0;
+  }
+
+  // this is our chance to report write-back errors to close(2)
+  FileHandle* handle = GetFileHandle(fi);
+  if (handle && handle->buffer) {
+    return handle->buffer->Flush();
+  }
   return 0;
 }
 
 int FuseContext::release(const char* path, struct fuse_file_info* fi) {
-  if (fi->fh) {
-    return ResultOrErrno(::close(fi->fh));
+  if (control_.Owns(path)) {
+    return control_.Release(fi);
+  }
+
+  FileHandle* handle = GetFileHandle(fi);
+  if (handle) {
+    if (handle->buffer) {
+      int result = handle->buffer->Flush();
+      LOG_IF(WARNING, result < 0) << "Lost buffered writes to '" << path
+                                  << "' on release, [" << -result
+                                  << "] : " << strerror(-result);
+      write_buffers_.Detach(handle->buffer);
+      handle->buffer = NULL;
+    }
+
+    int fd = handle->shared ? shared_fds_.Release(handle->inode) : handle->fd;
+    bool dirty = handle->dirty;
+    if (dirty) {
+      hasher_.Forget(path);
+      pack_.Invalidate(path);
+      Changed(path);
+    }
+    delete handle;
+    fi->fh = 0;
+    open_files_.Add(-1);
+    if (fd >= 0) {
+      // a negative fd means other handles still use the shared descriptor
+      RetireFd(fd, dirty);
+    }
+    return 0;
   } else {
     return -EBADF;
   }
 }
 
 int FuseContext::getattr(const char* path, struct stat* out) {
-  namespace fs = boost::filesystem;
-  Path wrapped = real_root_ / path;
+  if (control_.Owns(path)) {
+    return control_.Getattr(path, out);
+  }
+
+  ScratchString wrapped;
+  RealPath(path, &wrapped);
 
-  int result = ::lstat(wrapped.c_str(), out);
+  int result = TimeBacking([&] { return ::lstat(wrapped->c_str(), out); });
   if (result < 0) {
     return -errno;
   }
 
+  // drop cached attributes if the file has been replaced underneath us
+  xattr_cache_.Validate(*wrapped, InodeKey(*out));
+
+  // report the size the file will have once buffered writes land
+  if (write_buffers_.HasBuffers() && S_ISREG(out->st_mode)) {
+    write_buffers_.AdjustSize(InodeKey(*out), &out->st_size);
+  }
+
   return 0;
 }
 
 int FuseContext::fgetattr(const char* path, struct stat* out,
                           struct fuse_file_info* fi) {
-  namespace fs = boost::filesystem;
-  Path wrapped = real_root_ / path;
+  if (control_.Owns(path)) {
+    return control_.Getattr(path, out);
+  }
 
-  if (fi->fh) {
-    int result = ::fstat(fi->fh, out);
+  FileHandle* handle = GetFileHandle(fi);
+  if (handle) {
+    if (handle->buffer) {
+      int result = handle->buffer->WriteOut();
+      if (result < 0) {
+        return result;
+      }
+    }
+
+    int result = TimeBacking([&] { return ::fstat(handle->fd, out); });
     if (result < 0) {
       return -errno;
     }
@@ -248,53 +729,79 @@ int FuseContext::fgetattr(const char* path, struct stat* out,
 }
 
 int FuseContext::unlink(const char* path) {
-  access_log_->AddEntry("unlink", path);
+  if (control_.Owns(path)) {
+    return -EPERM;
+  }
+
+  access_log_->AddEntry(kOpUnlink, path);
   namespace fs = boost::filesystem;
 
-  Path wrapped = real_root_ / path;
+  ScratchString wrapped;
+  RealPath(path, &wrapped);
 
   // first we make sure that the parent directory exists
-  Path parent = wrapped.parent_path();
+  Path parent = Path(*wrapped).parent_path();
   if (!fs::exists(parent))
     return -ENOENT;
 
   // unlink the directory holding the file contents, the meta file,
   // and the staged file
-  fs::remove_all(wrapped);
+  TimeBacking([&] { return fs::remove_all(*wrapped); });
+
+  // only once it is gone, so that a concurrent lookup can't cache it again
+  fd_cache_.Invalidate(*wrapped);
+  xattr_cache_.Invalidate(*wrapped);
+  hasher_.Forget(path);
+  pack_.Invalidate(path);
+  Changed(path);
   return 0;
 }
 
 int FuseContext::mkdir(const char* path, mode_t mode) {
-  access_log_->AddEntry("mkdir", path);
+  if (control_.Owns(path)) {
+    return -EPERM;
+  }
 
-  namespace fs = boost::filesystem;
-  Path wrapped = real_root_ / path;
+  access_log_->AddEntry(kOpMkdir, path);
+
+  ScratchString wrapped;
+  RealPath(path, &wrapped);
+  xattr_cache_.Invalidate(*wrapped);
 
   // create the directory
-  int result = ::mkdir(wrapped.c_str(), mode);
+  int result = TimeBacking([&] { return ::mkdir(wrapped->c_str(), mode); });
   if (result) {
     return -errno;
   }
 
+  Changed(path);
   return 0;
 }
 
 int FuseContext::opendir(const char* path, struct fuse_file_info* fi) {
-  access_log_->AddEntry("opendir", path);
+  if (control_.Owns(path)) {
+    return control_.Opendir(path);
+  }
+
+  access_log_->AddEntry(kOpOpendir, path);
 
-  Path wrapped = real_root_ / path;
-  DIR* result = ::opendir(wrapped.c_str());
+  ScratchString wrapped;
+  RealPath(path, &wrapped);
+  DIR* result = TimeBacking([&] { return ::opendir(wrapped->c_str()); });
   if (result == NULL) {
     return -errno;
   } else {
     fi->fh = reinterpret_cast<uint64_t>(result);
+    open_dirs_.Add(1);
     return 0;
   }
 }
 
 int FuseContext::readdir(const char* path, void* buf, fuse_fill_dir_t filler,
                          off_t offset, struct fuse_file_info* fi) {
-  Path wrapped = real_root_ / path;
+  if (control_.Owns(path)) {
+    return control_.Readdir(path, buf, filler);
+  }
 
   if (!fi->fh) {
     return -EBADF;
@@ -303,8 +810,18 @@ int FuseContext::readdir(const char* path, void* buf, fuse_fill_dir_t filler,
   DIR* dir = reinterpret_cast<DIR*>(fi->fh);
   seekdir(dir, offset);
 
-  for (dirent* dir_entry = ::readdir(dir); dir_entry != NULL;
-       dir_entry = ::readdir(dir)) {
+  // the control directory hides anything of the same name in the real root
+  bool root = control_.enabled() && strcmp(path, "/") == 0;
+  if (root) {
+    control_.FillRoot(buf, filler);
+  }
+
+  for (dirent* dir_entry = TimeBacking([&] { return ::readdir(dir); });
+       dir_entry != NULL;
+       dir_entry = TimeBacking([&] { return ::readdir(dir); })) {
+    if (root && control_.name() == dir_entry->d_name) {
+      continue;
+    }
     filler(buf, dir_entry->d_name, NULL, 0);
 
     // TODO(josh): learn how to properly use filler and offset
@@ -317,11 +834,14 @@ int FuseContext::readdir(const char* path, void* buf, fuse_fill_dir_t filler,
 }
 
 int FuseContext::releasedir(const char* path, struct fuse_file_info* fi) {
-  Path wrapped = real_root_ / path;
+  if (control_.Owns(path)) {
+    return 0;
+  }
 
   if (fi->fh) {
     DIR* dir = reinterpret_cast<DIR*>(fi->fh);
-    return ResultOrErrno(::closedir(dir));
+    open_dirs_.Add(-1);
+    return ResultOrErrno(TimeBacking([&] { return ::closedir(dir); }));
   } else {
     return -EBADF;
   }
@@ -329,38 +849,68 @@ int FuseContext::releasedir(const char* path, struct fuse_file_info* fi) {
 
 int FuseContext::fsyncdir(const char* path, int datasync,
                           struct fuse_file_info* fi) {
-  access_log_->AddEntry("fsyncdir", path);
-  Path wrapped = real_root_ / path;
+  if (control_.Owns(path)) {
+    return 0;
+  }
+
+  access_log_->AddEntry(kOpFsyncdir, path);
   return 0;
 }
 
 int FuseContext::rmdir(const char* path) {
-  access_log_->AddEntry("rmdir", path);
-  namespace fs = boost::filesystem;
+  if (control_.Owns(path)) {
+    return -EPERM;
+  }
 
-  Path wrapped = real_root_ / path;
-  return ResultOrErrno(::rmdir(wrapped.c_str()));
+  access_log_->AddEntry(kOpRmdir, path);
+
+  ScratchString wrapped;
+  RealPath(path, &wrapped);
+  xattr_cache_.Invalidate(*wrapped);
+  int result =
+      ResultOrErrno(TimeBacking([&] { return ::rmdir(wrapped->c_str()); }));
+  if (result == 0) {
+    Changed(path, true);
+  }
+  return result;
 }
 
 int FuseContext::symlink(const char* oldpath, const char* newpath) {
-  access_log_->AddEntry("symlink", newpath);
+  if (control_.Owns(newpath)) {
+    return -EPERM;
+  }
 
-  Path oldwrap = real_root_ / oldpath;
-  Path newwrap = real_root_ / newpath;
+  access_log_->AddEntry(kOpSymlink, newpath);
 
-  int result = ::symlink(oldwrap.c_str(), newwrap.c_str());
+  ScratchString oldwrap;
+  RealPath(oldpath, &oldwrap);
+  ScratchString newwrap;
+  RealPath(newpath, &newwrap);
+  xattr_cache_.Invalidate(*newwrap);
+
+  int result = TimeBacking([&] {
+    return ::symlink(oldwrap->c_str(), newwrap->c_str());
+  });
   if (result < 0) {
     return -errno;
   }
 
+  Changed(newpath);
   return 0;
 }
 
 int FuseContext::readlink(const char* path, char* buf, size_t bufsize) {
-  access_log_->AddEntry("readlink", path);
+  if (control_.Owns(path)) {
+    return -EINVAL;
+  }
 
-  Path wrapped = real_root_ / path;
-  ssize_t result = ::readlink(wrapped.c_str(), buf, bufsize);
+  access_log_->AddEntry(kOpReadlink, path);
+
+  ScratchString wrapped;
+  RealPath(path, &wrapped);
+  ssize_t result = TimeBacking([&] {
+    return ::readlink(wrapped->c_str(), buf, bufsize);
+  });
   if (result == ssize_t(-1)) {
     return -errno;
   }
@@ -369,65 +919,138 @@ int FuseContext::readlink(const char* path, char* buf, size_t bufsize) {
 }
 
 int FuseContext::link(const char* oldpath, const char* newpath) {
-  access_log_->AddEntry("link", std::string(oldpath) + " -> " + newpath);
+  if (control_.Owns(oldpath) || control_.Owns(newpath)) {
+    return -EPERM;
+  }
+
+  if (access_log_->Wants(kOpLink)) {
+    ScratchString entry;
+    entry->append(oldpath).append(" -> ").append(newpath);
+    access_log_->AddEntry(kOpLink, *entry);
+  }
 
-  Path oldwrap = real_root_ / oldpath;
-  Path newwrap = real_root_ / newpath;
+  ScratchString oldwrap;
+  RealPath(oldpath, &oldwrap);
+  ScratchString newwrap;
+  RealPath(newpath, &newwrap);
+  xattr_cache_.Invalidate(*newwrap);
 
-  int result = ::link(oldwrap.c_str(), newwrap.c_str());
+  int result = TimeBacking([&] {
+    return ::link(oldwrap->c_str(), newwrap->c_str());
+  });
   if (result < 0) {
     return -errno;
   }
 
+  Changed(newpath);
   return 0;
 }
 
 int FuseContext::rename(const char* oldpath, const char* newpath) {
-  access_log_->AddEntry("rename", std::string(oldpath) + " -> " + newpath);
+  if (control_.Owns(oldpath) || control_.Owns(newpath)) {
+    return -EPERM;
+  }
 
-  namespace fs = boost::filesystem;
-  Path oldwrap = real_root_ / oldpath;
-  Path newwrap = real_root_ / newpath;
+  if (access_log_->Wants(kOpRename)) {
+    ScratchString entry;
+    entry->append(oldpath).append(" -> ").append(newpath);
+    access_log_->AddEntry(kOpRename, *entry);
+  }
 
-  // if the move overwrites a file then copy data, increment version, and
-  // unlink the old file
-  int result = ::rename(oldwrap.c_str(), newwrap.c_str());
+  ScratchString oldwrap;
+  RealPath(oldpath, &oldwrap);
+  ScratchString newwrap;
+  RealPath(newpath, &newwrap);
+
+  int result = TimeBacking([&] {
+    return ::rename(oldwrap->c_str(), newwrap->c_str());
+  });
   if (result < 0) {
     return -errno;
   }
 
+  // only once renamed, so that a concurrent lookup can't cache the file
+  // the rename replaced
+  fd_cache_.Invalidate(*oldwrap);
+  fd_cache_.Invalidate(*newwrap);
+  xattr_cache_.Invalidate(*oldwrap);
+  xattr_cache_.Invalidate(*newwrap);
+  hasher_.Forget(oldpath);
+  hasher_.Forget(newpath);
+  pack_.Invalidate(oldpath);
+  pack_.Invalidate(newpath);
+
+  // every path below a renamed directory moved with it
+  struct stat st;
+  bool dir = ::lstat(newwrap->c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+  if (dir) {
+    ScratchString old_dir;
+    old_dir->assign(oldpath);
+    ScratchString new_dir;
+    new_dir->assign(newpath);
+    fd_cache_.InvalidateBelow(*oldwrap);
+    fd_cache_.InvalidateBelow(*newwrap);
+    xattr_cache_.InvalidateBelow(*oldwrap);
+    xattr_cache_.InvalidateBelow(*newwrap);
+    hasher_.ForgetBelow(*old_dir);
+    hasher_.ForgetBelow(*new_dir);
+    pack_.InvalidateBelow(*old_dir);
+    pack_.InvalidateBelow(*new_dir);
+  }
+
+  Changed(oldpath, dir);
+  Changed(newpath, dir);
   return 0;
 }
 
 int FuseContext::chmod(const char* path, mode_t mode) {
-  access_log_->AddEntry("chmod", path);
-  namespace fs = boost::filesystem;
+  if (control_.Owns(path)) {
+    return -EPERM;
+  }
+
+  access_log_->AddEntry(kOpChmod, path);
 
-  Path wrapped = real_root_ / path;
-  int result = ::chmod(wrapped.c_str(), mode);
+  ScratchString wrapped;
+  RealPath(path, &wrapped);
+  int result = TimeBacking([&] { return ::chmod(wrapped->c_str(), mode); });
   if (result < 0)
     return -errno;
 
+  xattr_cache_.Invalidate(*wrapped);
+  Changed(path);
   return 0;
 }
 
 int FuseContext::chown(const char* path, uid_t owner, gid_t group) {
-  access_log_->AddEntry("chmod", path);
-  namespace fs = boost::filesystem;
+  if (control_.Owns(path)) {
+    return -EPERM;
+  }
+
+  access_log_->AddEntry(kOpChmod, path);
 
-  Path wrapped = (real_root_ / path);
-  int result = ::chown(wrapped.c_str(), owner, group);
+  ScratchString wrapped;
+  RealPath(path, &wrapped);
+  int result = TimeBacking([&] {
+    return ::chown(wrapped->c_str(), owner, group);
+  });
   if (result < 0)
     return -errno;
 
+  xattr_cache_.Invalidate(*wrapped);
+  Changed(path);
   return 0;
 }
 
 int FuseContext::access(const char* path, int mode) {
-  access_log_->AddEntry("access", path);
+  if (control_.Owns(path)) {
+    return control_.Access(path, mode);
+  }
+
+  access_log_->AddEntry(kOpAccess, path);
 
-  Path wrapped = real_root_ / path;
-  int result = ::access(wrapped.c_str(), mode);
+  ScratchString wrapped;
+  RealPath(path, &wrapped);
+  int result = TimeBacking([&] { return ::access(wrapped->c_str(), mode); });
   if (result < 0)
     return -errno;
 
@@ -436,11 +1059,15 @@ int FuseContext::access(const char* path, int mode) {
 
 int FuseContext::lock(const char* path, struct fuse_file_info* fi, int cmd,
                       struct flock* fl) {
-  access_log_->AddEntry("lock", path);
+  if (control_.Owns(path)) {
+    return -ENOLCK;
+  }
 
-  Path wrapped = real_root_ / path;
-  if (fi->fh) {
-    int result = fcntl(fi->fh, cmd, fl);
+  access_log_->AddEntry(kOpLock, path);
+
+  FileHandle* handle = GetFileHandle(fi);
+  if (handle) {
+    int result = fcntl(handle->fd, cmd, fl);
     if (result < 0) {
       return -errno;
     }
@@ -451,28 +1078,40 @@ int FuseContext::lock(const char* path, struct fuse_file_info* fi, int cmd,
 }
 
 int FuseContext::utimens(const char* path, const struct timespec tv[2]) {
-  access_log_->AddEntry("utimens", path);
+  if (control_.Owns(path)) {
+    return -EPERM;
+  }
+
+  access_log_->AddEntry(kOpUtimens, path);
 
-  Path wrapped = real_root_ / path;
+  ScratchString wrapped;
+  RealPath(path, &wrapped);
   timeval times[2];
   for (int i = 0; i < 2; i++) {
     times[i].tv_sec = tv[i].tv_sec;
     times[i].tv_usec = tv[i].tv_nsec / 1000;
   }
 
-  int result = ::utimes(wrapped.c_str(), times);
+  int result = TimeBacking([&] { return ::utimes(wrapped->c_str(), times); });
   if (result < 0) {
     return -errno;
   }
 
+  Changed(path);
   return 0;
 }
 
 int FuseContext::statfs(const char* path, struct statvfs* buf) {
-  access_log_->AddEntry("statfs", path);
+  if (control_.Owns(path)) {
+    // that of the real root, without logging an access of it
+    return ResultOrErrno(::statvfs(real_root_.c_str(), buf));
+  }
+
+  access_log_->AddEntry(kOpStatfs, path);
 
-  Path wrapped = real_root_ / path;
-  int result = ::statvfs(wrapped.c_str(), buf);
+  ScratchString wrapped;
+  RealPath(path, &wrapped);
+  int result = TimeBacking([&] { return ::statvfs(wrapped->c_str(), buf); });
   if (result < 0) {
     return -errno;
   }
@@ -482,47 +1121,75 @@ int FuseContext::statfs(const char* path, struct statvfs* buf) {
 
 int FuseContext::setxattr(const char* path, const char* key, const char* value,
                           size_t bufsize, int flags) {
-  access_log_->AddEntry("setxattr", path);
+  if (control_.Owns(path)) {
+    return -EPERM;
+  }
 
-  Path wrapped = real_root_ / path;
-  int result = ::setxattr(wrapped.c_str(), key, value, bufsize, flags);
+  access_log_->AddEntry(kOpSetxattr, path);
+
+  ScratchString wrapped;
+  RealPath(path, &wrapped);
+  int result = TimeBacking([&] {
+    return ::lsetxattr(wrapped->c_str(), key, value, bufsize, flags);
+  });
   if (result < 0) {
     return -errno;
   }
+
+  xattr_cache_.Invalidate(*wrapped);
+  Changed(path);
   return 0;
 }
 
 int FuseContext::getxattr(const char* path, const char* key, char* value,
                           size_t bufsize) {
-  access_log_->AddEntry("getxattr", path);
-
-  Path wrapped = real_root_ / path;
-  int result = ::getxattr(wrapped.c_str(), key, value, bufsize);
-  if (result < 0) {
-    return -errno;
+  if (control_.Owns(path)) {
+    return -ENODATA;
   }
-  return 0;
+
+  access_log_->AddEntry(kOpGetxattr, path);
+
+  ScratchString wrapped;
+  RealPath(path, &wrapped);
+  return xattr_cache_.Get(*wrapped, key, value, bufsize);
 }
 
 int FuseContext::listxattr(const char* path, char* buf, size_t bufsize) {
-  access_log_->AddEntry("listxattr", path);
+  if (control_.Owns(path)) {
+    return 0;
+  }
+
+  access_log_->AddEntry(kOpListxattr, path);
 
-  Path wrapped = real_root_ / path;
-  int result = ::listxattr(wrapped.c_str(), buf, bufsize);
+  ScratchString wrapped;
+  RealPath(path, &wrapped);
+  ssize_t result = TimeBacking([&] {
+    return ::llistxattr(wrapped->c_str(), buf, bufsize);
+  });
   if (result < 0) {
     return -errno;
   }
-  return 0;
+  return result;
 }
 
 int FuseContext::removexattr(const char* path, const char* key) {
-  access_log_->AddEntry("removexattr", path);
+  if (control_.Owns(path)) {
+    return -EPERM;
+  }
+
+  access_log_->AddEntry(kOpRemovexattr, path);
 
-  Path wrapped = real_root_ / path;
-  int result = ::removexattr(wrapped.c_str(), key);
+  ScratchString wrapped;
+  RealPath(path, &wrapped);
+  int result = TimeBacking([&] {
+    return ::lremovexattr(wrapped->c_str(), key);
+  });
   if (result < 0) {
     return -errno;
   }
+
+  xattr_cache_.Invalidate(*wrapped);
+  Changed(path);
   return 0;
 }
 
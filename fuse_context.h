@@ -1,12 +1,32 @@
 
+#include <functional>
+#include <memory>
 #include <string>
 #include <sys/types.h>
 #include <boost/filesystem.hpp>
+#include "completion_pool.h"
+#include "content_hasher.h"
+#include "control_dir.h"
+#include "fd_cache.h"
 #include "fuse_include.h"
+#include "mirror_tree.h"
+#include "options.h"
+#include "pack_file.h"
+#include "prefetcher.h"
+#include "request_arena.h"
+#include "shared_fd_table.h"
+#include "sharded.h"
+#include "stats.h"
+#include "tracer.h"
+#include "tree_watcher.h"
+#include "worker_affinity.h"
+#include "write_buffer.h"
+#include "xattr_cache.h"
 
 namespace logfs_fuse {
 
 class AccessLog;
+struct FileHandle;
 typedef boost::filesystem::path Path;
 
 /// Main fuse context
@@ -19,11 +39,159 @@ class FuseContext {
  private:
   AccessLog* access_log_;
   Path real_root_;
+  Options options_;
+  std::unique_ptr<MirrorTree> own_tree_;  ///< the tree, unless it is shared
+  MirrorTree* tree_;  ///< caches of the real tree, maybe shared
+
+  // the members of tree_, which other mounts of the tree may be using too
+  FdCache& fd_cache_;  ///< descriptors for handle-less read/write
+  SharedFdTable& shared_fds_;  ///< descriptors shared by read-only opens
+  CompletionPool& completions_;  ///< background closes and syncs
+  WriteBufferPool& write_buffers_;  ///< merges small sequential writes
+  XattrCache& xattr_cache_;  ///< answers repeated getxattr calls
+  ContentHasher& hasher_;    ///< hashes files opened for reading
+  PackFile& pack_;           ///< serves reads of packed files
+  TreeWatcher& watcher_;     ///< invalidates on changes outside the mount
+
+  Prefetcher prefetcher_;   ///< warms caches from a previous run's log
+  Stats stats_;             ///< per-op counters and latencies
+  Tracer tracer_;           ///< per-op timeline, while tracing
+  ControlDir control_;      ///< the virtual /.logfs directory
+  WorkerPinner workers_;    ///< pins the threads serving requests
+  ShardedCounter open_files_;  ///< live FileHandles
+  ShardedCounter open_dirs_;   ///< live directory handles
+  /// told of the paths changed through the mount, see ReportChanges()
+  std::function<void(const std::string&, bool)> changed_;
+
+  /// Report @p path, and if @p below everything below it, as changed
+  void Changed(const char* path, bool below = false) {
+    if (changed_) {
+      changed_(path, below);
+    }
+  }
+
+  /// Build the real-tree path of @p path in @p real
+  void RealPath(const char* path, ScratchString* real) const {
+    (*real)->assign(real_root_.native()).append(path);
+  }
+
+  /// Finish setting up a handle for a file just opened with @p flags
+  /**
+   *  Writes out other handles' buffered data for the same inode, so that
+   *  the new handle sees it, and attaches a write buffer if the handle is
+   *  writable and buffering is enabled.
+   */
+  void PrepareHandle(FileHandle* handle, int flags);
+
+  /// Write out every handle's buffered writes to the file open as @p fd,
+  /// whose inode is @p inode or found with fstat if that is unset, so that
+  /// a read of it sees what getattr reports
+  void FlushWritesTo(int fd, InodeKey inode);
+
+  /// Serve reads through the read-only @p handle of @p path from the pack,
+  /// if the file is packed and unchanged
+  void UsePack(FileHandle* handle, const char* path);
+
+  /// Close @p fd on the completion pool, syncing it first if it is
+  /// @p dirty and deferred syncs are enabled
+  void RetireFd(int fd, bool dirty);
 
  public:
-  FuseContext(const std::string& real_root, AccessLog* access_log);
+  /// Mirror @p real_root with caches of our own
+  FuseContext(const std::string& real_root, AccessLog* access_log,
+              const Options& options);
+
+  /// Mirror the real tree of @p tree, sharing its caches with every other
+  /// context using it. @p tree must outlive the context.
+  FuseContext(MirrorTree* tree, AccessLog* access_log,
+              const Options& options);
+
   ~FuseContext();
 
+  FdCache::Stats GetFdCacheStats() const {
+    return fd_cache_.GetStats();
+  }
+
+  SharedFdTable::Stats GetSharedFdStats() const {
+    return shared_fds_.GetStats();
+  }
+
+  CompletionPool::Stats GetCompletionStats() const {
+    return completions_.GetStats();
+  }
+
+  WriteBufferPool::Stats GetWriteBufferStats() const {
+    return write_buffers_.GetStats();
+  }
+
+  XattrCache::Stats GetXattrCacheStats() const {
+    return xattr_cache_.GetStats();
+  }
+
+  /// Return the per-op stats to record into, or NULL if they are disabled
+  Stats* stats() {
+    return options_.stats ? &stats_ : NULL;
+  }
+
+  /// Return the tracer which ops record into while it is tracing
+  Tracer* tracer() {
+    return &tracer_;
+  }
+
+  /// Return true if ops are dispatched through the tracer, so that tracing
+  /// started from the control directory records them
+  bool traceable() const {
+    return options_.trace || options_.trace_control;
+  }
+
+  /// Return the prefetcher, which has threads if a prefetch log was given
+  Prefetcher* prefetcher() {
+    return &prefetcher_;
+  }
+
+  /// Return a report of the op stats and cache counters
+  std::string FormatStats(bool json);
+
+  /// Empty the fd and xattr caches, forget the content hashes and stop
+  /// using the pack, after changes to the tree were missed
+  void DropCaches();
+
+  /// Drop what the caches hold for the mirror @p path, which was changed
+  /// outside of the mount, and if @p below for everything below it
+  void InvalidatePath(const std::string& path, bool below);
+
+  /// Called with each mirror path changed through the mount, and whether
+  /// everything below it may have changed too
+  typedef std::function<void(const std::string& path, bool below)>
+      ChangedFn;
+
+  /// Pass every path changed through the mount to @p changed, which has to
+  /// be set before the mount serves requests
+  void ReportChanges(ChangedFn changed) {
+    changed_ = changed;
+  }
+
+  /// Return the warm state of the caches, for a process taking over
+  std::string SaveSnapshot();
+
+  /// Fill the caches from what SaveSnapshot() of a process mirroring the
+  /// same real tree returned, return false if it didn't. Nothing is loaded
+  /// unless all of the snapshot reads back.
+  bool LoadSnapshot(const std::string& snapshot);
+
+  /// Return what pins the calling thread, which ops enter before running
+  WorkerPinner* workers() {
+    return &workers_;
+  }
+
+  int64_t open_files() const {
+    return open_files_.value();
+  }
+
+  int64_t open_dirs() const {
+    return open_dirs_.value();
+  }
+
   /// Create a file node
   /**
    *
@@ -185,6 +353,9 @@ class FuseContext {
    * file.  The return value of release is ignored.
    *
    * Changed in version 2.2
+   *
+   * Since nobody sees the result we hand the close of the real file to the
+   * completion pool rather than blocking this fuse worker on it.
    */
   int release(const char*, struct fuse_file_info*);
 
@@ -376,10 +547,18 @@ class FuseContext {
   /** Set extended attributes */
   int setxattr(const char*, const char*, const char*, size_t, int);
 
-  /** Get extended attributes */
+  /** Get extended attributes
+   *
+   * Returns the size of the value, or with a zero size just probes for the
+   * size of the value. Answers are cached, including ENODATA.
+   */
   int getxattr(const char*, const char*, char*, size_t);
 
-  /** List extended attributes */
+  /** List extended attributes
+   *
+   * Returns the size of the list, with the same size-probe semantics as
+   * getxattr()
+   */
   int listxattr(const char*, char*, size_t);
 
   /** Remove extended attributes */
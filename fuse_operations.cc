@@ -2,68 +2,104 @@
 
 #include "fuse_context.h"
 #include "fuse_operations.h"
+#include "stats.h"
 
 namespace logfs_fuse {
 
-void SetFuseOps(fuse_operations* fuse_ops) {
+void SetFuseOps(fuse_operations* fuse_ops, const Options& options) {
+  // tracing may be started through the control directory at any time if
+  // it is allowed to, so it can only be left out when it isn't
+  bool stats = options.stats;
+  bool trace = options.trace ||
+               (options.trace_control && !options.control_dir.empty());
+  if (stats && trace) {
+    fuse_ops::Dispatch<fuse_ops::OpPolicy<true, true> >::Fill(fuse_ops);
+  } else if (stats) {
+    fuse_ops::Dispatch<fuse_ops::OpPolicy<true, false> >::Fill(fuse_ops);
+  } else if (trace) {
+    fuse_ops::Dispatch<fuse_ops::OpPolicy<false, true> >::Fill(fuse_ops);
+  } else {
+    fuse_ops::Dispatch<fuse_ops::OpPolicy<false, false> >::Fill(fuse_ops);
+  }
+}
+
+namespace fuse_ops {
+
+/// Call @p call with the FuseContext of the mount as @p op on @p path,
+/// timing it into the stats and tracer if @p Policy has them
+template <typename Policy, typename Call>
+inline int Run(Op op, const char* path, Call call) {
+  fuse_context* ctx = fuse_get_context();
+  FuseContext* fs = static_cast<FuseContext*>(ctx->private_data);
+  fs->workers()->Enter();
+  if (!Policy::kStats && !Policy::kTrace) {
+    return call(fs);
+  }
+  OpTimer timer(Policy::kStats ? fs->stats() : NULL,
+                Policy::kTrace ? fs->tracer() : NULL, op, ctx->pid, path);
+  return timer.Finish(call(fs));
+}
+
+template <typename Policy>
+void Dispatch<Policy>::Fill(fuse_operations* fuse_ops) {
   memset(fuse_ops, 0, sizeof(fuse_operations));
 
-  fuse_ops->getattr = fuse_ops::getattr;
-  fuse_ops->readlink = fuse_ops::readlink;
+  fuse_ops->getattr = getattr;
+  fuse_ops->readlink = readlink;
   fuse_ops->getdir = NULL;
-  fuse_ops->mknod = fuse_ops::mknod;
-  fuse_ops->mkdir = fuse_ops::mkdir;
-  fuse_ops->unlink = fuse_ops::unlink;
-  fuse_ops->rmdir = fuse_ops::rmdir;
-  fuse_ops->symlink = fuse_ops::symlink;
-  fuse_ops->rename = fuse_ops::rename;
-  fuse_ops->link = fuse_ops::link;
-  fuse_ops->chmod = fuse_ops::chmod;
-  fuse_ops->chown = fuse_ops::chown;
-  fuse_ops->truncate = fuse_ops::truncate;
+  fuse_ops->mknod = mknod;
+  fuse_ops->mkdir = mkdir;
+  fuse_ops->unlink = unlink;
+  fuse_ops->rmdir = rmdir;
+  fuse_ops->symlink = symlink;
+  fuse_ops->rename = rename;
+  fuse_ops->link = link;
+  fuse_ops->chmod = chmod;
+  fuse_ops->chown = chown;
+  fuse_ops->truncate = truncate;
   fuse_ops->utime = NULL;
-  fuse_ops->open = fuse_ops::open;
-  fuse_ops->read = fuse_ops::read;
-  fuse_ops->write = fuse_ops::write;
-  fuse_ops->statfs = fuse_ops::statfs;
-  fuse_ops->flush = fuse_ops::flush;
-  fuse_ops->release = fuse_ops::release;
-  fuse_ops->fsync = fuse_ops::fsync;
+  fuse_ops->open = open;
+  fuse_ops->read = read;
+  fuse_ops->write = write;
+  fuse_ops->statfs = statfs;
+  fuse_ops->flush = flush;
+  fuse_ops->release = release;
+  fuse_ops->fsync = fsync;
 #ifdef HAVE_SETXATTR
-  fuse_ops->setxattr = fuse_ops::setxattr;
-  fuse_ops->getxattr = fuse_ops::getxattr;
-  fuse_ops->listxattr = fuse_ops::listxattr;
-  fuse_ops->removexattr = fuse_ops::removexattr;
+  fuse_ops->setxattr = setxattr;
+  fuse_ops->getxattr = getxattr;
+  fuse_ops->listxattr = listxattr;
+  fuse_ops->removexattr = removexattr;
 #endif
-  fuse_ops->opendir = fuse_ops::opendir;
-  fuse_ops->readdir = fuse_ops::readdir;
-  fuse_ops->releasedir = fuse_ops::releasedir;
-  fuse_ops->fsyncdir = fuse_ops::fsyncdir;
+  fuse_ops->opendir = opendir;
+  fuse_ops->readdir = readdir;
+  fuse_ops->releasedir = releasedir;
+  fuse_ops->fsyncdir = fsyncdir;
   fuse_ops->init = fuse_ops::init;
   fuse_ops->destroy = fuse_ops::destroy;
-  fuse_ops->access = fuse_ops::access;
-  fuse_ops->create = fuse_ops::create;
-  fuse_ops->ftruncate = fuse_ops::ftruncate;
-  fuse_ops->fgetattr = fuse_ops::fgetattr;
-  fuse_ops->lock = fuse_ops::lock;
-  fuse_ops->utimens = fuse_ops::utimens;
+  fuse_ops->access = access;
+  fuse_ops->create = create;
+  fuse_ops->ftruncate = ftruncate;
+  fuse_ops->fgetattr = fgetattr;
+  fuse_ops->lock = lock;
+  fuse_ops->utimens = utimens;
   fuse_ops->bmap = NULL;
-  fuse_ops->ioctl = fuse_ops::ioctl;
-  fuse_ops->poll = fuse_ops::poll;
+  fuse_ops->ioctl = ioctl;
+  fuse_ops->poll = poll;
 }
 
-namespace fuse_ops {
-
-int getattr(const char* path, struct stat* out) {
-  fuse_context* ctx = fuse_get_context();
-  FuseContext* fs = static_cast<FuseContext*>(ctx->private_data);
-  return fs->getattr(path, out);
+template <typename Policy>
+int Dispatch<Policy>::getattr(const char* path, struct stat* out) {
+  return Run<Policy>(kOpGetattr, path, [path, out](FuseContext* fs) {
+    return fs->getattr(path, out);
+  });
 }
 
-int readlink(const char* path, char* buf, size_t bufsize) {
-  fuse_context* ctx = fuse_get_context();
-  FuseContext* fs = static_cast<FuseContext*>(ctx->private_data);
-  return fs->readlink(path, buf, bufsize);
+template <typename Policy>
+int Dispatch<Policy>::readlink(const char* path, char* buf, size_t bufsize) {
+  return Run<Policy>(kOpReadlink, path, [path, buf, bufsize](FuseContext* fs) {
+    return fs->readlink(path, buf, bufsize);
+  });
 }
 
 // int getdir (const char *, fuse_dirh_t, fuse_dirfil_t)
@@ -71,64 +107,75 @@ int readlink(const char* path, char* buf, size_t bufsize) {
 //    return 0;
 //}
 
-int mknod(const char* pathname, mode_t mode, dev_t dev) {
-  fuse_context* ctx = fuse_get_context();
-  FuseContext* fs = static_cast<FuseContext*>(ctx->private_data);
-  return fs->mknod(pathname, mode, dev);
+template <typename Policy>
+int Dispatch<Policy>::mknod(const char* pathname, mode_t mode, dev_t dev) {
+  return Run<Policy>(kOpMknod, pathname,
+                     [pathname, mode, dev](FuseContext* fs) {
+                       return fs->mknod(pathname, mode, dev);
+                     });
 }
 
-int mkdir(const char* pathname, mode_t mode) {
-  fuse_context* ctx = fuse_get_context();
-  FuseContext* fs = static_cast<FuseContext*>(ctx->private_data);
-  return fs->mkdir(pathname, mode);
+template <typename Policy>
+int Dispatch<Policy>::mkdir(const char* pathname, mode_t mode) {
+  return Run<Policy>(kOpMkdir, pathname, [pathname, mode](FuseContext* fs) {
+    return fs->mkdir(pathname, mode);
+  });
 }
 
-int unlink(const char* pathname) {
-  fuse_context* ctx = fuse_get_context();
-  FuseContext* fs = static_cast<FuseContext*>(ctx->private_data);
-  return fs->unlink(pathname);
+template <typename Policy>
+int Dispatch<Policy>::unlink(const char* pathname) {
+  return Run<Policy>(kOpUnlink, pathname, [pathname](FuseContext* fs) {
+    return fs->unlink(pathname);
+  });
 }
 
-int rmdir(const char* pathname) {
-  fuse_context* ctx = fuse_get_context();
-  FuseContext* fs = static_cast<FuseContext*>(ctx->private_data);
-  return fs->rmdir(pathname);
+template <typename Policy>
+int Dispatch<Policy>::rmdir(const char* pathname) {
+  return Run<Policy>(kOpRmdir, pathname, [pathname](FuseContext* fs) {
+    return fs->rmdir(pathname);
+  });
 }
 
-int symlink(const char* oldpath, const char* newpath) {
-  fuse_context* ctx = fuse_get_context();
-  FuseContext* fs = static_cast<FuseContext*>(ctx->private_data);
-  return fs->symlink(oldpath, newpath);
+template <typename Policy>
+int Dispatch<Policy>::symlink(const char* oldpath, const char* newpath) {
+  return Run<Policy>(kOpSymlink, newpath, [oldpath, newpath](FuseContext* fs) {
+    return fs->symlink(oldpath, newpath);
+  });
 }
 
-int rename(const char* oldpath, const char* newpath) {
-  fuse_context* ctx = fuse_get_context();
-  FuseContext* fs = static_cast<FuseContext*>(ctx->private_data);
-  return fs->rename(oldpath, newpath);
+template <typename Policy>
+int Dispatch<Policy>::rename(const char* oldpath, const char* newpath) {
+  return Run<Policy>(kOpRename, oldpath, [oldpath, newpath](FuseContext* fs) {
+    return fs->rename(oldpath, newpath);
+  });
 }
 
-int link(const char* oldpath, const char* newpath) {
-  fuse_context* ctx = fuse_get_context();
-  FuseContext* fs = static_cast<FuseContext*>(ctx->private_data);
-  return fs->link(oldpath, newpath);
+template <typename Policy>
+int Dispatch<Policy>::link(const char* oldpath, const char* newpath) {
+  return Run<Policy>(kOpLink, oldpath, [oldpath, newpath](FuseContext* fs) {
+    return fs->link(oldpath, newpath);
+  });
 }
 
-int chmod(const char* path, mode_t mode) {
-  fuse_context* ctx = fuse_get_context();
-  FuseContext* fs = static_cast<FuseContext*>(ctx->private_data);
-  return fs->chmod(path, mode);
+template <typename Policy>
+int Dispatch<Policy>::chmod(const char* path, mode_t mode) {
+  return Run<Policy>(kOpChmod, path, [path, mode](FuseContext* fs) {
+    return fs->chmod(path, mode);
+  });
 }
 
-int chown(const char* path, uid_t owner, gid_t group) {
-  fuse_context* ctx = fuse_get_context();
-  FuseContext* fs = static_cast<FuseContext*>(ctx->private_data);
-  return fs->chown(path, owner, group);
+template <typename Policy>
+int Dispatch<Policy>::chown(const char* path, uid_t owner, gid_t group) {
+  return Run<Policy>(kOpChown, path, [path, owner, group](FuseContext* fs) {
+    return fs->chown(path, owner, group);
+  });
 }
 
-int truncate(const char* path, off_t length) {
-  fuse_context* ctx = fuse_get_context();
-  FuseContext* fs = static_cast<FuseContext*>(ctx->private_data);
-  return fs->truncate(path, length);
+template <typename Policy>
+int Dispatch<Policy>::truncate(const char* path, off_t length) {
+  return Run<Policy>(kOpTruncate, path, [path, length](FuseContext* fs) {
+    return fs->truncate(path, length);
+  });
 }
 
 // int utime (const char *, struct utimbuf *)
@@ -136,98 +183,128 @@ int truncate(const char* path, off_t length) {
 //    return 0;
 //}
 
-int open(const char* pathname, struct fuse_file_info* info) {
-  fuse_context* ctx = fuse_get_context();
-  FuseContext* fs = static_cast<FuseContext*>(ctx->private_data);
-  return fs->open(pathname, info);
-}
-
-int read(const char* pathname, char* buf, size_t bufsize, off_t offset,
-         struct fuse_file_info* info) {
-  fuse_context* ctx = fuse_get_context();
-  FuseContext* fs = static_cast<FuseContext*>(ctx->private_data);
-  return fs->read(pathname, buf, bufsize, offset, info);
-}
-
-int write(const char* pathname, const char* buf, size_t bufsize, off_t offset,
-          struct fuse_file_info* info) {
-  fuse_context* ctx = fuse_get_context();
-  FuseContext* fs = static_cast<FuseContext*>(ctx->private_data);
-  return fs->write(pathname, buf, bufsize, offset, info);
-}
+template <typename Policy>
+int Dispatch<Policy>::open(const char* pathname, struct fuse_file_info* info) {
+  return Run<Policy>(kOpOpen, pathname, [pathname, info](FuseContext* fs) {
+    return fs->open(pathname, info);
+  });
+}
+
+template <typename Policy>
+int Dispatch<Policy>::read(const char* pathname, char* buf, size_t bufsize,
+                           off_t offset, struct fuse_file_info* info) {
+  return Run<Policy>(kOpRead, pathname,
+                     [pathname, buf, bufsize, offset, info](FuseContext* fs) {
+                       return fs->read(pathname, buf, bufsize, offset, info);
+                     });
+}
 
-int statfs(const char* path, struct statvfs* buf) {
-  fuse_context* ctx = fuse_get_context();
-  FuseContext* fs = static_cast<FuseContext*>(ctx->private_data);
-  return fs->statfs(path, buf);
+template <typename Policy>
+int Dispatch<Policy>::write(const char* pathname, const char* buf,
+                            size_t bufsize, off_t offset,
+                            struct fuse_file_info* info) {
+  return Run<Policy>(kOpWrite, pathname,
+                     [pathname, buf, bufsize, offset, info](FuseContext* fs) {
+                       return fs->write(pathname, buf, bufsize, offset, info);
+                     });
 }
 
-int flush(const char* path, struct fuse_file_info* info) {
-  fuse_context* ctx = fuse_get_context();
-  FuseContext* fs = static_cast<FuseContext*>(ctx->private_data);
-  return fs->flush(path, info);
+template <typename Policy>
+int Dispatch<Policy>::statfs(const char* path, struct statvfs* buf) {
+  return Run<Policy>(kOpStatfs, path, [path, buf](FuseContext* fs) {
+    return fs->statfs(path, buf);
+  });
 }
 
-int release(const char* path, struct fuse_file_info* info) {
-  fuse_context* ctx = fuse_get_context();
-  FuseContext* fs = static_cast<FuseContext*>(ctx->private_data);
-  return fs->release(path, info);
+template <typename Policy>
+int Dispatch<Policy>::flush(const char* path, struct fuse_file_info* info) {
+  return Run<Policy>(kOpFlush, path, [path, info](FuseContext* fs) {
+    return fs->flush(path, info);
+  });
 }
 
-int fsync(const char* path, int syncdata, struct fuse_file_info* info) {
-  fuse_context* ctx = fuse_get_context();
-  FuseContext* fs = static_cast<FuseContext*>(ctx->private_data);
-  return fs->fsync(path, syncdata, info);
+template <typename Policy>
+int Dispatch<Policy>::release(const char* path, struct fuse_file_info* info) {
+  return Run<Policy>(kOpRelease, path, [path, info](FuseContext* fs) {
+    return fs->release(path, info);
+  });
 }
 
-int setxattr(const char* pathname, const char* key, const char* value,
-             size_t bufsize, int unknown) {
-  fuse_context* ctx = fuse_get_context();
-  FuseContext* fs = static_cast<FuseContext*>(ctx->private_data);
-  return fs->setxattr(pathname, key, value, bufsize, unknown);
+template <typename Policy>
+int Dispatch<Policy>::fsync(const char* path, int syncdata,
+                            struct fuse_file_info* info) {
+  return Run<Policy>(kOpFsync, path, [path, syncdata, info](FuseContext* fs) {
+    return fs->fsync(path, syncdata, info);
+  });
 }
 
-int getxattr(const char* pathname, const char* key, char* buf, size_t bufsize) {
-  fuse_context* ctx = fuse_get_context();
-  FuseContext* fs = static_cast<FuseContext*>(ctx->private_data);
-  return fs->getxattr(pathname, key, buf, bufsize);
+template <typename Policy>
+int Dispatch<Policy>::setxattr(const char* pathname, const char* key,
+                               const char* value, size_t bufsize,
+                               int unknown) {
+  return Run<Policy>(
+      kOpSetxattr, pathname,
+      [pathname, key, value, bufsize, unknown](FuseContext* fs) {
+        return fs->setxattr(pathname, key, value, bufsize, unknown);
+      });
 }
 
-int listxattr(const char* pathname, char* buf, size_t bufsize) {
-  fuse_context* ctx = fuse_get_context();
-  FuseContext* fs = static_cast<FuseContext*>(ctx->private_data);
-  return fs->listxattr(pathname, buf, bufsize);
+template <typename Policy>
+int Dispatch<Policy>::getxattr(const char* pathname, const char* key,
+                               char* buf, size_t bufsize) {
+  return Run<Policy>(kOpGetxattr, pathname,
+                     [pathname, key, buf, bufsize](FuseContext* fs) {
+                       return fs->getxattr(pathname, key, buf, bufsize);
+                     });
 }
 
-int removexattr(const char* pathname, const char* key) {
-  fuse_context* ctx = fuse_get_context();
-  FuseContext* fs = static_cast<FuseContext*>(ctx->private_data);
-  return fs->removexattr(pathname, key);
+template <typename Policy>
+int Dispatch<Policy>::listxattr(const char* pathname, char* buf,
+                                size_t bufsize) {
+  return Run<Policy>(kOpListxattr, pathname,
+                     [pathname, buf, bufsize](FuseContext* fs) {
+                       return fs->listxattr(pathname, buf, bufsize);
+                     });
 }
 
-int opendir(const char* path, struct fuse_file_info* fi) {
-  fuse_context* ctx = fuse_get_context();
-  FuseContext* fs = static_cast<FuseContext*>(ctx->private_data);
-  return fs->opendir(path, fi);
+template <typename Policy>
+int Dispatch<Policy>::removexattr(const char* pathname, const char* key) {
+  return Run<Policy>(kOpRemovexattr, pathname,
+                     [pathname, key](FuseContext* fs) {
+                       return fs->removexattr(pathname, key);
+                     });
 }
 
-int readdir(const char* path, void* buf, fuse_fill_dir_t filler, off_t offset,
-            struct fuse_file_info* fi) {
-  fuse_context* ctx = fuse_get_context();
-  FuseContext* fs = static_cast<FuseContext*>(ctx->private_data);
-  return fs->readdir(path, buf, filler, offset, fi);
+template <typename Policy>
+int Dispatch<Policy>::opendir(const char* path, struct fuse_file_info* fi) {
+  return Run<Policy>(kOpOpendir, path, [path, fi](FuseContext* fs) {
+    return fs->opendir(path, fi);
+  });
 }
 
-int releasedir(const char* path, struct fuse_file_info* fi) {
-  fuse_context* ctx = fuse_get_context();
-  FuseContext* fs = static_cast<FuseContext*>(ctx->private_data);
-  return fs->releasedir(path, fi);
+template <typename Policy>
+int Dispatch<Policy>::readdir(const char* path, void* buf,
+                              fuse_fill_dir_t filler, off_t offset,
+                              struct fuse_file_info* fi) {
+  return Run<Policy>(kOpReaddir, path,
+                     [path, buf, filler, offset, fi](FuseContext* fs) {
+                       return fs->readdir(path, buf, filler, offset, fi);
+                     });
+}
+
+template <typename Policy>
+int Dispatch<Policy>::releasedir(const char* path, struct fuse_file_info* fi) {
+  return Run<Policy>(kOpReleasedir, path, [path, fi](FuseContext* fs) {
+    return fs->releasedir(path, fi);
+  });
 }
 
-int fsyncdir(const char* path, int datasync, struct fuse_file_info* fi) {
-  fuse_context* ctx = fuse_get_context();
-  FuseContext* fs = static_cast<FuseContext*>(ctx->private_data);
-  return fs->fsyncdir(path, datasync, fi);
+template <typename Policy>
+int Dispatch<Policy>::fsyncdir(const char* path, int datasync,
+                               struct fuse_file_info* fi) {
+  return Run<Policy>(kOpFsyncdir, path, [path, datasync, fi](FuseContext* fs) {
+    return fs->fsyncdir(path, datasync, fi);
+  });
 }
 
 void* init(struct fuse_conn_info* conn) {
@@ -242,51 +319,65 @@ void destroy(void* private_data) {
   }
 }
 
-int access(const char* path, int mode) {
-  fuse_context* ctx = fuse_get_context();
-  FuseContext* fs = static_cast<FuseContext*>(ctx->private_data);
-  return fs->access(path, mode);
+template <typename Policy>
+int Dispatch<Policy>::access(const char* path, int mode) {
+  return Run<Policy>(kOpAccess, path, [path, mode](FuseContext* fs) {
+    return fs->access(path, mode);
+  });
 }
 
-int create(const char* path, mode_t mode, struct fuse_file_info* fi) {
-  fuse_context* ctx = fuse_get_context();
-  FuseContext* fs = static_cast<FuseContext*>(ctx->private_data);
-  return fs->create(path, mode, fi);
+template <typename Policy>
+int Dispatch<Policy>::create(const char* path, mode_t mode,
+                             struct fuse_file_info* fi) {
+  return Run<Policy>(kOpCreate, path, [path, mode, fi](FuseContext* fs) {
+    return fs->create(path, mode, fi);
+  });
 }
 
-int ftruncate(const char* path, off_t length, struct fuse_file_info* fi) {
-  fuse_context* ctx = fuse_get_context();
-  FuseContext* fs = static_cast<FuseContext*>(ctx->private_data);
-  return fs->ftruncate(path, length, fi);
+template <typename Policy>
+int Dispatch<Policy>::ftruncate(const char* path, off_t length,
+                                struct fuse_file_info* fi) {
+  return Run<Policy>(kOpFtruncate, path, [path, length, fi](FuseContext* fs) {
+    return fs->ftruncate(path, length, fi);
+  });
 }
 
-int fgetattr(const char* path, struct stat* sf, struct fuse_file_info* fi) {
-  fuse_context* ctx = fuse_get_context();
-  FuseContext* fs = static_cast<FuseContext*>(ctx->private_data);
-  return fs->fgetattr(path, sf, fi);
+template <typename Policy>
+int Dispatch<Policy>::fgetattr(const char* path, struct stat* sf,
+                               struct fuse_file_info* fi) {
+  return Run<Policy>(kOpFgetattr, path, [path, sf, fi](FuseContext* fs) {
+    return fs->fgetattr(path, sf, fi);
+  });
 }
 
-int lock(const char*, struct fuse_file_info*, int cmd, struct flock*) {
-  return 0;
+template <typename Policy>
+int Dispatch<Policy>::lock(const char* path, struct fuse_file_info*, int cmd,
+                           struct flock*) {
+  return Run<Policy>(kOpLock, path, [](FuseContext* fs) { return 0; });
 }
 
-int utimens(const char*, const struct timespec tv[2]) {
-  return 0;
+template <typename Policy>
+int Dispatch<Policy>::utimens(const char* path, const struct timespec tv[2]) {
+  return Run<Policy>(kOpUtimens, path, [](FuseContext* fs) { return 0; });
 }
 
-int bmap(const char*, size_t blocksize, uint64_t* idx) {
-  return 0;
+template <typename Policy>
+int Dispatch<Policy>::ioctl(const char* path, int cmd, void* arg,
+                            struct fuse_file_info*, unsigned int flags,
+                            void* data) {
+  return Run<Policy>(kOpIoctl, path, [](FuseContext* fs) { return 0; });
 }
 
-int ioctl(const char*, int cmd, void* arg, struct fuse_file_info*,
-          unsigned int flags, void* data) {
-  return 0;
+template <typename Policy>
+int Dispatch<Policy>::poll(const char* path, struct fuse_file_info*,
+                           struct fuse_pollhandle* ph, unsigned* reventsp) {
+  return Run<Policy>(kOpPoll, path, [](FuseContext* fs) { return 0; });
 }
 
-int poll(const char*, struct fuse_file_info*, struct fuse_pollhandle* ph,
-         unsigned* reventsp) {
-  return 0;
-}
+template struct Dispatch<OpPolicy<true, true> >;
+template struct Dispatch<OpPolicy<true, false> >;
+template struct Dispatch<OpPolicy<false, true> >;
+template struct Dispatch<OpPolicy<false, false> >;
 
 }  // namespace fuse_ops
 }  // namespace logfs_fuse
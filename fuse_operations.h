@@ -1,55 +1,80 @@
 #include "fuse_include.h"
+#include "options.h"
 
 namespace logfs_fuse {
 
-void SetFuseOps(fuse_operations* fuse_ops);
+/// Fill @p fuse_ops with the dispatch table suited to @p options
+/**
+ *  The table is picked from instantiations of fuse_ops::Dispatch, so a
+ *  mount without stats or tracing runs ops with no timing code at all
+ *  rather than checking for it on every call.
+ */
+void SetFuseOps(fuse_operations* fuse_ops, const Options& options);
 
 /// encapsulates global functions which simply extract the fuse context
 /// and then call the corresponding fuction of OpenbookFS
 namespace fuse_ops {
 
-int getattr(const char*, struct stat*);
-int readlink(const char*, char*, size_t);
-//  int getdir (const char *, fuse_dirh_t, fuse_dirfil_t);
-int mknod(const char*, mode_t, dev_t);
-int mkdir(const char*, mode_t);
-int unlink(const char*);
-int rmdir(const char*);
-int symlink(const char*, const char*);
-int rename(const char*, const char*);
-int link(const char*, const char*);
-int chmod(const char*, mode_t);
-int chown(const char*, uid_t, gid_t);
-int truncate(const char*, off_t);
-//  int utime (const char *, struct utimbuf *);
-int open(const char*, struct fuse_file_info*);
-int read(const char*, char*, size_t, off_t, struct fuse_file_info*);
-int write(const char*, const char*, size_t, off_t, struct fuse_file_info*);
-int statfs(const char*, struct statvfs*);
-int flush(const char*, struct fuse_file_info*);
-int release(const char*, struct fuse_file_info*);
-int fsync(const char*, int, struct fuse_file_info*);
-int setxattr(const char*, const char*, const char*, size_t, int);
-int getxattr(const char*, const char*, char*, size_t);
-int listxattr(const char*, char*, size_t);
-int removexattr(const char*, const char*);
-int opendir(const char*, struct fuse_file_info*);
-int readdir(const char*, void*, fuse_fill_dir_t, off_t, struct fuse_file_info*);
-int releasedir(const char*, struct fuse_file_info*);
-int fsyncdir(const char*, int, struct fuse_file_info*);
+/// Compile-time choice of what the dispatch layer does around each op
+template <bool kStatsEnabled, bool kTraceEnabled>
+struct OpPolicy {
+  /// Record each op in the per-op stats
+  static const bool kStats = kStatsEnabled;
+  /// Record each op in the tracer while it is tracing
+  static const bool kTrace = kTraceEnabled;
+};
+
+/// Per-op functions which get the FuseContext of the mount, wrap the call
+/// to it in what @p Policy asks for, and pass its result back to fuse
+template <typename Policy>
+struct Dispatch {
+  static int getattr(const char*, struct stat*);
+  static int readlink(const char*, char*, size_t);
+  static int mknod(const char*, mode_t, dev_t);
+  static int mkdir(const char*, mode_t);
+  static int unlink(const char*);
+  static int rmdir(const char*);
+  static int symlink(const char*, const char*);
+  static int rename(const char*, const char*);
+  static int link(const char*, const char*);
+  static int chmod(const char*, mode_t);
+  static int chown(const char*, uid_t, gid_t);
+  static int truncate(const char*, off_t);
+  static int open(const char*, struct fuse_file_info*);
+  static int read(const char*, char*, size_t, off_t, struct fuse_file_info*);
+  static int write(const char*, const char*, size_t, off_t,
+                   struct fuse_file_info*);
+  static int statfs(const char*, struct statvfs*);
+  static int flush(const char*, struct fuse_file_info*);
+  static int release(const char*, struct fuse_file_info*);
+  static int fsync(const char*, int, struct fuse_file_info*);
+  static int setxattr(const char*, const char*, const char*, size_t, int);
+  static int getxattr(const char*, const char*, char*, size_t);
+  static int listxattr(const char*, char*, size_t);
+  static int removexattr(const char*, const char*);
+  static int opendir(const char*, struct fuse_file_info*);
+  static int readdir(const char*, void*, fuse_fill_dir_t, off_t,
+                     struct fuse_file_info*);
+  static int releasedir(const char*, struct fuse_file_info*);
+  static int fsyncdir(const char*, int, struct fuse_file_info*);
+  static int access(const char*, int);
+  static int create(const char*, mode_t, struct fuse_file_info*);
+  static int ftruncate(const char*, off_t, struct fuse_file_info*);
+  static int fgetattr(const char*, struct stat*, struct fuse_file_info*);
+  static int lock(const char*, struct fuse_file_info*, int cmd,
+                  struct flock*);
+  static int utimens(const char*, const struct timespec tv[2]);
+  static int ioctl(const char*, int cmd, void* arg, struct fuse_file_info*,
+                   unsigned int flags, void* data);
+  static int poll(const char*, struct fuse_file_info*,
+                  struct fuse_pollhandle* ph, unsigned* reventsp);
+
+  /// Fill @p fuse_ops with the functions of this instantiation
+  static void Fill(fuse_operations* fuse_ops);
+};
+
 void* init(struct fuse_conn_info* conn);
 void destroy(void* user_pointer);
-int access(const char*, int);
-int create(const char*, mode_t, struct fuse_file_info*);
-int ftruncate(const char*, off_t, struct fuse_file_info*);
-int fgetattr(const char*, struct stat*, struct fuse_file_info*);
-int lock(const char*, struct fuse_file_info*, int cmd, struct flock*);
-int utimens(const char*, const struct timespec tv[2]);
-int bmap(const char*, size_t blocksize, uint64_t* idx);
-int ioctl(const char*, int cmd, void* arg, struct fuse_file_info*,
-          unsigned int flags, void* data);
-int poll(const char*, struct fuse_file_info*, struct fuse_pollhandle* ph,
-         unsigned* reventsp);
 
 }  // namespace fuse_ops
 }  // namespace logfs_fuse
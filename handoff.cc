@@ -0,0 +1,481 @@
+#include "handoff.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+
+#include <glog/logging.h>
+
+#include "unix_socket.h"
+
+namespace logfs_fuse {
+
+// Each message is one packet starting with its type
+static const char kTakeover = 'T';  // client: hand me the mount
+static const char kState = 'S';     // server: our log path, state in a memfd
+static const char kDetach = 'D';    // client: loaded, let go of the mount
+static const char kDetached = 'K';  // server: the result of detaching
+static const char kChanged = 'C';   // server: '1' or '0' for below, a path
+static const char kDropAll = 'F';   // server: lost track, drop everything
+
+// largest message, the state itself goes in the memfd
+static const size_t kMaxMessage = 8192;
+
+// how long either side waits for the other before giving up
+static const int kTimeoutSeconds = 30;
+
+// most change reports queued before they are replaced by one kDropAll
+static const size_t kMaxQueuedReports = 4096;
+
+// send a message of @p type, passing @p pass_fd with it unless it is -1
+static int SendMessage(int fd, char type, const std::string& payload,
+                       int pass_fd) {
+  std::string packet(1, type);
+  packet += payload;
+  iovec iov;
+  iov.iov_base = &packet[0];
+  iov.iov_len = packet.size();
+
+  msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  char control[CMSG_SPACE(sizeof(int))];
+  if (pass_fd >= 0) {
+    memset(control, 0, sizeof(control));
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &pass_fd, sizeof(int));
+  }
+
+  while (::sendmsg(fd, &msg, MSG_NOSIGNAL) < 0) {
+    if (errno != EINTR) {
+      return -errno;
+    }
+  }
+  return 0;
+}
+
+// receive a message into @p type and @p payload, and the descriptor passed
+// with it into @p passed_fd, or -1 if there was none
+static int ReceiveMessage(int fd, char* type, std::string* payload,
+                          int* passed_fd) {
+  std::string packet(kMaxMessage, '\0');
+  iovec iov;
+  iov.iov_base = &packet[0];
+  iov.iov_len = packet.size();
+
+  msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  char control[CMSG_SPACE(sizeof(int))];
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+
+  ssize_t size;
+  while ((size = ::recvmsg(fd, &msg, MSG_CMSG_CLOEXEC)) < 0) {
+    if (errno != EINTR) {
+      return -errno;
+    }
+  }
+
+  *passed_fd = -1;
+  for (cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+       cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+      memcpy(passed_fd, CMSG_DATA(cmsg), sizeof(int));
+    }
+  }
+  if (size == 0) {
+    return -ECONNRESET;
+  }
+  *type = packet[0];
+  payload->assign(packet, 1, size - 1);
+  return 0;
+}
+
+// split the payload of a kChanged message into the path and whether
+// everything below it changed
+static std::pair<std::string, bool> DecodeChange(const std::string& payload) {
+  if (payload.empty()) {
+    return std::make_pair(std::string(), false);
+  }
+  return std::make_pair(payload.substr(1), payload[0] == '1');
+}
+
+static void SetTimeouts(int fd) {
+  timeval timeout;
+  timeout.tv_sec = kTimeoutSeconds;
+  timeout.tv_usec = 0;
+  ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  ::setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+}
+
+// return a memfd holding @p data, or -errno
+static int WriteMemfd(const std::string& data) {
+  int fd = ::memfd_create("logfs_snapshot", MFD_CLOEXEC);
+  if (fd < 0) {
+    return -errno;
+  }
+  for (size_t written = 0; written < data.size();) {
+    ssize_t result = ::write(fd, data.data() + written, data.size() - written);
+    if (result < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      int error = errno;
+      ::close(fd);
+      return -error;
+    }
+    written += result;
+  }
+  return fd;
+}
+
+// read all of the file @p fd into @p data, return 0 or -errno
+static int ReadAll(int fd, std::string* data) {
+  struct stat st;
+  if (::fstat(fd, &st) < 0) {
+    return -errno;
+  }
+  data->resize(st.st_size);
+  for (size_t done = 0; done < data->size();) {
+    ssize_t result = ::pread(fd, &(*data)[done], data->size() - done, done);
+    if (result < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -errno;
+    }
+    if (result == 0) {
+      data->resize(done);
+      break;
+    }
+    done += result;
+  }
+  return 0;
+}
+
+HandoffServer::HandoffServer(const std::string& socket_path,
+                             const std::string& log_path, SnapshotFn snapshot,
+                             DetachFn detach)
+    : socket_path_(socket_path),
+      log_path_(log_path),
+      snapshot_(snapshot),
+      detach_(detach),
+      listen_fd_(-1),
+      reporting_(false),
+      drop_all_(false),
+      stopping_(false) {
+  wake_pipe_[0] = wake_pipe_[1] = -1;
+}
+
+HandoffServer::~HandoffServer() {
+  Stop();
+}
+
+void HandoffServer::Start() {
+  listen_fd_ = ListenUnixSocket(socket_path_, SOCK_SEQPACKET, 1);
+  LOG_IF(FATAL, listen_fd_ < 0)
+      << "Failed to listen on handoff socket '" << socket_path_ << "', ["
+      << -listen_fd_ << "] : " << strerror(-listen_fd_);
+  PLOG_IF(FATAL, ::pipe2(wake_pipe_, O_CLOEXEC) < 0)
+      << "Failed to create handoff server pipe";
+
+  thread_ = std::thread(&HandoffServer::ServerMain, this);
+}
+
+void HandoffServer::Stop() {
+  if (thread_.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(reports_mutex_);
+      stopping_ = true;
+    }
+    reports_cv_.notify_all();
+    char stop = 'q';
+    ssize_t ignored = ::write(wake_pipe_[1], &stop, 1);
+    (void)ignored;
+    thread_.join();
+  }
+  SetReporting(false);
+  // once detached the socket is our successor's
+  if (listen_fd_ >= 0) {
+    ::close(listen_fd_);
+    ::unlink(socket_path_.c_str());
+    listen_fd_ = -1;
+  }
+  if (wake_pipe_[0] >= 0) {
+    ::close(wake_pipe_[0]);
+    ::close(wake_pipe_[1]);
+    wake_pipe_[0] = wake_pipe_[1] = -1;
+  }
+}
+
+void HandoffServer::Changed(const std::string& path, bool below) {
+  if (!reporting_.load(std::memory_order_relaxed)) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(reports_mutex_);
+    if (!reporting_ || drop_all_) {
+      return;
+    }
+    if (reports_.size() >= kMaxQueuedReports) {
+      reports_.clear();
+      drop_all_ = true;
+    } else {
+      reports_.push_back(std::make_pair(path, below));
+    }
+  }
+  reports_cv_.notify_one();
+}
+
+void HandoffServer::SetReporting(bool reporting) {
+  std::lock_guard<std::mutex> lock(reports_mutex_);
+  reporting_ = reporting;
+  reports_.clear();
+  drop_all_ = false;
+}
+
+void HandoffServer::ReportMain(int client_fd) {
+  while (true) {
+    std::deque<std::pair<std::string, bool>> reports;
+    bool drop_all = false;
+    {
+      std::unique_lock<std::mutex> lock(reports_mutex_);
+      reports_cv_.wait(lock, [this] {
+        return stopping_ || drop_all_ || !reports_.empty();
+      });
+      if (reports_.empty() && !drop_all_) {
+        return;
+      }
+      reports.swap(reports_);
+      std::swap(drop_all, drop_all_);
+    }
+
+    int result = 0;
+    if (drop_all) {
+      result = SendMessage(client_fd, kDropAll, "", -1);
+    }
+    for (size_t i = 0; i < reports.size() && result == 0; i++) {
+      result = SendMessage(client_fd, kChanged,
+                           (reports[i].second ? "1" : "0") + reports[i].first,
+                           -1);
+    }
+    if (result < 0) {
+      LOG(WARNING) << "Failed to report changes to the process taking over, "
+                   << "it may serve stale caches, [" << -result
+                   << "] : " << strerror(-result);
+      SetReporting(false);
+      return;
+    }
+  }
+}
+
+void HandoffServer::ServerMain() {
+  while (true) {
+    pollfd fds[2];
+    fds[0].fd = wake_pipe_[0];
+    fds[0].events = POLLIN;
+    fds[1].fd = listen_fd_;
+    fds[1].events = POLLIN;
+    if (::poll(fds, 2, -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      PLOG(ERROR) << "Handoff server poll failed";
+      return;
+    }
+    if (fds[0].revents & POLLIN) {
+      return;
+    }
+
+    if (fds[1].revents & POLLIN) {
+      int client_fd = ::accept4(listen_fd_, NULL, NULL, SOCK_CLOEXEC);
+      if (client_fd < 0) {
+        continue;
+      }
+      SetTimeouts(client_fd);
+      if (Serve(client_fd)) {
+        LOG(INFO) << "Handed the mount over, serving its remaining users";
+        ReportMain(client_fd);
+        ::close(client_fd);
+        return;
+      }
+      ::close(client_fd);
+    }
+  }
+}
+
+bool HandoffServer::Serve(int client_fd) {
+  char type = 0;
+  std::string payload;
+  int passed_fd = -1;
+  int result = ReceiveMessage(client_fd, &type, &payload, &passed_fd);
+  if (passed_fd >= 0) {
+    ::close(passed_fd);
+  }
+  if (result < 0 || type != kTakeover) {
+    LOG(WARNING) << "Ignoring handoff client which didn't ask to take over";
+    return false;
+  }
+
+  // changes the snapshot might miss are reported once we have detached
+  SetReporting(true);
+
+  // without the state the new process just starts cold
+  int state_fd = WriteMemfd(snapshot_());
+  LOG_IF(WARNING, state_fd < 0) << "Failed to pass on warm state, ["
+                                << -state_fd << "] : " << strerror(-state_fd);
+  result = SendMessage(client_fd, kState, log_path_, state_fd);
+  if (state_fd >= 0) {
+    ::close(state_fd);
+  }
+  if (result < 0) {
+    LOG(WARNING) << "Failed to hand over, [" << -result
+                 << "] : " << strerror(-result);
+    SetReporting(false);
+    return false;
+  }
+
+  result = ReceiveMessage(client_fd, &type, &payload, &passed_fd);
+  if (passed_fd >= 0) {
+    ::close(passed_fd);
+  }
+  if (result < 0 || type != kDetach) {
+    LOG(WARNING) << "Process taking over gave up before the detach";
+    SetReporting(false);
+    return false;
+  }
+
+  int32_t detached = detach_();
+  if (detached == 0) {
+    // the successor listens on the same path once told we detached
+    ::close(listen_fd_);
+    ::unlink(socket_path_.c_str());
+    listen_fd_ = -1;
+  } else {
+    SetReporting(false);
+  }
+  SendMessage(client_fd, kDetached,
+              std::string(reinterpret_cast<const char*>(&detached),
+                          sizeof(detached)),
+              -1);
+  return detached == 0;
+}
+
+HandoffClient::HandoffClient() : fd_(-1) {}
+
+HandoffClient::~HandoffClient() {
+  if (thread_.joinable()) {
+    // wakes FollowMain() as if the process taken over had exited
+    ::shutdown(fd_, SHUT_RDWR);
+    thread_.join();
+  }
+  if (fd_ >= 0) {
+    ::close(fd_);
+  }
+}
+
+int HandoffClient::Receive(const std::string& socket_path,
+                           std::string* log_path, std::string* snapshot) {
+  sockaddr_un addr;
+  if (!UnixSocketAddress(socket_path, &addr)) {
+    return -ENAMETOOLONG;
+  }
+  fd_ = ::socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  if (fd_ < 0 ||
+      ::connect(fd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+    return -errno;
+  }
+  SetTimeouts(fd_);
+
+  int result = SendMessage(fd_, kTakeover, "", -1);
+  if (result < 0) {
+    return result;
+  }
+  char type = 0;
+  int state_fd = -1;
+  result = ReceiveMessage(fd_, &type, log_path, &state_fd);
+  if (result == 0 && type != kState) {
+    result = -EPROTO;
+  }
+  snapshot->clear();
+  if (result == 0 && state_fd >= 0) {
+    result = ReadAll(state_fd, snapshot);
+  }
+  if (state_fd >= 0) {
+    ::close(state_fd);
+  }
+  return result;
+}
+
+int HandoffClient::Detach(ChangedFn changed, DropFn drop_all) {
+  int result = SendMessage(fd_, kDetach, "", -1);
+  if (result < 0) {
+    return result;
+  }
+  char type = 0;
+  std::string payload;
+  int passed_fd = -1;
+  result = ReceiveMessage(fd_, &type, &payload, &passed_fd);
+  if (passed_fd >= 0) {
+    ::close(passed_fd);
+  }
+  if (result < 0) {
+    return result;
+  }
+  int32_t detached = 0;
+  if (type != kDetached || payload.size() != sizeof(detached)) {
+    return -EPROTO;
+  }
+  memcpy(&detached, payload.data(), sizeof(detached));
+  if (detached == 0) {
+    changed_ = changed;
+    drop_all_ = drop_all;
+    thread_ = std::thread(&HandoffClient::FollowMain, this);
+  }
+  return detached;
+}
+
+void HandoffClient::FollowMain() {
+  while (true) {
+    char type = 0;
+    std::string payload;
+    int passed_fd = -1;
+    int result = ReceiveMessage(fd_, &type, &payload, &passed_fd);
+    if (passed_fd >= 0) {
+      ::close(passed_fd);
+    }
+    if (result == -EAGAIN) {
+      // the receive timeout, it just had nothing to report
+      continue;
+    }
+    if (result < 0) {
+      break;
+    }
+    if (type == kChanged) {
+      std::pair<std::string, bool> change = DecodeChange(payload);
+      changed_(change.first, change.second);
+    } else if (type == kDropAll) {
+      drop_all_();
+    }
+  }
+  LOG(INFO) << "No longer following the process taken over";
+}
+
+}  // namespace logfs_fuse
@@ -0,0 +1,141 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>  // NOLINT(build/c++11)
+#include <deque>
+#include <functional>
+#include <mutex>  // NOLINT(build/c++11)
+#include <string>
+#include <thread>  // NOLINT(build/c++11)
+#include <utility>
+
+namespace logfs_fuse {
+
+/// Lets a newly started logfs_fuse take over the mount of this one
+/**
+ *  The fuse 2 high-level library numbers the kernel's inodes privately, so
+ *  another process can't serve requests on our /dev/fuse descriptor.
+ *  Instead a restart overlaps the two processes:
+ *    * the new process connects to the socket and is sent the warm state
+ *      of our caches, in a memfd passed with SCM_RIGHTS
+ *    * once it has loaded them it asks us to detach the mount, which we
+ *      lazily unmount, so that processes with files open or their working
+ *      directory in the mirror keep being served by us. Our stats and
+ *      handoff sockets are closed for it to listen on.
+ *    * it mounts in our place, and every new lookup goes to it
+ *
+ *  From the snapshot on, every path changed through our mount is queued
+ *  and, once we have detached, sent over the connection by the server
+ *  thread, so that the new process drops what it caches for files our
+ *  remaining users write. Requests never wait for the new process: if it
+ *  falls behind and the queue fills up, the queue is replaced by one
+ *  report telling it to drop all of its caches. We exit once the last of
+ *  our users lets go of the detached mount, which ends the reports.
+ *
+ *  Nothing is mounted between the detach and the new mount, which takes
+ *  as long as running fusermount. Lookups made then see the directory
+ *  under the mount point, so they fail, or create files in that directory
+ *  rather than in the real tree.
+ */
+class HandoffServer {
+ public:
+  /// Called on the server thread for the warm state to hand over
+  typedef std::function<std::string()> SnapshotFn;
+  /// Called on the server thread to detach the mount, returns 0 or -errno
+  typedef std::function<int()> DetachFn;
+
+  /// The taking over process is told @p log_path, so that it can refuse to
+  /// write to the log we are still writing
+  HandoffServer(const std::string& socket_path, const std::string& log_path,
+                SnapshotFn snapshot, DetachFn detach);
+
+  /// Stops the server
+  ~HandoffServer();
+
+  /// Listen on the socket and start the thread
+  void Start();
+
+  /// Stop the thread and remove the socket
+  void Stop();
+
+  /// Queue a report of @p path, and if @p below everything below it, as
+  /// changed for the process taking over, if one is. May be called from
+  /// any thread, and doesn't block on the other process.
+  void Changed(const std::string& path, bool below);
+
+ private:
+  HandoffServer(const HandoffServer&);
+  HandoffServer& operator=(const HandoffServer&);
+
+  void ServerMain();
+
+  /// Hand over to the process at the other end of @p client_fd, return
+  /// true once the mount has been detached
+  bool Serve(int client_fd);
+
+  /// Send the queued Changed() reports to the process at the other end of
+  /// @p client_fd until we are stopped or it goes away
+  void ReportMain(int client_fd);
+
+  /// Start or stop queueing Changed() reports, dropping any queued
+  void SetReporting(bool reporting);
+
+  std::string socket_path_;
+  std::string log_path_;
+  SnapshotFn snapshot_;
+  DetachFn detach_;
+  int listen_fd_;
+  int wake_pipe_[2];  ///< Stop() writes to it to wake the thread
+  std::thread thread_;
+
+  std::atomic<bool> reporting_;  ///< Changed() queues reports
+  std::mutex reports_mutex_;
+  std::condition_variable reports_cv_;
+  std::deque<std::pair<std::string, bool>> reports_;  ///< path and below
+  bool drop_all_;  ///< the queue overflowed, report everything changed
+  bool stopping_;  ///< Stop() was called, send what is queued and return
+};
+
+/// The side of HandoffServer in the process taking over
+class HandoffClient {
+ public:
+  /// Called with each path the process taken over reports as changed
+  typedef std::function<void(const std::string& path, bool below)>
+      ChangedFn;
+  /// Called when it reports that it lost track of what changed
+  typedef std::function<void()> DropFn;
+
+  HandoffClient();
+
+  /// Stops following the process taken over
+  ~HandoffClient();
+
+  /// Connect to the HandoffServer at @p socket_path and receive the log
+  /// path and warm state of the running process, return 0 or -errno
+  int Receive(const std::string& socket_path, std::string* log_path,
+              std::string* snapshot);
+
+  /// Ask the running process to detach its mount, return 0 once it has or
+  /// -errno
+  /**
+   *  Once it has detached, a thread passes the paths it reports as changed
+   *  since the snapshot to @p changed, or calls @p drop_all if it lost
+   *  track of them, until it exits or we are destroyed.
+   */
+  int Detach(ChangedFn changed, DropFn drop_all);
+
+ private:
+  HandoffClient(const HandoffClient&);
+  HandoffClient& operator=(const HandoffClient&);
+
+  /// Pass the reports of the detached process to changed_ and drop_all_
+  /// until it exits
+  void FollowMain();
+
+  int fd_;
+  ChangedFn changed_;
+  DropFn drop_all_;
+  std::thread thread_;
+};
+
+}  // namespace logfs_fuse
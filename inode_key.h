@@ -0,0 +1,34 @@
+#pragma once
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <cstddef>
+#include <functional>
+
+namespace logfs_fuse {
+
+/// Identifies a file in the real tree independent of the path used to reach it
+struct InodeKey {
+  dev_t dev;
+  ino_t ino;
+
+  InodeKey() : dev(0), ino(0) {}
+  InodeKey(dev_t dev, ino_t ino) : dev(dev), ino(ino) {}
+  explicit InodeKey(const struct stat& st) : dev(st.st_dev), ino(st.st_ino) {}
+
+  bool operator==(const InodeKey& other) const {
+    return dev == other.dev && ino == other.ino;
+  }
+  bool operator!=(const InodeKey& other) const {
+    return !(*this == other);
+  }
+};
+
+struct InodeKeyHash {
+  size_t operator()(const InodeKey& key) const {
+    return std::hash<ino_t>()(key.ino) * 31 + std::hash<dev_t>()(key.dev);
+  }
+};
+
+}  // namespace logfs_fuse
@@ -0,0 +1,158 @@
+#include "log_reader.h"
+
+#include <unistd.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+namespace logfs_fuse {
+
+LogReader::LogReader(const std::string& path)
+    : file_(NULL),
+      close_(false),
+      line_(NULL),
+      capacity_(0),
+      lines_(0),
+      malformed_(0) {
+  if (path == "-") {
+    file_ = stdin;
+  } else if (::access(path.c_str(), F_OK) == 0 &&
+             !SegmentReader::IsSegment(path)) {
+    file_ = fopen(path.c_str(), "re");
+    close_ = true;
+  } else {
+    segments_.reset(new SegmentReader(path));
+    if (!segments_->ok()) {
+      segments_.reset();
+    }
+  }
+}
+
+LogReader::~LogReader() {
+  if (file_ && close_) {
+    fclose(file_);
+  }
+  free(line_);
+}
+
+bool LogReader::Next(LogRecord* record) {
+  if (segments_) {
+    const char* line;
+    size_t size;
+    while (segments_->NextLine(&line, &size)) {
+      lines_++;
+      if (Parse(line, size, record)) {
+        return true;
+      }
+      malformed_++;
+    }
+    return false;
+  }
+  if (file_ == NULL) {
+    return false;
+  }
+
+  ssize_t size;
+  while ((size = getline(&line_, &capacity_, file_)) >= 0) {
+    lines_++;
+    if (size > 0 && line_[size - 1] == '\n') {
+      size--;
+    }
+    if (Parse(line_, size, record)) {
+      return true;
+    }
+    malformed_++;
+  }
+  return false;
+}
+
+bool LogReader::Parse(const char* line, size_t size, LogRecord* record) {
+  // AccessLog writes the op, a space and a colon, then the path
+  const char* end = line + size;
+  const char* separator = static_cast<const char*>(memchr(line, ' ', size));
+  if (separator == NULL || separator + 1 >= end || separator[1] != ':') {
+    return false;
+  }
+
+  std::string name(line, separator);
+  record->op = OpFromName(name.c_str());
+  if (record->op == kNumOps) {
+    return false;
+  }
+
+  const char* path = separator + 2;
+  const char* path_end =
+      static_cast<const char*>(memchr(path, '\t', end - path));
+  if (path_end == NULL) {
+    path_end = end;
+  }
+  record->path.assign(path, path_end);
+  record->target.clear();
+  record->command.clear();
+  record->pid = 0;
+
+  if (record->op == kOpLink || record->op == kOpRename) {
+    size_t arrow = record->path.find(" -> ");
+    if (arrow == std::string::npos) {
+      return false;
+    }
+    record->target = record->path.substr(arrow + 4);
+    record->path.resize(arrow);
+  }
+
+  // optional "\t<command>\t<pid>\t<session>"
+  if (path_end < end) {
+    const char* command = path_end + 1;
+    const char* command_end =
+        static_cast<const char*>(memchr(command, '\t', end - command));
+    if (command_end) {
+      record->command.assign(command, command_end);
+      record->pid = atoi(command_end + 1);
+    }
+  }
+  return !record->path.empty();
+}
+
+std::string NormalizePath(const std::string& path) {
+  std::vector<std::string> parts;
+  size_t begin = 0;
+  while (begin <= path.size()) {
+    size_t end = path.find('/', begin);
+    if (end == std::string::npos) {
+      end = path.size();
+    }
+    std::string part = path.substr(begin, end - begin);
+    if (part == "..") {
+      if (!parts.empty()) {
+        parts.pop_back();
+      }
+    } else if (!part.empty() && part != ".") {
+      parts.push_back(part);
+    }
+    begin = end + 1;
+  }
+
+  std::string normalized;
+  for (const std::string& part : parts) {
+    normalized += "/" + part;
+  }
+  return normalized.empty() ? "/" : normalized;
+}
+
+std::vector<std::string> SplitLogList(const std::string& list) {
+  std::vector<std::string> logs;
+  for (size_t begin = 0; begin <= list.size();) {
+    size_t end = list.find(',', begin);
+    if (end == std::string::npos) {
+      end = list.size();
+    }
+    if (end > begin) {
+      logs.push_back(list.substr(begin, end - begin));
+    }
+    begin = end + 1;
+  }
+  return logs;
+}
+
+}  // namespace logfs_fuse
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "op.h"
+#include "segment_log.h"
+
+namespace logfs_fuse {
+
+/// One line of an access log
+struct LogRecord {
+  Op op;
+  std::string path;    ///< the path accessed, or the source of link/rename
+  std::string target;  ///< the destination of link/rename, otherwise empty
+  std::string command;  ///< the accessing process, if the log has it
+  int pid;              ///< zero if the log has no process attribution
+};
+
+/// Streams the records of an access log written by AccessLog
+/**
+ *  Lines are "<op> :<path>", where link and rename paths are
+ *  "<from> -> <to>", optionally followed by tab separated command, pid and
+ *  session. Lines which don't parse are counted and skipped so that a log
+ *  cut off mid-line by a crash can still be read. Memory use is one line,
+ *  or one block of a segmented log, however long the log.
+ *
+ *  Segmented logs are read through SegmentReader, either one segment file
+ *  or, given the base path, every segment in order.
+ */
+class LogReader {
+ public:
+  /// Read the log at @p path, "-" for stdin. If @p path is a segment, or
+  /// there is no file at @p path, read it as a segmented log.
+  explicit LogReader(const std::string& path);
+  ~LogReader();
+
+  /// Return false if the log couldn't be opened
+  bool ok() const {
+    return file_ != NULL || segments_ != NULL;
+  }
+
+  /// Read the next record into @p record, return false at the end
+  bool Next(LogRecord* record);
+
+  uint64_t lines() const {
+    return lines_;
+  }
+
+  uint64_t malformed() const {
+    return malformed_;
+  }
+
+  /// Parse one @p line, without its newline, into @p record
+  static bool Parse(const char* line, size_t size, LogRecord* record);
+
+ private:
+  LogReader(const LogReader&);
+  LogReader& operator=(const LogReader&);
+
+  FILE* file_;
+  bool close_;  ///< file_ is ours to close
+  std::unique_ptr<SegmentReader> segments_;  ///< instead of file_
+  char* line_;
+  size_t capacity_;
+  uint64_t lines_;
+  uint64_t malformed_;
+};
+
+/// Return @p path made absolute, with ".", ".." and repeated or trailing
+/// slashes removed. ".." at the root stays at the root.
+std::string NormalizePath(const std::string& path);
+
+/// Return the paths of the comma separated list of logs @p list, as taken
+/// by the --log flag of the tools, skipping empty items
+std::vector<std::string> SplitLogList(const std::string& list);
+
+}  // namespace logfs_fuse
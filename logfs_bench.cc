@@ -0,0 +1,551 @@
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>  // NOLINT(build/c++11)
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <memory>
+#include <new>
+#include <sstream>
+#include <string>
+#include <thread>  // NOLINT(build/c++11)
+#include <vector>
+
+#include <boost/filesystem.hpp>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include "access_log.h"
+#include "access_summary.h"
+#include "event_ring.h"
+#include "fuse_context.h"
+#include "request_arena.h"
+#include "segment_log.h"
+#include "sharded.h"
+#include "worker_affinity.h"
+#include "xorshift.h"
+
+DEFINE_string(tree, "",
+              "empty directory to generate the test tree in, a temporary "
+              "directory which is removed afterwards by default");
+DEFINE_int32(dirs, 16, "number of directories in the test tree");
+DEFINE_int32(files_per_dir, 256, "number of files in each directory");
+DEFINE_int32(file_size, 4096, "bytes in each file");
+DEFINE_string(threads, "1,4",
+              "comma separated numbers of threads to run each benchmark with");
+DEFINE_string(worker_cpus, "",
+              "CPUs to pin benchmark threads to, one each, in the syntax of "
+              "logfs_fuse --worker_cpus");
+DEFINE_double(min_time, 0.5, "seconds each benchmark runs for at least");
+DEFINE_string(filter, "", "only run benchmarks whose name contains this");
+DEFINE_string(format, "text", "format of the results, text or json");
+DEFINE_string(output, "", "file to write the results to, stdout by default");
+DEFINE_string(baseline, "",
+              "json results of an earlier run, exit with status 1 if a "
+              "benchmark got slower by more than --max_regression");
+DEFINE_double(max_regression, 0.10,
+              "fraction by which a benchmark may be slower than --baseline");
+DEFINE_double(max_allocs_per_op, -1,
+              "exit with status 1 if a benchmark makes more heap allocations "
+              "per op than this, negative to not check");
+
+namespace fs = boost::filesystem;
+using logfs_fuse::AccessLog;
+using logfs_fuse::FuseContext;
+using logfs_fuse::NextRandom;
+
+const std::string kUsageMessage =
+    "Benchmarks FuseContext operations and AccessLog modes by calling them "
+    "directly against a generated tree, without mounting anything.";
+
+namespace {
+
+/// Runs its share of the iterations of a benchmark on thread @p thread
+typedef std::function<void(int thread, uint64_t iterations)> Body;
+
+struct Result {
+  std::string name;
+  int threads;
+  uint64_t iterations;  ///< per thread
+  double ns_per_op;     ///< wall time per iteration of one thread
+  double ops_per_sec;   ///< iterations of all threads per second
+  double allocs_per_op;  ///< operator new calls per iteration
+};
+
+// keeps the compiler from dropping the work being measured
+std::atomic<uint64_t> g_sink(0);
+
+// parsed --worker_cpus
+std::vector<int> g_worker_cpus;
+
+}  // namespace
+
+// operator new calls made by the calling thread
+static thread_local uint64_t tls_allocations = 0;
+
+// count every allocation, so that benchmarks can report how many each op
+// makes once it is warm
+void* operator new(size_t size) {
+  tls_allocations++;
+  void* pointer = malloc(size ? size : 1);
+  if (pointer == NULL) {
+    throw std::bad_alloc();
+  }
+  return pointer;
+}
+
+void operator delete(void* pointer) noexcept {
+  free(pointer);
+}
+
+namespace {
+
+int CountEntry(void* buf, const char*, const struct stat*, off_t) {
+  ++*static_cast<size_t*>(buf);
+  return 0;
+}
+
+/// Run @p body for @p iterations on each of @p threads threads started
+/// together, return the wall time in seconds and add the allocations they
+/// made to @p allocations
+double TimeThreads(const Body& body, int threads, uint64_t iterations,
+                   uint64_t* allocations) {
+  std::atomic<uint64_t> allocated(0);
+  std::atomic<int> ready(0);
+  std::atomic<bool> go(false);
+  std::vector<std::thread> workers;
+  for (int i = 0; i < threads; i++) {
+    workers.emplace_back([&body, &allocated, &ready, &go, i, iterations] {
+      // the way logfs_fuse places its workers
+      if (!g_worker_cpus.empty()) {
+        logfs_fuse::PinThread(g_worker_cpus[i % g_worker_cpus.size()]);
+      }
+      logfs_fuse::SetThreadShard(i);
+      // one untimed op fills the thread's scratch strings and pools, as a
+      // long-lived worker of logfs_fuse would have long since done
+      body(i, 1);
+      ready++;
+      while (!go.load()) {
+        std::this_thread::yield();
+      }
+      uint64_t before = tls_allocations;
+      body(i, iterations);
+      allocated += tls_allocations - before;
+    });
+  }
+  while (ready.load() < threads) {
+    std::this_thread::yield();
+  }
+  auto start = std::chrono::steady_clock::now();
+  go = true;
+  for (std::thread& worker : workers) {
+    worker.join();
+  }
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  *allocations = allocated.load();
+  return elapsed.count();
+}
+
+/// Grow the iteration count until one run takes --min_time
+Result RunBenchmark(const std::string& name, int threads, const Body& body) {
+  uint64_t iterations = 1;
+  uint64_t allocations = 0;
+  double seconds = 0;
+  while (true) {
+    // the short runs warm up caches and pools, only the last one counts
+    seconds = TimeThreads(body, threads, iterations, &allocations);
+    if (seconds >= FLAGS_min_time || iterations >= (uint64_t(1) << 32)) {
+      break;
+    }
+    double wanted = seconds > 0
+                        ? iterations * FLAGS_min_time * 1.4 / seconds
+                        : iterations * 10.0;
+    iterations = std::max<uint64_t>(
+        iterations + 1, std::min<double>(wanted, iterations * 10.0));
+  }
+
+  Result result;
+  result.name = name;
+  result.threads = threads;
+  result.iterations = iterations;
+  result.ns_per_op = seconds * 1e9 / iterations;
+  result.ops_per_sec = iterations * threads / seconds;
+  result.allocs_per_op = static_cast<double>(allocations) /
+                         (iterations * threads);
+  return result;
+}
+
+/// Generate --dirs directories of --files_per_dir files under @p root,
+/// appending the mirror paths of both to @p dirs and @p files
+void MakeTree(const fs::path& root, std::vector<std::string>* dirs,
+              std::vector<std::string>* files) {
+  std::string contents(FLAGS_file_size, 'x');
+  for (int d = 0; d < FLAGS_dirs; d++) {
+    char dir[32];
+    snprintf(dir, sizeof(dir), "/d%03d", d);
+    fs::create_directories(root.string() + dir);
+    dirs->push_back(dir);
+    for (int f = 0; f < FLAGS_files_per_dir; f++) {
+      char file[64];
+      snprintf(file, sizeof(file), "%s/f%05d.h", dir, f);
+      std::string real = root.string() + file;
+      int fd = ::open(real.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+      PLOG_IF(FATAL, fd < 0) << "Failed to create '" << real << "'";
+      PLOG_IF(FATAL, ::write(fd, contents.data(), contents.size()) !=
+                         static_cast<ssize_t>(contents.size()))
+          << "Failed to write '" << real << "'";
+      ::close(fd);
+      files->push_back(file);
+    }
+  }
+}
+
+std::vector<int> ParseThreads(const std::string& list) {
+  std::vector<int> threads;
+  std::istringstream in(list);
+  std::string item;
+  while (std::getline(in, item, ',')) {
+    int count = atoi(item.c_str());
+    LOG_IF(FATAL, count <= 0) << "Bad thread count '" << item << "'";
+    threads.push_back(count);
+  }
+  LOG_IF(FATAL, threads.empty()) << "--threads is empty";
+  return threads;
+}
+
+std::string FormatResults(const std::vector<Result>& results) {
+  std::ostringstream out;
+  if (FLAGS_format == "json") {
+    char date[64];
+    time_t now = time(NULL);
+    struct tm local;
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S%z",
+             localtime_r(&now, &local));
+    out << "{\"context\": {\"date\": \"" << date
+        << "\", \"num_cpus\": " << std::thread::hardware_concurrency()
+        << ", \"dirs\": " << FLAGS_dirs
+        << ", \"files_per_dir\": " << FLAGS_files_per_dir
+        << ", \"file_size\": " << FLAGS_file_size << "},\n"
+        << " \"benchmarks\": [\n";
+    // one benchmark per line, which is what --baseline reads back
+    for (size_t i = 0; i < results.size(); i++) {
+      const Result& result = results[i];
+      out << "  {\"name\": \"" << result.name
+          << "\", \"threads\": " << result.threads
+          << ", \"iterations\": " << result.iterations
+          << ", \"ns_per_op\": " << result.ns_per_op
+          << ", \"ops_per_sec\": " << result.ops_per_sec
+          << ", \"allocs_per_op\": " << result.allocs_per_op << "}"
+          << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    out << " ]}\n";
+  } else {
+    char line[128];
+    snprintf(line, sizeof(line), "%-28s %7s %12s %12s %14s %10s\n",
+             "benchmark", "threads", "iterations", "ns/op", "ops/s",
+             "allocs/op");
+    out << line;
+    for (const Result& result : results) {
+      snprintf(line, sizeof(line), "%-28s %7d %12lu %12.1f %14.0f %10.3f\n",
+               result.name.c_str(), result.threads, result.iterations,
+               result.ns_per_op, result.ops_per_sec, result.allocs_per_op);
+      out << line;
+    }
+  }
+  return out.str();
+}
+
+/// Read "name/threads" to ns_per_op from json results written by
+/// FormatResults()
+std::map<std::string, double> ReadBaseline(const std::string& path) {
+  std::map<std::string, double> baseline;
+  std::ifstream in(path.c_str());
+  PLOG_IF(FATAL, !in) << "Failed to open baseline '" << path << "'";
+  std::string line;
+  while (std::getline(in, line)) {
+    char name[128];
+    int threads;
+    unsigned long iterations;  // NOLINT(runtime/int)
+    double ns_per_op;
+    if (sscanf(line.c_str(),
+               " {\"name\": \"%127[^\"]\", \"threads\": %d, \"iterations\": "
+               "%lu, \"ns_per_op\": %lf",
+               name, &threads, &iterations, &ns_per_op) == 4) {
+      baseline[std::string(name) + "/" + std::to_string(threads)] = ns_per_op;
+    }
+  }
+  return baseline;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  google::InitGoogleLogging(argv[0]);
+  google::SetUsageMessage(kUsageMessage);
+  google::ParseCommandLineFlags(&argc, &argv, true);
+
+  LOG_IF(FATAL, FLAGS_dirs <= 0 || FLAGS_files_per_dir <= 0)
+      << "--dirs and --files_per_dir must be > 0";
+  LOG_IF(FATAL, FLAGS_file_size < 0) << "--file_size must be >= 0";
+  LOG_IF(FATAL, FLAGS_format != "text" && FLAGS_format != "json")
+      << "--format must be text or json";
+  std::vector<int> thread_counts = ParseThreads(FLAGS_threads);
+  std::string cpus_error;
+  LOG_IF(FATAL, !logfs_fuse::ParseCpuList(FLAGS_worker_cpus, &g_worker_cpus,
+                                          &cpus_error))
+      << "--worker_cpus: " << cpus_error;
+
+  fs::path root;
+  bool temporary = FLAGS_tree.empty();
+  if (temporary) {
+    char pattern[] = "/tmp/logfs_bench.XXXXXX";
+    PLOG_IF(FATAL, !mkdtemp(pattern)) << "Failed to create a temporary tree";
+    root = pattern;
+  } else {
+    root = FLAGS_tree;
+    fs::create_directories(root);
+  }
+  fs::path real_tree = root / "tree";
+  std::vector<std::string> dirs, files;
+  MakeTree(real_tree, &dirs, &files);
+
+  std::vector<Result> results;
+  auto run = [&results, &thread_counts](const std::string& name,
+                                        const Body& body) {
+    if (name.find(FLAGS_filter) == std::string::npos) {
+      return;
+    }
+    for (int threads : thread_counts) {
+      results.push_back(RunBenchmark(name, threads, body));
+      LOG(INFO) << name << "/" << threads << ": "
+                << results.back().ns_per_op << " ns/op";
+    }
+  };
+
+  // the fuse context ops, logging nowhere so that only the op is measured
+  {
+    AccessLog quiet("", NULL, NULL, NULL, NULL);
+    logfs_fuse::Options options;
+    options.control_dir = "";
+    FuseContext context(real_tree.string(), &quiet, options);
+    FuseContext* mirror = &context;
+    const std::vector<std::string>* paths = &files;
+
+    run("getattr_hit", [mirror, paths](int thread, uint64_t iterations) {
+      uint64_t state = thread + 1, sum = 0;
+      struct stat st;
+      for (uint64_t i = 0; i < iterations; i++) {
+        const std::string& path = (*paths)[NextRandom(&state) % paths->size()];
+        sum += mirror->getattr(path.c_str(), &st) == 0 ? st.st_size : 0;
+      }
+      g_sink += sum;
+    });
+
+    run("getattr_miss", [mirror, paths](int thread, uint64_t iterations) {
+      uint64_t state = thread + 1, sum = 0;
+      struct stat st;
+      // scratch, like the mirror's own, so that the count is of getattr
+      logfs_fuse::ScratchString path;
+      for (uint64_t i = 0; i < iterations; i++) {
+        path->assign((*paths)[NextRandom(&state) % paths->size()]);
+        path->append(".missing");
+        sum += mirror->getattr(path->c_str(), &st);
+      }
+      g_sink += sum;
+    });
+
+    run("access", [mirror, paths](int thread, uint64_t iterations) {
+      uint64_t state = thread + 1, sum = 0;
+      for (uint64_t i = 0; i < iterations; i++) {
+        const std::string& path = (*paths)[NextRandom(&state) % paths->size()];
+        sum += mirror->access(path.c_str(), R_OK);
+      }
+      g_sink += sum;
+    });
+
+    run("open_read_release", [mirror, paths](int thread, uint64_t iterations) {
+      uint64_t state = thread + 1, sum = 0;
+      logfs_fuse::ScratchString buf;
+      buf->resize(std::max(FLAGS_file_size, 1));
+      for (uint64_t i = 0; i < iterations; i++) {
+        const std::string& path = (*paths)[NextRandom(&state) % paths->size()];
+        struct fuse_file_info fi;
+        memset(&fi, 0, sizeof(fi));
+        fi.flags = O_RDONLY;
+        if (mirror->open(path.c_str(), &fi) == 0) {
+          sum += mirror->read(path.c_str(), &(*buf)[0], buf->size(), 0, &fi);
+          mirror->release(path.c_str(), &fi);
+        }
+      }
+      g_sink += sum;
+    });
+
+    // the same attribute is looked up again and again, so after the first
+    // round these are all answered by the cache, which counts each one
+    run("getxattr_cached", [mirror, paths](int thread, uint64_t iterations) {
+      uint64_t state = thread + 1, sum = 0;
+      char value[64];
+      for (uint64_t i = 0; i < iterations; i++) {
+        const std::string& path = (*paths)[NextRandom(&state) % paths->size()];
+        sum += mirror->getxattr(path.c_str(), "user.logfs_bench", value,
+                                sizeof(value));
+      }
+      g_sink += sum;
+    });
+
+    const std::vector<std::string>* dir_paths = &dirs;
+    run("readdir", [mirror, dir_paths](int thread, uint64_t iterations) {
+      uint64_t state = thread + 1, sum = 0;
+      for (uint64_t i = 0; i < iterations; i++) {
+        const std::string& path =
+            (*dir_paths)[NextRandom(&state) % dir_paths->size()];
+        struct fuse_file_info fi;
+        memset(&fi, 0, sizeof(fi));
+        if (mirror->opendir(path.c_str(), &fi) == 0) {
+          size_t entries = 0;
+          mirror->readdir(path.c_str(), &entries, CountEntry, 0, &fi);
+          mirror->releasedir(path.c_str(), &fi);
+          sum += entries;
+        }
+      }
+      g_sink += sum;
+    });
+  }
+
+  // a counter bumped on every op, shared against sharded per worker
+  {
+    std::atomic<uint64_t> shared(0);
+    std::atomic<uint64_t>* counter = &shared;
+    run("counter_shared", [counter](int thread, uint64_t iterations) {
+      for (uint64_t i = 0; i < iterations; i++) {
+        counter->fetch_add(1, std::memory_order_relaxed);
+      }
+    });
+    g_sink += counter->load();
+
+    logfs_fuse::ShardedCounter sharded;
+    logfs_fuse::ShardedCounter* shards = &sharded;
+    run("counter_sharded", [shards](int thread, uint64_t iterations) {
+      for (uint64_t i = 0; i < iterations; i++) {
+        shards->Add(1);
+      }
+    });
+    g_sink += shards->value();
+  }
+
+  // AddEntry under each logging mode
+  std::string log_path = (root / "bench.log").string();
+  std::string summary_path = (root / "bench.summary.csv").string();
+  const char* kModes[] = {"none", "events", "segments", "summary", "both"};
+  for (const char* mode : kModes) {
+    std::string name = std::string("log_") + mode;
+    bool events = strcmp(mode, "events") == 0 || strcmp(mode, "both") == 0;
+    bool segments = strcmp(mode, "segments") == 0;
+    bool summary = strcmp(mode, "summary") == 0 || strcmp(mode, "both") == 0;
+
+    std::unique_ptr<logfs_fuse::SegmentWriter> writer;
+    if (segments) {
+      writer.reset(new logfs_fuse::SegmentWriter(log_path, 64 << 20, 0, 2,
+                                                 true, 1.0));
+      int result = writer->Start();
+      LOG_IF(FATAL, result < 0) << "Failed to start segments, [" << -result
+                                << "] : " << strerror(-result);
+    }
+    std::unique_ptr<logfs_fuse::AccessSummary> totals;
+    if (summary) {
+      totals.reset(new logfs_fuse::AccessSummary(
+          1 << 20, summary_path, 0, logfs_fuse::AccessSummary::kGroupNone));
+    }
+    AccessLog log(events ? log_path : "", writer.get(), NULL, totals.get(),
+                  NULL);
+    AccessLog* access_log = &log;
+    const std::vector<std::string>* paths = &files;
+    // the summary of a long-running mount has long since seen every path,
+    // and a slow log disk leaves too few iterations to amortize the inserts
+    for (const std::string& path : files) {
+      access_log->AddEntry(logfs_fuse::kOpOpen, path);
+    }
+    run(name, [access_log, paths](int thread, uint64_t iterations) {
+      uint64_t state = thread + 1;
+      for (uint64_t i = 0; i < iterations; i++) {
+        access_log->AddEntry(logfs_fuse::kOpOpen,
+                             (*paths)[NextRandom(&state) % paths->size()]);
+      }
+    });
+    if (writer) {
+      writer->Stop();
+    }
+  }
+
+  // publishing to the event ring, which AddEntry does when it has one
+  {
+    logfs_fuse::EventRing ring;
+    std::string ring_name = "/logfs_bench." + std::to_string(getpid());
+    int result = ring.Create(ring_name, 1 << 16);
+    LOG_IF(FATAL, result < 0) << "Failed to create event ring, [" << -result
+                              << "] : " << strerror(-result);
+    logfs_fuse::EventRing* events = &ring;
+    const std::vector<std::string>* paths = &files;
+    run("log_event_ring", [events, paths](int thread, uint64_t iterations) {
+      uint64_t state = thread + 1;
+      for (uint64_t i = 0; i < iterations; i++) {
+        const std::string& path = (*paths)[NextRandom(&state) % paths->size()];
+        events->Publish(logfs_fuse::kOpOpen, path.data(), path.size(), 0);
+      }
+    });
+  }
+
+  if (temporary) {
+    boost::system::error_code error;
+    fs::remove_all(root, error);
+  }
+
+  std::string report = FormatResults(results);
+  if (FLAGS_output.empty()) {
+    fputs(report.c_str(), stdout);
+  } else {
+    std::ofstream out(FLAGS_output.c_str());
+    out << report;
+    PLOG_IF(FATAL, !out) << "Failed to write '" << FLAGS_output << "'";
+  }
+
+  int failures = 0;
+  if (FLAGS_max_allocs_per_op >= 0) {
+    for (const Result& result : results) {
+      if (result.allocs_per_op > FLAGS_max_allocs_per_op) {
+        fprintf(stderr, "%s/%d made %.3f allocations per op\n",
+                result.name.c_str(), result.threads, result.allocs_per_op);
+        failures++;
+      }
+    }
+  }
+
+  if (FLAGS_baseline.empty()) {
+    return failures > 0 ? 1 : 0;
+  }
+  std::map<std::string, double> baseline = ReadBaseline(FLAGS_baseline);
+  for (const Result& result : results) {
+    auto found =
+        baseline.find(result.name + "/" + std::to_string(result.threads));
+    if (found == baseline.end()) {
+      continue;
+    }
+    double change = result.ns_per_op / found->second - 1;
+    if (change > FLAGS_max_regression) {
+      fprintf(stderr, "%s/%d regressed by %.1f%%: %.1f ns/op, was %.1f\n",
+              result.name.c_str(), result.threads, change * 100,
+              result.ns_per_op, found->second);
+      failures++;
+    }
+  }
+  return failures > 0 ? 1 : 0;
+}
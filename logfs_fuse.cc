@@ -1,12 +1,157 @@
+#include <set>
+#include <string>
+#include <vector>
+
 #include <boost/filesystem.hpp>
 #include <gflags/gflags.h>
 #include <glog/logging.h>
 
 #include "mount_point.h"
+#include "mount_set.h"
+#include "worker_affinity.h"
 
 DEFINE_string(real_tree, "", "path to the directory tree to mirror");
 DEFINE_string(mount_point, "", "path to the mount point of the mirror tree");
 DEFINE_string(log_path, "/tmp/logfs_fuse.txt", "path of log-file to write to");
+DEFINE_string(mounts, "",
+              "config file of several mirrors to serve from this process, "
+              "one \"<mount point> <real tree> <log path>\" per line, "
+              "instead of --mount_point, --real_tree and --log_path");
+DEFINE_int32(fd_cache_size, 64,
+             "number of real-tree descriptors to keep open for read/write "
+             "calls without a file handle, 0 to disable");
+DEFINE_bool(share_readonly_fds, true,
+            "let read-only opens of the same file share one real-tree "
+            "descriptor");
+DEFINE_int32(completion_threads, 2,
+             "background threads for closing released files, 0 to close "
+             "synchronously");
+DEFINE_int32(completion_queue_depth, 256,
+             "maximum queued background closes before release() closes "
+             "synchronously");
+DEFINE_bool(fadvise_dontneed_on_close, false,
+            "drop cached pages of real files when they are released");
+DEFINE_bool(deferred_sync, false,
+            "fdatasync written files in the background when they are "
+            "released");
+DEFINE_int32(write_buffer_size, 0,
+             "bytes of small sequential writes to merge per open file before "
+             "writing them to the real tree, 0 to disable");
+DEFINE_int32(write_buffer_memory_limit, 64 << 20,
+             "total bytes all write buffers may use");
+DEFINE_int32(xattr_cache_size, 4096,
+             "number of files whose extended attributes are cached, 0 to "
+             "disable");
+DEFINE_double(xattr_cache_ttl, 10.0,
+              "seconds before cached extended attributes are looked up "
+              "again");
+DEFINE_bool(watch_real_tree, false,
+            "watch the real tree with inotify and invalidate caches when it "
+            "is changed outside of the mount");
+DEFINE_double(watch_batch_seconds, 0.05,
+              "seconds over which changes to the real tree are coalesced");
+DEFINE_bool(stats, true, "count and time every fuse operation");
+DEFINE_string(stats_path, "",
+              "file to write stats to on SIGUSR1, empty to log them instead");
+DEFINE_string(stats_socket, "",
+              "unix socket on which to serve stats, empty to disable");
+DEFINE_string(stats_format, "text", "format of stats reports, text or json");
+DEFINE_string(control_dir, ".logfs",
+              "name of the virtual control directory in the root of the "
+              "mirror, empty to disable");
+DEFINE_bool(list_control_dir, false,
+            "list the control directory in the root of the mirror");
+DEFINE_string(log_mode, "events",
+              "what the access log records: \"events\" writes a line per "
+              "access to log_path, \"summary\" keeps per-path totals and "
+              "writes them to summary_path, \"both\" does both");
+DEFINE_int64(log_segment_bytes, 0,
+             "write the event log as segments of about this many bytes, "
+             "named log_path.<sequence>.seg, 0 for one plain file");
+DEFINE_double(log_segment_seconds, 0,
+              "start a new log segment after this many seconds, 0 for no "
+              "limit");
+DEFINE_int32(log_segments_kept, 0,
+             "number of finished log segments to keep, older ones are "
+             "deleted, 0 to keep all");
+DEFINE_bool(log_compress, true, "deflate the blocks of log segments");
+DEFINE_double(log_flush_interval, 1.0,
+              "seconds between writes of buffered lines to the current log "
+              "segment, which bounds what a crash loses");
+DEFINE_string(event_ring, "",
+              "name of a POSIX shared-memory ring, like /logfs_events, to "
+              "publish accesses to for live readers such as logfs_tail, "
+              "empty to disable");
+DEFINE_int32(event_ring_size, 1 << 16,
+             "number of events the ring holds, a power of two");
+DEFINE_string(summary_path, "",
+              "CSV file of per-path access totals, defaults to log_path "
+              "with .summary.csv appended");
+DEFINE_double(summary_interval, 0,
+              "seconds between writes of the access summary, 0 to only "
+              "write it on unmount and SIGUSR1");
+DEFINE_int32(summary_max_paths, 1 << 20,
+             "most paths the access summary holds");
+DEFINE_string(summary_group_by, "",
+              "split the access summary of each path by the \"command\" or "
+              "\"session\" of the accessing process, implies "
+              "--attribute_processes");
+DEFINE_bool(attribute_processes, false,
+            "end each access log line with the command, pid and session of "
+            "the accessing process");
+DEFINE_int32(process_table_size, 4096,
+             "number of processes whose command and session are remembered");
+DEFINE_int32(process_revalidate_ms, 1000,
+             "milliseconds before a remembered process is looked up again, "
+             "in case its pid was reused");
+DEFINE_bool(multithreaded, false,
+            "serve requests from several fuse worker threads");
+DEFINE_string(worker_cpus, "",
+              "CPUs to pin the threads serving requests to, one each, as "
+              "comma separated numbers, ranges like 8-15 or NUMA nodes like "
+              "node1; empty leaves them unpinned");
+DEFINE_string(handoff_socket, "",
+              "unix socket on which a newly started logfs_fuse can take the "
+              "mount over, empty to disable");
+DEFINE_string(takeover, "",
+              "handoff socket of the running logfs_fuse to take the mount "
+              "over from, with its warm caches");
+DEFINE_bool(hash_contents, false,
+            "hash files opened for reading in the background and write a "
+            "manifest of their hashes on unmount");
+DEFINE_int32(hash_threads, 2, "number of threads hashing file contents");
+DEFINE_int32(hash_queue_depth, 65536,
+             "most files waiting to be hashed, further files are hashed on "
+             "a later open");
+DEFINE_string(hash_manifest_path, "",
+              "file the content hashes are written to, defaults to log_path "
+              "with .hashes appended");
+DEFINE_bool(trace, false,
+            "trace ops from the start, the trace is written on unmount");
+DEFINE_bool(trace_control, false,
+            "let traces be started and stopped through the control "
+            "directory, which costs every op a check of the tracer");
+DEFINE_string(trace_path, "/tmp/logfs_trace.json",
+              "file that Chrome trace-event JSON traces are written to");
+DEFINE_int32(trace_max_events, 1000000,
+             "most ops recorded in one trace, later ops are dropped");
+DEFINE_string(prefetch_log, "",
+              "access log of a previous run, whose paths are prefetched in "
+              "the order they were first accessed when mounting");
+DEFINE_int32(prefetch_threads, 8, "number of threads prefetching");
+DEFINE_bool(prefetch_contents, true,
+            "read ahead the contents of files the previous run opened, not "
+            "just their metadata");
+DEFINE_int64(prefetch_max_bytes, 0,
+             "most bytes of file contents to read ahead, 0 for no limit");
+DEFINE_bool(prefetch_wait, false,
+            "finish prefetching before serving requests");
+DEFINE_string(pack_path, "",
+              "pack file written by logfs_pack, reads of the files in it "
+              "are served from it while they are unchanged");
+DEFINE_int32(pack_readahead, 16 << 20,
+             "bytes of the pack to read ahead of the furthest read, 0 to "
+             "leave readahead to the kernel");
 
 namespace fs = boost::filesystem;
 
@@ -20,19 +165,173 @@ int main(int argc, char** argv) {
   google::SetUsageMessage(kUsageMessage);
   google::ParseCommandLineFlags(&argc, &argv, true);
 
-  fs::path real_tree_path(FLAGS_real_tree);
-  fs::path mount_point_path(FLAGS_mount_point);
-  fs::path log_path(FLAGS_log_path);
+  // every mount is checked the same way, whether from flags or the config
+  std::vector<logfs_fuse::MountConfig> mounts;
+  if (FLAGS_mounts.empty()) {
+    logfs_fuse::MountConfig mount;
+    mount.mount_point = FLAGS_mount_point;
+    mount.real_tree = FLAGS_real_tree;
+    mount.log_path = FLAGS_log_path;
+    mounts.push_back(mount);
+  } else {
+    std::string config_error;
+    LOG_IF(FATAL, !logfs_fuse::ReadMountsConfig(FLAGS_mounts, &mounts,
+                                                &config_error))
+        << "--mounts: " << config_error;
+    LOG_IF(FATAL, mounts.empty())
+        << "--mounts: '" << FLAGS_mounts << "' has no mounts";
+  }
+  std::set<std::string> mount_points, log_paths;
+  for (const logfs_fuse::MountConfig& mount : mounts) {
+    fs::path real_tree_path(mount.real_tree);
+    fs::path mount_point_path(mount.mount_point);
+    fs::path log_path(mount.log_path);
+
+    LOG_IF(FATAL, !fs::exists(real_tree_path))
+        << "Real tree to mirror '" << mount.real_tree << "' doesn't exist";
+    LOG_IF(FATAL, !fs::exists(mount_point_path))
+        << "Mount point '" << mount.mount_point << "' doesn't exist";
+    LOG_IF(FATAL, !fs::exists(log_path.parent_path()))
+        << "Parent directory of desired logfile '" << mount.log_path
+        << "' doesn't exist";
+    LOG_IF(FATAL, !mount_points.insert(mount.mount_point).second)
+        << "Mount point '" << mount.mount_point << "' is mounted twice";
+    LOG_IF(FATAL, !log_paths.insert(mount.log_path).second)
+        << "Log path '" << mount.log_path << "' is used by two mounts";
+  }
+  if (!FLAGS_mounts.empty()) {
+    // these name one file, socket or ring, which the mounts can't all use
+    LOG_IF(FATAL, !FLAGS_summary_path.empty())
+        << "--summary_path can't be used with --mounts";
+    LOG_IF(FATAL, !FLAGS_hash_manifest_path.empty())
+        << "--hash_manifest_path can't be used with --mounts";
+    LOG_IF(FATAL, !FLAGS_event_ring.empty())
+        << "--event_ring can't be used with --mounts";
+    LOG_IF(FATAL, !FLAGS_handoff_socket.empty() || !FLAGS_takeover.empty())
+        << "--handoff_socket and --takeover can't be used with --mounts";
+  }
+
+  LOG_IF(FATAL, FLAGS_fd_cache_size < 0) << "--fd_cache_size must be >= 0";
+  LOG_IF(FATAL, FLAGS_completion_threads < 0)
+      << "--completion_threads must be >= 0";
+  LOG_IF(FATAL, FLAGS_completion_queue_depth < 0)
+      << "--completion_queue_depth must be >= 0";
+  LOG_IF(FATAL, FLAGS_write_buffer_size < 0)
+      << "--write_buffer_size must be >= 0";
+  LOG_IF(FATAL, FLAGS_write_buffer_memory_limit < 0)
+      << "--write_buffer_memory_limit must be >= 0";
+  LOG_IF(FATAL, FLAGS_xattr_cache_size < 0)
+      << "--xattr_cache_size must be >= 0";
+  LOG_IF(FATAL, FLAGS_watch_batch_seconds < 0)
+      << "--watch_batch_seconds must be >= 0";
+  LOG_IF(FATAL, !FLAGS_summary_group_by.empty() &&
+                    FLAGS_summary_group_by != "command" &&
+                    FLAGS_summary_group_by != "session")
+      << "--summary_group_by must be empty, command or session";
+  LOG_IF(FATAL, FLAGS_process_table_size <= 0)
+      << "--process_table_size must be > 0";
+  LOG_IF(FATAL, FLAGS_hash_contents && FLAGS_hash_threads <= 0)
+      << "--hash_threads must be > 0 with --hash_contents";
+  LOG_IF(FATAL, FLAGS_hash_queue_depth < 0)
+      << "--hash_queue_depth must be >= 0";
+  LOG_IF(FATAL, FLAGS_log_segment_bytes < 0)
+      << "--log_segment_bytes must be >= 0";
+  LOG_IF(FATAL, FLAGS_log_segment_seconds < 0)
+      << "--log_segment_seconds must be >= 0";
+  LOG_IF(FATAL, FLAGS_log_segments_kept < 0)
+      << "--log_segments_kept must be >= 0";
+  LOG_IF(FATAL, FLAGS_log_flush_interval <= 0)
+      << "--log_flush_interval must be > 0";
+  LOG_IF(FATAL, FLAGS_event_ring_size <= 0 ||
+                    (FLAGS_event_ring_size & (FLAGS_event_ring_size - 1)))
+      << "--event_ring_size must be a power of two";
+  LOG_IF(FATAL, !FLAGS_event_ring.empty() && FLAGS_event_ring[0] != '/')
+      << "--event_ring must start with /";
+  bool segmented = FLAGS_log_segment_bytes > 0 || FLAGS_log_segment_seconds > 0;
+  boost::system::error_code error;
+  for (const logfs_fuse::MountConfig& mount : mounts) {
+    LOG_IF(FATAL, !segmented && !FLAGS_prefetch_log.empty() &&
+                      fs::equivalent(FLAGS_prefetch_log, mount.log_path, error))
+        << "--prefetch_log can't be the log path '" << mount.log_path
+        << "', which is truncated on mount";
+  }
+  LOG_IF(FATAL, FLAGS_prefetch_threads <= 0)
+      << "--prefetch_threads must be > 0";
+  LOG_IF(FATAL, FLAGS_prefetch_max_bytes < 0)
+      << "--prefetch_max_bytes must be >= 0";
+  LOG_IF(FATAL, FLAGS_pack_readahead < 0) << "--pack_readahead must be >= 0";
+  std::vector<int> worker_cpus;
+  std::string cpus_error;
+  LOG_IF(FATAL, !logfs_fuse::ParseCpuList(FLAGS_worker_cpus, &worker_cpus,
+                                          &cpus_error))
+      << "--worker_cpus: " << cpus_error;
+
+  logfs_fuse::Options options;
+  options.fd_cache_size = FLAGS_fd_cache_size;
+  options.share_readonly_fds = FLAGS_share_readonly_fds;
+  options.completion_threads = FLAGS_completion_threads;
+  options.completion_queue_depth = FLAGS_completion_queue_depth;
+  options.fadvise_dontneed_on_close = FLAGS_fadvise_dontneed_on_close;
+  options.deferred_sync = FLAGS_deferred_sync;
+  options.write_buffer_size = FLAGS_write_buffer_size;
+  options.write_buffer_memory_limit = FLAGS_write_buffer_memory_limit;
+  options.xattr_cache_size = FLAGS_xattr_cache_size;
+  options.xattr_cache_ttl = FLAGS_xattr_cache_ttl;
+  options.watch_real_tree = FLAGS_watch_real_tree;
+  options.watch_batch_seconds = FLAGS_watch_batch_seconds;
+  options.stats = FLAGS_stats;
+  options.stats_path = FLAGS_stats_path;
+  options.stats_socket = FLAGS_stats_socket;
+  options.stats_json = FLAGS_stats_format == "json";
+  options.control_dir = FLAGS_control_dir;
+  options.list_control_dir = FLAGS_list_control_dir;
+  options.log_events = FLAGS_log_mode != "summary";
+  options.log_summary = FLAGS_log_mode != "events";
+  options.log_segment_bytes = FLAGS_log_segment_bytes;
+  options.log_segment_seconds = FLAGS_log_segment_seconds;
+  options.log_segments_kept = FLAGS_log_segments_kept;
+  options.log_compress = FLAGS_log_compress;
+  options.log_flush_interval = FLAGS_log_flush_interval;
+  options.event_ring = FLAGS_event_ring;
+  options.event_ring_size = FLAGS_event_ring_size;
+  options.summary_path = FLAGS_summary_path.empty()
+                             ? FLAGS_log_path + ".summary.csv"
+                             : FLAGS_summary_path;
+  options.summary_interval = FLAGS_summary_interval;
+  options.summary_max_paths = FLAGS_summary_max_paths;
+  options.summary_group_by = FLAGS_summary_group_by;
+  options.attribute_processes = FLAGS_attribute_processes;
+  options.process_table_size = FLAGS_process_table_size;
+  options.process_revalidate_ms = FLAGS_process_revalidate_ms;
+  options.multithreaded = FLAGS_multithreaded;
+  options.worker_cpus = worker_cpus;
+  options.handoff_socket = FLAGS_handoff_socket;
+  options.takeover_socket = FLAGS_takeover;
+  options.hash_contents = FLAGS_hash_contents;
+  options.hash_threads = FLAGS_hash_threads;
+  options.hash_queue_depth = FLAGS_hash_queue_depth;
+  options.hash_manifest_path = FLAGS_hash_manifest_path.empty()
+                                   ? FLAGS_log_path + ".hashes"
+                                   : FLAGS_hash_manifest_path;
+  options.trace = FLAGS_trace;
+  options.trace_control = FLAGS_trace_control;
+  options.trace_path = FLAGS_trace_path;
+  options.trace_max_events = FLAGS_trace_max_events;
+  options.prefetch_log = FLAGS_prefetch_log;
+  options.prefetch_threads = FLAGS_prefetch_threads;
+  options.prefetch_contents = FLAGS_prefetch_contents;
+  options.prefetch_max_bytes = FLAGS_prefetch_max_bytes;
+  options.prefetch_wait = FLAGS_prefetch_wait;
+  options.pack_path = FLAGS_pack_path;
+  options.pack_readahead = FLAGS_pack_readahead;
 
-  LOG_IF(FATAL, !fs::exists(real_tree_path))
-      << "Real tree to mirror '" << FLAGS_real_tree << "' doesn't exist";
-  LOG_IF(FATAL, !fs::exists(mount_point_path))
-      << "Mount point '" << FLAGS_mount_point << "' doesn't exist";
-  LOG_IF(FATAL, !fs::exists(log_path.parent_path()))
-      << "Parent directory of desired logfile '" << FLAGS_log_path
-      << "' doesn't exist";
+  if (!FLAGS_mounts.empty()) {
+    logfs_fuse::MountSet mount_set(mounts, options);
+    mount_set.Run(argc, argv);
+    return 0;
+  }
 
   logfs_fuse::MountPoint mount_point(FLAGS_mount_point, FLAGS_real_tree,
-                                     FLAGS_log_path);
+                                     FLAGS_log_path, options);
   mount_point.Run(argc, argv);
 }
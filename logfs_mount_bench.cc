@@ -0,0 +1,526 @@
+#include <dirent.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <sstream>
+#include <string>
+#include <thread>  // NOLINT(build/c++11)
+#include <vector>
+
+#include <boost/filesystem.hpp>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include "clock.h"
+#include "stats.h"
+#include "xorshift.h"
+
+DEFINE_string(logfs_fuse, "",
+              "logfs_fuse binary to mount with, defaults to the one next to "
+              "this binary");
+DEFINE_string(work_dir, "",
+              "empty directory for the tree, mount point and logs, a "
+              "temporary directory which is removed afterwards by default");
+DEFINE_int32(depth, 3, "levels of directories in the generated tree");
+DEFINE_int32(fanout, 4, "subdirectories of each directory above the leaves");
+DEFINE_int32(files_per_dir, 32, "files in each directory");
+DEFINE_string(sizes, "512:40,4096:40,32768:15,262144:5",
+              "comma separated size:weight pairs files are drawn from");
+DEFINE_int32(large_files, 4, "number of large files for sequential reads");
+DEFINE_int64(large_file_size, 64 << 20, "bytes in each large file");
+DEFINE_int32(threads, 8, "threads running each workload");
+DEFINE_double(duration, 5, "seconds each workload runs for");
+DEFINE_double(miss_ratio, 0.5,
+              "fraction of stats in the stat workload which miss, like an "
+              "include path search");
+DEFINE_string(workloads, "stat,header,seq_read,walk,write",
+              "comma separated workloads to run: stat, header, seq_read, "
+              "walk and write");
+DEFINE_string(configs, "default",
+              "semicolon separated logfs_fuse configurations to measure, "
+              "each a space separated list of extra flags or \"default\"");
+DEFINE_double(mount_timeout, 10, "seconds to wait for a mount to appear");
+DEFINE_string(format, "text", "format of the results, text or json");
+DEFINE_string(output, "", "file to write the results to, stdout by default");
+
+namespace fs = boost::filesystem;
+using logfs_fuse::Histogram;
+using logfs_fuse::NextRandom;
+using logfs_fuse::NowNs;
+
+const std::string kUsageMessage =
+    "Generates a sysroot-like tree, mounts it with logfs_fuse in each "
+    "configuration and runs build-like workloads on the mirror and on the "
+    "tree itself, reporting throughput, latency percentiles and the "
+    "slowdown of the mirror.";
+
+namespace {
+
+const int64_t kFuseSuperMagic = 0x65735546;
+
+/// The files of the generated tree, as paths relative to its root
+struct Tree {
+  std::vector<std::string> files;
+  std::vector<std::string> dirs;   ///< including the root, ""
+  std::vector<std::string> large;  ///< files for sequential reads
+};
+
+struct Result {
+  std::string config;
+  std::string workload;
+  int threads;
+  uint64_t ops;
+  uint64_t errors;
+  double ops_per_sec;
+  uint64_t p50_ns;
+  uint64_t p99_ns;
+  uint64_t p999_ns;
+  double slowdown;  ///< native ops/s over these ops/s, 1 for native runs
+};
+
+/// Per thread state of a running workload
+struct Worker {
+  int thread;
+  uint64_t random;
+  uint64_t ops;
+  uint64_t errors;
+  std::vector<uint64_t> latency;
+  std::vector<char> buf;
+  int fd;  ///< the large file seq_read is reading, or -1
+};
+
+/// Run one op of a workload on tree root @p root, return false on error
+typedef std::function<bool(const std::string& root, Worker* worker)> OpFn;
+
+std::vector<std::string> Split(const std::string& list, char separator) {
+  std::vector<std::string> items;
+  std::istringstream in(list);
+  std::string item;
+  while (std::getline(in, item, separator)) {
+    if (!item.empty()) {
+      items.push_back(item);
+    }
+  }
+  return items;
+}
+
+void WriteFile(const std::string& path, int64_t size) {
+  int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  PLOG_IF(FATAL, fd < 0) << "Failed to create '" << path << "'";
+  std::vector<char> chunk(std::min<int64_t>(size, 1 << 20), 'x');
+  for (int64_t written = 0; written < size;) {
+    ssize_t result =
+        ::write(fd, chunk.data(), std::min<int64_t>(chunk.size(),
+                                                    size - written));
+    PLOG_IF(FATAL, result <= 0) << "Failed to write '" << path << "'";
+    written += result;
+  }
+  ::close(fd);
+}
+
+void MakeDir(const std::string& root, const std::string& dir, int level,
+             const std::vector<std::pair<int64_t, int>>& sizes,
+             int total_weight, uint64_t* random, Tree* tree) {
+  ::mkdir((root + dir).c_str(), 0755);
+  tree->dirs.push_back(dir);
+  for (int f = 0; f < FLAGS_files_per_dir; f++) {
+    int pick = NextRandom(random) % total_weight;
+    int64_t size = sizes.back().first;
+    for (const auto& size_weight : sizes) {
+      if (pick < size_weight.second) {
+        size = size_weight.first;
+        break;
+      }
+      pick -= size_weight.second;
+    }
+    char name[32];
+    snprintf(name, sizeof(name), "/f%04d.h", f);
+    WriteFile(root + dir + name, size);
+    tree->files.push_back(dir + name);
+  }
+  if (level + 1 < FLAGS_depth) {
+    for (int d = 0; d < FLAGS_fanout; d++) {
+      char name[32];
+      snprintf(name, sizeof(name), "/d%02d", d);
+      MakeDir(root, dir + name, level + 1, sizes, total_weight, random,
+              tree);
+    }
+  }
+}
+
+/// Generate the tree under @p root
+Tree MakeTree(const std::string& root) {
+  std::vector<std::pair<int64_t, int>> sizes;
+  int total_weight = 0;
+  for (const std::string& item : Split(FLAGS_sizes, ',')) {
+    int64_t size = 0;
+    int weight = 0;
+    LOG_IF(FATAL, sscanf(item.c_str(), "%ld:%d", &size, &weight) != 2 ||
+                      size < 0 || weight <= 0)
+        << "Bad --sizes entry '" << item << "'";
+    sizes.push_back(std::make_pair(size, weight));
+    total_weight += weight;
+  }
+  LOG_IF(FATAL, sizes.empty()) << "--sizes is empty";
+
+  Tree tree;
+  uint64_t random = 42;
+  MakeDir(root, "", 0, sizes, total_weight, &random, &tree);
+  ::mkdir((root + "/large").c_str(), 0755);
+  for (int i = 0; i < FLAGS_large_files; i++) {
+    std::string path = "/large/l" + std::to_string(i);
+    WriteFile(root + path, FLAGS_large_file_size);
+    tree.large.push_back(path);
+  }
+  for (int i = 0; i < FLAGS_threads; i++) {
+    ::mkdir((root + "/scratch" + std::to_string(i)).c_str(), 0755);
+  }
+  return tree;
+}
+
+/// Return the op of workload @p name
+OpFn MakeOp(const std::string& name, const Tree* tree,
+            std::atomic<uint64_t>* next_dir) {
+  if (name == "stat") {
+    // a compiler searching include paths mostly misses
+    return [tree](const std::string& root, Worker* worker) {
+      std::string path =
+          root + tree->files[NextRandom(&worker->random) % tree->files.size()];
+      bool miss = (NextRandom(&worker->random) % 1000) <
+                  FLAGS_miss_ratio * 1000;
+      if (miss) {
+        path += ".missing";
+      }
+      struct stat st;
+      return (::lstat(path.c_str(), &st) == 0) != miss;
+    };
+  } else if (name == "header") {
+    return [tree](const std::string& root, Worker* worker) {
+      std::string path =
+          root + tree->files[NextRandom(&worker->random) % tree->files.size()];
+      int fd = ::open(path.c_str(), O_RDONLY);
+      if (fd < 0) {
+        return false;
+      }
+      ssize_t result;
+      while ((result = ::read(fd, worker->buf.data(), worker->buf.size())) >
+             0) {
+      }
+      ::close(fd);
+      return result == 0;
+    };
+  } else if (name == "seq_read") {
+    // each op reads the next 1 MiB of this thread's large file
+    return [tree](const std::string& root, Worker* worker) {
+      if (worker->fd < 0 && !tree->large.empty()) {
+        std::string path =
+            root + tree->large[worker->thread % tree->large.size()];
+        worker->fd = ::open(path.c_str(), O_RDONLY);
+      }
+      if (worker->fd < 0) {
+        return false;
+      }
+      off_t offset = worker->ops * worker->buf.size() % FLAGS_large_file_size;
+      return ::pread(worker->fd, worker->buf.data(), worker->buf.size(),
+                     offset) >= 0;
+    };
+  } else if (name == "walk") {
+    // each op lists one directory and lstats its entries, like find
+    return [tree, next_dir](const std::string& root, Worker* worker) {
+      std::string dir = root + tree->dirs[(*next_dir)++ % tree->dirs.size()];
+      DIR* handle = ::opendir(dir.c_str());
+      if (!handle) {
+        return false;
+      }
+      bool ok = true;
+      for (dirent* entry = ::readdir(handle); entry;
+           entry = ::readdir(handle)) {
+        struct stat st;
+        std::string path = dir + "/" + entry->d_name;
+        ok = ::lstat(path.c_str(), &st) == 0 && ok;
+      }
+      ::closedir(handle);
+      return ok;
+    };
+  } else if (name == "write") {
+    // each op rewrites one of a few hundred small files, like objects
+    return [](const std::string& root, Worker* worker) {
+      std::string path = root + "/scratch" + std::to_string(worker->thread) +
+                         "/o" + std::to_string(worker->ops % 256);
+      int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+      if (fd < 0) {
+        return false;
+      }
+      bool ok = ::write(fd, worker->buf.data(), 4096) == 4096;
+      return ::close(fd) == 0 && ok;
+    };
+  }
+  LOG(FATAL) << "Unknown workload '" << name << "'";
+  return OpFn();
+}
+
+/// Run workload @p name on the tree at @p root for --duration seconds
+Result RunWorkload(const std::string& config, const std::string& name,
+                   const std::string& root, const Tree& tree) {
+  std::atomic<uint64_t> next_dir(0);
+  OpFn op = MakeOp(name, &tree, &next_dir);
+  std::vector<Worker> workers(FLAGS_threads);
+  int64_t deadline = NowNs() + static_cast<int64_t>(FLAGS_duration * 1e9);
+  int64_t start = NowNs();
+  std::vector<std::thread> threads;
+  for (int i = 0; i < FLAGS_threads; i++) {
+    Worker* worker = &workers[i];
+    worker->thread = i;
+    worker->random = i + 1;
+    worker->ops = 0;
+    worker->errors = 0;
+    worker->latency.assign(Histogram::kNumBuckets, 0);
+    worker->buf.assign(1 << 20, 'y');
+    worker->fd = -1;
+    threads.emplace_back([&op, &root, worker, deadline] {
+      for (int64_t now = NowNs(); now < deadline;) {
+        bool ok = op(root, worker);
+        int64_t end = NowNs();
+        worker->latency[Histogram::BucketIndex(end - now)]++;
+        worker->ops++;
+        worker->errors += ok ? 0 : 1;
+        now = end;
+      }
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  double seconds = (NowNs() - start) / 1e9;
+
+  Result result;
+  result.config = config;
+  result.workload = name;
+  result.threads = FLAGS_threads;
+  result.ops = 0;
+  result.errors = 0;
+  std::vector<uint64_t> latency(Histogram::kNumBuckets, 0);
+  for (const Worker& worker : workers) {
+    if (worker.fd >= 0) {
+      ::close(worker.fd);
+    }
+    result.ops += worker.ops;
+    result.errors += worker.errors;
+    for (int i = 0; i < Histogram::kNumBuckets; i++) {
+      latency[i] += worker.latency[i];
+    }
+  }
+  result.ops_per_sec = result.ops / seconds;
+  result.p50_ns = Histogram::Quantile(latency, 0.5);
+  result.p99_ns = Histogram::Quantile(latency, 0.99);
+  result.p999_ns = Histogram::Quantile(latency, 0.999);
+  result.slowdown = 1;
+  return result;
+}
+
+/// Run @p argv, return its exit status or -1 if it couldn't be run
+int RunCommand(const std::vector<std::string>& argv) {
+  pid_t pid = ::fork();
+  if (pid == 0) {
+    std::vector<char*> args;
+    for (const std::string& arg : argv) {
+      args.push_back(const_cast<char*>(arg.c_str()));
+    }
+    args.push_back(NULL);
+    ::execvp(args[0], args.data());
+    _exit(127);
+  }
+  int status = 0;
+  if (pid < 0 || ::waitpid(pid, &status, 0) < 0) {
+    return -1;
+  }
+  return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+bool IsFuseMount(const std::string& path) {
+  struct statfs st;
+  return ::statfs(path.c_str(), &st) == 0 && st.f_type == kFuseSuperMagic;
+}
+
+/// Mount @p real_tree at @p mount_point in the foreground with @p flags,
+/// return the pid of logfs_fuse once the mount is up
+pid_t Mount(const std::string& real_tree, const std::string& mount_point,
+            const std::string& log_path, const std::string& flags) {
+  std::vector<std::string> argv;
+  argv.push_back(FLAGS_logfs_fuse);
+  argv.push_back("--real_tree=" + real_tree);
+  argv.push_back("--mount_point=" + mount_point);
+  argv.push_back("--log_path=" + log_path);
+  for (const std::string& flag : Split(flags, ' ')) {
+    argv.push_back(flag);
+  }
+  argv.push_back("-f");
+
+  pid_t pid = ::fork();
+  PLOG_IF(FATAL, pid < 0) << "Failed to fork";
+  if (pid == 0) {
+    std::vector<char*> args;
+    for (const std::string& arg : argv) {
+      args.push_back(const_cast<char*>(arg.c_str()));
+    }
+    args.push_back(NULL);
+    ::execv(args[0], args.data());
+    _exit(127);
+  }
+
+  int64_t deadline = NowNs() + static_cast<int64_t>(FLAGS_mount_timeout * 1e9);
+  while (!IsFuseMount(mount_point)) {
+    int status;
+    LOG_IF(FATAL, ::waitpid(pid, &status, WNOHANG) == pid)
+        << "logfs_fuse exited before mounting, with status " << status;
+    if (NowNs() > deadline) {
+      ::kill(pid, SIGTERM);
+      LOG(FATAL) << "Timed out waiting for the mount at '" << mount_point
+                 << "'";
+    }
+    ::usleep(10000);
+  }
+  return pid;
+}
+
+/// Unmount @p mount_point and wait for logfs_fuse @p pid to exit
+void Unmount(const std::string& mount_point, pid_t pid) {
+  // fusermount lets an unprivileged user unmount what they mounted
+  if (RunCommand({"fusermount", "-u", mount_point}) != 0 &&
+      RunCommand({"fusermount3", "-u", mount_point}) != 0) {
+    LOG(ERROR) << "Failed to unmount '" << mount_point
+               << "', stopping logfs_fuse";
+    ::kill(pid, SIGTERM);
+  }
+  int status;
+  ::waitpid(pid, &status, 0);
+}
+
+std::string FormatResults(const std::vector<Result>& results) {
+  std::ostringstream out;
+  if (FLAGS_format == "json") {
+    out << "{\"results\": [\n";
+    for (size_t i = 0; i < results.size(); i++) {
+      const Result& result = results[i];
+      out << "  {\"config\": \"" << result.config
+          << "\", \"workload\": \"" << result.workload
+          << "\", \"threads\": " << result.threads
+          << ", \"ops\": " << result.ops << ", \"errors\": " << result.errors
+          << ", \"ops_per_sec\": " << result.ops_per_sec
+          << ", \"p50_ns\": " << result.p50_ns
+          << ", \"p99_ns\": " << result.p99_ns
+          << ", \"p999_ns\": " << result.p999_ns
+          << ", \"slowdown\": " << result.slowdown << "}"
+          << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    out << "]}\n";
+  } else {
+    char line[256];
+    snprintf(line, sizeof(line), "%-10s %12s %10s %10s %10s %10s %8s  %s\n",
+             "workload", "ops/s", "errors", "p50_us", "p99_us", "p999_us",
+             "slowdown", "config");
+    out << line;
+    for (const Result& result : results) {
+      snprintf(line, sizeof(line),
+               "%-10s %12.0f %10lu %10.1f %10.1f %10.1f %8.2f  %s\n",
+               result.workload.c_str(), result.ops_per_sec, result.errors,
+               result.p50_ns / 1e3, result.p99_ns / 1e3, result.p999_ns / 1e3,
+               result.slowdown, result.config.c_str());
+      out << line;
+    }
+  }
+  return out.str();
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  google::InitGoogleLogging(argv[0]);
+  google::SetUsageMessage(kUsageMessage);
+  google::ParseCommandLineFlags(&argc, &argv, true);
+
+  LOG_IF(FATAL, FLAGS_depth <= 0 || FLAGS_fanout <= 0 ||
+                    FLAGS_files_per_dir <= 0)
+      << "--depth, --fanout and --files_per_dir must be > 0";
+  LOG_IF(FATAL, FLAGS_large_file_size <= 0)
+      << "--large_file_size must be > 0";
+  LOG_IF(FATAL, FLAGS_threads <= 0) << "--threads must be > 0";
+  LOG_IF(FATAL, FLAGS_duration <= 0) << "--duration must be > 0";
+  LOG_IF(FATAL, FLAGS_format != "text" && FLAGS_format != "json")
+      << "--format must be text or json";
+  if (FLAGS_logfs_fuse.empty()) {
+    FLAGS_logfs_fuse =
+        (fs::absolute(argv[0]).parent_path() / "logfs_fuse").string();
+  }
+  std::vector<std::string> workloads = Split(FLAGS_workloads, ',');
+  std::vector<std::string> configs = Split(FLAGS_configs, ';');
+
+  fs::path work_dir;
+  bool temporary = FLAGS_work_dir.empty();
+  if (temporary) {
+    char pattern[] = "/tmp/logfs_mount_bench.XXXXXX";
+    PLOG_IF(FATAL, !mkdtemp(pattern)) << "Failed to create a work directory";
+    work_dir = pattern;
+  } else {
+    work_dir = fs::absolute(FLAGS_work_dir);
+    fs::create_directories(work_dir);
+  }
+  std::string real_tree = (work_dir / "tree").string();
+  std::string mount_point = (work_dir / "mnt").string();
+  fs::create_directories(mount_point);
+  LOG(INFO) << "Generating the tree in '" << real_tree << "'";
+  Tree tree = MakeTree(real_tree);
+  LOG(INFO) << tree.files.size() << " files in " << tree.dirs.size()
+            << " directories";
+
+  // the native runs are the baseline every mounted run is compared to
+  std::vector<Result> results;
+  std::vector<double> native;
+  for (const std::string& workload : workloads) {
+    // a first pass warms the page cache, so neither side reads the disk
+    RunWorkload("native", workload, real_tree, tree);
+    results.push_back(RunWorkload("native", workload, real_tree, tree));
+    native.push_back(results.back().ops_per_sec);
+  }
+
+  for (const std::string& config : configs) {
+    std::string flags = config == "default" ? "" : config;
+    pid_t pid = Mount(real_tree, mount_point,
+                      (work_dir / "access_log.txt").string(), flags);
+    for (size_t i = 0; i < workloads.size(); i++) {
+      Result result =
+          RunWorkload(config, workloads[i], mount_point, tree);
+      result.slowdown =
+          result.ops_per_sec > 0 ? native[i] / result.ops_per_sec : 0;
+      results.push_back(result);
+    }
+    Unmount(mount_point, pid);
+  }
+
+  if (temporary) {
+    boost::system::error_code error;
+    fs::remove_all(work_dir, error);
+  }
+
+  std::string report = FormatResults(results);
+  if (FLAGS_output.empty()) {
+    fputs(report.c_str(), stdout);
+  } else {
+    std::ofstream out(FLAGS_output.c_str());
+    out << report;
+    PLOG_IF(FATAL, !out) << "Failed to write '" << FLAGS_output << "'";
+  }
+  return 0;
+}
@@ -0,0 +1,109 @@
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include "log_reader.h"
+#include "pack_file.h"
+
+DEFINE_string(log, "",
+              "comma separated access logs written by logfs_fuse, - to read "
+              "stdin; files are packed in the order they were first read");
+DEFINE_string(real_tree, "", "the tree the logs were recorded against");
+DEFINE_string(output, "", "pack file to write");
+DEFINE_int64(max_file_size, 64 << 20,
+             "files larger than this are left out of the pack, they are "
+             "read sequentially anyway; 0 for no limit");
+
+namespace fs = boost::filesystem;
+
+const std::string kUsageMessage =
+    "Writes the contents of the files read in logfs_fuse access logs to one "
+    "pack file, in the order they were first read, for logfs_fuse "
+    "--pack_path to serve cold reads from.";
+
+int main(int argc, char** argv) {
+  google::InitGoogleLogging(argv[0]);
+  google::SetUsageMessage(kUsageMessage);
+  google::ParseCommandLineFlags(&argc, &argv, true);
+
+  LOG_IF(FATAL, FLAGS_log.empty()) << "--log is required";
+  LOG_IF(FATAL, FLAGS_output.empty()) << "--output is required";
+  LOG_IF(FATAL, !fs::is_directory(FLAGS_real_tree))
+      << "Real tree '" << FLAGS_real_tree << "' isn't a directory";
+  LOG_IF(FATAL, FLAGS_max_file_size < 0) << "--max_file_size must be >= 0";
+
+  // write a temporary and rename it so a mount never sees a partial pack
+  std::string temp_path = FLAGS_output + ".tmp";
+  logfs_fuse::PackWriter writer;
+  int result = writer.Open(temp_path);
+  LOG_IF(FATAL, result < 0) << "Failed to create pack '" << temp_path
+                            << "', [" << -result << "] : "
+                            << strerror(-result);
+
+  fs::path real_tree(FLAGS_real_tree);
+  std::unordered_set<std::string> seen;
+  uint64_t lines = 0, malformed = 0, missing = 0, too_big = 0, changed = 0;
+  for (const std::string& log : logfs_fuse::SplitLogList(FLAGS_log)) {
+    logfs_fuse::LogReader reader(log);
+    PLOG_IF(FATAL, !reader.ok()) << "Failed to open log '" << log << "'";
+    logfs_fuse::LogRecord record;
+    while (reader.Next(&record)) {
+      if ((record.op != logfs_fuse::kOpOpen &&
+           record.op != logfs_fuse::kOpRead) ||
+          !seen.insert(record.path).second) {
+        continue;
+      }
+
+      // the same path the fuse context opens, so the pack's index matches
+      fs::path wrapped = real_tree / record.path;
+      int fd = ::open(wrapped.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+      struct stat st;
+      if (fd < 0 || ::fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+        missing++;
+      } else if (FLAGS_max_file_size > 0 && st.st_size > FLAGS_max_file_size) {
+        too_big++;
+      } else {
+        ::posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        result = writer.Add(record.path, fd, st);
+        if (result == -EAGAIN) {
+          changed++;
+        } else {
+          LOG_IF(FATAL, result < 0) << "Failed to pack '" << wrapped.string()
+                                    << "', [" << -result << "] : "
+                                    << strerror(-result);
+        }
+      }
+      if (fd >= 0) {
+        ::close(fd);
+      }
+    }
+    lines += reader.lines();
+    malformed += reader.malformed();
+  }
+
+  result = writer.Finish();
+  if (result == 0 && ::rename(temp_path.c_str(), FLAGS_output.c_str()) < 0) {
+    result = -errno;
+  }
+  LOG_IF(FATAL, result < 0) << "Failed to write pack '" << FLAGS_output
+                            << "', [" << -result << "] : "
+                            << strerror(-result);
+
+  printf("read %lu lines (%lu malformed), packed %zu files, %lu bytes\n",
+         lines, malformed, writer.num_entries(), writer.data_size());
+  printf("left out %lu missing or special, %lu too big and %lu changing "
+         "files\n",
+         missing, too_big, changed);
+  return 0;
+}
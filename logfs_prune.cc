@@ -0,0 +1,463 @@
+#include <fcntl.h>
+#include <ftw.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>  // NOLINT(build/c++11)
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include "log_reader.h"
+#include "work_stealing_pool.h"
+
+DEFINE_string(log, "",
+              "comma separated access logs written by logfs_fuse, - to read "
+              "stdin");
+DEFINE_string(real_tree, "", "the tree the logs were recorded against");
+DEFINE_string(output, "",
+              "directory to build the pruned tree in, must be empty or not "
+              "exist");
+DEFINE_string(method, "hardlink",
+              "how files are put in the pruned tree: hardlink, reflink or "
+              "copy. hardlink and reflink fall back to copying where the "
+              "filesystem can't do them");
+DEFINE_int32(threads, 8, "threads reading logs and materializing files");
+DEFINE_bool(absolute_symlinks_in_tree, true,
+            "resolve absolute symlink targets inside the real tree, as for "
+            "a sysroot, rather than leaving them to the host");
+DEFINE_bool(report_savings, true,
+            "walk the whole real tree to report the bytes pruned");
+DEFINE_bool(dry_run, false, "only report what would be kept");
+
+namespace fs = boost::filesystem;
+
+const std::string kUsageMessage =
+    "Builds a copy of a tree which holds only the paths in logfs_fuse access "
+    "logs, with the directories and symlinks needed to reach them.";
+
+namespace logfs_fuse {
+
+// the kernel's limit on symlinks followed in one lookup
+static const int kMaxSymlinkHops = 40;
+
+/// What we keep of one entry of the real tree
+struct KeptEntry {
+  struct stat st;
+  std::string link_target;  ///< the symlink's contents, for symlinks
+};
+
+/// Decides which entries of the real tree a set of accessed paths needs
+/**
+ *  Keeping a path keeps each of its ancestors, and every symlink met on the
+ *  way is kept along with whatever it resolves to, so that the path still
+ *  resolves in the pruned tree. Entries are memoized so each is only
+ *  lstat()ed once however many accessed paths lie beneath it.
+ */
+class TreePruner {
+ public:
+  TreePruner(const std::string& real_tree, bool absolute_symlinks_in_tree)
+      : real_tree_(real_tree),
+        absolute_symlinks_in_tree_(absolute_symlinks_in_tree) {}
+
+  /// Keep the normalized @p path and everything needed to reach it
+  void Keep(const std::string& path) {
+    Resolve(path, 0);
+  }
+
+  /// Kept entries by path, so that a directory precedes its contents
+  const std::map<std::string, KeptEntry>& kept() const {
+    return kept_;
+  }
+
+ private:
+  void Resolve(const std::string& path, int hops);
+
+  /// Return the path that the kept symlink @p path points to, or an empty
+  /// string if it points out of the tree
+  std::string LinkDestination(const std::string& path,
+                              const std::string& target) const;
+
+  std::string real_tree_;
+  bool absolute_symlinks_in_tree_;
+  std::map<std::string, KeptEntry> kept_;
+  std::unordered_map<std::string, std::string> destinations_;
+};
+
+void TreePruner::Resolve(const std::string& path, int hops) {
+  size_t begin = 1;
+  while (begin < path.size()) {
+    size_t end = path.find('/', begin);
+    if (end == std::string::npos) {
+      end = path.size();
+    }
+    std::string prefix = path.substr(0, end);
+
+    auto found = kept_.find(prefix);
+    if (found == kept_.end()) {
+      KeptEntry entry;
+      std::string real_path = real_tree_ + prefix;
+      if (::lstat(real_path.c_str(), &entry.st) < 0) {
+        // created during the recorded run, or the access failed
+        return;
+      }
+      if (S_ISLNK(entry.st.st_mode)) {
+        char target[PATH_MAX];
+        ssize_t size = ::readlink(real_path.c_str(), target, sizeof(target));
+        if (size < 0) {
+          return;
+        }
+        entry.link_target.assign(target, size);
+        destinations_[prefix] = LinkDestination(prefix, entry.link_target);
+      } else if (!S_ISDIR(entry.st.st_mode) && !S_ISREG(entry.st.st_mode)) {
+        // devices, fifos and sockets are left out
+        return;
+      }
+      found = kept_.insert(std::make_pair(prefix, entry)).first;
+    }
+
+    const struct stat& st = found->second.st;
+    if (S_ISLNK(st.st_mode)) {
+      const std::string& destination = destinations_[prefix];
+      if (!destination.empty() && hops < kMaxSymlinkHops) {
+        Resolve(NormalizePath(destination + path.substr(end)), hops + 1);
+      }
+      return;
+    }
+    if (!S_ISDIR(st.st_mode)) {
+      return;
+    }
+    begin = end + 1;
+  }
+}
+
+std::string TreePruner::LinkDestination(const std::string& path,
+                                        const std::string& target) const {
+  if (target.empty()) {
+    return std::string();
+  }
+  if (target[0] != '/') {
+    // the directory holding the link has already been resolved, so
+    // handling ".." textually is correct up to the link itself
+    return NormalizePath(path.substr(0, path.rfind('/')) + "/" + target);
+  }
+  if (target.compare(0, real_tree_.size(), real_tree_) == 0 &&
+      (target.size() == real_tree_.size() ||
+       target[real_tree_.size()] == '/')) {
+    return NormalizePath(target.substr(real_tree_.size()));
+  }
+  return absolute_symlinks_in_tree_ ? NormalizePath(target) : std::string();
+}
+
+enum Method { kMethodHardlink, kMethodReflink, kMethodCopy };
+
+/// Counters for one materialization, updated from the pool's threads
+struct MaterializeStats {
+  std::atomic<uint64_t> linked;
+  std::atomic<uint64_t> reflinked;
+  std::atomic<uint64_t> copied;
+  std::atomic<uint64_t> failed;
+
+  MaterializeStats() : linked(0), reflinked(0), copied(0), failed(0) {}
+};
+
+// copy the rest of @p in_fd to @p out_fd, in the kernel if it can
+static bool CopyContents(int in_fd, int out_fd) {
+  bool kernel_copy = true;
+  while (kernel_copy) {
+    ssize_t result =
+        ::copy_file_range(in_fd, NULL, out_fd, NULL, 1 << 30, 0);
+    if (result == 0) {
+      return true;
+    }
+    if (result < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno != EXDEV && errno != ENOSYS && errno != EINVAL &&
+          errno != EOPNOTSUPP) {
+        return false;
+      }
+      kernel_copy = false;
+    }
+  }
+
+  std::unique_ptr<char[]> buf(new char[1 << 20]);
+  while (true) {
+    ssize_t count = ::read(in_fd, buf.get(), 1 << 20);
+    if (count < 0 && errno == EINTR) {
+      continue;
+    }
+    if (count <= 0) {
+      return count == 0;
+    }
+    for (ssize_t written = 0; written < count;) {
+      ssize_t result = ::write(out_fd, buf.get() + written, count - written);
+      if (result < 0 && errno != EINTR) {
+        return false;
+      }
+      written += std::max<ssize_t>(result, 0);
+    }
+  }
+}
+
+// clone or copy @p from to the new file @p to, giving it the mode and times
+// of @p st
+static bool CloneOrCopy(const std::string& from, const std::string& to,
+                        const struct stat& st, bool reflink,
+                        MaterializeStats* stats) {
+  int in_fd = ::open(from.c_str(), O_RDONLY | O_CLOEXEC);
+  if (in_fd < 0) {
+    return false;
+  }
+  int out_fd =
+      ::open(to.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+  if (out_fd < 0) {
+    ::close(in_fd);
+    return false;
+  }
+
+  bool ok;
+  if (reflink && ::ioctl(out_fd, FICLONE, in_fd) == 0) {
+    stats->reflinked++;
+    ok = true;
+  } else {
+    ::posix_fadvise(in_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    ok = CopyContents(in_fd, out_fd);
+    if (ok) {
+      stats->copied++;
+    }
+  }
+
+  timespec times[2] = {st.st_atim, st.st_mtim};
+  ok = ok && ::fchmod(out_fd, st.st_mode & 07777) == 0 &&
+       ::futimens(out_fd, times) == 0;
+  ::close(in_fd);
+  if (::close(out_fd) < 0) {
+    ok = false;
+  }
+  return ok;
+}
+
+static void MaterializeFile(const std::string& from, const std::string& to,
+                            const struct stat& st, Method method,
+                            MaterializeStats* stats) {
+  if (method == kMethodHardlink) {
+    if (::link(from.c_str(), to.c_str()) == 0) {
+      stats->linked++;
+      return;
+    }
+    if (errno != EXDEV && errno != EPERM && errno != EMLINK) {
+      PLOG(ERROR) << "Failed to link '" << from << "' to '" << to << "'";
+      stats->failed++;
+      return;
+    }
+  }
+
+  if (!CloneOrCopy(from, to, st, method == kMethodReflink, stats)) {
+    PLOG(ERROR) << "Failed to copy '" << from << "' to '" << to << "'";
+    stats->failed++;
+  }
+}
+
+static void MaterializeSymlink(const std::string& to, const KeptEntry& entry,
+                               MaterializeStats* stats) {
+  timespec times[2] = {entry.st.st_atim, entry.st.st_mtim};
+  if (::symlink(entry.link_target.c_str(), to.c_str()) < 0 ||
+      ::utimensat(AT_FDCWD, to.c_str(), times, AT_SYMLINK_NOFOLLOW) < 0) {
+    PLOG(ERROR) << "Failed to create symlink '" << to << "'";
+    stats->failed++;
+  }
+}
+
+/// Build the kept entries of @p real_tree under @p output
+static uint64_t Materialize(const std::map<std::string, KeptEntry>& kept,
+                            const std::string& real_tree,
+                            const std::string& output, Method method,
+                            WorkStealingPool* pool) {
+  MaterializeStats stats;
+
+  // directories are writable by us until their contents are in place
+  for (const auto& path_entry : kept) {
+    if (S_ISDIR(path_entry.second.st.st_mode)) {
+      std::string to = output + path_entry.first;
+      PLOG_IF(FATAL, ::mkdir(to.c_str(), 0700) < 0)
+          << "Failed to create directory '" << to << "'";
+    }
+  }
+
+  for (const auto& path_entry : kept) {
+    const KeptEntry* entry = &path_entry.second;
+    std::string from = real_tree + path_entry.first;
+    std::string to = output + path_entry.first;
+    if (S_ISREG(entry->st.st_mode)) {
+      pool->Submit([from, to, entry, method, &stats] {
+        MaterializeFile(from, to, entry->st, method, &stats);
+      });
+    } else if (S_ISLNK(entry->st.st_mode)) {
+      pool->Submit([to, entry, &stats] {
+        MaterializeSymlink(to, *entry, &stats);
+      });
+    }
+  }
+  pool->Wait();
+
+  // children first, so that setting their times doesn't touch the parent's
+  for (auto it = kept.rbegin(); it != kept.rend(); ++it) {
+    const struct stat& st = it->second.st;
+    if (S_ISDIR(st.st_mode)) {
+      std::string to = output + it->first;
+      timespec times[2] = {st.st_atim, st.st_mtim};
+      if (::chmod(to.c_str(), st.st_mode & 07777) < 0 ||
+          ::utimensat(AT_FDCWD, to.c_str(), times, 0) < 0) {
+        PLOG(ERROR) << "Failed to set attributes of '" << to << "'";
+        stats.failed++;
+      }
+    }
+  }
+
+  printf("hardlinked %lu, reflinked %lu and copied %lu files, %lu failures\n",
+         stats.linked.load(), stats.reflinked.load(), stats.copied.load(),
+         stats.failed.load());
+  return stats.failed;
+}
+
+/// Totals of a walk of the real tree, nftw() has no context argument
+static uint64_t g_tree_files = 0;
+static uint64_t g_tree_bytes = 0;
+
+static int CountEntry(const char*, const struct stat* st, int type,
+                      struct FTW*) {
+  if (type == FTW_F && S_ISREG(st->st_mode)) {
+    g_tree_files++;
+    g_tree_bytes += st->st_size;
+  }
+  return 0;
+}
+
+/// Read the logs into @p paths, each on its own thread
+static void ReadLogs(const std::vector<std::string>& logs,
+                     WorkStealingPool* pool,
+                     std::unordered_set<std::string>* paths) {
+  std::mutex mutex;
+  uint64_t lines = 0;
+  uint64_t malformed = 0;
+  for (const std::string& log : logs) {
+    pool->Submit([&mutex, &lines, &malformed, paths, log] {
+      LogReader reader(log);
+      PLOG_IF(FATAL, !reader.ok()) << "Failed to open log '" << log << "'";
+
+      // deduplicate locally, a log repeats its paths far more often than
+      // it adds new ones
+      std::unordered_set<std::string> seen;
+      LogRecord record;
+      while (reader.Next(&record)) {
+        seen.insert(NormalizePath(record.path));
+        if (!record.target.empty()) {
+          seen.insert(NormalizePath(record.target));
+        }
+      }
+
+      std::lock_guard<std::mutex> lock(mutex);
+      lines += reader.lines();
+      malformed += reader.malformed();
+      paths->insert(seen.begin(), seen.end());
+    });
+  }
+  pool->Wait();
+
+  printf("read %lu lines (%lu malformed) from %zu logs, %zu distinct paths\n",
+         lines, malformed, logs.size(), paths->size());
+}
+
+}  // namespace logfs_fuse
+
+int main(int argc, char** argv) {
+  google::InitGoogleLogging(argv[0]);
+  google::SetUsageMessage(kUsageMessage);
+  google::ParseCommandLineFlags(&argc, &argv, true);
+
+  LOG_IF(FATAL, FLAGS_log.empty()) << "--log is required";
+  LOG_IF(FATAL, !fs::is_directory(FLAGS_real_tree))
+      << "Real tree '" << FLAGS_real_tree << "' isn't a directory";
+  LOG_IF(FATAL, FLAGS_output.empty() && !FLAGS_dry_run)
+      << "--output is required unless --dry_run";
+  LOG_IF(FATAL, FLAGS_threads <= 0) << "--threads must be > 0";
+
+  logfs_fuse::Method method = logfs_fuse::kMethodHardlink;
+  if (FLAGS_method == "reflink") {
+    method = logfs_fuse::kMethodReflink;
+  } else if (FLAGS_method == "copy") {
+    method = logfs_fuse::kMethodCopy;
+  } else if (FLAGS_method != "hardlink") {
+    LOG(FATAL) << "--method must be hardlink, reflink or copy";
+  }
+
+  std::string real_tree = fs::canonical(FLAGS_real_tree).string();
+  if (real_tree == "/") {
+    real_tree.clear();
+  }
+
+  std::vector<std::string> logs = logfs_fuse::SplitLogList(FLAGS_log);
+
+  logfs_fuse::WorkStealingPool pool(FLAGS_threads);
+  logfs_fuse::TreePruner pruner(real_tree, FLAGS_absolute_symlinks_in_tree);
+  {
+    std::unordered_set<std::string> paths;
+    logfs_fuse::ReadLogs(logs, &pool, &paths);
+    for (const std::string& path : paths) {
+      pruner.Keep(path);
+    }
+  }
+
+  uint64_t files = 0, directories = 0, symlinks = 0, bytes = 0;
+  for (const auto& path_entry : pruner.kept()) {
+    const struct stat& st = path_entry.second.st;
+    if (S_ISREG(st.st_mode)) {
+      files++;
+      bytes += st.st_size;
+    } else if (S_ISDIR(st.st_mode)) {
+      directories++;
+    } else {
+      symlinks++;
+    }
+  }
+  printf("keeping %lu files, %lu directories and %lu symlinks, %lu bytes\n",
+         files, directories, symlinks, bytes);
+
+  if (FLAGS_report_savings) {
+    ::nftw(FLAGS_real_tree.c_str(), logfs_fuse::CountEntry, 64, FTW_PHYS);
+    uint64_t total = logfs_fuse::g_tree_bytes;
+    printf("real tree holds %lu files, %lu bytes; pruning saves %lu bytes "
+           "(%.1f%%)\n",
+           logfs_fuse::g_tree_files, total, total - std::min(total, bytes),
+           total ? 100.0 * (total - std::min(total, bytes)) / total : 0.0);
+  }
+
+  if (FLAGS_dry_run) {
+    return 0;
+  }
+
+  fs::create_directories(FLAGS_output);
+  LOG_IF(FATAL, !fs::is_empty(FLAGS_output))
+      << "Output directory '" << FLAGS_output << "' isn't empty";
+  std::string output = fs::canonical(FLAGS_output).string();
+
+  uint64_t failed = logfs_fuse::Materialize(pruner.kept(), real_tree, output,
+                                            method, &pool);
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,455 @@
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <sys/xattr.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>  // NOLINT(build/c++11)
+#include <condition_variable>  // NOLINT(build/c++11)
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>  // NOLINT(build/c++11)
+#include <sstream>
+#include <string>
+#include <thread>  // NOLINT(build/c++11)
+#include <unordered_map>
+#include <vector>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include "clock.h"
+#include "log_reader.h"
+#include "stats.h"
+
+DEFINE_string(log, "",
+              "comma separated access logs written by logfs_fuse, - to read "
+              "stdin, replayed one after the other");
+DEFINE_string(root, "",
+              "tree to replay against, a logfs_fuse mount or a native tree");
+DEFINE_int32(threads, 8,
+             "threads replaying, ops on the same path stay on one thread and "
+             "in log order, mutations run alone between the ops around them");
+DEFINE_double(rate, 0,
+              "most ops replayed per second, 0 to replay as fast as "
+              "possible");
+DEFINE_bool(mutations, false,
+            "also replay ops which change the tree, like mkdir, unlink and "
+            "rename; otherwise they are skipped");
+DEFINE_int32(read_size, 128 << 10, "bytes read per logged read");
+DEFINE_string(xattr_name, "security.capability",
+              "attribute looked up for getxattr, which the log doesn't name");
+DEFINE_string(format, "text", "format of the op stats, text or json");
+DEFINE_string(output, "", "file to write the op stats to, stdout by default");
+
+using logfs_fuse::LogRecord;
+using logfs_fuse::Op;
+
+const std::string kUsageMessage =
+    "Replays logfs_fuse access logs against a mounted mirror or a native "
+    "tree, issuing the syscall each logged op stands for, and reports the "
+    "latency of each op.";
+
+namespace {
+
+const size_t kBatchSize = 256;
+const size_t kMaxQueuedBatches = 64;
+
+/// Records for one replay thread, in log order
+struct Shard {
+  std::mutex mutex;
+  std::condition_variable ready_cv;  ///< batches were queued or done set
+  std::condition_variable room_cv;   ///< batches were taken
+  std::condition_variable idle_cv;   ///< a batch was replayed
+  std::deque<std::vector<LogRecord>> batches;
+  bool replaying = false;  ///< a taken batch isn't finished yet
+  bool done = false;
+};
+
+/// Return true for the ops --mutations replays, which change the tree
+bool IsMutation(Op op) {
+  switch (op) {
+    case logfs_fuse::kOpMkdir:
+    case logfs_fuse::kOpRmdir:
+    case logfs_fuse::kOpUnlink:
+    case logfs_fuse::kOpRename:
+    case logfs_fuse::kOpLink:
+    case logfs_fuse::kOpSymlink:
+    case logfs_fuse::kOpCreate:
+    case logfs_fuse::kOpMknod:
+    case logfs_fuse::kOpUtimens:
+      return true;
+    default:
+      return false;
+  }
+}
+
+/// Replays the records of one shard, keeping the files and directories
+/// they open open until the log releases them
+class Replayer {
+ public:
+  explicit Replayer(logfs_fuse::Stats* stats)
+      : stats_(stats), buf_(FLAGS_read_size), replayed_(0), skipped_(0) {}
+
+  ~Replayer() {
+    for (auto& path_fds : fds_) {
+      for (const OpenFile& file : path_fds.second) {
+        ::close(file.fd);
+      }
+    }
+    for (auto& path_dirs : dirs_) {
+      for (DIR* dir : path_dirs.second) {
+        ::closedir(dir);
+      }
+    }
+  }
+
+  void Replay(const LogRecord& record) {
+    std::string path = FLAGS_root + record.path;
+    int64_t start = logfs_fuse::NowNs();
+    int result = Issue(record, path);
+    if (result == kSkipped) {
+      skipped_++;
+      return;
+    }
+    int64_t latency = logfs_fuse::NowNs() - start;
+    stats_->Record(record.op, latency, latency, result < 0);
+    replayed_++;
+  }
+
+  uint64_t replayed() const {
+    return replayed_;
+  }
+
+  uint64_t skipped() const {
+    return skipped_;
+  }
+
+ private:
+  static const int kSkipped = 1;
+
+  struct OpenFile {
+    int fd;
+    off_t offset;  ///< where the next logged read continues
+  };
+
+  /// Issue the syscall @p record stands for on @p path, return 0, -1 on
+  /// error or kSkipped
+  int Issue(const LogRecord& record, const std::string& path) {
+    struct stat st;
+    switch (record.op) {
+      case logfs_fuse::kOpGetattr:
+      case logfs_fuse::kOpFgetattr:
+        return ::lstat(path.c_str(), &st);
+      case logfs_fuse::kOpReadlink: {
+        char target[4096];
+        return ::readlink(path.c_str(), target, sizeof(target)) < 0 ? -1 : 0;
+      }
+      case logfs_fuse::kOpAccess:
+        return ::access(path.c_str(), R_OK);
+      case logfs_fuse::kOpStatfs: {
+        struct statvfs st_fs;
+        return ::statvfs(path.c_str(), &st_fs);
+      }
+      case logfs_fuse::kOpGetxattr: {
+        // a missing attribute is the common answer, not a failure
+        ssize_t size =
+            ::lgetxattr(path.c_str(), FLAGS_xattr_name.c_str(), NULL, 0);
+        return size < 0 && errno != ENODATA ? -1 : 0;
+      }
+      case logfs_fuse::kOpListxattr:
+        return ::llistxattr(path.c_str(), NULL, 0) < 0 ? -1 : 0;
+      case logfs_fuse::kOpOpen: {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+          return -1;
+        }
+        fds_[record.path].push_back(OpenFile{fd, 0});
+        return 0;
+      }
+      case logfs_fuse::kOpRead:
+        return Read(record.path, path);
+      case logfs_fuse::kOpRelease: {
+        auto found = fds_.find(record.path);
+        if (found == fds_.end()) {
+          return kSkipped;
+        }
+        int result = ::close(found->second.back().fd);
+        found->second.pop_back();
+        if (found->second.empty()) {
+          fds_.erase(found);
+        }
+        return result;
+      }
+      case logfs_fuse::kOpOpendir: {
+        DIR* dir = ::opendir(path.c_str());
+        if (!dir) {
+          return -1;
+        }
+        dirs_[record.path].push_back(dir);
+        return 0;
+      }
+      case logfs_fuse::kOpReaddir: {
+        auto found = dirs_.find(record.path);
+        if (found == dirs_.end()) {
+          return kSkipped;
+        }
+        DIR* dir = found->second.back();
+        ::rewinddir(dir);
+        while (::readdir(dir)) {
+        }
+        return 0;
+      }
+      case logfs_fuse::kOpReleasedir: {
+        auto found = dirs_.find(record.path);
+        if (found == dirs_.end()) {
+          return kSkipped;
+        }
+        int result = ::closedir(found->second.back());
+        found->second.pop_back();
+        if (found->second.empty()) {
+          dirs_.erase(found);
+        }
+        return result;
+      }
+      default:
+        break;
+    }
+
+    if (!FLAGS_mutations) {
+      return kSkipped;
+    }
+    std::string target = FLAGS_root + record.target;
+    switch (record.op) {
+      case logfs_fuse::kOpMkdir:
+        return ::mkdir(path.c_str(), 0755);
+      case logfs_fuse::kOpRmdir:
+        return ::rmdir(path.c_str());
+      case logfs_fuse::kOpUnlink:
+        return ::unlink(path.c_str());
+      case logfs_fuse::kOpRename:
+        return record.target.empty()
+                   ? kSkipped
+                   : ::rename(path.c_str(), target.c_str());
+      case logfs_fuse::kOpLink:
+        return record.target.empty() ? kSkipped
+                                     : ::link(path.c_str(), target.c_str());
+      case logfs_fuse::kOpSymlink:
+        // logged as the link's path, its contents aren't logged
+        return ::symlink(".", path.c_str());
+      case logfs_fuse::kOpCreate:
+      case logfs_fuse::kOpMknod: {
+        int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+        return fd < 0 ? -1 : ::close(fd);
+      }
+      case logfs_fuse::kOpUtimens:
+        return ::utimensat(AT_FDCWD, path.c_str(), NULL, AT_SYMLINK_NOFOLLOW);
+      default:
+        return kSkipped;
+    }
+  }
+
+  /// Read the next --read_size bytes of a file the log opened, or of the
+  /// start of the file if the log's open was missed
+  int Read(const std::string& mirror_path, const std::string& path) {
+    auto found = fds_.find(mirror_path);
+    if (found == fds_.end()) {
+      int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+      if (fd < 0) {
+        return -1;
+      }
+      ssize_t result = ::pread(fd, buf_.data(), buf_.size(), 0);
+      ::close(fd);
+      return result < 0 ? -1 : 0;
+    }
+    OpenFile& file = found->second.back();
+    ssize_t result = ::pread(file.fd, buf_.data(), buf_.size(), file.offset);
+    if (result < 0) {
+      return -1;
+    }
+    file.offset = result == 0 ? 0 : file.offset + result;
+    return 0;
+  }
+
+  logfs_fuse::Stats* stats_;
+  std::vector<char> buf_;
+  std::unordered_map<std::string, std::vector<OpenFile>> fds_;
+  std::unordered_map<std::string, std::vector<DIR*>> dirs_;
+  uint64_t replayed_;
+  uint64_t skipped_;
+};
+
+const int Replayer::kSkipped;
+
+/// Replay batches from @p shard until it is done
+void ReplayMain(Shard* shard, Replayer* replayer) {
+  std::unique_lock<std::mutex> lock(shard->mutex);
+  while (true) {
+    while (shard->batches.empty() && !shard->done) {
+      shard->ready_cv.wait(lock);
+    }
+    if (shard->batches.empty()) {
+      return;
+    }
+    std::vector<LogRecord> batch = std::move(shard->batches.front());
+    shard->batches.pop_front();
+    shard->replaying = true;
+    lock.unlock();
+    shard->room_cv.notify_one();
+    for (const LogRecord& record : batch) {
+      replayer->Replay(record);
+    }
+    lock.lock();
+    shard->replaying = false;
+    shard->idle_cv.notify_all();
+  }
+}
+
+/// Hand @p batch to @p shard, waiting while it is far behind
+void Enqueue(Shard* shard, std::vector<LogRecord>* batch) {
+  if (batch->empty()) {
+    return;
+  }
+  std::unique_lock<std::mutex> lock(shard->mutex);
+  while (shard->batches.size() >= kMaxQueuedBatches) {
+    shard->room_cv.wait(lock);
+  }
+  shard->batches.push_back(std::move(*batch));
+  lock.unlock();
+  shard->ready_cv.notify_one();
+  batch->clear();
+}
+
+/// Wait until @p shard has replayed everything handed to it
+void Drain(Shard* shard) {
+  std::unique_lock<std::mutex> lock(shard->mutex);
+  while (!shard->batches.empty() || shard->replaying) {
+    shard->idle_cv.wait(lock);
+  }
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  google::InitGoogleLogging(argv[0]);
+  google::SetUsageMessage(kUsageMessage);
+  google::ParseCommandLineFlags(&argc, &argv, true);
+
+  LOG_IF(FATAL, FLAGS_log.empty()) << "--log is required";
+  LOG_IF(FATAL, FLAGS_root.empty()) << "--root is required";
+  LOG_IF(FATAL, FLAGS_threads <= 0) << "--threads must be > 0";
+  LOG_IF(FATAL, FLAGS_rate < 0) << "--rate must be >= 0";
+  LOG_IF(FATAL, FLAGS_read_size <= 0) << "--read_size must be > 0";
+  LOG_IF(FATAL, FLAGS_format != "text" && FLAGS_format != "json")
+      << "--format must be text or json";
+  struct stat root_stat;
+  LOG_IF(FATAL, ::stat(FLAGS_root.c_str(), &root_stat) < 0 ||
+                    !S_ISDIR(root_stat.st_mode))
+      << "Root '" << FLAGS_root << "' isn't a directory";
+  while (FLAGS_root.size() > 1 && FLAGS_root.back() == '/') {
+    FLAGS_root.pop_back();
+  }
+
+  logfs_fuse::Stats stats;
+  std::vector<std::unique_ptr<Shard>> shards;
+  std::vector<std::unique_ptr<Replayer>> replayers;
+  std::vector<std::thread> threads;
+  for (int i = 0; i < FLAGS_threads; i++) {
+    shards.emplace_back(new Shard());
+    replayers.emplace_back(new Replayer(&stats));
+    threads.emplace_back(ReplayMain, shards.back().get(),
+                         replayers.back().get());
+  }
+  std::vector<std::vector<LogRecord>> pending(FLAGS_threads);
+  std::hash<std::string> hash;
+  Replayer mutator(&stats);
+
+  // with a rate, each record has a due time and batches go out early
+  // enough that no thread waits on a partial one
+  int64_t start = logfs_fuse::NowNs();
+  int64_t interval_ns = FLAGS_rate > 0 ? 1e9 / FLAGS_rate : 0;
+  uint64_t records = 0, lines = 0, malformed = 0;
+  for (const std::string& log : logfs_fuse::SplitLogList(FLAGS_log)) {
+    logfs_fuse::LogReader reader(log);
+    PLOG_IF(FATAL, !reader.ok()) << "Failed to open log '" << log << "'";
+    LogRecord record;
+    while (reader.Next(&record)) {
+      if (interval_ns > 0) {
+        int64_t due = start + records * interval_ns;
+        int64_t wait = due - logfs_fuse::NowNs();
+        if (wait > 1000000) {
+          for (int i = 0; i < FLAGS_threads; i++) {
+            Enqueue(shards[i].get(), &pending[i]);
+          }
+          std::this_thread::sleep_for(std::chrono::nanoseconds(wait));
+        }
+      }
+      if (FLAGS_mutations && IsMutation(record.op)) {
+        // a mutation changes what ops on other paths see, e.g. a rename of
+        // their directory, so the ops logged before it finish first and
+        // those after it wait for it
+        for (int i = 0; i < FLAGS_threads; i++) {
+          Enqueue(shards[i].get(), &pending[i]);
+        }
+        for (int i = 0; i < FLAGS_threads; i++) {
+          Drain(shards[i].get());
+        }
+        mutator.Replay(record);
+        records++;
+        continue;
+      }
+      size_t shard = hash(record.path) % FLAGS_threads;
+      pending[shard].push_back(std::move(record));
+      if (pending[shard].size() >= kBatchSize) {
+        Enqueue(shards[shard].get(), &pending[shard]);
+      }
+      records++;
+    }
+    lines += reader.lines();
+    malformed += reader.malformed();
+  }
+
+  for (int i = 0; i < FLAGS_threads; i++) {
+    Enqueue(shards[i].get(), &pending[i]);
+    {
+      std::lock_guard<std::mutex> lock(shards[i]->mutex);
+      shards[i]->done = true;
+    }
+    shards[i]->ready_cv.notify_one();
+  }
+  uint64_t replayed = mutator.replayed(), skipped = mutator.skipped();
+  for (int i = 0; i < FLAGS_threads; i++) {
+    threads[i].join();
+    replayed += replayers[i]->replayed();
+    skipped += replayers[i]->skipped();
+  }
+  replayers.clear();
+  double seconds = (logfs_fuse::NowNs() - start) / 1e9;
+
+  fprintf(stderr,
+          "read %lu lines (%lu malformed), replayed %lu ops and skipped %lu "
+          "in %.2f s, %.0f ops/s\n",
+          lines, malformed, replayed, skipped, seconds, replayed / seconds);
+
+  std::ostringstream report;
+  if (FLAGS_format == "json") {
+    stats.Snapshot().FormatJson(&report);
+    report << "\n";
+  } else {
+    stats.Snapshot().FormatText(&report);
+  }
+  if (FLAGS_output.empty()) {
+    fputs(report.str().c_str(), stdout);
+  } else {
+    std::ofstream out(FLAGS_output.c_str());
+    out << report.str();
+    PLOG_IF(FATAL, !out) << "Failed to write '" << FLAGS_output << "'";
+  }
+  return 0;
+}
@@ -0,0 +1,68 @@
+#include <time.h>
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include "event_ring.h"
+
+DEFINE_string(ring, "/logfs_events",
+              "name of the shared-memory event ring, as given to logfs_fuse "
+              "--event_ring");
+DEFINE_bool(from_start, false,
+            "print the events still in the ring first, not just new ones");
+DEFINE_bool(show_pid, false, "end each line with the accessing pid");
+DEFINE_int32(poll_us, 1000,
+             "microseconds to sleep when there are no new events");
+
+const std::string kUsageMessage =
+    "Prints the accesses logfs_fuse publishes to its shared-memory event "
+    "ring as they happen, in the same format as its access log, and "
+    "reports events missed because the reader fell behind.";
+
+int main(int argc, char** argv) {
+  google::InitGoogleLogging(argv[0]);
+  google::SetUsageMessage(kUsageMessage);
+  google::ParseCommandLineFlags(&argc, &argv, true);
+
+  LOG_IF(FATAL, FLAGS_poll_us <= 0 || FLAGS_poll_us >= 1000000)
+      << "--poll_us must be between 1 and 999999";
+
+  logfs_fuse::EventRingReader reader;
+  int result = reader.Open(FLAGS_ring);
+  LOG_IF(FATAL, result < 0) << "Failed to open event ring '" << FLAGS_ring
+                            << "', [" << -result << "] : "
+                            << strerror(-result);
+  if (FLAGS_from_start) {
+    reader.SeekToOldest();
+  }
+
+  struct timespec idle = {0, FLAGS_poll_us * 1000L};
+  logfs_fuse::Event event;
+  uint64_t reported_lost = 0;
+  while (true) {
+    if (!reader.Next(&event)) {
+      // only touch the kernel when the ring is drained
+      fflush(stdout);
+      nanosleep(&idle, NULL);
+      continue;
+    }
+    if (reader.lost() != reported_lost) {
+      fprintf(stderr, "lost %lu events\n", reader.lost() - reported_lost);
+      reported_lost = reader.lost();
+    }
+    fputs(logfs_fuse::OpName(event.op), stdout);
+    fputs(" :", stdout);
+    fwrite(event.path, 1, event.path_size, stdout);
+    if (event.truncated) {
+      fputs("...", stdout);
+    }
+    if (FLAGS_show_pid) {
+      printf("\t%d", event.pid);
+    }
+    fputc('\n', stdout);
+  }
+}
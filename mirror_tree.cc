@@ -0,0 +1,83 @@
+#include "mirror_tree.h"
+
+#include <cstring>
+
+#include <glog/logging.h>
+
+#include "request_arena.h"
+
+namespace logfs_fuse {
+
+MirrorTree::MirrorTree(const std::string& real_root, const Options& options)
+    : real_root_(real_root),
+      fd_cache_(options.fd_cache_size),
+      completions_(options.completion_threads,
+                   options.completion_queue_depth),
+      write_buffers_(options.write_buffer_size,
+                     options.write_buffer_memory_limit),
+      xattr_cache_(options.xattr_cache_size, options.xattr_cache_ttl),
+      hasher_(options.hash_contents ? options.hash_threads : 0,
+              options.hash_queue_depth, options.hash_manifest_path),
+      pack_(options.pack_readahead),
+      watcher_(real_root, options.watch_batch_seconds),
+      stopped_(false) {
+  if (options.watch_real_tree) {
+    int result = watcher_.Start(
+        [this](const std::string& path, bool below) {
+          InvalidatePath(path, below);
+        },
+        [this] { DropCaches(); });
+    LOG_IF(FATAL, result < 0) << "Failed to watch real tree '" << real_root
+                              << "', [" << -result
+                              << "] : " << strerror(-result);
+  }
+  if (!options.pack_path.empty()) {
+    int result = pack_.Open(options.pack_path);
+    LOG_IF(FATAL, result < 0) << "Failed to open pack file '"
+                              << options.pack_path << "', [" << -result
+                              << "] : " << strerror(-result);
+  }
+}
+
+MirrorTree::~MirrorTree() {
+  Stop();
+}
+
+void MirrorTree::Stop() {
+  if (stopped_) {
+    return;
+  }
+  stopped_ = true;
+  watcher_.Stop();
+  completions_.Drain();
+  if (hasher_.enabled()) {
+    hasher_.Stop();
+    int result = hasher_.WriteManifest();
+    LOG_IF(ERROR, result < 0) << "Failed to write content manifest, ["
+                              << -result << "] : " << strerror(-result);
+  }
+}
+
+void MirrorTree::DropCaches() {
+  fd_cache_.Clear();
+  xattr_cache_.Clear();
+  hasher_.ForgetAll();
+  pack_.InvalidateAll();
+}
+
+void MirrorTree::InvalidatePath(const std::string& path, bool below) {
+  ScratchString wrapped;
+  wrapped->assign(real_root_).append(path);
+  fd_cache_.Invalidate(*wrapped);
+  xattr_cache_.Invalidate(*wrapped);
+  hasher_.Forget(path.c_str());
+  pack_.Invalidate(path.c_str());
+  if (below) {
+    fd_cache_.InvalidateBelow(*wrapped);
+    xattr_cache_.InvalidateBelow(*wrapped);
+    hasher_.ForgetBelow(path);
+    pack_.InvalidateBelow(path);
+  }
+}
+
+}  // namespace logfs_fuse
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <string>
+
+#include "completion_pool.h"
+#include "content_hasher.h"
+#include "fd_cache.h"
+#include "options.h"
+#include "pack_file.h"
+#include "shared_fd_table.h"
+#include "tree_watcher.h"
+#include "write_buffer.h"
+#include "xattr_cache.h"
+
+namespace logfs_fuse {
+
+/// What we keep about a real tree, shared by every mount mirroring it
+/**
+ *  The descriptors, caches, content hashes and pack of a tree only depend
+ *  on the tree, not on the mount or the builds using it. A daemon serving
+ *  several mounts of one sysroot keeps them here once, so memory and the
+ *  cold-start I/O of warming them grow with the number of distinct trees
+ *  rather than the number of mounts, and buffered writes made through one
+ *  mount are flushed before another mount opens the file.
+ *
+ *  The members are only used through the FuseContext of each mount, which
+ *  all must be destroyed before the tree.
+ */
+class MirrorTree {
+ public:
+  /// Sets up the caches for @p real_root as @p options say, and starts
+  /// watching the tree if asked to. The hashes of every mount of the tree
+  /// go to the one manifest at @p options.hash_manifest_path.
+  MirrorTree(const std::string& real_root, const Options& options);
+
+  /// Stops the tree
+  ~MirrorTree();
+
+  const std::string& real_root() const {
+    return real_root_;
+  }
+
+  /// Stop watching, wait for background closes, and finish hashing and
+  /// write the manifest. Later calls do nothing.
+  void Stop();
+
+  /// Empty the fd and xattr caches, forget the content hashes and stop
+  /// using the pack, after changes to the tree were missed
+  void DropCaches();
+
+  /// Drop what the caches hold for the mirror @p path, which was changed
+  /// outside of the mount, and if @p below for everything below it
+  void InvalidatePath(const std::string& path, bool below);
+
+  FdCache* fd_cache() {
+    return &fd_cache_;
+  }
+
+  SharedFdTable* shared_fds() {
+    return &shared_fds_;
+  }
+
+  CompletionPool* completions() {
+    return &completions_;
+  }
+
+  WriteBufferPool* write_buffers() {
+    return &write_buffers_;
+  }
+
+  XattrCache* xattr_cache() {
+    return &xattr_cache_;
+  }
+
+  ContentHasher* hasher() {
+    return &hasher_;
+  }
+
+  PackFile* pack() {
+    return &pack_;
+  }
+
+  TreeWatcher* watcher() {
+    return &watcher_;
+  }
+
+ private:
+  MirrorTree(const MirrorTree&);
+  MirrorTree& operator=(const MirrorTree&);
+
+  std::string real_root_;
+  FdCache fd_cache_;  ///< descriptors for handle-less read/write
+  SharedFdTable shared_fds_;  ///< descriptors shared by read-only opens
+  CompletionPool completions_;  ///< background closes and syncs
+  WriteBufferPool write_buffers_;  ///< merges small sequential writes
+  XattrCache xattr_cache_;  ///< answers repeated getxattr calls
+  ContentHasher hasher_;    ///< hashes files opened for reading
+  PackFile pack_;           ///< serves reads of packed files
+  TreeWatcher watcher_;     ///< invalidates on changes outside the mount
+  bool stopped_;
+};
+
+}  // namespace logfs_fuse
@@ -1,45 +1,135 @@
+#include <cerrno>
+#include <cstring>
+
 #include <gflags/gflags.h>
 #include <glog/logging.h>
 
 #include "access_log.h"
+#include "access_summary.h"
+#include "event_ring.h"
 #include "fuse_context.h"
 #include "fuse_operations.h"
+#include "handoff.h"
 #include "mount_point.h"
+#include "process_table.h"
+#include "segment_log.h"
+#include "stats_server.h"
 
 namespace logfs_fuse {
 
 MountPoint::MountPoint(const std::string& mount, const std::string& real_tree,
-                       const std::string& log_path)
+                       const std::string& log_path, const Options& options,
+                       MirrorTree* tree)
     : mount_point_(mount),
       real_tree_(real_tree),
       log_path_(log_path),
+      options_(options),
+      tree_(tree),
+      process_table_(NULL),
+      log_segments_(NULL),
+      event_ring_(NULL),
+      access_summary_(NULL),
+      stats_server_(NULL),
+      handoff_server_(NULL),
+      handoff_client_(NULL),
+      handed_off_(false),
       fuse_chan_(0),
       fuse_(0),
-      use_mt_(false) {}
+      use_mt_(options.multithreaded),
+      live_context_(NULL) {}
 
 MountPoint::~MountPoint() {
   // fuse_context_ will be destoyed by the destroy fuse op that we
   // implemented
   // delete fuse_context_;
   delete access_log_;
+  delete log_segments_;
+  delete event_ring_;
+  delete access_summary_;
+  delete process_table_;
 }
 
 void MountPoint::Run(int argc, char** argv) {
   // fuse arguments
   fuse_args args = {argc, argv, 0};
 
+  // initialize fuse_ops
+  SetFuseOps(&ops_, options_);
+
+  // create initializer object which is passed to fuse_ops::init
+  AccessSummary::Group group = AccessSummary::kGroupNone;
+  if (options_.summary_group_by == "command") {
+    group = AccessSummary::kGroupCommand;
+  } else if (options_.summary_group_by == "session") {
+    group = AccessSummary::kGroupSession;
+  }
+  if (options_.attribute_processes || group != AccessSummary::kGroupNone) {
+    process_table_ = new ProcessTable(options_.process_table_size,
+                                      options_.process_revalidate_ms);
+  }
+  if (options_.log_summary) {
+    access_summary_ =
+        new AccessSummary(options_.summary_max_paths, options_.summary_path,
+                          options_.summary_interval, group);
+    access_summary_->Start();
+  }
+  bool segmented =
+      options_.log_segment_bytes > 0 || options_.log_segment_seconds > 0;
+  if (options_.log_events && segmented) {
+    log_segments_ = new SegmentWriter(
+        log_path_, options_.log_segment_bytes, options_.log_segment_seconds,
+        options_.log_segments_kept, options_.log_compress,
+        options_.log_flush_interval);
+    int result = log_segments_->Start();
+    LOG_IF(FATAL, result < 0) << "Failed to start segmented log '"
+                              << log_path_ << "', [" << -result << "] : "
+                              << strerror(-result);
+  }
+  if (!options_.event_ring.empty()) {
+    event_ring_ = new EventRing();
+    int result =
+        event_ring_->Create(options_.event_ring, options_.event_ring_size);
+    LOG_IF(FATAL, result < 0) << "Failed to create event ring '"
+                              << options_.event_ring << "', [" << -result
+                              << "] : " << strerror(-result);
+  }
+  access_log_ = new AccessLog(
+      options_.log_events && !segmented ? log_path_ : "", log_segments_,
+      event_ring_, access_summary_, process_table_);
+  if (tree_) {
+    fuse_context_ = new FuseContext(tree_, access_log_, options_);
+  } else {
+    fuse_context_ = new FuseContext(real_tree_, access_log_, options_);
+  }
+  {
+    std::lock_guard<std::mutex> lock(live_mutex_);
+    live_context_ = fuse_context_;
+  }
+
+  // warm the caches from, and then detach, the process we replace
+  if (!options_.takeover_socket.empty()) {
+    TakeOver();
+  }
+
+  // the stats of a shared tree's mounts are served together. A process we
+  // took over from has closed its socket by now.
+  if (options_.stats && !tree_) {
+    FuseContext* fuse_context = fuse_context_;
+    stats_server_ = new StatsServer(
+        options_.stats_path, options_.stats_socket, options_.stats_json,
+        [fuse_context](bool json) { return fuse_context->FormatStats(json); });
+    if (access_summary_) {
+      AccessSummary* summary = access_summary_;
+      stats_server_->AddSignalHook([summary] { summary->Write(); });
+    }
+    stats_server_->Start();
+  }
+
   // create the mount point
   fuse_chan_ = fuse_mount(mount_point_.c_str(), &args);
   if (!fuse_chan_)
     LOG(FATAL) << "Failed to fuse_mount " << mount_point_;
 
-  // initialize fuse_ops
-  SetFuseOps(&ops_);
-
-  // create initializer object which is passed to fuse_ops::init
-  access_log_ = new AccessLog(log_path_);
-  fuse_context_ = new FuseContext(real_tree_, access_log_);
-
   // initialize fuse
   fuse_ = fuse_new(fuse_chan_, &args, &ops_, sizeof(ops_), fuse_context_);
   if (!fuse_) {
@@ -48,6 +138,28 @@ void MountPoint::Run(int argc, char** argv) {
     LOG(FATAL) << "Failed to fuse_new";
   }
 
+  if (!options_.handoff_socket.empty()) {
+    FuseContext* fuse_context = fuse_context_;
+    handoff_server_ = new HandoffServer(
+        options_.handoff_socket, log_path_,
+        [fuse_context] { return fuse_context->SaveSnapshot(); },
+        [this] { return Detach(); });
+    HandoffServer* handoff_server = handoff_server_;
+    fuse_context_->ReportChanges(
+        [handoff_server](const std::string& path, bool below) {
+          handoff_server->Changed(path, below);
+        });
+    handoff_server_->Start();
+  }
+
+  // warm the caches before, or while, serving requests
+  if (!options_.prefetch_log.empty()) {
+    fuse_context_->prefetcher()->Start(options_.prefetch_log);
+    if (options_.prefetch_wait) {
+      fuse_context_->prefetcher()->Wait();
+    }
+  }
+
   // start the main fuse loop
   LOG(INFO) << "MountPoint::main: " << static_cast<void*>(this)
             << "entering fuse loop\n";
@@ -59,8 +171,94 @@ void MountPoint::Run(int argc, char** argv) {
 
   LOG(INFO) << "MountPoint::main: " << static_cast<void*>(this)
             << "exiting fuse loop\n";
-  fuse_unmount(mount_point_.c_str(), fuse_chan_);
+
+  // the fuse context goes away in fuse_destroy, stop reporting on it and
+  // invalidating it first. Detach() uses the stats server on the handoff
+  // thread, which goes first.
+  delete handoff_server_;
+  handoff_server_ = NULL;
+  delete handoff_client_;
+  handoff_client_ = NULL;
+  delete stats_server_;
+  stats_server_ = NULL;
+  {
+    std::lock_guard<std::mutex> lock(live_mutex_);
+    live_context_ = NULL;
+  }
+
+  // once detached the mount point is our successor's, fuse_destroy closes
+  // our channel without touching it
+  if (!handed_off_) {
+    fuse_unmount(mount_point_.c_str(), fuse_chan_);
+  }
   fuse_destroy(fuse_);
+
+  // nothing is logged after the context is gone
+  if (log_segments_) {
+    log_segments_->Stop();
+  }
+
+  if (access_summary_) {
+    access_summary_->Stop();
+    int result = access_summary_->Write();
+    LOG_IF(ERROR, result < 0) << "Failed to write access summary '"
+                              << options_.summary_path << "', [" << -result
+                              << "] : " << strerror(-result);
+  }
+}
+
+std::string MountPoint::FormatStats(bool json) {
+  std::lock_guard<std::mutex> lock(live_mutex_);
+  return live_context_ ? live_context_->FormatStats(json) : "";
+}
+
+int MountPoint::WriteSummary() {
+  std::lock_guard<std::mutex> lock(live_mutex_);
+  return live_context_ && access_summary_ ? access_summary_->Write() : 0;
+}
+
+void MountPoint::TakeOver() {
+  handoff_client_ = new HandoffClient();
+  std::string old_log_path, snapshot;
+  int result = handoff_client_->Receive(options_.takeover_socket,
+                                        &old_log_path, &snapshot);
+  LOG_IF(FATAL, result < 0) << "Failed to take over from '"
+                            << options_.takeover_socket << "', [" << -result
+                            << "] : " << strerror(-result);
+  // it goes on logging accesses by its remaining users
+  LOG_IF(FATAL, old_log_path == log_path_)
+      << "The process being taken over is still writing '" << log_path_
+      << "', give this one its own --log_path";
+
+  LOG_IF(WARNING, !snapshot.empty() && !fuse_context_->LoadSnapshot(snapshot))
+      << "Ignoring the warm state of the process being taken over, it "
+         "mirrors another tree or is another version";
+
+  // what its remaining users change mustn't be served from our caches
+  FuseContext* fuse_context = fuse_context_;
+  result = handoff_client_->Detach(
+      [fuse_context](const std::string& path, bool below) {
+        fuse_context->InvalidatePath(path, below);
+      },
+      [fuse_context] { fuse_context->DropCaches(); });
+  LOG_IF(FATAL, result < 0) << "Process being taken over failed to detach "
+                            << mount_point_ << ", [" << -result
+                            << "] : " << strerror(-result);
+}
+
+int MountPoint::Detach() {
+  std::string cmd = "fusermount -u -z " + mount_point_;
+  LOG(INFO) << "MountPoint::Detach: " << cmd;
+
+  if (system(cmd.c_str()) != 0) {
+    return -EBUSY;
+  }
+  handed_off_ = true;
+  // our successor listens on the stats socket
+  if (stats_server_) {
+    stats_server_->CloseSocket();
+  }
+  return 0;
 }
 
 void MountPoint::Unmount() {
@@ -1,12 +1,23 @@
 #pragma once
 
+#include <atomic>
+#include <mutex>  // NOLINT(build/c++11)
 #include <string>
 #include "fuse_include.h"
+#include "options.h"
 
 namespace logfs_fuse {
 
 class AccessLog;
+class AccessSummary;
+class EventRing;
+class ProcessTable;
+class SegmentWriter;
 class FuseContext;
+class HandoffClient;
+class HandoffServer;
+class MirrorTree;
+class StatsServer;
 
 /// encapsulates the path to a mount point, the fuse channel, and fuse object
 /// for the fuse filesystem mounted at that point
@@ -15,21 +26,75 @@ class MountPoint {
   std::string mount_point_;  ///< path to the mount point
   std::string real_tree_;    ///< path to the real tree we are mirroring
   std::string log_path_;     ///< path to the logfile to write to
+  Options options_;          ///< tunables passed on to the fuse context
+  MirrorTree* tree_;         ///< shared with other mounts, or NULL
 
+  ProcessTable* process_table_;    ///< attributes accesses, or NULL
+  SegmentWriter* log_segments_;    ///< writes a segmented log, or NULL
+  EventRing* event_ring_;          ///< publishes accesses, or NULL
+  AccessSummary* access_summary_;  ///< per-path totals, or NULL
   AccessLog* access_log_;      ///< where we log accesses to
   FuseContext* fuse_context_;  ///< our fuse context
+  StatsServer* stats_server_;  ///< reports fuse_context_'s stats, or NULL
+  HandoffServer* handoff_server_;  ///< hands the mount over, or NULL
+  HandoffClient* handoff_client_;  ///< follows who we took over, or NULL
+  std::atomic<bool> handed_off_;   ///< the mount has been detached
   fuse_chan* fuse_chan_;       ///< channel from fuse_mount
   fuse* fuse_;                 ///< fuse struct from fuse_new
   fuse_operations ops_;        ///< fuse operations
   bool use_mt_;                ///< use multi threaded loop
 
+  std::mutex live_mutex_;       ///< guards live_context_
+  FuseContext* live_context_;  ///< fuse_context_ while it exists, or NULL
+
+  /// Take the mount over from the logfs_fuse serving it, which hands us its
+  /// warm state and detaches once we have loaded it
+  /**
+   *  Until it exits, the paths it reports as changed by its remaining
+   *  users are invalidated in our caches. Nothing is mounted from its
+   *  detach until we mount.
+   */
+  void TakeOver();
+
+  /// Lazily unmount for a process taking over, return 0 or -errno
+  /**
+   *  The mount leaves the namespace at once, but processes with files open
+   *  or their working directory in it keep being served by us until they
+   *  let go of it, which ends the fuse loop. The stats socket is closed
+   *  for the process taking over to listen on.
+   */
+  int Detach();
+
  public:
-  MountPoint(const std::string& Run, const std::string& real_tree,
-             const std::string& log_path);
+  /// Mirror @p real_tree at @p mount, logging accesses to @p log_path
+  /**
+   *  With a @p tree the mount shares its caches with the other mounts of
+   *  the tree, and leaves serving stats to whoever runs them all, through
+   *  FormatStats() and WriteSummary().
+   */
+  MountPoint(const std::string& mount, const std::string& real_tree,
+             const std::string& log_path, const Options& options,
+             MirrorTree* tree = NULL);
   ~MountPoint();
 
   void Run(int argc, char** argv);
 
+  const std::string& mount_point() const {
+    return mount_point_;
+  }
+
+  const std::string& real_tree() const {
+    return real_tree_;
+  }
+
+  /// Return the stats report of the mount, or an empty string if it isn't
+  /// mounted. May be called from any thread.
+  std::string FormatStats(bool json);
+
+  /// Write the access summary if there is one, return 0 or -errno. May be
+  /// called from any thread.
+  int WriteSummary();
+
   /// calls fusermount -u
   /**
    *  note: it seems that it would be reasonable to call fuse_exit
@@ -0,0 +1,158 @@
+#include "mount_set.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <thread>  // NOLINT(build/c++11)
+
+#include <boost/filesystem.hpp>
+#include <glog/logging.h>
+
+#include "mirror_tree.h"
+#include "mount_point.h"
+#include "stats_server.h"
+
+namespace logfs_fuse {
+
+bool ReadMountsConfig(const std::string& path,
+                      std::vector<MountConfig>* mounts, std::string* error) {
+  std::ifstream in(path.c_str());
+  if (!in) {
+    *error = "can't read '" + path + "'";
+    return false;
+  }
+
+  std::string line;
+  for (int line_number = 1; std::getline(in, line); ++line_number) {
+    std::istringstream fields(line);
+    MountConfig mount;
+    if (!(fields >> mount.mount_point) || mount.mount_point[0] == '#') {
+      continue;
+    }
+    std::string extra;
+    if (!(fields >> mount.real_tree >> mount.log_path) || fields >> extra) {
+      *error = path + ":" + std::to_string(line_number) +
+               ": expected a mount point, real tree and log path";
+      return false;
+    }
+    mounts->push_back(mount);
+  }
+  return true;
+}
+
+// write @p value as a JSON string
+static void WriteJsonString(const std::string& value, std::ostream* out) {
+  *out << '"';
+  for (char c : value) {
+    if (c == '"' || c == '\\') {
+      *out << '\\' << c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      char escaped[8];
+      snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+      *out << escaped;
+    } else {
+      *out << c;
+    }
+  }
+  *out << '"';
+}
+
+MountSet::MountSet(const std::vector<MountConfig>& mounts,
+                   const Options& options)
+    : options_(options) {
+  for (const MountConfig& config : mounts) {
+    Options mount_options = options;
+    mount_options.summary_path = config.log_path + ".summary.csv";
+    mount_options.hash_manifest_path = config.log_path + ".hashes";
+    mount_options.trace_path = config.log_path + ".trace.json";
+
+    // the tree, and with it the hasher writing the manifest, is set up
+    // with the options of its first mount
+    std::string key = boost::filesystem::canonical(config.real_tree).string();
+    MirrorTree*& tree = trees_[key];
+    if (tree) {
+      mount_options.prefetch_log.clear();
+    } else {
+      tree = new MirrorTree(config.real_tree, mount_options);
+    }
+    mounts_.push_back(new MountPoint(config.mount_point, config.real_tree,
+                                     config.log_path, mount_options, tree));
+  }
+}
+
+MountSet::~MountSet() {
+  // the trees outlive the fuse contexts using them
+  for (MountPoint* mount : mounts_) {
+    delete mount;
+  }
+  for (const auto& pair : trees_) {
+    delete pair.second;
+  }
+}
+
+void MountSet::Run(int argc, char** argv) {
+  StatsServer* stats_server = NULL;
+  if (options_.stats) {
+    stats_server = new StatsServer(
+        options_.stats_path, options_.stats_socket, options_.stats_json,
+        [this](bool json) { return FormatStats(json); });
+    if (options_.log_summary) {
+      std::vector<MountPoint*> mounts = mounts_;
+      stats_server->AddSignalHook([mounts] {
+        for (MountPoint* mount : mounts) {
+          int result = mount->WriteSummary();
+          LOG_IF(ERROR, result < 0) << "Failed to write access summary of "
+                                    << mount->mount_point() << ", ["
+                                    << -result << "] : " << strerror(-result);
+        }
+      });
+    }
+    stats_server->Start();
+  }
+
+  std::vector<std::thread> threads;
+  for (MountPoint* mount : mounts_) {
+    threads.push_back(
+        std::thread([mount, argc, argv] { mount->Run(argc, argv); }));
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+
+  delete stats_server;
+  for (const auto& pair : trees_) {
+    pair.second->Stop();
+  }
+}
+
+std::string MountSet::FormatStats(bool json) {
+  std::ostringstream out;
+  if (json) {
+    out << "{\"mounts\": [";
+    for (size_t i = 0; i < mounts_.size(); ++i) {
+      std::string report = mounts_[i]->FormatStats(true);
+      if (report.empty()) {
+        report = "null";
+      } else if (report.back() == '\n') {
+        report.erase(report.size() - 1);
+      }
+      out << (i > 0 ? ", " : "") << "{\"mount_point\": ";
+      WriteJsonString(mounts_[i]->mount_point(), &out);
+      out << ", \"real_tree\": ";
+      WriteJsonString(mounts_[i]->real_tree(), &out);
+      out << ", \"stats\": " << report << "}";
+    }
+    out << "]}\n";
+  } else {
+    for (MountPoint* mount : mounts_) {
+      std::string report = mount->FormatStats(false);
+      out << "mount " << mount->mount_point() << " of "
+          << mount->real_tree() << ":\n"
+          << (report.empty() ? "not mounted\n" : report);
+    }
+  }
+  return out.str();
+}
+
+}  // namespace logfs_fuse
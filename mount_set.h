@@ -0,0 +1,65 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "options.h"
+
+namespace logfs_fuse {
+
+class MirrorTree;
+class MountPoint;
+
+/// One mount of a mounts config file
+struct MountConfig {
+  std::string mount_point;  ///< where to mount the mirror
+  std::string real_tree;    ///< the tree it mirrors
+  std::string log_path;     ///< the access log of the mount's builds
+};
+
+/// Read the mounts config at @p path into @p mounts
+/**
+ *  Each line holds the mount point, real tree and log path of one mount,
+ *  separated by whitespace. Blank lines and lines starting with # are
+ *  skipped. Return false with a description of the first bad line in
+ *  @p error if the file can't be read or a line doesn't have three fields.
+ */
+bool ReadMountsConfig(const std::string& path,
+                      std::vector<MountConfig>* mounts, std::string* error);
+
+/// Serves several mounts from one process
+/**
+ *  Every mount runs its own fuse loop on its own thread and writes its own
+ *  access log, so the builds using one mount are logged apart from those
+ *  using another. Mounts of the same real tree share a MirrorTree, so
+ *  dozens of builds of one sysroot keep one set of caches between them.
+ *  Only the first mount of each tree prefetches, since the others would
+ *  warm the same caches again.
+ *
+ *  The access summary and trace of each mount are named after that mount's
+ *  log path. The content hashes belong to the tree, so mounts sharing a
+ *  tree share one manifest, named after the log path of its first mount.
+ *  Stats of all mounts are served together from one StatsServer.
+ */
+class MountSet {
+ public:
+  MountSet(const std::vector<MountConfig>& mounts, const Options& options);
+  ~MountSet();
+
+  /// Mount everything and serve until every mount has been unmounted
+  void Run(int argc, char** argv);
+
+ private:
+  MountSet(const MountSet&);
+  MountSet& operator=(const MountSet&);
+
+  /// Return the reports of every mount, under its mount point
+  std::string FormatStats(bool json);
+
+  Options options_;
+  std::map<std::string, MirrorTree*> trees_;  ///< by canonical real tree
+  std::vector<MountPoint*> mounts_;
+};
+
+}  // namespace logfs_fuse
@@ -0,0 +1,33 @@
+#include "op.h"
+
+#include <cstring>
+
+namespace logfs_fuse {
+
+static const char* kOpNames[kNumOps] = {
+    "getattr",   "readlink",  "mknod",      "mkdir",       "unlink",
+    "rmdir",     "symlink",   "rename",     "link",        "chmod",
+    "chown",     "truncate",  "open",       "read",        "write",
+    "statfs",    "flush",     "release",    "fsync",       "setxattr",
+    "getxattr",  "listxattr", "removexattr", "opendir",    "readdir",
+    "releasedir", "fsyncdir", "access",     "create",      "ftruncate",
+    "fgetattr",  "lock",      "utimens",    "bmap",        "ioctl",
+    "poll"};
+
+const char* OpName(Op op) {
+  if (op < 0 || op >= kNumOps) {
+    return "unknown";
+  }
+  return kOpNames[op];
+}
+
+Op OpFromName(const char* name) {
+  for (int i = 0; i < kNumOps; i++) {
+    if (strcmp(kOpNames[i], name) == 0) {
+      return static_cast<Op>(i);
+    }
+  }
+  return kNumOps;
+}
+
+}  // namespace logfs_fuse
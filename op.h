@@ -0,0 +1,52 @@
+#pragma once
+
+namespace logfs_fuse {
+
+/// The fuse operations we implement, for indexing per-operation state
+enum Op {
+  kOpGetattr = 0,
+  kOpReadlink,
+  kOpMknod,
+  kOpMkdir,
+  kOpUnlink,
+  kOpRmdir,
+  kOpSymlink,
+  kOpRename,
+  kOpLink,
+  kOpChmod,
+  kOpChown,
+  kOpTruncate,
+  kOpOpen,
+  kOpRead,
+  kOpWrite,
+  kOpStatfs,
+  kOpFlush,
+  kOpRelease,
+  kOpFsync,
+  kOpSetxattr,
+  kOpGetxattr,
+  kOpListxattr,
+  kOpRemovexattr,
+  kOpOpendir,
+  kOpReaddir,
+  kOpReleasedir,
+  kOpFsyncdir,
+  kOpAccess,
+  kOpCreate,
+  kOpFtruncate,
+  kOpFgetattr,
+  kOpLock,
+  kOpUtimens,
+  kOpBmap,
+  kOpIoctl,
+  kOpPoll,
+  kNumOps
+};
+
+/// Return the name of @p op, the same as the fuse_operations member
+const char* OpName(Op op);
+
+/// Return the op named @p name, or kNumOps if there is no such op
+Op OpFromName(const char* name);
+
+}  // namespace logfs_fuse
@@ -0,0 +1,198 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace logfs_fuse {
+
+/// Tunables for a mirror, filled in from the command line flags by main()
+struct Options {
+  /// number of descriptors kept open for handle-less read/write calls, zero
+  /// disables the cache
+  size_t fd_cache_size = 64;
+
+  /// read-only opens of the same inode share one real-tree descriptor
+  bool share_readonly_fds = true;
+
+  /// number of background threads used for closes in release(), zero
+  /// closes synchronously
+  size_t completion_threads = 2;
+
+  /// maximum number of queued background closes before release() falls
+  /// back to closing synchronously
+  size_t completion_queue_depth = 256;
+
+  /// hint the kernel to drop cached pages of a file when it is released
+  bool fadvise_dontneed_on_close = false;
+
+  /// fdatasync files written through a handle in the background when the
+  /// handle is released. An fsync() requested by the caller is always
+  /// synchronous.
+  bool deferred_sync = false;
+
+  /// size of the per-handle buffer used to merge small sequential writes,
+  /// zero disables write buffering
+  size_t write_buffer_size = 0;
+
+  /// total memory all write buffers may use, handles opened beyond this
+  /// are unbuffered
+  size_t write_buffer_memory_limit = 64 << 20;
+
+  /// number of files whose extended attributes are cached, zero disables
+  /// the cache
+  size_t xattr_cache_size = 4096;
+
+  /// seconds after which cached extended attributes are looked up again,
+  /// bounding how stale they get if changed outside of the mount
+  double xattr_cache_ttl = 10.0;
+
+  /// watch the real tree with inotify and drop what is cached for files
+  /// changed outside of the mount
+  bool watch_real_tree = false;
+
+  /// seconds over which changes to the real tree are coalesced before the
+  /// caches are invalidated
+  double watch_batch_seconds = 0.05;
+
+  /// record per-op counters and latency histograms
+  bool stats = true;
+
+  /// file to write a stats report to on SIGUSR1, empty for the INFO log
+  std::string stats_path;
+
+  /// unix socket on which to serve stats reports, empty for none
+  std::string stats_socket;
+
+  /// write stats reports as JSON rather than text
+  bool stats_json = false;
+
+  /// name of the virtual control directory in the root of the mirror,
+  /// empty for none
+  std::string control_dir = ".logfs";
+
+  /// include the control directory in listings of the root
+  bool list_control_dir = false;
+
+  /// hash the contents of files opened for reading in the background and
+  /// write a manifest of the hashes on unmount
+  bool hash_contents = false;
+
+  /// number of threads hashing files
+  size_t hash_threads = 2;
+
+  /// most files waiting to be hashed, further files are hashed on a later
+  /// open
+  size_t hash_queue_depth = 65536;
+
+  /// file the hashes are written to
+  std::string hash_manifest_path;
+
+  /// start tracing ops when mounted, rather than from the control directory
+  bool trace = false;
+
+  /// let traces be started and stopped through the control directory. Ops
+  /// are only dispatched through the tracer with this or trace set.
+  bool trace_control = false;
+
+  /// file that traces are written to when tracing stops
+  std::string trace_path = "/tmp/logfs_trace.json";
+
+  /// most ops recorded in one trace, later ops are dropped
+  size_t trace_max_events = 1000000;
+
+  /// access log of a previous run whose paths are prefetched on mount,
+  /// empty for none
+  std::string prefetch_log;
+
+  /// number of threads prefetching
+  size_t prefetch_threads = 8;
+
+  /// read ahead the contents of files the previous run opened, not just
+  /// their metadata
+  bool prefetch_contents = true;
+
+  /// most bytes of file contents read ahead, zero for no limit
+  int64_t prefetch_max_bytes = 0;
+
+  /// finish prefetching before serving requests
+  bool prefetch_wait = false;
+
+  /// pack file written by logfs_pack whose files reads are served from,
+  /// empty for none
+  std::string pack_path;
+
+  /// bytes of the pack read ahead of the furthest read, zero to leave it
+  /// to the kernel
+  size_t pack_readahead = 16 << 20;
+
+  /// write one line per access to the log file
+  bool log_events = true;
+
+  /// keep per-path access totals and write them as CSV on unmount
+  bool log_summary = false;
+
+  /// start a new log segment once the current one reaches this size
+  uint64_t log_segment_bytes = 0;
+
+  /// start a new log segment once the current one is this many seconds old
+  double log_segment_seconds = 0;
+
+  /// number of finished log segments kept, zero to keep all
+  size_t log_segments_kept = 0;
+
+  /// deflate blocks of log segments
+  bool log_compress = true;
+
+  /// seconds between writes of buffered lines to the current segment
+  double log_flush_interval = 1.0;
+
+  /// name of a shared-memory ring accesses are published to, empty for none
+  std::string event_ring;
+
+  /// number of events the ring holds, a power of two
+  uint64_t event_ring_size = 1 << 16;
+
+  /// file the per-path totals are written to
+  std::string summary_path;
+
+  /// seconds between writes of the per-path totals, zero only writes them
+  /// on unmount and SIGUSR1
+  double summary_interval = 0;
+
+  /// most paths the summary holds, accesses to further paths are dropped
+  size_t summary_max_paths = 1 << 20;
+
+  /// split the summary totals of each path by "command" or "session" of
+  /// the accessing process, empty for no split
+  std::string summary_group_by;
+
+  /// end each log line with the command, pid and session of the accessing
+  /// process
+  bool attribute_processes = false;
+
+  /// number of processes whose command and session are remembered
+  size_t process_table_size = 4096;
+
+  /// milliseconds after which a remembered process is looked up again, in
+  /// case its pid has been reused
+  int64_t process_revalidate_ms = 1000;
+
+  /// serve requests from several threads rather than one
+  bool multithreaded = false;
+
+  /// CPUs the threads serving requests are pinned to, one each, empty to
+  /// leave them unpinned
+  std::vector<int> worker_cpus;
+
+  /// unix socket on which a newly started logfs_fuse can take the mount
+  /// over, empty for none
+  std::string handoff_socket;
+
+  /// handoff socket of the running logfs_fuse to take the mount over from,
+  /// empty to mount afresh
+  std::string takeover_socket;
+};
+
+}  // namespace logfs_fuse
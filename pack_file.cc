@@ -0,0 +1,354 @@
+#include "pack_file.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include "clock.h"
+#include "path_prefix.h"
+
+namespace logfs_fuse {
+
+const char kPackMagic[8] = {'L', 'O', 'G', 'F', 'S', 'P', 'K', '1'};
+
+// largest single readahead(2), so that unmounting is never long delayed
+static const uint64_t kReadaheadChunk = 2 << 20;
+
+// write all of @p size bytes of @p data to @p fd at @p offset
+static int PwriteAll(int fd, const void* data, size_t size, uint64_t offset) {
+  const char* bytes = static_cast<const char*>(data);
+  for (size_t written = 0; written < size;) {
+    ssize_t result =
+        ::pwrite(fd, bytes + written, size - written, offset + written);
+    if (result < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -errno;
+    }
+    written += result;
+  }
+  return 0;
+}
+
+PackWriter::PackWriter() : fd_(-1), offset_(sizeof(PackHeader)) {}
+
+PackWriter::~PackWriter() {
+  if (fd_ >= 0) {
+    ::close(fd_);
+  }
+}
+
+int PackWriter::Open(const std::string& path) {
+  fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  return fd_ < 0 ? -errno : 0;
+}
+
+int PackWriter::Add(const std::string& mirror_path, int fd,
+                    const struct stat& st) {
+  // copy in the kernel where the filesystems allow it
+  loff_t in_offset = 0;
+  loff_t out_offset = offset_;
+  uint64_t copied = 0;
+  bool kernel_copy = true;
+  std::vector<char> buf;
+  while (copied < static_cast<uint64_t>(st.st_size)) {
+    size_t want = st.st_size - copied;
+    ssize_t result = -1;
+    if (kernel_copy) {
+      result = ::copy_file_range(fd, &in_offset, fd_, &out_offset, want, 0);
+      if (result < 0 && (errno == EXDEV || errno == ENOSYS ||
+                         errno == EINVAL || errno == EOPNOTSUPP)) {
+        kernel_copy = false;
+        continue;
+      }
+    } else {
+      buf.resize(1 << 20);
+      result = ::pread(fd, buf.data(), std::min(want, buf.size()), copied);
+      if (result > 0) {
+        int error = PwriteAll(fd_, buf.data(), result, offset_ + copied);
+        if (error < 0) {
+          return error;
+        }
+      }
+    }
+    if (result < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -errno;
+    }
+    if (result == 0) {
+      // the file shrank
+      return -EAGAIN;
+    }
+    copied += result;
+  }
+
+  struct stat after;
+  if (::fstat(fd, &after) < 0) {
+    return -errno;
+  }
+  if (after.st_size != st.st_size || MtimeNs(after) != MtimeNs(st)) {
+    // the next file overwrites what we copied
+    return -EAGAIN;
+  }
+
+  Entry entry;
+  entry.path = mirror_path;
+  entry.offset = offset_;
+  entry.size = st.st_size;
+  entry.mtime_ns = MtimeNs(st);
+  entries_.push_back(entry);
+  offset_ += st.st_size;
+  return 0;
+}
+
+int PackWriter::Finish() {
+  std::string index;
+  for (const Entry& entry : entries_) {
+    uint32_t path_size = entry.path.size();
+    index.append(reinterpret_cast<const char*>(&entry.offset),
+                 sizeof(entry.offset));
+    index.append(reinterpret_cast<const char*>(&entry.size),
+                 sizeof(entry.size));
+    index.append(reinterpret_cast<const char*>(&entry.mtime_ns),
+                 sizeof(entry.mtime_ns));
+    index.append(reinterpret_cast<const char*>(&path_size),
+                 sizeof(path_size));
+    index.append(entry.path);
+  }
+
+  PackHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, kPackMagic, sizeof(header.magic));
+  header.version = kPackVersion;
+  header.num_entries = entries_.size();
+  header.index_offset = offset_;
+  header.index_size = index.size();
+
+  // the header goes last, so an interrupted pack is never mistaken for one
+  int result = PwriteAll(fd_, index.data(), index.size(), offset_);
+  if (result == 0) {
+    result = PwriteAll(fd_, &header, sizeof(header), 0);
+  }
+  if (::close(fd_) < 0 && result == 0) {
+    result = -errno;
+  }
+  fd_ = -1;
+  return result;
+}
+
+PackFile::PackFile(size_t readahead)
+    : readahead_(readahead),
+      fd_(-1),
+      size_(0),
+      wanted_(0),
+      done_(0),
+      stopping_(false),
+      opens_(0),
+      mismatches_(0),
+      reads_(0),
+      bytes_(0),
+      readahead_bytes_(0) {}
+
+PackFile::~PackFile() {
+  if (thread_.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopping_ = true;
+    }
+    wanted_cv_.notify_all();
+    thread_.join();
+  }
+  if (fd_ >= 0) {
+    ::close(fd_);
+  }
+}
+
+int PackFile::Open(const std::string& path) {
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return -errno;
+  }
+
+  struct stat st;
+  PackHeader header;
+  if (::fstat(fd, &st) < 0 ||
+      ::pread(fd, &header, sizeof(header), 0) !=
+          static_cast<ssize_t>(sizeof(header))) {
+    ::close(fd);
+    return -EINVAL;
+  }
+  uint64_t size = st.st_size;
+  if (memcmp(header.magic, kPackMagic, sizeof(header.magic)) != 0 ||
+      header.version != kPackVersion || header.index_offset > size ||
+      header.index_size > size - header.index_offset) {
+    ::close(fd);
+    return -EINVAL;
+  }
+
+  std::vector<char> index(header.index_size);
+  if (::pread(fd, index.data(), index.size(), header.index_offset) !=
+          static_cast<ssize_t>(index.size()) ||
+      !ParseIndex(index, header.num_entries)) {
+    ::close(fd);
+    return -EINVAL;
+  }
+  for (const auto& path_entry : index_) {
+    if (path_entry.second->offset + path_entry.second->size >
+        header.index_offset) {
+      ::close(fd);
+      index_.clear();
+      return -EINVAL;
+    }
+  }
+
+  // the kernel's own readahead doubles its window for sequential access
+  ::posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+  fd_ = fd;
+  size_ = header.index_offset;
+  if (readahead_ > 0) {
+    thread_ = std::thread(&PackFile::ReadaheadMain, this);
+  }
+  return 0;
+}
+
+bool PackFile::ParseIndex(const std::vector<char>& index,
+                          uint32_t num_entries) {
+  const size_t kFixedSize = 3 * sizeof(uint64_t) + sizeof(uint32_t);
+  if (num_entries > index.size() / kFixedSize) {
+    return false;
+  }
+  entries_.reset(new Entry[num_entries]);
+  size_t position = 0;
+  for (uint32_t i = 0; i < num_entries; i++) {
+    if (index.size() - position < kFixedSize) {
+      return false;
+    }
+    Entry& entry = entries_[i];
+    uint32_t path_size;
+    memcpy(&entry.offset, &index[position], sizeof(entry.offset));
+    memcpy(&entry.size, &index[position + 8], sizeof(entry.size));
+    memcpy(&entry.mtime_ns, &index[position + 16], sizeof(entry.mtime_ns));
+    memcpy(&path_size, &index[position + 24], sizeof(path_size));
+    position += kFixedSize;
+    if (index.size() - position < path_size) {
+      return false;
+    }
+    entry.stale = false;
+    index_[std::string(&index[position], path_size)] = &entry;
+    position += path_size;
+  }
+  return true;
+}
+
+const PackFile::Entry* PackFile::FindImpl(const char* mirror_path,
+                                          const struct stat& st) {
+  auto found = index_.find(mirror_path);
+  if (found == index_.end() || found->second->stale) {
+    return NULL;
+  }
+
+  const Entry* entry = found->second;
+  if (static_cast<uint64_t>(st.st_size) != entry->size ||
+      MtimeNs(st) != entry->mtime_ns) {
+    mismatches_++;
+    return NULL;
+  }
+  opens_++;
+  return entry;
+}
+
+void PackFile::InvalidateImpl(const char* mirror_path) {
+  auto found = index_.find(mirror_path);
+  if (found != index_.end()) {
+    found->second->stale = true;
+  }
+}
+
+void PackFile::InvalidateBelowImpl(const std::string& mirror_dir) {
+  for (const auto& pair : index_) {
+    if (IsBelow(pair.first.data(), pair.first.size(), mirror_dir)) {
+      pair.second->stale = true;
+    }
+  }
+}
+
+void PackFile::InvalidateAllImpl() {
+  for (const auto& pair : index_) {
+    pair.second->stale = true;
+  }
+}
+
+int PackFile::Read(const Entry& entry, char* buf, size_t size,
+                   off_t offset) {
+  if (offset < 0) {
+    return -EINVAL;
+  }
+  if (static_cast<uint64_t>(offset) >= entry.size) {
+    return 0;
+  }
+  size = std::min<uint64_t>(size, entry.size - offset);
+  uint64_t position = entry.offset + offset;
+
+  if (readahead_ > 0) {
+    // wake the readahead thread once per quarter window of progress, the
+    // unlocked check keeps most reads off the mutex
+    uint64_t target = std::min(position + size + readahead_, size_);
+    if (target > wanted_.load() + readahead_ / 4) {
+      std::unique_lock<std::mutex> lock(mutex_);
+      if (target > wanted_.load()) {
+        wanted_ = target;
+      }
+      lock.unlock();
+      wanted_cv_.notify_one();
+    }
+  }
+
+  ssize_t result = ::pread(fd_, buf, size, position);
+  if (result < 0) {
+    return -errno;
+  }
+  reads_++;
+  bytes_ += result;
+  return result;
+}
+
+void PackFile::ReadaheadMain() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    while (wanted_ <= done_ && !stopping_) {
+      wanted_cv_.wait(lock);
+    }
+    if (stopping_) {
+      return;
+    }
+
+    // don't go back for what a jump forward skipped over
+    uint64_t wanted = wanted_.load();
+    uint64_t from = std::max<uint64_t>(
+        done_, wanted > 2 * readahead_ ? wanted - 2 * readahead_ : 0);
+    uint64_t length = std::min(wanted - from, kReadaheadChunk);
+    lock.unlock();
+    ::readahead(fd_, from, length);
+    readahead_bytes_ += length;
+    lock.lock();
+    done_ = from + length;
+  }
+}
+
+PackFile::Stats PackFile::GetStats() const {
+  Stats stats;
+  stats.opens = opens_.load();
+  stats.mismatches = mismatches_.load();
+  stats.reads = reads_.load();
+  stats.bytes = bytes_.load();
+  stats.readahead = readahead_bytes_.load();
+  return stats;
+}
+
+}  // namespace logfs_fuse
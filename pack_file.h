@@ -0,0 +1,192 @@
+#pragma once
+
+#include <sys/stat.h>
+
+#include <atomic>
+#include <condition_variable>  // NOLINT(build/c++11)
+#include <cstdint>
+#include <memory>
+#include <mutex>  // NOLINT(build/c++11)
+#include <string>
+#include <thread>  // NOLINT(build/c++11)
+#include <unordered_map>
+#include <vector>
+
+namespace logfs_fuse {
+
+/// Layout of a pack file
+/**
+ *  A pack holds the contents of many files of the real tree back to back,
+ *  in the order a previous run first read them, so that a cold run which
+ *  reads them in about the same order reads the pack sequentially instead
+ *  of seeking between thousands of small files.
+ *
+ *  The file is a PackHeader, then the contents, then the index: for each
+ *  file its offset in the pack, size and mtime in nanoseconds as 64 bit
+ *  integers, then the length of its mirror path as a 32 bit integer and
+ *  the path itself. Integers are in host byte order, a pack is meant to be
+ *  used on the machine that built it.
+ */
+struct PackHeader {
+  char magic[8];  ///< kPackMagic
+  uint32_t version;
+  uint32_t num_entries;
+  uint64_t index_offset;
+  uint64_t index_size;
+};
+
+extern const char kPackMagic[8];
+static const uint32_t kPackVersion = 1;
+
+/// Writes a pack file, see PackHeader
+class PackWriter {
+ public:
+  PackWriter();
+  ~PackWriter();
+
+  /// Create the pack at @p path, return 0 or -errno
+  int Open(const std::string& path);
+
+  /// Append the contents of @p fd, the file at @p mirror_path, which had
+  /// stat @p st when opened. Returns 0, or -EAGAIN if the file changed
+  /// while being copied, in which case it is left out, or -errno.
+  int Add(const std::string& mirror_path, int fd, const struct stat& st);
+
+  /// Write the index and header, return 0 or -errno
+  int Finish();
+
+  size_t num_entries() const {
+    return entries_.size();
+  }
+
+  uint64_t data_size() const {
+    return offset_ - sizeof(PackHeader);
+  }
+
+ private:
+  PackWriter(const PackWriter&);
+  PackWriter& operator=(const PackWriter&);
+
+  struct Entry {
+    std::string path;
+    uint64_t offset;
+    uint64_t size;
+    int64_t mtime_ns;
+  };
+
+  int fd_;
+  uint64_t offset_;  ///< where the next file's contents go
+  std::vector<Entry> entries_;
+};
+
+/// Serves reads of the files in a pack, see PackHeader
+/**
+ *  An entry is only used for a file whose size and mtime still match the
+ *  ones it was packed with, and Invalidate() retires an entry when the file
+ *  is changed through the mirror, so the pack never serves stale contents.
+ *
+ *  Reads of the pack are followed by a background thread which keeps a
+ *  large window ahead of the furthest read in the page cache. A cold run
+ *  which reads files in about the packed order then mostly finds its data
+ *  already read by large sequential reads.
+ */
+class PackFile {
+ public:
+  /// Snapshot of the pack counters
+  struct Stats {
+    uint64_t opens;       ///< opens of packed files served from the pack
+    uint64_t mismatches;  ///< opens of packed files which had changed
+    uint64_t reads;       ///< reads served from the pack
+    uint64_t bytes;       ///< bytes read from the pack
+    uint64_t readahead;   ///< bytes of the pack read ahead
+  };
+
+  /// One packed file
+  struct Entry {
+    uint64_t offset;
+    uint64_t size;
+    int64_t mtime_ns;
+    std::atomic<bool> stale;  ///< changed since it was packed
+  };
+
+  /// Read ahead @p readahead bytes past the furthest read, zero to leave
+  /// readahead to the kernel
+  explicit PackFile(size_t readahead);
+  ~PackFile();
+
+  /// Open the pack at @p path and read its index, return 0 or -errno
+  int Open(const std::string& path);
+
+  bool enabled() const {
+    return fd_ >= 0;
+  }
+
+  /// Return the entry of @p mirror_path, if the file with stat @p st is
+  /// unchanged since it was packed, otherwise NULL
+  const Entry* Find(const char* mirror_path, const struct stat& st) {
+    return enabled() ? FindImpl(mirror_path, st) : NULL;
+  }
+
+  /// Stop using the entry of @p mirror_path, it may have changed
+  void Invalidate(const char* mirror_path) {
+    if (enabled()) {
+      InvalidateImpl(mirror_path);
+    }
+  }
+
+  /// Stop using the entries of every path below the directory
+  /// @p mirror_dir, after it was renamed
+  void InvalidateBelow(const std::string& mirror_dir) {
+    if (enabled()) {
+      InvalidateBelowImpl(mirror_dir);
+    }
+  }
+
+  /// Stop using every entry, after changes to the tree were missed
+  void InvalidateAll() {
+    if (enabled()) {
+      InvalidateAllImpl();
+    }
+  }
+
+  /// Read like pread() from the packed file @p entry, return the number of
+  /// bytes read or -errno
+  int Read(const Entry& entry, char* buf, size_t size, off_t offset);
+
+  Stats GetStats() const;
+
+ private:
+  PackFile(const PackFile&);
+  PackFile& operator=(const PackFile&);
+
+  const Entry* FindImpl(const char* mirror_path, const struct stat& st);
+  void InvalidateImpl(const char* mirror_path);
+  void InvalidateBelowImpl(const std::string& mirror_dir);
+  void InvalidateAllImpl();
+
+  /// Parse the index in @p index, return false if it is malformed
+  bool ParseIndex(const std::vector<char>& index, uint32_t num_entries);
+
+  void ReadaheadMain();
+
+  size_t readahead_;
+  int fd_;
+  uint64_t size_;
+  std::unique_ptr<Entry[]> entries_;
+  std::unordered_map<std::string, Entry*> index_;
+
+  std::mutex mutex_;
+  std::condition_variable wanted_cv_;
+  std::atomic<uint64_t> wanted_;  ///< read ahead to here, set under mutex_
+  uint64_t done_;  ///< the pack has been read ahead to here
+  bool stopping_;
+  std::thread thread_;
+
+  std::atomic<uint64_t> opens_;
+  std::atomic<uint64_t> mismatches_;
+  std::atomic<uint64_t> reads_;
+  std::atomic<uint64_t> bytes_;
+  std::atomic<uint64_t> readahead_bytes_;
+};
+
+}  // namespace logfs_fuse
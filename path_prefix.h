@@ -0,0 +1,16 @@
+#pragma once
+
+#include <cstring>
+#include <string>
+
+namespace logfs_fuse {
+
+/// Return true if the @p size bytes at @p path name something below the
+/// directory @p dir, rather than @p dir itself or a sibling sharing its
+/// name as a prefix
+inline bool IsBelow(const char* path, size_t size, const std::string& dir) {
+  return size > dir.size() && path[dir.size()] == '/' &&
+         memcmp(path, dir.data(), dir.size()) == 0;
+}
+
+}  // namespace logfs_fuse
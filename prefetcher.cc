@@ -0,0 +1,184 @@
+#include "prefetcher.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <unordered_set>
+#include <vector>
+
+#include <glog/logging.h>
+
+#include "log_reader.h"
+#include "xattr_cache.h"
+
+namespace logfs_fuse {
+
+// tasks queued per prefetch thread before the log reader prefetches inline
+static const size_t kQueuePerThread = 64;
+
+Prefetcher::Prefetcher(const std::string& real_root, XattrCache* xattr_cache,
+                       size_t num_threads, int64_t max_bytes)
+    : real_root_(real_root),
+      xattr_cache_(xattr_cache),
+      max_bytes_(max_bytes),
+      pool_(num_threads, num_threads * kQueuePerThread),
+      stopping_(false),
+      paths_(0),
+      missing_(0),
+      xattrs_(0),
+      files_(0),
+      bytes_(0),
+      skipped_(0) {}
+
+Prefetcher::~Prefetcher() {
+  Stop();
+}
+
+void Prefetcher::Start(const std::string& log_path) {
+  LOG_IF(FATAL, reader_.joinable()) << "Prefetcher already started";
+  reader_ = std::thread(&Prefetcher::ReaderMain, this, log_path);
+}
+
+void Prefetcher::Wait() {
+  if (reader_.joinable()) {
+    reader_.join();
+  }
+  pool_.Drain();
+}
+
+void Prefetcher::Stop() {
+  stopping_ = true;
+  Wait();
+}
+
+void Prefetcher::ReaderMain(std::string log_path) {
+  LogReader reader(log_path);
+  if (!reader.ok()) {
+    PLOG(WARNING) << "Failed to open prefetch log '" << log_path << "'";
+    return;
+  }
+
+  // the first access of each path decides its place in the order,
+  // contents are read ahead from the first open or read
+  std::unordered_set<std::string> seen;
+  std::unordered_set<std::string> read;
+  std::unordered_set<std::string> xattrs_read;
+  LogRecord record;
+  while (!stopping_ && reader.Next(&record)) {
+    bool wants_xattrs =
+        (record.op == kOpGetxattr || record.op == kOpListxattr) &&
+        xattr_cache_ && xattr_cache_->enabled();
+    bool wants_contents =
+        (record.op == kOpOpen || record.op == kOpRead) && max_bytes_ >= 0;
+
+    if (seen.insert(record.path).second) {
+      paths_++;
+      if (wants_xattrs) {
+        xattrs_read.insert(record.path);
+      }
+      std::string path = record.path;
+      pool_.Run([this, path, wants_xattrs] {
+        PrefetchMetadata(path, wants_xattrs);
+      });
+    } else if (wants_xattrs && xattrs_read.insert(record.path).second) {
+      std::string path = record.path;
+      pool_.Run([this, path] { PrefetchMetadata(path, true); });
+    }
+
+    if (wants_contents && read.insert(record.path).second) {
+      std::string path = record.path;
+      pool_.Run([this, path] { PrefetchContents(path); });
+    }
+  }
+
+  LOG(INFO) << "Read " << reader.lines() << " lines of prefetch log '"
+            << log_path << "', " << paths_.load() << " distinct paths";
+}
+
+void Prefetcher::PrefetchMetadata(const std::string& path, bool xattrs) {
+  if (stopping_) {
+    return;
+  }
+
+  // the same path the fuse context builds, so the xattr cache keys match
+  boost::filesystem::path wrapped = real_root_ / path;
+  struct stat st;
+  if (::lstat(wrapped.c_str(), &st) < 0) {
+    missing_++;
+    return;
+  }
+  if (!xattrs) {
+    return;
+  }
+
+  ssize_t size = ::llistxattr(wrapped.c_str(), NULL, 0);
+  if (size <= 0) {
+    return;
+  }
+  std::vector<char> names(size);
+  size = ::llistxattr(wrapped.c_str(), names.data(), names.size());
+  for (ssize_t begin = 0; begin < size;) {
+    const char* name = names.data() + begin;
+    // a size probe fetches the value into the cache
+    xattr_cache_->Get(wrapped.native(), name, NULL, 0);
+    xattrs_++;
+    begin += strlen(name) + 1;
+  }
+}
+
+void Prefetcher::PrefetchContents(const std::string& path) {
+  if (stopping_) {
+    return;
+  }
+
+  // O_NONBLOCK so that a fifo in the tree doesn't hang the thread
+  boost::filesystem::path wrapped = real_root_ / path;
+  int flags = O_RDONLY | O_NONBLOCK | O_CLOEXEC;
+  int fd = ::open(wrapped.c_str(), flags | O_NOATIME);
+  if (fd < 0 && errno == EPERM) {
+    fd = ::open(wrapped.c_str(), flags);
+  }
+  if (fd < 0) {
+    skipped_++;
+    return;
+  }
+
+  struct stat st;
+  if (::fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+    ::close(fd);
+    return;
+  }
+
+  uint64_t total = bytes_.fetch_add(st.st_size) + st.st_size;
+  if (max_bytes_ > 0 && total > static_cast<uint64_t>(max_bytes_)) {
+    bytes_ -= st.st_size;
+    skipped_++;
+    ::close(fd);
+    return;
+  }
+
+  // readahead blocks until the reads are issued, which is what spreads
+  // them over the pool; fadvise is the fallback where it isn't supported
+  if (::readahead(fd, 0, st.st_size) < 0) {
+    ::posix_fadvise(fd, 0, st.st_size, POSIX_FADV_WILLNEED);
+  }
+  files_++;
+  ::close(fd);
+}
+
+Prefetcher::Stats Prefetcher::GetStats() const {
+  Stats stats;
+  stats.paths = paths_.load();
+  stats.missing = missing_.load();
+  stats.xattrs = xattrs_.load();
+  stats.files = files_.load();
+  stats.bytes = bytes_.load();
+  stats.skipped = skipped_.load();
+  return stats;
+}
+
+}  // namespace logfs_fuse
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>  // NOLINT(build/c++11)
+
+#include <boost/filesystem.hpp>
+
+#include "completion_pool.h"
+
+namespace logfs_fuse {
+
+class XattrCache;
+
+/// Warms caches with the paths a previous run accessed
+/**
+ *  Consecutive runs of the same build touch nearly the same files in the
+ *  same order. Start() streams the access log of a previous run on a
+ *  background thread and, for each path in order of its first access,
+ *  hands a pool of threads:
+ *    * an lstat() of the real file, which pulls its inode and the dentries
+ *      on its path into the kernel's caches
+ *    * for paths whose xattrs were read, a fetch of each attribute into
+ *      the xattr cache
+ *    * for paths which were opened or read, a readahead(2) of the file's
+ *      contents into the page cache
+ *
+ *  Prefetching overlaps with serving requests, so the earliest accesses of
+ *  the new run find their files already cached. The pool's queue is
+ *  bounded, and when it is full the log reader prefetches inline, so the
+ *  reader can't run arbitrarily far ahead of the prefetches.
+ */
+class Prefetcher {
+ public:
+  /// Snapshot of the prefetch counters
+  struct Stats {
+    uint64_t paths;    ///< distinct paths read from the log
+    uint64_t missing;  ///< paths no longer in the real tree
+    uint64_t xattrs;   ///< attributes fetched into the xattr cache
+    uint64_t files;    ///< files whose contents were read ahead
+    uint64_t bytes;    ///< bytes read ahead
+    uint64_t skipped;  ///< files left out, over max_bytes or unreadable
+  };
+
+  /// Read ahead at most @p max_bytes of file contents in all, zero for no
+  /// limit and -1 to only prefetch metadata. @p xattr_cache may be NULL.
+  Prefetcher(const std::string& real_root, XattrCache* xattr_cache,
+             size_t num_threads, int64_t max_bytes);
+
+  /// Abandons any prefetching still in progress
+  ~Prefetcher();
+
+  /// Start prefetching the paths in the access log at @p log_path
+  void Start(const std::string& log_path);
+
+  /// Wait until every path in the log has been prefetched
+  void Wait();
+
+  /// Abandon the prefetch, leaving whatever is cached so far
+  void Stop();
+
+  Stats GetStats() const;
+
+ private:
+  Prefetcher(const Prefetcher&);
+  Prefetcher& operator=(const Prefetcher&);
+
+  void ReaderMain(std::string log_path);
+
+  /// Stat @p path, and fetch its xattrs if @p xattrs
+  void PrefetchMetadata(const std::string& path, bool xattrs);
+
+  void PrefetchContents(const std::string& path);
+
+  boost::filesystem::path real_root_;
+  XattrCache* xattr_cache_;
+  int64_t max_bytes_;
+  CompletionPool pool_;
+  std::thread reader_;
+  std::atomic<bool> stopping_;
+
+  std::atomic<uint64_t> paths_;
+  std::atomic<uint64_t> missing_;
+  std::atomic<uint64_t> xattrs_;
+  std::atomic<uint64_t> files_;
+  std::atomic<uint64_t> bytes_;
+  std::atomic<uint64_t> skipped_;
+};
+
+}  // namespace logfs_fuse
@@ -0,0 +1,149 @@
+#include "process_table.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "clock.h"
+
+namespace logfs_fuse {
+
+const int ProcessTable::kNumShards;
+
+ProcessTable::ProcessTable(size_t capacity, int64_t revalidate_ms)
+    : shard_capacity_((capacity + kNumShards - 1) / kNumShards),
+      revalidate_ms_(revalidate_ms) {}
+
+ProcessTable::~ProcessTable() {}
+
+bool ProcessTable::ReadProcessInfo(pid_t pid, ProcessInfo* info) {
+  char path[32];
+  snprintf(path, sizeof(path), "/proc/%d/stat", static_cast<int>(pid));
+  int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+  char buf[1024];
+  ssize_t size = ::read(fd, buf, sizeof(buf) - 1);
+  ::close(fd);
+  if (size <= 0) {
+    return false;
+  }
+  buf[size] = '\0';
+
+  // "pid (comm) state ppid pgrp session ...", where comm may itself
+  // contain spaces and parentheses, so find the last ')'
+  char* open_paren = strchr(buf, '(');
+  char* close_paren = strrchr(buf, ')');
+  if (open_paren == NULL || close_paren == NULL || close_paren < open_paren) {
+    return false;
+  }
+
+  info->pid = pid;
+  info->command.assign(open_paren + 1, close_paren);
+
+  // the fields after comm, numbered from 3 as in proc(5)
+  char* field = close_paren + 1;
+  for (int number = 3; number <= 22; number++) {
+    while (*field == ' ') {
+      field++;
+    }
+    if (*field == '\0') {
+      return false;
+    }
+    switch (number) {
+      case 5:
+        info->pgid = strtol(field, NULL, 10);
+        break;
+      case 6:
+        info->sid = strtol(field, NULL, 10);
+        break;
+      case 22:
+        info->start_time = strtoull(field, NULL, 10);
+        break;
+    }
+    while (*field != ' ' && *field != '\0') {
+      field++;
+    }
+  }
+  return true;
+}
+
+bool ProcessTable::Lookup(pid_t pid, ProcessInfo* info) {
+  if (pid <= 0) {
+    return false;
+  }
+
+  Shard& shard = shards_[pid % kNumShards];
+  int64_t now_ms = CoarseNowMs();
+  {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto found = shard.index.find(pid);
+    if (found != shard.index.end() &&
+        now_ms - found->second->checked_ms < revalidate_ms_) {
+      shard.lru.splice(shard.lru.begin(), shard.lru, found->second);
+      *info = found->second->info;
+      hits_.Add(1);
+      return true;
+    }
+  }
+
+  // read outside of the lock, a racing reader of the same pid just
+  // overwrites our answer with an equally fresh one
+  reads_.Add(1);
+  Entry entry;
+  if (!ReadProcessInfo(pid, &entry.info)) {
+    failures_.Add(1);
+    // the process is gone, don't let its entry answer for the next
+    // process given the pid
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto found = shard.index.find(pid);
+    if (found != shard.index.end()) {
+      shard.lru.erase(found->second);
+      shard.index.erase(found);
+    }
+    return false;
+  }
+  entry.checked_ms = now_ms;
+  *info = entry.info;
+
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  auto found = shard.index.find(pid);
+  if (found != shard.index.end()) {
+    Entry& cached = *found->second;
+    if (cached.info.start_time != entry.info.start_time) {
+      // the pid was reused, the entry described an exited process
+      reused_.Add(1);
+      cached = entry;
+    } else if (cached.checked_ms <= entry.checked_ms) {
+      // the same process, which may since have exec'd or called setsid()
+      cached = entry;
+    }
+    shard.lru.splice(shard.lru.begin(), shard.lru, found->second);
+    return true;
+  }
+
+  shard.lru.push_front(entry);
+  shard.index[pid] = shard.lru.begin();
+  while (shard.lru.size() > shard_capacity_) {
+    shard.index.erase(shard.lru.back().info.pid);
+    shard.lru.pop_back();
+    evictions_.Add(1);
+  }
+  return true;
+}
+
+ProcessTable::Stats ProcessTable::GetStats() const {
+  Stats stats;
+  stats.hits = hits_.value();
+  stats.reads = reads_.value();
+  stats.failures = failures_.value();
+  stats.evictions = evictions_.value();
+  stats.reused = reused_.value();
+  return stats;
+}
+
+}  // namespace logfs_fuse
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <sys/types.h>
+
+#include <cstdint>
+#include <list>
+#include <mutex>  // NOLINT(build/c++11)
+#include <string>
+#include <unordered_map>
+
+#include "sharded.h"
+
+namespace logfs_fuse {
+
+/// What we know about a process that made a request
+struct ProcessInfo {
+  pid_t pid;
+  pid_t pgid;           ///< process group
+  pid_t sid;            ///< session, e.g. one build started from a shell
+  uint64_t start_time;  ///< in clock ticks after boot, tells reused pids apart
+  std::string command;  ///< the kernel's short command name
+};
+
+/// Bounded LRU cache from pid to command name, process group and session
+/**
+ *  Resolving a pid means reading /proc/<pid>/stat, far too slow to do for
+ *  every request. This keeps the answer for up to @p capacity processes,
+ *  so a process costs one /proc read when first seen.
+ *
+ *  Pids get reused, so an entry is re-read if it is older than
+ *  @p revalidate_ms. If the start time read then differs from the one
+ *  cached, the pid now belongs to a new process and the entry is replaced
+ *  whole; an entry whose process can't be read any more is dropped.
+ *  The table is split into shards by pid so that workers serving different
+ *  processes don't contend.
+ */
+class ProcessTable {
+ public:
+  /// Snapshot of the table counters
+  struct Stats {
+    uint64_t hits;        ///< lookups answered from the table
+    uint64_t reads;       ///< reads of /proc/<pid>/stat
+    uint64_t failures;    ///< reads which failed, e.g. the process exited
+    uint64_t evictions;   ///< entries dropped to stay under capacity
+    uint64_t reused;      ///< entries found to describe an exited process
+  };
+
+  ProcessTable(size_t capacity, int64_t revalidate_ms);
+  ~ProcessTable();
+
+  /// Fill in @p info for @p pid, return false if it can't be resolved
+  bool Lookup(pid_t pid, ProcessInfo* info);
+
+  Stats GetStats() const;
+
+  /// Read /proc/<pid>/stat into @p info, return false on failure
+  static bool ReadProcessInfo(pid_t pid, ProcessInfo* info);
+
+ private:
+  ProcessTable(const ProcessTable&);
+  ProcessTable& operator=(const ProcessTable&);
+
+  static const int kNumShards = 16;
+
+  struct Entry {
+    ProcessInfo info;
+    int64_t checked_ms;  ///< when info was last read from /proc
+  };
+  typedef std::list<Entry> LruList;
+
+  struct Shard {
+    std::mutex mutex;
+    LruList lru;  ///< most recently used at the front
+    std::unordered_map<pid_t, LruList::iterator> index;
+  };
+
+  size_t shard_capacity_;
+  int64_t revalidate_ms_;
+  Shard shards_[kNumShards];
+
+  ShardedCounter hits_;
+  ShardedCounter reads_;
+  ShardedCounter failures_;
+  ShardedCounter evictions_;
+  ShardedCounter reused_;
+};
+
+}  // namespace logfs_fuse
@@ -0,0 +1,46 @@
+#include "replacing_file.h"
+
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+
+namespace logfs_fuse {
+
+ReplacingFile::ReplacingFile(const std::string& path)
+    : path_(path),
+      temp_path_(path + ".tmp"),
+      out_(temp_path_.c_str(), std::ios::out | std::ios::trunc),
+      error_(0),
+      committed_(false) {
+  if (!out_) {
+    error_ = errno != 0 ? -errno : -EIO;
+  }
+}
+
+ReplacingFile::~ReplacingFile() {
+  if (!committed_ && error_ == 0) {
+    out_.close();
+    ::unlink(temp_path_.c_str());
+  }
+}
+
+int ReplacingFile::Commit() {
+  if (error_ < 0) {
+    return error_;
+  }
+  committed_ = true;
+  out_.close();
+  if (!out_) {
+    ::unlink(temp_path_.c_str());
+    return -EIO;
+  }
+  if (::rename(temp_path_.c_str(), path_.c_str()) < 0) {
+    int error = errno;
+    ::unlink(temp_path_.c_str());
+    return -error;
+  }
+  return 0;
+}
+
+}  // namespace logfs_fuse
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <fstream>
+#include <ostream>
+#include <string>
+
+namespace logfs_fuse {
+
+/// Writes a new version of a file without readers ever seeing part of it
+/**
+ *  The contents go to a temporary next to the file, which Commit() renames
+ *  over it, so a reader finds either the old file or the new one in full.
+ *  The temporary is removed if the writer gives up before committing.
+ */
+class ReplacingFile {
+ public:
+  /// Start writing a replacement of the file at @p path
+  explicit ReplacingFile(const std::string& path);
+  ~ReplacingFile();
+
+  /// Return 0 if the temporary could be created, otherwise -errno
+  int error() const {
+    return error_;
+  }
+
+  std::ostream& out() {
+    return out_;
+  }
+
+  /// Finish the temporary and rename it over the file, return 0 or -errno
+  int Commit();
+
+ private:
+  ReplacingFile(const ReplacingFile&);
+  ReplacingFile& operator=(const ReplacingFile&);
+
+  std::string path_;
+  std::string temp_path_;
+  std::ofstream out_;
+  int error_;
+  bool committed_;
+};
+
+}  // namespace logfs_fuse
@@ -0,0 +1,23 @@
+#include "request_arena.h"
+
+namespace logfs_fuse {
+
+RequestArena::RequestArena() : used_(0) {}
+
+RequestArena::~RequestArena() {}
+
+RequestArena* RequestArena::Current() {
+  static thread_local RequestArena arena;
+  return &arena;
+}
+
+std::string* RequestArena::Push() {
+  if (used_ == strings_.size()) {
+    strings_.emplace_back(new std::string());
+  }
+  std::string* string = strings_[used_++].get();
+  string->clear();
+  return string;
+}
+
+}  // namespace logfs_fuse
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace logfs_fuse {
+
+/// Per-thread scratch strings for the temporaries of a request
+/**
+ *  Real-tree paths, cache keys and log lines are built for almost every
+ *  op, and would each cost an allocation if built in a fresh std::string.
+ *  Instead each thread keeps a stack of strings which ScratchString takes
+ *  from and gives back when it goes out of scope, so everything a request
+ *  took is released when its op returns. The strings keep their capacity,
+ *  so once a thread has served a few requests its temporaries need no
+ *  allocation at all.
+ */
+class RequestArena {
+ public:
+  RequestArena();
+  ~RequestArena();
+
+  /// Return the arena of the calling thread
+  static RequestArena* Current();
+
+  /// Take the next string off the stack, empty but with its capacity
+  std::string* Push();
+
+  /// Give back the string most recently taken
+  void Pop() {
+    used_--;
+  }
+
+  /// Return the most strings which have been taken at once
+  size_t size() const {
+    return strings_.size();
+  }
+
+ private:
+  RequestArena(const RequestArena&);
+  RequestArena& operator=(const RequestArena&);
+
+  std::vector<std::unique_ptr<std::string>> strings_;
+  size_t used_;  ///< strings currently taken, from the front
+};
+
+/// A string taken from the calling thread's RequestArena until the end of
+/// the enclosing scope
+class ScratchString {
+ public:
+  ScratchString()
+      : arena_(RequestArena::Current()), string_(arena_->Push()) {}
+  ~ScratchString() {
+    arena_->Pop();
+  }
+
+  std::string& operator*() const {
+    return *string_;
+  }
+
+  std::string* operator->() const {
+    return string_;
+  }
+
+ private:
+  ScratchString(const ScratchString&);
+  ScratchString& operator=(const ScratchString&);
+
+  RequestArena* arena_;
+  std::string* string_;
+};
+
+}  // namespace logfs_fuse
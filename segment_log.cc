@@ -0,0 +1,568 @@
+#include "segment_log.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <chrono>  // NOLINT(build/c++11)
+#include <cstdlib>
+#include <cstring>
+#include <utility>
+
+#include <glog/logging.h>
+
+#include "clock.h"
+
+namespace logfs_fuse {
+
+const char kSegmentMagic[8] = {'L', 'O', 'G', 'F', 'S', 'S', 'G', '1'};
+
+// lines are handed to the writer in blocks of about this size
+static const size_t kBlockSize = 64 << 10;
+
+// full blocks the writer may fall behind by before Append() waits
+static const size_t kMaxQueuedBlocks = 16;
+
+// largest block a reader accepts, anything bigger is corruption
+static const uint32_t kMaxBlockSize = 64 << 20;
+
+static const char kFinishedSuffix[] = ".seg";
+static const char kActiveSuffix[] = ".active";
+
+static bool EndsWith(const std::string& value, const char* suffix) {
+  size_t size = strlen(suffix);
+  return value.size() >= size &&
+         value.compare(value.size() - size, size, suffix) == 0;
+}
+
+// read up to @p size bytes, stopping early only at the end of the file
+static ssize_t ReadFull(int fd, void* buf, size_t size) {
+  char* bytes = static_cast<char*>(buf);
+  size_t done = 0;
+  while (done < size) {
+    ssize_t result = ::read(fd, bytes + done, size - done);
+    if (result < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    if (result == 0) {
+      break;
+    }
+    done += result;
+  }
+  return done;
+}
+
+/// A segment's sequence number and path
+typedef std::pair<uint64_t, std::string> NumberedSegment;
+
+static std::vector<NumberedSegment> FindSegments(const std::string& base_path,
+                                                 bool include_active) {
+  size_t slash = base_path.rfind('/');
+  std::string directory =
+      slash == std::string::npos ? "." : base_path.substr(0, slash + 1);
+  std::string prefix =
+      (slash == std::string::npos ? base_path : base_path.substr(slash + 1)) +
+      ".";
+
+  std::vector<NumberedSegment> segments;
+  DIR* dir = ::opendir(directory.c_str());
+  if (dir == NULL) {
+    return segments;
+  }
+  while (dirent* entry = ::readdir(dir)) {
+    std::string name = entry->d_name;
+    if (name.compare(0, prefix.size(), prefix) != 0) {
+      continue;
+    }
+    bool finished = EndsWith(name, kFinishedSuffix);
+    if (!finished && !(include_active && EndsWith(name, kActiveSuffix))) {
+      continue;
+    }
+
+    // the sequence number is all digits, so other files sharing the
+    // prefix aren't mistaken for segments
+    const char* digits = name.c_str() + prefix.size();
+    char* end = NULL;
+    uint64_t sequence = strtoull(digits, &end, 10);
+    if (end == digits || *end != '.' || !isdigit(*digits) ||
+        std::string(end) !=
+            (finished ? kFinishedSuffix : kActiveSuffix)) {
+      continue;
+    }
+    std::string path = slash == std::string::npos ? name : directory + name;
+    segments.push_back(std::make_pair(sequence, path));
+  }
+  ::closedir(dir);
+
+  std::sort(segments.begin(), segments.end());
+  return segments;
+}
+
+std::vector<std::string> ListSegments(const std::string& base_path,
+                                      bool include_active) {
+  std::vector<std::string> paths;
+  for (const NumberedSegment& segment :
+       FindSegments(base_path, include_active)) {
+    paths.push_back(segment.second);
+  }
+  return paths;
+}
+
+SegmentWriter::SegmentWriter(const std::string& base_path,
+                             uint64_t segment_bytes, double segment_seconds,
+                             size_t segments_kept, bool compress,
+                             double flush_interval)
+    : base_path_(base_path),
+      segment_bytes_(segment_bytes),
+      segment_ns_(static_cast<int64_t>(segment_seconds * 1e9)),
+      segments_kept_(segments_kept),
+      compress_(compress),
+      flush_interval_ns_(static_cast<int64_t>(flush_interval * 1e9)),
+      fd_(-1),
+      sequence_(1),
+      segment_size_(0),
+      segment_started_ns_(0),
+      flush_requested_(0),
+      flush_done_(0),
+      sync_requested_(false),
+      stopping_(false),
+      segments_(0),
+      raw_bytes_(0),
+      stored_bytes_(0),
+      deleted_(0),
+      dropped_(0) {}
+
+SegmentWriter::~SegmentWriter() {
+  Stop();
+}
+
+std::string SegmentWriter::SegmentPath(uint64_t sequence, bool active) const {
+  char number[32];
+  snprintf(number, sizeof(number), ".%08llu",
+           static_cast<unsigned long long>(sequence));  // NOLINT(runtime/int)
+  return base_path_ + number + (active ? kActiveSuffix : kFinishedSuffix);
+}
+
+int SegmentWriter::Start() {
+  // a crash leaves the segment it was writing active, finish it so that it
+  // is shipped and counted for retention like the others
+  for (const NumberedSegment& segment : FindSegments(base_path_, true)) {
+    if (EndsWith(segment.second, kActiveSuffix)) {
+      std::string finished = SegmentPath(segment.first, false);
+      PLOG_IF(WARNING, ::rename(segment.second.c_str(), finished.c_str()) < 0)
+          << "Failed to finish log segment '" << segment.second << "'";
+    }
+    sequence_ = std::max(sequence_, segment.first + 1);
+  }
+
+  if (!OpenSegment()) {
+    return -errno;
+  }
+  // the writer may be writing a full queue while Append() fills another,
+  // and the flush may add one to each. Every block that can be in flight
+  // is allocated now, so that Append() never has to.
+  const size_t max_queued = kMaxQueuedBlocks + 1;
+  block_.reserve(kBlockSize);
+  full_.reserve(max_queued);
+  writing_.reserve(max_queued);
+  spare_.reserve(2 * max_queued + 1);
+  spare_.resize(2 * max_queued);
+  for (std::string& block : spare_) {
+    block.reserve(kBlockSize);
+  }
+  thread_ = std::thread(&SegmentWriter::WriterMain, this);
+  return 0;
+}
+
+bool SegmentWriter::OpenSegment() {
+  std::string path = SegmentPath(sequence_, true);
+  fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+  if (fd_ < 0) {
+    int error = errno;
+    PLOG(ERROR) << "Failed to create log segment '" << path << "'";
+    if (error == EEXIST) {
+      sequence_++;
+    }
+    errno = error;
+    return false;
+  }
+
+  SegmentHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, kSegmentMagic, sizeof(header.magic));
+  header.version = kSegmentVersion;
+  header.sequence = sequence_;
+  header.created_ns = WallClockNs();
+  if (::write(fd_, &header, sizeof(header)) !=
+      static_cast<ssize_t>(sizeof(header))) {
+    int error = errno;
+    PLOG(ERROR) << "Failed to write log segment '" << path << "'";
+    ::close(fd_);
+    fd_ = -1;
+    // so that the next try can create it again
+    ::unlink(path.c_str());
+    errno = error;
+    return false;
+  }
+
+  segment_size_ = sizeof(header);
+  segment_started_ns_ = NowNs();
+  segments_++;
+  return true;
+}
+
+void SegmentWriter::FinishSegment() {
+  if (fd_ < 0) {
+    return;
+  }
+
+  // the rename tells readers the segment is complete, so it has to be on
+  // disk first
+  ::fdatasync(fd_);
+  ::close(fd_);
+  fd_ = -1;
+  std::string active = SegmentPath(sequence_, true);
+  std::string finished = SegmentPath(sequence_, false);
+  PLOG_IF(ERROR, ::rename(active.c_str(), finished.c_str()) < 0)
+      << "Failed to finish log segment '" << active << "'";
+
+  if (segments_kept_ > 0) {
+    std::vector<NumberedSegment> segments = FindSegments(base_path_, false);
+    for (size_t i = 0; i + segments_kept_ < segments.size(); i++) {
+      if (::unlink(segments[i].second.c_str()) == 0) {
+        deleted_++;
+      }
+    }
+  }
+}
+
+void SegmentWriter::WriteBlock(const std::string& block) {
+  // a failed rotation left no segment, try again now
+  if (fd_ < 0 && !OpenSegment()) {
+    LOG(ERROR) << "Dropped " << block.size()
+               << " bytes of log lines without a segment to write them to";
+    dropped_++;
+    return;
+  }
+
+  SegmentBlockHeader header;
+  header.raw_size = block.size();
+  header.stored_size = block.size();
+  header.crc32 = ::crc32(0, reinterpret_cast<const Bytef*>(block.data()),
+                         block.size());
+  header.flags = 0;
+
+  iovec iov[2];
+  iov[0].iov_base = &header;
+  iov[0].iov_len = sizeof(header);
+  iov[1].iov_base = const_cast<char*>(block.data());
+  iov[1].iov_len = block.size();
+
+  if (compress_) {
+    uLongf size = compressBound(block.size());
+    deflated_.resize(size);
+    int result = compress2(reinterpret_cast<Bytef*>(&deflated_[0]), &size,
+                           reinterpret_cast<const Bytef*>(block.data()),
+                           block.size(), Z_BEST_SPEED);
+    if (result == Z_OK && size < block.size()) {
+      header.stored_size = size;
+      header.flags = kBlockDeflated;
+      iov[1].iov_base = &deflated_[0];
+      iov[1].iov_len = size;
+    }
+  }
+
+  ssize_t expected = sizeof(header) + header.stored_size;
+  ssize_t written = ::writev(fd_, iov, 2);
+  if (written != expected) {
+    PLOG(ERROR) << "Failed to write log segment "
+                << SegmentPath(sequence_, true);
+    dropped_++;
+    return;
+  }
+  segment_size_ += written;
+  raw_bytes_ += block.size();
+  stored_bytes_ += written;
+
+  if (segment_bytes_ > 0 && segment_size_ >= segment_bytes_) {
+    FinishSegment();
+    sequence_++;
+    OpenSegment();
+  }
+}
+
+void SegmentWriter::WriterMain() {
+  int64_t next_flush_ns = NowNs() + flush_interval_ns_;
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    auto has_work = [this] {
+      return !full_.empty() || flush_requested_ != flush_done_ || stopping_;
+    };
+
+    // wake for the periodic flush, and once a second to rotate by age
+    int64_t timeout_ns = -1;
+    if (flush_interval_ns_ > 0) {
+      timeout_ns = std::max<int64_t>(next_flush_ns - NowNs(), 0);
+    }
+    if (segment_ns_ > 0) {
+      timeout_ns = timeout_ns < 0 ? 1000000000
+                                  : std::min<int64_t>(timeout_ns, 1000000000);
+    }
+    if (timeout_ns < 0) {
+      writer_cv_.wait(lock, has_work);
+    } else {
+      writer_cv_.wait_for(lock, std::chrono::nanoseconds(timeout_ns),
+                          has_work);
+    }
+
+    int64_t now_ns = NowNs();
+    bool interval_due = flush_interval_ns_ > 0 && now_ns >= next_flush_ns;
+    uint64_t flush_target = flush_requested_;
+    bool sync = sync_requested_;
+    bool stop = stopping_;
+    sync_requested_ = false;
+    if ((interval_due || flush_target != flush_done_ || stop) &&
+        !block_.empty()) {
+      HandOverLocked();
+    }
+    writing_.swap(full_);
+    lock.unlock();
+    done_cv_.notify_all();
+
+    for (const std::string& block : writing_) {
+      WriteBlock(block);
+    }
+    if (interval_due) {
+      next_flush_ns = now_ns + flush_interval_ns_;
+    }
+    if (segment_ns_ > 0 && fd_ >= 0 && segment_size_ > sizeof(SegmentHeader) &&
+        now_ns - segment_started_ns_ >= segment_ns_ && !stop) {
+      FinishSegment();
+      sequence_++;
+      OpenSegment();
+    }
+    if (sync && fd_ >= 0) {
+      ::fdatasync(fd_);
+    }
+
+    lock.lock();
+    for (std::string& block : writing_) {
+      spare_.push_back(std::move(block));
+    }
+    writing_.clear();
+    flush_done_ = flush_target;
+    done_cv_.notify_all();
+    if (stop) {
+      break;
+    }
+  }
+  lock.unlock();
+  FinishSegment();
+}
+
+void SegmentWriter::Append(const char* data, size_t size) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (full_.size() >= kMaxQueuedBlocks && !stopping_) {
+    done_cv_.wait(lock);
+  }
+  // a line which would outgrow the block starts the next one instead, so
+  // that blocks keep the buffer they were reserved with
+  if (!block_.empty() && block_.size() + size > block_.capacity()) {
+    HandOverLocked();
+    writer_cv_.notify_one();
+  }
+  block_.append(data, size);
+  if (block_.size() >= kBlockSize) {
+    HandOverLocked();
+    lock.unlock();
+    writer_cv_.notify_one();
+  }
+}
+
+void SegmentWriter::HandOverLocked() {
+  full_.push_back(std::move(block_));
+  if (spare_.empty()) {
+    block_.clear();
+    block_.reserve(kBlockSize);
+  } else {
+    block_.swap(spare_.back());
+    spare_.pop_back();
+    block_.clear();
+  }
+}
+
+void SegmentWriter::Flush(bool sync) {
+  if (!thread_.joinable()) {
+    return;
+  }
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  uint64_t target = ++flush_requested_;
+  sync_requested_ = sync_requested_ || sync;
+  writer_cv_.notify_one();
+  while (flush_done_ < target && !stopping_) {
+    done_cv_.wait(lock);
+  }
+}
+
+void SegmentWriter::Stop() {
+  if (!thread_.joinable()) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  writer_cv_.notify_one();
+  done_cv_.notify_all();
+  thread_.join();
+}
+
+SegmentWriter::Stats SegmentWriter::GetStats() const {
+  Stats stats;
+  stats.segments = segments_.load();
+  stats.raw_bytes = raw_bytes_.load();
+  stats.stored_bytes = stored_bytes_.load();
+  stats.deleted = deleted_.load();
+  stats.dropped = dropped_.load();
+  return stats;
+}
+
+SegmentReader::SegmentReader(const std::string& path)
+    : next_path_(0), fd_(-1), position_(0), corrupt_(0) {
+  struct stat st;
+  if (::stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode)) {
+    paths_.push_back(path);
+  } else {
+    paths_ = ListSegments(path, true);
+  }
+}
+
+SegmentReader::~SegmentReader() {
+  if (fd_ >= 0) {
+    ::close(fd_);
+  }
+}
+
+bool SegmentReader::IsSegment(const std::string& path) {
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+  char magic[sizeof(kSegmentMagic)];
+  bool segment = ReadFull(fd, magic, sizeof(magic)) ==
+                     static_cast<ssize_t>(sizeof(magic)) &&
+                 memcmp(magic, kSegmentMagic, sizeof(magic)) == 0;
+  ::close(fd);
+  return segment;
+}
+
+bool SegmentReader::OpenNext() {
+  while (next_path_ < paths_.size()) {
+    const std::string& path = paths_[next_path_++];
+    fd_ = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd_ < 0 && errno == ENOENT && EndsWith(path, kActiveSuffix)) {
+      // the writer finished the segment since we listed it
+      std::string finished =
+          path.substr(0, path.size() - strlen(kActiveSuffix)) +
+          kFinishedSuffix;
+      fd_ = ::open(finished.c_str(), O_RDONLY | O_CLOEXEC);
+    }
+    // a segment deleted by retention since we listed it is skipped
+    if (fd_ < 0) {
+      continue;
+    }
+    ::posix_fadvise(fd_, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    SegmentHeader header;
+    if (ReadFull(fd_, &header, sizeof(header)) ==
+            static_cast<ssize_t>(sizeof(header)) &&
+        memcmp(header.magic, kSegmentMagic, sizeof(header.magic)) == 0 &&
+        header.version == kSegmentVersion) {
+      return true;
+    }
+    corrupt_++;
+    ::close(fd_);
+    fd_ = -1;
+  }
+  return false;
+}
+
+bool SegmentReader::NextBlock() {
+  while (true) {
+    if (fd_ < 0 && !OpenNext()) {
+      return false;
+    }
+
+    SegmentBlockHeader header;
+    ssize_t size = ReadFull(fd_, &header, sizeof(header));
+    bool ok = size == static_cast<ssize_t>(sizeof(header)) &&
+              header.raw_size <= kMaxBlockSize &&
+              header.stored_size <= kMaxBlockSize;
+    if (ok) {
+      stored_.resize(header.stored_size);
+      ok = ReadFull(fd_, stored_.data(), stored_.size()) ==
+           static_cast<ssize_t>(stored_.size());
+    }
+    if (!ok) {
+      // the end of the segment, or a tail cut short by a crash
+      if (size != 0) {
+        corrupt_++;
+      }
+      ::close(fd_);
+      fd_ = -1;
+      continue;
+    }
+
+    block_.resize(header.raw_size);
+    if (header.flags & kBlockDeflated) {
+      uLongf raw_size = header.raw_size;
+      ok = uncompress(reinterpret_cast<Bytef*>(block_.data()), &raw_size,
+                      reinterpret_cast<const Bytef*>(stored_.data()),
+                      stored_.size()) == Z_OK &&
+           raw_size == header.raw_size;
+    } else {
+      ok = header.stored_size == header.raw_size;
+      if (ok) {
+        memcpy(block_.data(), stored_.data(), stored_.size());
+      }
+    }
+    ok = ok && ::crc32(0, reinterpret_cast<const Bytef*>(block_.data()),
+                       block_.size()) == header.crc32;
+    if (!ok) {
+      // blocks are framed by their headers, so the next one is readable
+      corrupt_++;
+      continue;
+    }
+    position_ = 0;
+    return true;
+  }
+}
+
+bool SegmentReader::NextLine(const char** line, size_t* size) {
+  while (position_ >= block_.size()) {
+    if (!NextBlock()) {
+      return false;
+    }
+  }
+
+  const char* begin = block_.data() + position_;
+  size_t remaining = block_.size() - position_;
+  const char* end = static_cast<const char*>(memchr(begin, '\n', remaining));
+  *line = begin;
+  *size = end ? end - begin : remaining;
+  position_ += end ? *size + 1 : remaining;
+  return true;
+}
+
+}  // namespace logfs_fuse
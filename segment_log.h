@@ -0,0 +1,206 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>  // NOLINT(build/c++11)
+#include <cstdint>
+#include <mutex>  // NOLINT(build/c++11)
+#include <string>
+#include <thread>  // NOLINT(build/c++11)
+#include <vector>
+
+namespace logfs_fuse {
+
+/// Layout of a log segment
+/**
+ *  A segmented log is a series of files "<base>.<sequence>.seg", with
+ *  sequence numbers of 8 or more digits. The segment being written is
+ *  "<base>.<sequence>.active" and is renamed once it is complete and
+ *  synced, so finished ".seg" files can be shipped or deleted while the
+ *  log is still being written.
+ *
+ *  A segment is a SegmentHeader followed by blocks. Each block is a
+ *  SegmentBlockHeader and the block's lines, deflated with zlib if that
+ *  made them smaller. Blocks hold whole lines and are independent, so a
+ *  reader can decode any block it reaches and a segment cut short by a
+ *  crash loses at most its last block. Integers are in host byte order.
+ */
+struct SegmentHeader {
+  char magic[8];  ///< kSegmentMagic
+  uint32_t version;
+  uint32_t reserved;
+  uint64_t sequence;
+  int64_t created_ns;  ///< wall clock time the segment was started
+};
+
+struct SegmentBlockHeader {
+  uint32_t raw_size;     ///< bytes of lines in the block
+  uint32_t stored_size;  ///< bytes following this header
+  uint32_t crc32;        ///< of the raw lines
+  uint32_t flags;        ///< kBlockDeflated if the lines are deflated
+};
+
+extern const char kSegmentMagic[8];
+static const uint32_t kSegmentVersion = 1;
+static const uint32_t kBlockDeflated = 1;
+
+/// Return the finished segments of the log at @p base_path in order, and
+/// the active one last if @p include_active
+std::vector<std::string> ListSegments(const std::string& base_path,
+                                      bool include_active);
+
+/// Writes a segmented log, see SegmentHeader
+/**
+ *  Append() only copies lines into the current block, under a lock. Full
+ *  blocks are handed to a writer thread which compresses and writes them
+ *  in order, rotates segments by size and age, and deletes the oldest
+ *  finished segments beyond the retention count. The writer also writes
+ *  out a partial block every flush interval, which bounds how much of the
+ *  log a crash can lose. If the writer falls behind by more than a few
+ *  blocks Append() waits for it, so memory use is bounded.
+ *
+ *  If a segment can't be created, e.g. while the disk is full, the blocks
+ *  written meanwhile are logged and counted as dropped, and creating it is
+ *  retried with the next block.
+ */
+class SegmentWriter {
+ public:
+  /// Snapshot of the writer counters
+  struct Stats {
+    uint64_t segments;      ///< segments started
+    uint64_t raw_bytes;     ///< bytes of lines written
+    uint64_t stored_bytes;  ///< bytes written to segments
+    uint64_t deleted;       ///< segments deleted by retention
+    uint64_t dropped;       ///< blocks lost to failed writes or opens
+  };
+
+  /// Rotate segments once they reach @p segment_bytes or are
+  /// @p segment_seconds old, either zero for no limit, keep the newest
+  /// @p segments_kept finished segments, zero to keep all
+  SegmentWriter(const std::string& base_path, uint64_t segment_bytes,
+                double segment_seconds, size_t segments_kept, bool compress,
+                double flush_interval);
+
+  /// Finishes the current segment
+  ~SegmentWriter();
+
+  /// Finish any segment left active by a crash, start a new segment after
+  /// the last existing one and start the writer, return 0 or -errno
+  int Start();
+
+  /// Append @p size bytes of whole lines
+  void Append(const char* data, size_t size);
+
+  /// Write out everything appended so far, and sync it to disk if @p sync
+  void Flush(bool sync);
+
+  /// Write out everything appended so far, finish the segment and stop the
+  /// writer
+  void Stop();
+
+  Stats GetStats() const;
+
+ private:
+  SegmentWriter(const SegmentWriter&);
+  SegmentWriter& operator=(const SegmentWriter&);
+
+  void WriterMain();
+
+  /// Compress and write @p block to the active segment, rotating first if
+  /// it is full or old. Only called on the writer thread.
+  void WriteBlock(const std::string& block);
+
+  /// Hand block_ to the writer and start a new one, reusing a written
+  /// block when there is one. Called with mutex_ held.
+  void HandOverLocked();
+
+  /// Start segment @p sequence_, return false if it can't be created. A
+  /// sequence number taken by another file is skipped for the next try.
+  bool OpenSegment();
+
+  /// Sync, close and rename the active segment, then apply retention
+  void FinishSegment();
+
+  std::string SegmentPath(uint64_t sequence, bool active) const;
+
+  std::string base_path_;
+  uint64_t segment_bytes_;
+  int64_t segment_ns_;
+  size_t segments_kept_;
+  bool compress_;
+  int64_t flush_interval_ns_;
+
+  // written only on the writer thread, or before it starts
+  int fd_;
+  uint64_t sequence_;
+  uint64_t segment_size_;
+  int64_t segment_started_ns_;
+  std::string deflated_;
+  std::vector<std::string> writing_;  ///< blocks taken from full_
+
+  std::mutex mutex_;
+  std::condition_variable writer_cv_;  ///< work for the writer
+  std::condition_variable done_cv_;    ///< the writer made progress
+  std::string block_;                  ///< lines not yet handed over
+  std::vector<std::string> full_;      ///< blocks waiting to be written
+  std::vector<std::string> spare_;     ///< written blocks kept for reuse
+  uint64_t flush_requested_;  ///< generation of the latest Flush()
+  uint64_t flush_done_;       ///< generation the writer has completed
+  bool sync_requested_;
+  bool stopping_;
+  std::thread thread_;
+
+  std::atomic<uint64_t> segments_;
+  std::atomic<uint64_t> raw_bytes_;
+  std::atomic<uint64_t> stored_bytes_;
+  std::atomic<uint64_t> deleted_;
+  std::atomic<uint64_t> dropped_;
+};
+
+/// Streams the lines of a segmented log, see SegmentHeader
+class SegmentReader {
+ public:
+  /// Read the segment file at @p path, or if there is no such file every
+  /// segment of the log with base path @p path, including the active one
+  explicit SegmentReader(const std::string& path);
+  ~SegmentReader();
+
+  /// Return false if there are no segments to read
+  bool ok() const {
+    return !paths_.empty();
+  }
+
+  /// Point @p line at the next line, without its newline, which is valid
+  /// until the next call. Return false at the end of the log.
+  bool NextLine(const char** line, size_t* size);
+
+  /// Number of segments or blocks which couldn't be read
+  uint64_t corrupt() const {
+    return corrupt_;
+  }
+
+  /// Return true if the file at @p path starts with a segment header
+  static bool IsSegment(const std::string& path);
+
+ private:
+  SegmentReader(const SegmentReader&);
+  SegmentReader& operator=(const SegmentReader&);
+
+  /// Decode the next block of the current segment into block_, moving on
+  /// to the next segment at the end of one. Return false at the end.
+  bool NextBlock();
+
+  /// Open the next of paths_, return false when there are no more. The
+  /// active segment may have been finished since it was listed, and is
+  /// then opened under its finished name.
+  bool OpenNext();
+
+  std::vector<std::string> paths_;
+  size_t next_path_;
+  int fd_;
+  std::vector<char> stored_;
+  std::vector<char> block_;
+  size_t position_;  ///< of the next line in block_
+  uint64_t corrupt_;
+};
+
+}  // namespace logfs_fuse
@@ -0,0 +1,11 @@
+#include "sharded.h"
+
+namespace logfs_fuse {
+
+static std::atomic<int> g_next_shard(0);
+
+int NextThreadShard() {
+  return g_next_shard.fetch_add(1, std::memory_order_relaxed);
+}
+
+}  // namespace logfs_fuse
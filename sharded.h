@@ -0,0 +1,110 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+namespace logfs_fuse {
+
+/// Return the next unused shard number
+int NextThreadShard();
+
+/// Return the shard of the calling thread, or -1 before it has one
+inline int& ThreadShardSlot() {
+  static thread_local int shard = -1;
+  return shard;
+}
+
+/// Return the shard of the calling thread
+/**
+ *  Threads are numbered densely from zero in the order they first ask,
+ *  unless they were given a shard with SetThreadShard(), which pinned
+ *  workers use so that each core updates its own shard.
+ */
+inline int ThreadShard() {
+  int& shard = ThreadShardSlot();
+  if (shard < 0) {
+    shard = NextThreadShard();
+  }
+  return shard;
+}
+
+/// Make @p shard the shard of the calling thread
+inline void SetThreadShard(int shard) {
+  ThreadShardSlot() = shard;
+}
+
+/// One @p T per thread shard, merged only by whoever reads them
+/**
+ *  Each shard is padded away from its neighbours so that threads updating
+ *  their own shard never share a cache line. There are a fixed number of
+ *  shards, and threads beyond that share one with an earlier thread, so
+ *  @p T must still be safe to update from several threads at once.
+ */
+template <typename T>
+class Sharded {
+ public:
+  static const int kNumShards = 64;
+
+  /// value-initializes every shard, so atomics start at zero
+  Sharded() : shards_() {}
+
+  /// Return the shard of the calling thread
+  T& local() {
+    return shards_[ThreadShard() % kNumShards].value;
+  }
+
+  /// Call @p visit with each shard in turn
+  template <typename Visit>
+  void ForEach(Visit visit) const {
+    for (int i = 0; i < kNumShards; i++) {
+      visit(shards_[i].value);
+    }
+  }
+
+ private:
+  /// The spatial prefetcher pulls in cache lines in aligned pairs, so
+  /// 128 bytes between shards keep them out of each other's pair, whatever
+  /// the alignment of the array
+  static const int kPadding = 128;
+
+  struct Shard {
+    char leading_pad[kPadding];
+    T value;
+  };
+
+  Shard shards_[kNumShards];
+  char trailing_pad_[kPadding];
+};
+
+template <typename T>
+const int Sharded<T>::kNumShards;
+
+template <typename T>
+const int Sharded<T>::kPadding;
+
+/// A counter each thread adds to on its own cache line
+/**
+ *  Adding costs an uncontended atomic add however many threads count,
+ *  while reading the value sums every shard, so this suits statistics
+ *  which are bumped on every op and read once per report.
+ */
+class ShardedCounter {
+ public:
+  void Add(int64_t amount) {
+    shards_.local().fetch_add(amount, std::memory_order_relaxed);
+  }
+
+  /// Return the sum of all shards
+  int64_t value() const {
+    int64_t sum = 0;
+    shards_.ForEach([&sum](const std::atomic<int64_t>& shard) {
+      sum += shard.load(std::memory_order_relaxed);
+    });
+    return sum;
+  }
+
+ private:
+  Sharded<std::atomic<int64_t>> shards_;
+};
+
+}  // namespace logfs_fuse
@@ -0,0 +1,131 @@
+#include "shared_fd_table.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+
+namespace logfs_fuse {
+
+SharedFdTable::SharedFdTable(size_t num_shards)
+    : num_shards_(num_shards > 0 ? num_shards : 1),
+      shards_(new Shard[num_shards_]) {}
+
+SharedFdTable::~SharedFdTable() {
+  for (size_t i = 0; i < num_shards_; i++) {
+    for (auto& pair : shards_[i].entries) {
+      ::close(pair.second.fd);
+    }
+  }
+}
+
+bool SharedFdTable::IsShareable(int flags) {
+  // anything that changes the behavior of the open file description
+  // itself needs a description of its own
+  const int kPrivateFlags = O_TRUNC | O_APPEND | O_DIRECT | O_NONBLOCK;
+  return (flags & O_ACCMODE) == O_RDONLY && !(flags & kPrivateFlags);
+}
+
+SharedFdTable::Shard& SharedFdTable::GetShard(const InodeKey& key) {
+  return shards_[InodeKeyHash()(key) % num_shards_];
+}
+
+int SharedFdTable::Ref(const InodeKey& key) {
+  Shard& shard = GetShard(key);
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  auto found = shard.entries.find(key);
+  if (found == shard.entries.end()) {
+    return -1;
+  }
+  found->second.refcount++;
+  return found->second.fd;
+}
+
+int SharedFdTable::Acquire(const std::string& path, int flags,
+                           InodeKey* key, bool* shared) {
+  acquires_.Add(1);
+  *shared = false;
+
+  // a stat is cheaper than an open, and the kernel has almost certainly
+  // just looked up this path so the inode is hot
+  struct stat st;
+  if (::stat(path.c_str(), &st) < 0) {
+    return -errno;
+  }
+
+  if (S_ISREG(st.st_mode)) {
+    int fd = Ref(InodeKey(st));
+    if (fd >= 0) {
+      shared_.Add(1);
+      *key = InodeKey(st);
+      *shared = true;
+      return fd;
+    }
+  }
+
+  backing_opens_.Add(1);
+  int fd = ::open(path.c_str(), flags);
+  if (fd < 0) {
+    return -errno;
+  }
+
+  // the path may have been replaced since the stat, so key the entry by
+  // what we actually opened
+  if (::fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+    return fd;
+  }
+
+  InodeKey opened(st);
+  Shard& shard = GetShard(opened);
+  {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto found = shard.entries.find(opened);
+    if (found == shard.entries.end()) {
+      Entry entry = {fd, 1};
+      shard.entries[opened] = entry;
+      open_fds_.Add(1);
+      *key = opened;
+      *shared = true;
+      return fd;
+    }
+
+    // somebody else opened the same inode while we were unlocked
+    found->second.refcount++;
+    *key = opened;
+    *shared = true;
+    int existing = found->second.fd;
+    shared_.Add(1);
+    ::close(fd);
+    return existing;
+  }
+}
+
+int SharedFdTable::Release(const InodeKey& key) {
+  Shard& shard = GetShard(key);
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  auto found = shard.entries.find(key);
+  if (found == shard.entries.end()) {
+    return -1;
+  }
+
+  if (--found->second.refcount > 0) {
+    return -1;
+  }
+
+  int fd = found->second.fd;
+  shard.entries.erase(found);
+  open_fds_.Add(-1);
+  return fd;
+}
+
+SharedFdTable::Stats SharedFdTable::GetStats() const {
+  Stats stats;
+  stats.acquires = acquires_.value();
+  stats.shared = shared_.value();
+  stats.backing_opens = backing_opens_.value();
+  stats.open_fds = open_fds_.value();
+  return stats;
+}
+
+}  // namespace logfs_fuse
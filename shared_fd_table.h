@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>  // NOLINT(build/c++11)
+#include <string>
+#include <unordered_map>
+
+#include "block_pool.h"
+#include "inode_key.h"
+#include "sharded.h"
+
+namespace logfs_fuse {
+
+/// Refcounted real-tree descriptors shared by read-only opens of one inode
+/**
+ *  During a parallel build the same headers and libraries are opened by
+ *  many processes at once. Since reads go through pread(), which doesn't
+ *  depend on the file offset, every read-only open of an inode can use the
+ *  same descriptor. The table holds one descriptor per inode along with the
+ *  number of open handles using it, and closes it when the last handle is
+ *  released.
+ *
+ *  The table is split into independently locked shards so that concurrent
+ *  opens of different files don't contend.
+ */
+class SharedFdTable {
+ public:
+  /// Snapshot of the table counters
+  struct Stats {
+    uint64_t acquires;       ///< total calls to Acquire()
+    uint64_t shared;         ///< acquires satisfied by an existing descriptor
+    uint64_t backing_opens;  ///< acquires that had to open the file
+    uint64_t open_fds;       ///< descriptors currently held by the table
+  };
+
+  explicit SharedFdTable(size_t num_shards = 16);
+  ~SharedFdTable();
+
+  /// Return true if an open with @p flags may use a shared descriptor
+  static bool IsShareable(int flags);
+
+  /// Return a read-only descriptor for @p path, or -errno on failure
+  /**
+   *  If the file is a regular file the descriptor is shared, @p key is set
+   *  to its inode and *@p shared is set to true; the caller must call
+   *  Release() with @p key when done with it. Otherwise the descriptor is
+   *  private to the caller, who must close it.
+   */
+  int Acquire(const std::string& path, int flags, InodeKey* key,
+              bool* shared);
+
+  /// Drop one reference to the descriptor for @p key
+  /**
+   *  Returns the descriptor if this was the last reference, in which case
+   *  the caller is responsible for closing it, otherwise returns -1.
+   */
+  int Release(const InodeKey& key);
+
+  Stats GetStats() const;
+
+ private:
+  struct Entry {
+    int fd;
+    uint64_t refcount;
+  };
+
+  struct Shard {
+    std::mutex mutex;
+    /// entries come and go with every open of an unshared file, so their
+    /// nodes are pooled
+    std::unordered_map<InodeKey, Entry, InodeKeyHash, std::equal_to<InodeKey>,
+                       PoolAllocator<std::pair<const InodeKey, Entry>>>
+        entries;
+  };
+
+  Shard& GetShard(const InodeKey& key);
+
+  /// Take a reference on an existing entry for @p key, returning its fd or
+  /// -1 if there is no entry
+  int Ref(const InodeKey& key);
+
+  size_t num_shards_;
+  std::unique_ptr<Shard[]> shards_;
+
+  ShardedCounter acquires_;
+  ShardedCounter shared_;
+  ShardedCounter backing_opens_;
+  ShardedCounter open_fds_;
+};
+
+}  // namespace logfs_fuse
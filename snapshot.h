@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+namespace logfs_fuse {
+
+/// Appends integers and strings to a buffer, for handing warm state to
+/// another process
+/**
+ *  Both ends are the same binary on the same machine, so integers are
+ *  written in host byte order and there is no versioning beyond the magic
+ *  the caller writes first.
+ */
+class SnapshotWriter {
+ public:
+  void PutU64(uint64_t value) {
+    data_.append(reinterpret_cast<const char*>(&value), sizeof(value));
+  }
+
+  void PutString(const std::string& value) {
+    PutU64(value.size());
+    data_.append(value);
+  }
+
+  const std::string& data() const {
+    return data_;
+  }
+
+ private:
+  std::string data_;
+};
+
+/// Reads back what a SnapshotWriter wrote
+/**
+ *  Every getter returns false once the data runs out, so a truncated
+ *  snapshot is detected rather than misread.
+ */
+class SnapshotReader {
+ public:
+  /// @p data must outlive the reader
+  explicit SnapshotReader(const std::string& data)
+      : data_(data), position_(0) {}
+
+  bool GetU64(uint64_t* value) {
+    if (data_.size() - position_ < sizeof(*value)) {
+      return false;
+    }
+    memcpy(value, data_.data() + position_, sizeof(*value));
+    position_ += sizeof(*value);
+    return true;
+  }
+
+  bool GetString(std::string* value) {
+    uint64_t size = 0;
+    if (!GetU64(&size) || data_.size() - position_ < size) {
+      return false;
+    }
+    value->assign(data_, position_, size);
+    position_ += size;
+    return true;
+  }
+
+  bool done() const {
+    return position_ == data_.size();
+  }
+
+ private:
+  const std::string& data_;
+  size_t position_;
+};
+
+}  // namespace logfs_fuse
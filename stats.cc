@@ -0,0 +1,293 @@
+#include "stats.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <ostream>
+#include <unordered_map>
+#include <utility>
+
+namespace logfs_fuse {
+
+const int Histogram::kSubBucketBits;
+const int Histogram::kMaxExponent;
+const int Histogram::kNumBuckets;
+
+int Histogram::BucketIndex(uint64_t value) {
+  const uint64_t kSubBuckets = 1 << kSubBucketBits;
+  if (value < kSubBuckets) {
+    return value;
+  }
+
+  int exponent = 63 - __builtin_clzll(value);
+  if (exponent > kMaxExponent) {
+    return kNumBuckets - 1;
+  }
+  int sub_bucket = (value >> (exponent - kSubBucketBits)) & (kSubBuckets - 1);
+  return ((exponent - kSubBucketBits + 1) << kSubBucketBits) + sub_bucket;
+}
+
+uint64_t Histogram::BucketLowerBound(int bucket) {
+  const uint64_t kSubBuckets = 1 << kSubBucketBits;
+  if (bucket < static_cast<int>(kSubBuckets)) {
+    return bucket;
+  }
+
+  int exponent = (bucket >> kSubBucketBits) + kSubBucketBits - 1;
+  uint64_t sub_bucket = bucket & (kSubBuckets - 1);
+  return (kSubBuckets + sub_bucket) << (exponent - kSubBucketBits);
+}
+
+uint64_t Histogram::BucketUpperBound(int bucket) {
+  if (bucket + 1 >= kNumBuckets) {
+    return UINT64_MAX;
+  }
+  return BucketLowerBound(bucket + 1) - 1;
+}
+
+uint64_t Histogram::Quantile(const std::vector<uint64_t>& counts,
+                             double quantile) {
+  uint64_t total = 0;
+  for (uint64_t count : counts) {
+    total += count;
+  }
+  if (total == 0) {
+    return 0;
+  }
+
+  // report the upper bound of the bucket so that we never under-report
+  uint64_t rank = std::min(static_cast<uint64_t>(quantile * total), total - 1);
+  uint64_t seen = 0;
+  for (size_t i = 0; i < counts.size(); i++) {
+    seen += counts[i];
+    if (seen > rank) {
+      return BucketUpperBound(i);
+    }
+  }
+  return BucketUpperBound(counts.size() - 1);
+}
+
+OpStats::OpStats()
+    : count(0),
+      errors(0),
+      total_ns(0),
+      backing_ns(0),
+      latency(Histogram::kNumBuckets, 0),
+      backing(Histogram::kNumBuckets, 0) {}
+
+void StatsSnapshot::FormatText(std::ostream* out) const {
+  *out << std::left << std::setw(12) << "op" << std::right
+       << std::setw(12) << "count" << std::setw(10) << "errors"
+       << std::setw(12) << "mean_us" << std::setw(12) << "backing_us"
+       << std::setw(10) << "p50_us" << std::setw(10) << "p99_us"
+       << std::setw(10) << "p999_us" << "\n";
+  *out << std::fixed << std::setprecision(1);
+  for (int i = 0; i < kNumOps; i++) {
+    const OpStats& op = ops[i];
+    if (op.count == 0) {
+      continue;
+    }
+    *out << std::left << std::setw(12) << OpName(static_cast<Op>(i))
+         << std::right << std::setw(12) << op.count << std::setw(10)
+         << op.errors << std::setw(12) << op.total_ns / 1e3 / op.count
+         << std::setw(12) << op.backing_ns / 1e3 / op.count << std::setw(10)
+         << Histogram::Quantile(op.latency, 0.5) / 1e3 << std::setw(10)
+         << Histogram::Quantile(op.latency, 0.99) / 1e3 << std::setw(10)
+         << Histogram::Quantile(op.latency, 0.999) / 1e3 << "\n";
+  }
+}
+
+static void FormatQuantilesJson(const std::vector<uint64_t>& counts,
+                                std::ostream* out) {
+  *out << "{\"p50\": " << Histogram::Quantile(counts, 0.5)
+       << ", \"p90\": " << Histogram::Quantile(counts, 0.9)
+       << ", \"p99\": " << Histogram::Quantile(counts, 0.99)
+       << ", \"p999\": " << Histogram::Quantile(counts, 0.999)
+       << ", \"max\": " << Histogram::Quantile(counts, 1.0) << "}";
+}
+
+void StatsSnapshot::FormatJson(std::ostream* out) const {
+  *out << "{";
+  bool first = true;
+  for (int i = 0; i < kNumOps; i++) {
+    const OpStats& op = ops[i];
+    if (op.count == 0) {
+      continue;
+    }
+    if (!first) {
+      *out << ", ";
+    }
+    first = false;
+    *out << "\"" << OpName(static_cast<Op>(i)) << "\": {"
+         << "\"count\": " << op.count << ", \"errors\": " << op.errors
+         << ", \"total_ns\": " << op.total_ns
+         << ", \"backing_ns\": " << op.backing_ns << ", \"latency_ns\": ";
+    FormatQuantilesJson(op.latency, out);
+    *out << ", \"backing_latency_ns\": ";
+    FormatQuantilesJson(op.backing, out);
+    *out << "}";
+  }
+  *out << "}";
+}
+
+/// Counters for one op on one thread
+struct OpCounters {
+  std::atomic<uint64_t> count;
+  std::atomic<uint64_t> errors;
+  std::atomic<uint64_t> total_ns;
+  std::atomic<uint64_t> backing_ns;
+  std::atomic<uint64_t> latency[Histogram::kNumBuckets];
+  std::atomic<uint64_t> backing[Histogram::kNumBuckets];
+};
+
+/// Counters for all ops on one thread, padded so that no two threads'
+/// counters share a cache line
+struct Stats::ThreadStats {
+  char leading_pad[64];
+  OpCounters ops[kNumOps];
+  bool in_use;  ///< a live thread records into it, guarded by mutex_
+  char trailing_pad[64];
+};
+
+// Only the owning thread ever writes its counters, so a relaxed load and
+// store is enough and avoids the locked instruction of fetch_add
+static inline void Bump(std::atomic<uint64_t>* counter, uint64_t amount) {
+  counter->store(counter->load(std::memory_order_relaxed) + amount,
+                 std::memory_order_relaxed);
+}
+
+static std::atomic<uint64_t> g_next_stats_id(1);
+
+// Cache of the counters the current thread uses in the Stats most recently
+// recorded into on it
+static thread_local uint64_t tls_stats_id = 0;
+static thread_local void* tls_thread_stats = NULL;
+
+static thread_local int64_t tls_backing_ns = 0;
+
+// Stats which still exist, by id, so that an exiting thread only hands its
+// counters back to those
+static std::mutex g_live_mutex;
+
+static std::unordered_map<uint64_t, Stats*>& LiveStats() {
+  // never destroyed, threads may exit after static destructors have run
+  static std::unordered_map<uint64_t, Stats*>* live =
+      new std::unordered_map<uint64_t, Stats*>();
+  return *live;
+}
+
+/// Hands the counters the calling thread used back to their Stats when the
+/// thread exits
+struct StatsThreadExit {
+  /// the counters the thread records into, by Stats id
+  std::vector<std::pair<uint64_t, Stats::ThreadStats*>> used;
+
+  ~StatsThreadExit() {
+    std::lock_guard<std::mutex> live_lock(g_live_mutex);
+    for (const auto& pair : used) {
+      auto live = LiveStats().find(pair.first);
+      if (live != LiveStats().end()) {
+        std::lock_guard<std::mutex> lock(live->second->mutex_);
+        pair.second->in_use = false;
+      }
+    }
+  }
+};
+
+static thread_local StatsThreadExit tls_thread_exit;
+
+Stats::Stats() : id_(g_next_stats_id++) {
+  std::lock_guard<std::mutex> lock(g_live_mutex);
+  LiveStats()[id_] = this;
+}
+
+Stats::~Stats() {
+  std::lock_guard<std::mutex> lock(g_live_mutex);
+  LiveStats().erase(id_);
+}
+
+Stats::ThreadStats* Stats::GetThreadStats() {
+  if (tls_stats_id == id_) {
+    return static_cast<ThreadStats*>(tls_thread_stats);
+  }
+
+  // a thread recording into several Stats keeps its counters in each
+  ThreadStats* thread_stats = NULL;
+  for (const auto& pair : tls_thread_exit.used) {
+    if (pair.first == id_) {
+      thread_stats = pair.second;
+    }
+  }
+  if (!thread_stats) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const std::unique_ptr<ThreadStats>& retired : threads_) {
+      if (!retired->in_use) {
+        thread_stats = retired.get();
+        break;
+      }
+    }
+    if (!thread_stats) {
+      // value-initialization zeroes all of the counters
+      thread_stats = new ThreadStats();
+      threads_.push_back(std::unique_ptr<ThreadStats>(thread_stats));
+    }
+    thread_stats->in_use = true;
+    tls_thread_exit.used.push_back(std::make_pair(id_, thread_stats));
+  }
+  tls_stats_id = id_;
+  tls_thread_stats = thread_stats;
+  return thread_stats;
+}
+
+void Stats::Record(Op op, int64_t latency_ns, int64_t backing_ns,
+                   bool error) {
+  OpCounters& counters = GetThreadStats()->ops[op];
+  Bump(&counters.count, 1);
+  if (error) {
+    Bump(&counters.errors, 1);
+  }
+  Bump(&counters.total_ns, latency_ns);
+  Bump(&counters.backing_ns, backing_ns);
+  Bump(&counters.latency[Histogram::BucketIndex(latency_ns)], 1);
+  Bump(&counters.backing[Histogram::BucketIndex(backing_ns)], 1);
+}
+
+StatsSnapshot Stats::Snapshot() const {
+  StatsSnapshot snapshot;
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (const std::unique_ptr<ThreadStats>& thread_stats : threads_) {
+    for (int i = 0; i < kNumOps; i++) {
+      const OpCounters& counters = thread_stats->ops[i];
+      OpStats& merged = snapshot.ops[i];
+      merged.count += counters.count.load(std::memory_order_relaxed);
+      merged.errors += counters.errors.load(std::memory_order_relaxed);
+      merged.total_ns += counters.total_ns.load(std::memory_order_relaxed);
+      merged.backing_ns +=
+          counters.backing_ns.load(std::memory_order_relaxed);
+      for (int j = 0; j < Histogram::kNumBuckets; j++) {
+        merged.latency[j] +=
+            counters.latency[j].load(std::memory_order_relaxed);
+        merged.backing[j] +=
+            counters.backing[j].load(std::memory_order_relaxed);
+      }
+    }
+  }
+  return snapshot;
+}
+
+thread_local bool BackingTimer::timing_ = false;
+
+void BackingTimer::Begin(bool timing) {
+  tls_backing_ns = 0;
+  timing_ = timing;
+}
+
+int64_t BackingTimer::End() {
+  timing_ = false;
+  return tls_backing_ns;
+}
+
+void BackingTimer::Add(int64_t ns) {
+  tls_backing_ns += ns;
+}
+
+}  // namespace logfs_fuse
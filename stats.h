@@ -0,0 +1,187 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <iosfwd>
+#include <memory>
+#include <mutex>  // NOLINT(build/c++11)
+#include <string>
+#include <vector>
+
+#include "clock.h"
+#include "op.h"
+#include "tracer.h"
+
+namespace logfs_fuse {
+
+/// Log-linear bucketing of latencies, in the style of HDR histograms
+/**
+ *  Values below 2^kSubBucketBits get a bucket each. Above that each power
+ *  of two is split into 2^kSubBucketBits equal buckets, so a recorded value
+ *  is known to within 1/2^kSubBucketBits of itself, using only a few
+ *  hundred buckets for the range from nanoseconds to minutes.
+ */
+struct Histogram {
+  static const int kSubBucketBits = 3;
+  static const int kMaxExponent = 40;  ///< larger values share a bucket
+  static const int kNumBuckets = (kMaxExponent - kSubBucketBits + 2)
+                                 << kSubBucketBits;
+
+  /// Return the bucket which counts @p value
+  static int BucketIndex(uint64_t value);
+
+  /// Return the smallest value counted by @p bucket
+  static uint64_t BucketLowerBound(int bucket);
+
+  /// Return the largest value counted by @p bucket
+  static uint64_t BucketUpperBound(int bucket);
+
+  /// Return the value below which fraction @p quantile of @p counts fall
+  static uint64_t Quantile(const std::vector<uint64_t>& counts,
+                           double quantile);
+};
+
+/// Merged counters for one op
+struct OpStats {
+  uint64_t count;       ///< number of completed calls
+  uint64_t errors;      ///< calls which returned an error
+  uint64_t total_ns;    ///< total time spent in the calls
+  uint64_t backing_ns;  ///< part of total_ns spent in real-tree syscalls
+  std::vector<uint64_t> latency;  ///< histogram of per-call time
+  std::vector<uint64_t> backing;  ///< histogram of per-call backing time
+
+  OpStats();
+};
+
+/// Merged counters for all ops at one point in time
+struct StatsSnapshot {
+  OpStats ops[kNumOps];
+
+  /// Write a human readable table of ops which have been called
+  void FormatText(std::ostream* out) const;
+
+  /// Write a JSON object keyed by op name
+  void FormatJson(std::ostream* out) const;
+};
+
+/// Per-operation counters and latency histograms
+/**
+ *  Every thread which records into a Stats gets its own set of counters,
+ *  padded away from other threads' so that recording never shares a cache
+ *  line and never takes a lock or does a locked read-modify-write. Threads
+ *  register their counters on first use, and Snapshot() merges them all.
+ *  This keeps the cost of recording to a few relaxed stores per op, cheap
+ *  enough to leave on in production.
+ *
+ *  The counters of a thread which exits are kept, and handed to the next
+ *  thread to start recording, so the multithreaded fuse loop retiring and
+ *  starting workers doesn't grow them without bound.
+ */
+class Stats {
+ public:
+  Stats();
+  ~Stats();
+
+  /// Record one completed @p op on the calling thread
+  void Record(Op op, int64_t latency_ns, int64_t backing_ns, bool error);
+
+  /// Merge the counters of every thread
+  StatsSnapshot Snapshot() const;
+
+ private:
+  struct ThreadStats;
+  friend struct StatsThreadExit;
+
+  ThreadStats* GetThreadStats();
+
+  uint64_t id_;  ///< distinguishes instances in the thread-local cache
+  mutable std::mutex mutex_;
+  /// the counters of every thread, including ones which have exited
+  std::vector<std::unique_ptr<ThreadStats>> threads_;
+};
+
+/// Times a real-tree syscall, accumulating into the current op's backing time
+/**
+ *  Place one of these in a scope around a syscall on the real tree. OpTimer
+ *  collects the time accumulated on the thread when its op finishes, which
+ *  splits the op's time into real-tree time and our own overhead.
+ *
+ *  The clock is only read while an OpTimer recording stats runs on the
+ *  thread, so with stats off, or on threads outside of ops, a BackingTimer
+ *  costs a thread-local load.
+ */
+class BackingTimer {
+ public:
+  BackingTimer() : timed_(timing_), start_ns_(timed_ ? NowNs() : 0) {}
+  ~BackingTimer() {
+    if (timed_) {
+      Add(NowNs() - start_ns_);
+    }
+  }
+
+  /// Reset the backing time accumulated on this thread, and time syscalls
+  /// on it from now on if @p timing
+  static void Begin(bool timing);
+
+  /// Stop timing syscalls on this thread, return the time accumulated
+  static int64_t End();
+
+ private:
+  static void Add(int64_t ns);
+
+  static thread_local bool timing_;  ///< an op on this thread wants timing
+
+  bool timed_;
+  int64_t start_ns_;
+};
+
+/// Run @p call inside a BackingTimer and return its result
+template <typename Call>
+auto TimeBacking(Call call) -> decltype(call()) {
+  BackingTimer timer;
+  return call();
+}
+
+/// Times one fuse operation and records it on Finish()
+class OpTimer {
+ public:
+  /// A NULL @p stats disables recording stats, a NULL or stopped @p tracer
+  /// disables tracing. @p caller and @p path are only used for tracing.
+  OpTimer(Stats* stats, Tracer* tracer, Op op, pid_t caller, const char* path)
+      : stats_(stats),
+        tracer_(tracer && tracer->enabled() ? tracer : NULL),
+        op_(op),
+        caller_(caller),
+        path_(path),
+        start_ns_(0) {
+    if (stats_ || tracer_) {
+      BackingTimer::Begin(stats_ != NULL);
+      start_ns_ = NowNs();
+    }
+  }
+
+  /// Record the op, which returned @p result, and pass the result through
+  int Finish(int result) {
+    if (stats_ || tracer_) {
+      int64_t end_ns = NowNs();
+      int64_t backing_ns = BackingTimer::End();
+      if (stats_) {
+        stats_->Record(op_, end_ns - start_ns_, backing_ns, result < 0);
+      }
+      if (tracer_) {
+        tracer_->Record(op_, start_ns_, end_ns, caller_, path_, result);
+      }
+    }
+    return result;
+  }
+
+ private:
+  Stats* stats_;
+  Tracer* tracer_;
+  Op op_;
+  pid_t caller_;
+  const char* path_;
+  int64_t start_ns_;
+};
+
+}  // namespace logfs_fuse
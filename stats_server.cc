@@ -0,0 +1,228 @@
+#include "stats_server.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include <glog/logging.h>
+
+#include "replacing_file.h"
+#include "unix_socket.h"
+
+namespace logfs_fuse {
+
+// Wakes the server thread. The signal handler writes kSignalByte, Stop()
+// writes kStopByte and CloseSocket() kCloseByte.
+static int g_wake_pipe[2] = {-1, -1};
+static const char kSignalByte = 's';
+static const char kStopByte = 'q';
+static const char kCloseByte = 'c';
+
+static struct sigaction g_previous_action;
+
+// how long a client may stall the reply, and with it SIGUSR1 dumps
+static const int kSendTimeoutSeconds = 2;
+
+static void HandleSignal(int) {
+  int saved_errno = errno;
+  ssize_t ignored = ::write(g_wake_pipe[1], &kSignalByte, 1);
+  (void)ignored;
+  errno = saved_errno;
+}
+
+// send all of @p data to the socket @p fd, without SIGPIPE if the client
+// went away
+static bool SendAll(int fd, const std::string& data) {
+  for (size_t sent = 0; sent < data.size();) {
+    ssize_t result =
+        ::send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+    if (result < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    sent += result;
+  }
+  return true;
+}
+
+StatsServer::StatsServer(const std::string& dump_path,
+                         const std::string& socket_path, bool json,
+                         ReportFn report)
+    : dump_path_(dump_path),
+      socket_path_(socket_path),
+      json_(json),
+      report_(report),
+      listen_fd_(-1),
+      running_(false) {}
+
+StatsServer::~StatsServer() {
+  Stop();
+}
+
+void StatsServer::AddSignalHook(SignalHook hook) {
+  std::lock_guard<std::mutex> lock(hooks_mutex_);
+  hooks_.push_back(hook);
+}
+
+void StatsServer::Start() {
+  LOG_IF(FATAL, g_wake_pipe[0] >= 0) << "Only one StatsServer may run";
+  PLOG_IF(FATAL, ::pipe2(g_wake_pipe, O_CLOEXEC | O_NONBLOCK) < 0)
+      << "Failed to create stats server pipe";
+
+  if (!socket_path_.empty()) {
+    listen_fd_ = ListenUnixSocket(socket_path_, SOCK_STREAM, 8);
+    LOG_IF(FATAL, listen_fd_ < 0)
+        << "Failed to listen on stats socket '" << socket_path_ << "', ["
+        << -listen_fd_ << "] : " << strerror(-listen_fd_);
+  }
+
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = HandleSignal;
+  action.sa_flags = SA_RESTART;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGUSR1, &action, &g_previous_action);
+
+  running_ = true;
+  thread_ = std::thread(&StatsServer::ServerMain, this);
+}
+
+void StatsServer::Stop() {
+  if (!running_) {
+    return;
+  }
+
+  sigaction(SIGUSR1, &g_previous_action, NULL);
+  ssize_t ignored = ::write(g_wake_pipe[1], &kStopByte, 1);
+  (void)ignored;
+  thread_.join();
+  running_ = false;
+
+  CloseSocketLocked();
+  ::close(g_wake_pipe[0]);
+  ::close(g_wake_pipe[1]);
+  g_wake_pipe[0] = g_wake_pipe[1] = -1;
+}
+
+void StatsServer::CloseSocket() {
+  std::unique_lock<std::mutex> lock(socket_mutex_);
+  if (!running_) {
+    CloseSocketLocked();
+    return;
+  }
+  // the thread may be polling the socket, so it closes it itself
+  ssize_t ignored = ::write(g_wake_pipe[1], &kCloseByte, 1);
+  (void)ignored;
+  socket_closed_.wait(lock, [this] { return listen_fd_ < 0; });
+}
+
+void StatsServer::CloseSocketLocked() {
+  if (listen_fd_ >= 0) {
+    ::close(listen_fd_);
+    ::unlink(socket_path_.c_str());
+    listen_fd_ = -1;
+  }
+}
+
+void StatsServer::ServerMain() {
+  while (true) {
+    pollfd fds[2];
+    fds[0].fd = g_wake_pipe[0];
+    fds[0].events = POLLIN;
+    fds[1].fd = listen_fd_;
+    fds[1].events = POLLIN;
+    int nfds = listen_fd_ >= 0 ? 2 : 1;
+
+    if (::poll(fds, nfds, -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      PLOG(ERROR) << "Stats server poll failed";
+      return;
+    }
+
+    if (fds[0].revents & POLLIN) {
+      char bytes[16];
+      ssize_t count = ::read(g_wake_pipe[0], bytes, sizeof(bytes));
+      bool signalled = false;
+      for (ssize_t i = 0; i < count; i++) {
+        if (bytes[i] == kStopByte) {
+          return;
+        } else if (bytes[i] == kCloseByte) {
+          std::lock_guard<std::mutex> lock(socket_mutex_);
+          CloseSocketLocked();
+          socket_closed_.notify_all();
+          nfds = 1;
+        } else {
+          signalled = true;
+        }
+      }
+      if (signalled) {
+        WriteDump();
+        std::lock_guard<std::mutex> lock(hooks_mutex_);
+        for (SignalHook& hook : hooks_) {
+          hook();
+        }
+      }
+    }
+
+    if (nfds > 1 && (fds[1].revents & POLLIN)) {
+      int client_fd = ::accept4(listen_fd_, NULL, NULL, SOCK_CLOEXEC);
+      if (client_fd >= 0) {
+        ServeClient(client_fd);
+        ::close(client_fd);
+      }
+    }
+  }
+}
+
+void StatsServer::WriteDump() {
+  std::string report = report_(json_);
+  if (dump_path_.empty()) {
+    LOG(INFO) << "stats:\n" << report;
+    return;
+  }
+
+  ReplacingFile file(dump_path_);
+  file.out() << report;
+  int result = file.Commit();
+  LOG_IF(WARNING, result < 0) << "Failed to write stats dump '" << dump_path_
+                              << "', [" << -result
+                              << "] : " << strerror(-result);
+}
+
+void StatsServer::ServeClient(int client_fd) {
+  timeval timeout;
+  timeout.tv_sec = kSendTimeoutSeconds;
+  timeout.tv_usec = 0;
+  ::setsockopt(client_fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+  // give the client a moment to say which format it wants
+  bool json = json_;
+  pollfd pfd;
+  pfd.fd = client_fd;
+  pfd.events = POLLIN;
+  if (::poll(&pfd, 1, 100) > 0) {
+    char request[16] = {0};
+    ssize_t count = ::read(client_fd, request, sizeof(request) - 1);
+    if (count > 0) {
+      if (strncmp(request, "text", 4) == 0) {
+        json = false;
+      } else if (strncmp(request, "json", 4) == 0) {
+        json = true;
+      }
+    }
+  }
+  SendAll(client_fd, report_(json));
+}
+
+}  // namespace logfs_fuse
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <condition_variable>  // NOLINT(build/c++11)
+#include <functional>
+#include <mutex>  // NOLINT(build/c++11)
+#include <string>
+#include <thread>  // NOLINT(build/c++11)
+#include <vector>
+
+namespace logfs_fuse {
+
+/// Serves stats reports on SIGUSR1 and over a unix socket
+/**
+ *  A background thread waits for either:
+ *    * SIGUSR1, on which it writes a report to the dump path (or to the
+ *      glog INFO log if there is no dump path) and runs any signal hooks
+ *    * a connection on the unix socket, to which it replies with a report.
+ *      A client may send "text" or "json" to choose the format, otherwise
+ *      it gets the default format. Clients are served one at a time, so
+ *      one which stops reading is dropped after a short send timeout, and
+ *      one which goes away mid-reply doesn't raise SIGPIPE.
+ *
+ *  The signal handler only writes a byte to a pipe, so the report itself
+ *  is never generated in signal context. Since the signal disposition is
+ *  process-wide there should only be one server per process.
+ */
+class StatsServer {
+ public:
+  /// Generates a report, in JSON if @p json is true, otherwise as text
+  typedef std::function<std::string(bool json)> ReportFn;
+
+  /// Called on the server thread for every SIGUSR1
+  typedef std::function<void()> SignalHook;
+
+  /// Either path may be empty. If @p json the dump file and default socket
+  /// replies are JSON, otherwise text.
+  StatsServer(const std::string& dump_path, const std::string& socket_path,
+              bool json, ReportFn report);
+  ~StatsServer();
+
+  /// Register @p hook to run on every SIGUSR1, may be called while running
+  void AddSignalHook(SignalHook hook);
+
+  /// Install the signal handler, open the socket and start the thread
+  void Start();
+
+  /// Stop the thread, close the socket and restore the signal handler
+  void Stop();
+
+  /// Close and remove the socket, for a process taking over to listen on,
+  /// but go on serving SIGUSR1. Returns once the socket is gone.
+  void CloseSocket();
+
+ private:
+  StatsServer(const StatsServer&);
+  StatsServer& operator=(const StatsServer&);
+
+  void ServerMain();
+  void WriteDump();
+  void ServeClient(int client_fd);
+
+  /// Close and remove the socket if it is open. Caller must hold
+  /// socket_mutex_, unless the thread isn't running.
+  void CloseSocketLocked();
+
+  std::string dump_path_;
+  std::string socket_path_;
+  bool json_;
+  ReportFn report_;
+
+  std::mutex hooks_mutex_;
+  std::vector<SignalHook> hooks_;
+
+  std::mutex socket_mutex_;  ///< guards closing listen_fd_
+  std::condition_variable socket_closed_;
+  int listen_fd_;
+  std::thread thread_;
+  bool running_;
+};
+
+}  // namespace logfs_fuse
@@ -0,0 +1,230 @@
+#include "tracer.h"
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <thread>  // NOLINT(build/c++11)
+
+#include "replacing_file.h"
+#include "stats.h"
+
+namespace logfs_fuse {
+
+// events a thread takes from the shared budget at once, so that workers
+// rarely touch the shared counter
+static const size_t kReserveEvents = 256;
+
+struct Tracer::Event {
+  Op op;
+  int result;
+  pid_t caller;
+  int64_t begin_ns;
+  int64_t end_ns;
+  std::string path;
+};
+
+/// Events recorded by one thread, only ever written by that thread
+struct Tracer::ThreadTrace {
+  std::atomic<bool> busy;  ///< the owner is inside Record()
+  pid_t tid;
+  size_t reserved;  ///< events left of the thread's share of the budget
+  std::vector<Event> events;
+
+  ThreadTrace() : busy(false), tid(syscall(SYS_gettid)), reserved(0) {}
+};
+
+static std::atomic<uint64_t> g_next_tracer_id(1);
+
+// Cache of the trace of the current thread in the tracer most recently
+// recorded into on it
+static thread_local uint64_t tls_tracer_id = 0;
+static thread_local void* tls_thread_trace = NULL;
+
+Tracer::Tracer(const std::string& path, size_t max_events)
+    : path_(path),
+      max_events_(max_events),
+      id_(g_next_tracer_id++),
+      enabled_(false),
+      budget_(0),
+      dropped_(0),
+      started_ns_(0),
+      written_(0) {}
+
+Tracer::~Tracer() {
+  Stop();
+}
+
+Tracer::ThreadTrace* Tracer::GetThreadTrace() {
+  if (tls_tracer_id == id_) {
+    return static_cast<ThreadTrace*>(tls_thread_trace);
+  }
+
+  ThreadTrace* thread_trace = new ThreadTrace();
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    threads_.push_back(std::unique_ptr<ThreadTrace>(thread_trace));
+  }
+  tls_tracer_id = id_;
+  tls_thread_trace = thread_trace;
+  return thread_trace;
+}
+
+void Tracer::Record(Op op, int64_t begin_ns, int64_t end_ns, pid_t caller,
+                    const char* path, int result) {
+  ThreadTrace* thread = GetThreadTrace();
+
+  // Both this store and the load of enabled_ are sequentially consistent,
+  // so either we see that tracing stopped, or Stop() sees us busy and
+  // waits for us
+  thread->busy.store(true);
+  if (enabled_.load()) {
+    if (thread->reserved == 0) {
+      size_t budget = budget_.load(std::memory_order_relaxed);
+      size_t take = 0;
+      do {
+        take = std::min(budget, kReserveEvents);
+      } while (take > 0 && !budget_.compare_exchange_weak(
+                               budget, budget - take,
+                               std::memory_order_relaxed));
+      thread->reserved = take;
+    }
+
+    if (thread->reserved > 0) {
+      thread->reserved--;
+      Event event;
+      event.op = op;
+      event.result = result;
+      event.caller = caller;
+      event.begin_ns = begin_ns;
+      event.end_ns = end_ns;
+      event.path = path ? path : "";
+      thread->events.push_back(event);
+    } else {
+      dropped_.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+  thread->busy.store(false, std::memory_order_release);
+}
+
+void Tracer::Start() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  enabled_.store(false);
+  for (std::unique_ptr<ThreadTrace>& thread : threads_) {
+    while (thread->busy.load()) {
+      std::this_thread::yield();
+    }
+    thread->events.clear();
+    thread->reserved = 0;
+  }
+
+  budget_.store(max_events_);
+  dropped_.store(0);
+  started_ns_ = NowNs();
+  enabled_.store(true);
+}
+
+int Tracer::Stop() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!enabled_.load()) {
+    return 0;
+  }
+
+  enabled_.store(false);
+  for (std::unique_ptr<ThreadTrace>& thread : threads_) {
+    while (thread->busy.load()) {
+      std::this_thread::yield();
+    }
+  }
+
+  int result = WriteTrace();
+  for (std::unique_ptr<ThreadTrace>& thread : threads_) {
+    std::vector<Event>().swap(thread->events);
+    thread->reserved = 0;
+  }
+  return result;
+}
+
+// write @p value as a JSON string
+static void WriteJsonString(const std::string& value, std::ostream* out) {
+  *out << '"';
+  for (char c : value) {
+    if (c == '"' || c == '\\') {
+      *out << '\\' << c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      char escaped[8];
+      snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+      *out << escaped;
+    } else {
+      *out << c;
+    }
+  }
+  *out << '"';
+}
+
+int Tracer::WriteTrace() {
+  ReplacingFile file(path_);
+  if (file.error() < 0) {
+    return file.error();
+  }
+  std::ostream& out = file.out();
+
+  pid_t pid = getpid();
+  size_t written = 0;
+  out << "{\"displayTimeUnit\": \"ns\", \"otherData\": {\"dropped_events\": "
+      << dropped_.load() << "}, \"traceEvents\": [\n";
+  out << std::fixed << std::setprecision(3);
+  bool first = true;
+  for (const std::unique_ptr<ThreadTrace>& thread : threads_) {
+    if (thread->events.empty()) {
+      continue;
+    }
+    if (!first) {
+      out << ",\n";
+    }
+    first = false;
+    out << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": " << pid
+        << ", \"tid\": " << thread->tid
+        << ", \"args\": {\"name\": \"fuse worker " << thread->tid << "\"}}";
+
+    for (const Event& event : thread->events) {
+      out << ",\n{\"name\": \"" << OpName(event.op)
+          << "\", \"cat\": \"fuse\", \"ph\": \"X\", \"pid\": " << pid
+          << ", \"tid\": " << thread->tid
+          << ", \"ts\": " << (event.begin_ns - started_ns_) / 1e3
+          << ", \"dur\": " << (event.end_ns - event.begin_ns) / 1e3
+          << ", \"args\": {\"path\": ";
+      WriteJsonString(event.path, &out);
+      out << ", \"caller\": " << event.caller
+          << ", \"result\": " << event.result << "}}";
+      written++;
+    }
+  }
+  out << "\n]}\n";
+  int result = file.Commit();
+  if (result < 0) {
+    return result;
+  }
+  written_ = written;
+  return 0;
+}
+
+std::string Tracer::Status() const {
+  std::ostringstream out;
+  if (enabled()) {
+    out << "tracing, at most " << max_events_ << " events, "
+        << dropped_.load() << " dropped so far\n";
+  } else {
+    std::lock_guard<std::mutex> lock(mutex_);
+    out << "stopped, last trace of " << written_ << " events in " << path_
+        << "\n";
+  }
+  return out.str();
+}
+
+}  // namespace logfs_fuse
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <sys/types.h>
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>  // NOLINT(build/c++11)
+#include <string>
+#include <vector>
+
+#include "op.h"
+
+namespace logfs_fuse {
+
+/// Records a timeline of fuse operations in the Chrome trace event format
+/**
+ *  While tracing, every op records its begin and end time, worker thread,
+ *  calling process, path and result into a buffer owned by the worker
+ *  thread. Appending takes no lock: the worker marks itself busy with a
+ *  single store, and Stop() waits for workers to leave Record() before it
+ *  reads the buffers, so the buffers are never read while being written.
+ *
+ *  Stop() writes the trace as JSON which loads in chrome://tracing or
+ *  https://ui.perfetto.dev, with one track per worker thread. The number
+ *  of events per trace is capped, events beyond the cap are dropped and
+ *  counted, so tracing can be left running around a slow build step
+ *  without running the mirror out of memory.
+ *
+ *  While not tracing, the cost per op is one relaxed load.
+ */
+class Tracer {
+ public:
+  /// Traces are written to @p path, holding at most @p max_events
+  Tracer(const std::string& path, size_t max_events);
+  ~Tracer();
+
+  bool enabled() const {
+    return enabled_.load(std::memory_order_relaxed);
+  }
+
+  /// Start a new trace, discarding any events not yet written
+  void Start();
+
+  /// Stop tracing and write the trace, return 0 or -errno. Does nothing
+  /// if not tracing.
+  int Stop();
+
+  /// Record one op, called by the worker thread which ran it
+  void Record(Op op, int64_t begin_ns, int64_t end_ns, pid_t caller,
+              const char* path, int result);
+
+  /// Return a one line summary of the state of the tracer
+  std::string Status() const;
+
+ private:
+  Tracer(const Tracer&);
+  Tracer& operator=(const Tracer&);
+
+  struct Event;
+  struct ThreadTrace;
+
+  ThreadTrace* GetThreadTrace();
+  int WriteTrace();
+
+  std::string path_;
+  size_t max_events_;
+  uint64_t id_;  ///< distinguishes instances in the thread-local cache
+
+  std::atomic<bool> enabled_;
+  std::atomic<size_t> budget_;   ///< events which may still be recorded
+  std::atomic<size_t> dropped_;  ///< events over the cap in this trace
+
+  mutable std::mutex mutex_;  ///< guards threads_ and start/stop
+  std::vector<std::unique_ptr<ThreadTrace>> threads_;
+  int64_t started_ns_;
+  size_t written_;  ///< events in the last trace written
+};
+
+}  // namespace logfs_fuse
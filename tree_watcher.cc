@@ -0,0 +1,311 @@
+#include "tree_watcher.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+#include <glog/logging.h>
+
+#include "clock.h"
+
+namespace logfs_fuse {
+
+const size_t TreeWatcher::kMaxBatchPaths;
+
+// everything that can change what a cache holds for a path. Watches are
+// per directory and report changes to the files in it by name.
+static const uint32_t kWatchMask = IN_MODIFY | IN_ATTRIB | IN_CREATE |
+                                   IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO |
+                                   IN_ONLYDIR | IN_DONT_FOLLOW |
+                                   IN_EXCL_UNLINK;
+
+TreeWatcher::TreeWatcher(const std::string& real_root, double batch_seconds)
+    : real_root_(real_root),
+      batch_ns_(static_cast<int64_t>(std::max(batch_seconds, 0.0) * 1e9)),
+      inotify_fd_(-1),
+      pending_flush_(false),
+      rescan_(false),
+      watches_(0),
+      unwatched_(0),
+      events_(0),
+      batches_(0),
+      invalidated_(0),
+      flushes_(0),
+      overflows_(0) {
+  wake_pipe_[0] = wake_pipe_[1] = -1;
+  // the mirror path of a file is the real path without the root
+  while (real_root_.size() > 1 && real_root_.back() == '/') {
+    real_root_.erase(real_root_.size() - 1);
+  }
+  if (real_root_ == "/") {
+    real_root_.clear();
+  }
+}
+
+TreeWatcher::~TreeWatcher() {
+  Stop();
+}
+
+int TreeWatcher::Start(InvalidateFn invalidate, FlushFn flush) {
+  invalidate_ = invalidate;
+  flush_ = flush;
+  inotify_fd_ = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (inotify_fd_ < 0) {
+    return -errno;
+  }
+  if (::pipe2(wake_pipe_, O_CLOEXEC) < 0) {
+    int error = errno;
+    ::close(inotify_fd_);
+    inotify_fd_ = -1;
+    return -error;
+  }
+  thread_ = std::thread(&TreeWatcher::WatcherMain, this);
+  return 0;
+}
+
+void TreeWatcher::Stop() {
+  if (thread_.joinable()) {
+    char stop = 'q';
+    ssize_t ignored = ::write(wake_pipe_[1], &stop, 1);
+    (void)ignored;
+    thread_.join();
+  }
+  if (inotify_fd_ >= 0) {
+    ::close(inotify_fd_);
+    ::close(wake_pipe_[0]);
+    ::close(wake_pipe_[1]);
+    inotify_fd_ = wake_pipe_[0] = wake_pipe_[1] = -1;
+  }
+}
+
+TreeWatcher::Stats TreeWatcher::GetStats() const {
+  Stats stats;
+  stats.watches = watches_.load();
+  stats.unwatched = unwatched_.load();
+  stats.events = events_.load();
+  stats.batches = batches_.load();
+  stats.invalidated = invalidated_.load();
+  stats.flushes = flushes_.load();
+  stats.overflows = overflows_.load();
+  return stats;
+}
+
+void TreeWatcher::WatcherMain() {
+  // watched from here rather than in Start(), so that a large tree doesn't
+  // hold up the mount
+  WatchTree("", false);
+
+  bool batching = false;
+  int64_t deadline_ns = 0;
+  while (true) {
+    int timeout_ms = -1;
+    if (batching) {
+      int64_t remaining_ns = std::max<int64_t>(deadline_ns - NowNs(), 0);
+      timeout_ms = static_cast<int>((remaining_ns + 999999) / 1000000);
+    }
+
+    pollfd fds[2];
+    fds[0].fd = wake_pipe_[0];
+    fds[0].events = POLLIN;
+    fds[1].fd = inotify_fd_;
+    fds[1].events = POLLIN;
+    if (::poll(fds, 2, timeout_ms) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      PLOG(ERROR) << "Tree watcher poll failed, no longer watching";
+      return;
+    }
+    if (fds[0].revents & POLLIN) {
+      return;
+    }
+
+    if (fds[1].revents & POLLIN) {
+      if (!ReadEvents()) {
+        return;
+      }
+      if (!batching && (pending_flush_ || !pending_.empty())) {
+        batching = true;
+        deadline_ns = NowNs() + batch_ns_;
+      }
+    }
+    if (batching && NowNs() >= deadline_ns) {
+      ApplyBatch();
+      batching = false;
+    }
+  }
+}
+
+void TreeWatcher::WatchTree(const std::string& path, bool invalidate) {
+  std::vector<std::string> stack(1, path);
+  while (!stack.empty()) {
+    std::string dir = std::move(stack.back());
+    stack.pop_back();
+
+    std::string real = real_root_ + dir;
+    if (real.empty()) {
+      real = "/";
+    }
+    int wd = ::inotify_add_watch(inotify_fd_, real.c_str(), kWatchMask);
+    if (wd < 0) {
+      // gone already, or not a directory after all
+      if (errno == ENOENT || errno == ENOTDIR) {
+        continue;
+      }
+      // usually ENOSPC, fs.inotify.max_user_watches is used up
+      if (unwatched_++ == 0) {
+        PLOG(WARNING) << "Failed to watch '" << real
+                      << "', changes below it won't invalidate caches";
+      }
+      continue;
+    }
+    // watching a directory twice returns the same watch
+    if (dirs_.insert(std::make_pair(wd, dir)).second) {
+      watches_++;
+    } else {
+      dirs_[wd] = dir;
+    }
+
+    DIR* handle = ::opendir(real.c_str());
+    if (!handle) {
+      continue;
+    }
+    while (dirent* entry = ::readdir(handle)) {
+      if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+        continue;
+      }
+      std::string child = dir + "/" + entry->d_name;
+      if (invalidate) {
+        AddPending(child);
+      }
+      bool is_dir = entry->d_type == DT_DIR;
+      if (entry->d_type == DT_UNKNOWN) {
+        struct stat st;
+        std::string real_child = real_root_ + child;
+        is_dir = ::lstat(real_child.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+      }
+      if (is_dir) {
+        stack.push_back(child);
+      }
+    }
+    ::closedir(handle);
+  }
+}
+
+bool TreeWatcher::ReadEvents() {
+  alignas(inotify_event) char buffer[64 << 10];
+  while (true) {
+    ssize_t size = ::read(inotify_fd_, buffer, sizeof(buffer));
+    if (size < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EAGAIN) {
+        return true;
+      }
+      PLOG(ERROR) << "Failed to read tree watcher events, no longer watching";
+      return false;
+    }
+
+    for (ssize_t offset = 0; offset < size;) {
+      const inotify_event* event =
+          reinterpret_cast<const inotify_event*>(buffer + offset);
+      offset += sizeof(inotify_event) + event->len;
+      events_++;
+
+      if (event->mask & IN_Q_OVERFLOW) {
+        overflows_++;
+        pending_flush_ = true;
+        rescan_ = true;
+        continue;
+      }
+      auto dir = dirs_.find(event->wd);
+      if (dir == dirs_.end()) {
+        // a watch we have stopped following
+        continue;
+      }
+      if (event->mask & IN_IGNORED) {
+        // the directory was removed
+        dirs_.erase(dir);
+        watches_--;
+        continue;
+      }
+
+      std::string path = dir->second;
+      if (event->len > 0 && event->name[0] != '\0') {
+        path += "/";
+        path += event->name;
+      } else if (path.empty()) {
+        path = "/";
+      }
+
+      if (event->mask & IN_ISDIR) {
+        if (event->mask & (IN_MOVED_FROM | IN_MOVED_TO)) {
+          // every path below it changed, and the watches with them
+          pending_flush_ = true;
+          rescan_ = true;
+        } else if (event->mask & IN_CREATE) {
+          WatchTree(path, true);
+        } else if ((event->mask & IN_DELETE) && !pending_flush_) {
+          // its files were removed first, but not necessarily seen
+          pending_dirs_.insert(path);
+        }
+      }
+      AddPending(path);
+    }
+  }
+}
+
+void TreeWatcher::AddPending(const std::string& path) {
+  if (pending_flush_) {
+    return;
+  }
+  pending_.insert(path);
+  if (pending_.size() + pending_dirs_.size() > kMaxBatchPaths) {
+    pending_flush_ = true;
+  }
+}
+
+void TreeWatcher::ApplyBatch() {
+  if (rescan_) {
+    // watch the tree as it is now, then drop the watches it no longer has
+    rescan_ = false;
+    std::unordered_map<int, std::string> old_dirs;
+    old_dirs.swap(dirs_);
+    watches_ = 0;
+    WatchTree("", false);
+    for (const auto& pair : old_dirs) {
+      if (dirs_.count(pair.first) == 0) {
+        ::inotify_rm_watch(inotify_fd_, pair.first);
+      }
+    }
+  }
+
+  if (pending_flush_) {
+    flush_();
+    flushes_++;
+  } else {
+    for (const std::string& path : pending_) {
+      invalidate_(path, false);
+    }
+    for (const std::string& path : pending_dirs_) {
+      invalidate_(path, true);
+    }
+    invalidated_ += pending_.size() + pending_dirs_.size();
+  }
+  batches_++;
+  pending_.clear();
+  pending_dirs_.clear();
+  pending_flush_ = false;
+}
+
+}  // namespace logfs_fuse
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <thread>  // NOLINT(build/c++11)
+#include <unordered_map>
+#include <unordered_set>
+
+namespace logfs_fuse {
+
+/// Turns changes made to the real tree outside of the mount into cache
+/// invalidations
+/**
+ *  Our caches are kept correct for changes made through the mount, but a
+ *  package manager refreshing a sysroot writes to the real tree directly.
+ *  Start() puts an inotify watch on every directory of the real tree, and
+ *  a background thread turns the events into mirror paths.
+ *
+ *  Events are coalesced for a short interval, so a file rewritten in many
+ *  small writes is invalidated once, and each batch is handed to the
+ *  invalidate callback one distinct path at a time. A removed directory is
+ *  invalidated along with everything below it, which covers files in
+ *  directories we couldn't watch. Anything we can't follow path by path
+ *  asks the flush callback to drop everything instead: the kernel dropping
+ *  events because its queue overflowed, a directory moved with cached files
+ *  below it, or a batch too large to be worth walking.
+ *
+ *  Watches are added for directories created or moved into the tree. A new
+ *  directory is listed after its watch is added and everything in it is
+ *  invalidated, since files may have been created in it before the watch
+ *  existed. The whole tree is rescanned after an overflow, since
+ *  directories created while events were lost would otherwise go
+ *  unwatched.
+ */
+class TreeWatcher {
+ public:
+  /// Called on the watcher thread with the mirror path of a changed file,
+  /// and with @p below for a removed directory whose descendants changed
+  /// too
+  typedef std::function<void(const std::string& path, bool below)>
+      InvalidateFn;
+  /// Called on the watcher thread when every cached path may be stale
+  typedef std::function<void()> FlushFn;
+
+  /// Snapshot of the watcher counters
+  struct Stats {
+    uint64_t watches;      ///< directories currently watched
+    uint64_t unwatched;    ///< directories a watch couldn't be added to
+    uint64_t events;       ///< inotify events read
+    uint64_t batches;      ///< coalesced batches applied
+    uint64_t invalidated;  ///< paths handed to the invalidate callback
+    uint64_t flushes;      ///< times every cache was dropped instead
+    uint64_t overflows;    ///< times the kernel dropped events
+  };
+
+  /// Most distinct paths in a batch before it becomes a flush
+  static const size_t kMaxBatchPaths = 4096;
+
+  /// Coalesce the events of @p batch_seconds before applying them
+  TreeWatcher(const std::string& real_root, double batch_seconds);
+
+  /// Stops the thread
+  ~TreeWatcher();
+
+  bool enabled() const {
+    return inotify_fd_ >= 0;
+  }
+
+  /// Start watching, return 0 or -errno if inotify isn't available
+  int Start(InvalidateFn invalidate, FlushFn flush);
+
+  /// Stop watching, dropping events which haven't been applied
+  void Stop();
+
+  Stats GetStats() const;
+
+ private:
+  TreeWatcher(const TreeWatcher&);
+  TreeWatcher& operator=(const TreeWatcher&);
+
+  void WatcherMain();
+
+  /// Watch the directory at @p path and every directory below it. If
+  /// @p invalidate, add everything found below it to the pending batch.
+  void WatchTree(const std::string& path, bool invalidate);
+
+  /// Add @p path to the pending batch, which becomes a flush if too large
+  void AddPending(const std::string& path);
+
+  /// Read the queued events into the pending batch, return false if the
+  /// inotify descriptor failed
+  bool ReadEvents();
+
+  /// Apply the pending batch and start a new one
+  void ApplyBatch();
+
+  std::string real_root_;
+  int64_t batch_ns_;
+  InvalidateFn invalidate_;
+  FlushFn flush_;
+  int inotify_fd_;
+  int wake_pipe_[2];  ///< Stop() writes to it to wake the thread
+  std::thread thread_;
+
+  // written only on the watcher thread
+  std::unordered_map<int, std::string> dirs_;  ///< mirror path by watch
+  std::unordered_set<std::string> pending_;  ///< paths changed in the batch
+  std::unordered_set<std::string> pending_dirs_;  ///< directories removed
+  bool pending_flush_;  ///< the batch drops everything instead
+  bool rescan_;         ///< the tree needs watching again after the batch
+
+  std::atomic<uint64_t> watches_;
+  std::atomic<uint64_t> unwatched_;
+  std::atomic<uint64_t> events_;
+  std::atomic<uint64_t> batches_;
+  std::atomic<uint64_t> invalidated_;
+  std::atomic<uint64_t> flushes_;
+  std::atomic<uint64_t> overflows_;
+};
+
+}  // namespace logfs_fuse
@@ -0,0 +1,64 @@
+#include "unix_socket.h"
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+
+namespace logfs_fuse {
+
+bool UnixSocketAddress(const std::string& path, sockaddr_un* addr) {
+  memset(addr, 0, sizeof(*addr));
+  addr->sun_family = AF_UNIX;
+  if (path.size() >= sizeof(addr->sun_path)) {
+    return false;
+  }
+  strncpy(addr->sun_path, path.c_str(), sizeof(addr->sun_path) - 1);
+  return true;
+}
+
+int ListenUnixSocket(const std::string& path, int type, int backlog) {
+  sockaddr_un addr;
+  if (!UnixSocketAddress(path, &addr)) {
+    return -ENAMETOOLONG;
+  }
+
+  struct stat st;
+  if (::lstat(path.c_str(), &st) == 0) {
+    // anything but a socket is more likely a mistyped path than ours
+    if (!S_ISSOCK(st.st_mode)) {
+      return -EEXIST;
+    }
+
+    // a socket someone still listens on isn't stale, and isn't ours to take
+    int probe = ::socket(AF_UNIX, type | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (probe < 0) {
+      return -errno;
+    }
+    int result =
+        ::connect(probe, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+    // EAGAIN is a full backlog, which someone is listening behind
+    bool live = result == 0 || errno == EAGAIN;
+    ::close(probe);
+    if (live) {
+      return -EADDRINUSE;
+    }
+    ::unlink(path.c_str());
+  }
+
+  int fd = ::socket(AF_UNIX, type | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    return -errno;
+  }
+  if (::bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 ||
+      ::listen(fd, backlog) < 0) {
+    int error = errno;
+    ::close(fd);
+    return -error;
+  }
+  return fd;
+}
+
+}  // namespace logfs_fuse
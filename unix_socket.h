@@ -0,0 +1,24 @@
+#pragma once
+
+#include <sys/un.h>
+
+#include <string>
+
+namespace logfs_fuse {
+
+/// Fill in @p addr for the unix socket at @p path, return false if the
+/// path is too long for it
+bool UnixSocketAddress(const std::string& path, sockaddr_un* addr);
+
+/// Listen for connections of @p type, e.g. SOCK_STREAM, on the unix socket
+/// at @p path
+/**
+ *  A socket left at @p path by a previous run would make bind fail, so it
+ *  is removed first, but one that a running process still listens on
+ *  fails with -EADDRINUSE, and anything other than a socket is left alone
+ *  and fails with -EEXIST. Return the listening descriptor, which is close
+ *  on exec, or -errno.
+ */
+int ListenUnixSocket(const std::string& path, int type, int backlog);
+
+}  // namespace logfs_fuse
@@ -0,0 +1,124 @@
+#include "work_stealing_pool.h"
+
+#include <utility>
+
+namespace logfs_fuse {
+
+// the pool and index of the worker running on the current thread, if any
+static thread_local const WorkStealingPool* tls_pool = NULL;
+static thread_local size_t tls_worker = 0;
+
+WorkStealingPool::WorkStealingPool(size_t num_threads)
+    : next_worker_(0),
+      queued_(0),
+      pending_(0),
+      stopping_(false),
+      steals_(0) {
+  if (num_threads == 0) {
+    num_threads = 1;
+  }
+  for (size_t i = 0; i < num_threads; i++) {
+    workers_.push_back(std::unique_ptr<Worker>(new Worker));
+  }
+  for (size_t i = 0; i < num_threads; i++) {
+    threads_.push_back(std::thread(&WorkStealingPool::WorkerMain, this, i));
+  }
+}
+
+WorkStealingPool::~WorkStealingPool() {
+  Wait();
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  work_cv_.notify_all();
+  for (std::thread& thread : threads_) {
+    thread.join();
+  }
+}
+
+void WorkStealingPool::Submit(Task task) {
+  size_t index = tls_pool == this
+                     ? tls_worker
+                     : next_worker_++ % workers_.size();
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    pending_++;
+  }
+  {
+    Worker& worker = *workers_[index];
+    std::lock_guard<std::mutex> lock(worker.mutex);
+    worker.tasks.push_back(std::move(task));
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    queued_++;
+  }
+  work_cv_.notify_one();
+}
+
+void WorkStealingPool::Wait() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (pending_ > 0) {
+    done_cv_.wait(lock);
+  }
+}
+
+bool WorkStealingPool::TakeTask(size_t self, Task* task) {
+  {
+    Worker& worker = *workers_[self];
+    std::lock_guard<std::mutex> lock(worker.mutex);
+    if (!worker.tasks.empty()) {
+      *task = std::move(worker.tasks.back());
+      worker.tasks.pop_back();
+      return true;
+    }
+  }
+
+  for (size_t i = 1; i < workers_.size(); i++) {
+    Worker& victim = *workers_[(self + i) % workers_.size()];
+    std::lock_guard<std::mutex> lock(victim.mutex);
+    if (!victim.tasks.empty()) {
+      *task = std::move(victim.tasks.front());
+      victim.tasks.pop_front();
+      steals_++;
+      return true;
+    }
+  }
+  return false;
+}
+
+void WorkStealingPool::WorkerMain(size_t self) {
+  tls_pool = this;
+  tls_worker = self;
+
+  while (true) {
+    {
+      // a task is counted in queued_ only once it is in a deque, so a
+      // worker woken here will find one
+      std::unique_lock<std::mutex> lock(mutex_);
+      while (queued_ == 0 && !stopping_) {
+        work_cv_.wait(lock);
+      }
+      if (queued_ == 0) {
+        return;
+      }
+      queued_--;
+    }
+
+    Task task;
+    while (!TakeTask(self, &task)) {
+      // another worker took the task we were counted for and its own task
+      // is still on the way to a deque
+      std::this_thread::yield();
+    }
+    task();
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (--pending_ == 0) {
+      done_cv_.notify_all();
+    }
+  }
+}
+
+}  // namespace logfs_fuse
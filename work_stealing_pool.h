@@ -0,0 +1,77 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>  // NOLINT(build/c++11)
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>  // NOLINT(build/c++11)
+#include <thread>  // NOLINT(build/c++11)
+#include <vector>
+
+namespace logfs_fuse {
+
+/// Thread pool in which idle workers steal queued tasks from busy ones
+/**
+ *  Each worker has its own deque. Tasks submitted from outside the pool
+ *  are dealt to the workers in turn, tasks submitted by a task go on its
+ *  worker's deque. A worker takes its newest task first, for locality,
+ *  and when it has none steals the oldest task of another worker, so a
+ *  few huge tasks (e.g. copying a large file) don't hold up the rest.
+ *
+ *  Each deque has its own lock, which is only contended when stealing.
+ */
+class WorkStealingPool {
+ public:
+  typedef std::function<void()> Task;
+
+  explicit WorkStealingPool(size_t num_threads);
+
+  /// Waits for all tasks to finish
+  ~WorkStealingPool();
+
+  void Submit(Task task);
+
+  /// Wait until every submitted task, including tasks submitted by tasks,
+  /// has finished
+  void Wait();
+
+  size_t num_threads() const {
+    return workers_.size();
+  }
+
+  /// Number of tasks taken from another worker's deque
+  uint64_t steals() const {
+    return steals_.load();
+  }
+
+ private:
+  WorkStealingPool(const WorkStealingPool&);
+  WorkStealingPool& operator=(const WorkStealingPool&);
+
+  struct Worker {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+  };
+
+  /// Take a task for worker @p self, return false if there is none
+  bool TakeTask(size_t self, Task* task);
+
+  void WorkerMain(size_t self);
+
+  std::vector<std::unique_ptr<Worker>> workers_;
+  std::vector<std::thread> threads_;
+  std::atomic<size_t> next_worker_;
+
+  std::mutex mutex_;
+  std::condition_variable work_cv_;  ///< signalled when a task is queued
+  std::condition_variable done_cv_;  ///< signalled when pending_ is zero
+  size_t queued_;   ///< tasks in any deque, guarded by mutex_
+  size_t pending_;  ///< tasks submitted and not finished, by mutex_
+  bool stopping_;
+
+  std::atomic<uint64_t> steals_;
+};
+
+}  // namespace logfs_fuse
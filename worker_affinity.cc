@@ -0,0 +1,130 @@
+#include "worker_affinity.h"
+
+#include <pthread.h>
+#include <sched.h>
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+#include <glog/logging.h>
+
+#include "sharded.h"
+
+namespace logfs_fuse {
+
+/// Parse @p item, a CPU number or range, onto the end of @p cpus
+static bool ParseCpuRange(const std::string& item, std::vector<int>* cpus) {
+  char* end = NULL;
+  int64_t first = strtoll(item.c_str(), &end, 10);
+  int64_t last = first;
+  if (end == item.c_str()) {
+    return false;
+  }
+  if (*end == '-') {
+    const char* start = end + 1;
+    last = strtoll(start, &end, 10);
+    if (end == start) {
+      return false;
+    }
+  }
+  if (*end != '\0' || first < 0 || last < first || last >= CPU_SETSIZE) {
+    return false;
+  }
+  for (int64_t cpu = first; cpu <= last; cpu++) {
+    cpus->push_back(cpu);
+  }
+  return true;
+}
+
+bool ParseCpuList(const std::string& spec, std::vector<int>* cpus,
+                  std::string* error) {
+  std::stringstream items(spec);
+  std::string item;
+  while (std::getline(items, item, ',')) {
+    if (item.compare(0, 4, "node") == 0) {
+      // the kernel lists a node's CPUs in the same syntax
+      std::string path =
+          "/sys/devices/system/node/" + item + "/cpulist";
+      std::ifstream in(path);
+      std::string node_cpus;
+      std::vector<int> parsed;
+      std::string ignored;
+      if (!std::getline(in, node_cpus) || node_cpus.empty() ||
+          node_cpus.find("node") != std::string::npos ||
+          !ParseCpuList(node_cpus, &parsed, &ignored)) {
+        *error = "no CPUs found for '" + item + "' in " + path;
+        return false;
+      }
+      cpus->insert(cpus->end(), parsed.begin(), parsed.end());
+    } else if (!ParseCpuRange(item, cpus)) {
+      *error = "'" + item + "' is not a CPU, range of CPUs or node";
+      return false;
+    }
+  }
+  return true;
+}
+
+int PinThread(int cpu) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  return -pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+/// Hands the number of a pinned thread back to its pinner when the thread
+/// exits
+struct PinnedWorker {
+  WorkerPinner* pinner = NULL;
+  int worker = -1;
+
+  ~PinnedWorker() {
+    if (pinner) {
+      pinner->Release(worker);
+    }
+  }
+};
+
+static thread_local PinnedWorker tls_pinned_worker;
+
+WorkerPinner::WorkerPinner(const std::vector<int>& cpus)
+    : cpus_(cpus), next_worker_(0), workers_(0) {}
+
+void WorkerPinner::PinOnce() {
+  static thread_local bool pinned = false;
+  if (pinned) {
+    return;
+  }
+  pinned = true;
+
+  int worker;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (free_.empty()) {
+      worker = next_worker_++;
+    } else {
+      worker = *free_.begin();
+      free_.erase(free_.begin());
+    }
+  }
+  workers_.fetch_add(1, std::memory_order_relaxed);
+  tls_pinned_worker.pinner = this;
+  tls_pinned_worker.worker = worker;
+
+  int cpu = cpus_[worker % cpus_.size()];
+  SetThreadShard(worker);
+  int result = PinThread(cpu);
+  LOG_IF(WARNING, result < 0) << "Failed to pin worker " << worker
+                              << " to CPU " << cpu << ", [" << -result
+                              << "] : " << strerror(-result);
+}
+
+void WorkerPinner::Release(int worker) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  free_.insert(worker);
+  workers_.fetch_sub(1, std::memory_order_relaxed);
+}
+
+}  // namespace logfs_fuse
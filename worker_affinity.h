@@ -0,0 +1,69 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>  // NOLINT(build/c++11)
+#include <set>
+#include <string>
+#include <vector>
+
+namespace logfs_fuse {
+
+/// Parse a comma separated list of CPUs into @p cpus
+/**
+ *  Each item is a CPU number, an inclusive range such as "8-15", or a NUMA
+ *  node such as "node1", which stands for the CPUs of that node. On a bad
+ *  item returns false and describes it in @p error.
+ */
+bool ParseCpuList(const std::string& spec, std::vector<int>* cpus,
+                  std::string* error);
+
+/// Pin the calling thread to @p cpu, return zero or a negative errno
+int PinThread(int cpu);
+
+/// Pins each thread serving fuse requests to its own CPU
+/**
+ *  fuse starts its worker threads itself, so each one is pinned when it
+ *  serves its first request: the n-th worker goes to the n-th CPU of the
+ *  list, wrapping round if there are more workers than CPUs, and takes
+ *  the n-th shard of every Sharded structure so that the workers of
+ *  different cores never update the same counters.
+ *
+ *  fuse also retires idle workers and starts new ones under load. A
+ *  worker's number is handed back when it exits and the lowest free number
+ *  goes to the next new worker, so replaced workers keep the spread over
+ *  the CPUs and shards. The pinner must outlive the threads it pins, as it
+ *  does the threads of the fuse loop it serves.
+ */
+class WorkerPinner {
+ public:
+  /// Pin to @p cpus, or leave threads alone if it is empty
+  explicit WorkerPinner(const std::vector<int>& cpus);
+
+  /// Pin the calling thread, if it isn't already
+  void Enter() {
+    if (!cpus_.empty()) {
+      PinOnce();
+    }
+  }
+
+  /// Return the number of pinned threads which haven't exited
+  int workers() const {
+    return workers_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  friend struct PinnedWorker;
+
+  void PinOnce();
+
+  /// Take back the number of a pinned thread which is exiting
+  void Release(int worker);
+
+  std::vector<int> cpus_;
+  std::mutex mutex_;
+  std::set<int> free_;  ///< numbers of exited workers
+  int next_worker_;     ///< lowest number never handed out
+  std::atomic<int> workers_;
+};
+
+}  // namespace logfs_fuse
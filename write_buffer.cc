@@ -0,0 +1,209 @@
+#include "write_buffer.h"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+namespace logfs_fuse {
+
+// buffered data is written out up to a multiple of this when the buffer
+// fills up
+static const off_t kWriteAlignment = 4096;
+
+// pwrite all of @p size bytes, returning 0 or -errno
+static int PwriteAll(int fd, const char* buf, size_t size, off_t offset) {
+  for (size_t written = 0; written < size;) {
+    ssize_t result =
+        ::pwrite(fd, buf + written, size - written, offset + written);
+    if (result < 0) {
+      return -errno;
+    }
+    written += result;
+  }
+  return 0;
+}
+
+WriteBuffer::WriteBuffer(int fd, const InodeKey& inode, size_t capacity)
+    : fd_(fd), inode_(inode), capacity_(capacity), start_(0), error_(0) {
+  data_.reserve(capacity_);
+}
+
+int WriteBuffer::WriteOutLocked(size_t size) {
+  int result = PwriteAll(fd_, data_.data(), size, start_);
+  if (result < 0) {
+    // the data is lost either way, keep the error for the application
+    error_ = -result;
+    data_.clear();
+    return result;
+  }
+
+  data_.erase(data_.begin(), data_.begin() + size);
+  start_ += size;
+  return 0;
+}
+
+ssize_t WriteBuffer::Write(const char* buf, size_t size, off_t offset) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (error_) {
+    return -error_;
+  }
+
+  off_t end = start_ + static_cast<off_t>(data_.size());
+  if (!data_.empty() && offset != end) {
+    int result = WriteOutLocked(data_.size());
+    if (result < 0) {
+      return result;
+    }
+  }
+
+  // large writes gain nothing from buffering
+  if (size >= capacity_) {
+    int result = PwriteAll(fd_, buf, size, offset);
+    return result < 0 ? result : static_cast<ssize_t>(size);
+  }
+
+  if (data_.empty()) {
+    start_ = offset;
+  }
+  data_.insert(data_.end(), buf, buf + size);
+
+  if (data_.size() >= capacity_) {
+    end = start_ + static_cast<off_t>(data_.size());
+    off_t aligned_end = end - end % kWriteAlignment;
+    size_t out_size = data_.size();
+    if (aligned_end > start_) {
+      out_size = aligned_end - start_;
+    }
+    int result = WriteOutLocked(out_size);
+    if (result < 0) {
+      return result;
+    }
+  }
+
+  return size;
+}
+
+int WriteBuffer::FlushRange(off_t offset, size_t size) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  off_t end = start_ + static_cast<off_t>(data_.size());
+  if (data_.empty() || offset >= end ||
+      offset + static_cast<off_t>(size) <= start_) {
+    return 0;
+  }
+  return WriteOutLocked(data_.size());
+}
+
+int WriteBuffer::WriteOut() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (data_.empty()) {
+    return 0;
+  }
+  return WriteOutLocked(data_.size());
+}
+
+int WriteBuffer::Flush() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!data_.empty()) {
+    WriteOutLocked(data_.size());
+  }
+
+  int error = error_;
+  error_ = 0;
+  return -error;
+}
+
+off_t WriteBuffer::End() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (data_.empty()) {
+    return 0;
+  }
+  return start_ + static_cast<off_t>(data_.size());
+}
+
+WriteBufferPool::WriteBufferPool(size_t buffer_size, size_t memory_limit)
+    : buffer_size_(buffer_size),
+      memory_limit_(memory_limit),
+      num_buffers_(0),
+      bytes_reserved_(0),
+      refused_(0) {}
+
+WriteBufferPool::~WriteBufferPool() {}
+
+WriteBuffer* WriteBufferPool::Attach(int fd, const InodeKey& inode) {
+  if (!enabled()) {
+    return NULL;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (bytes_reserved_ + buffer_size_ > memory_limit_) {
+    refused_++;
+    return NULL;
+  }
+
+  WriteBuffer* buffer = new WriteBuffer(fd, inode, buffer_size_);
+  index_[inode].push_back(buffer);
+  bytes_reserved_ += buffer_size_;
+  num_buffers_++;
+  return buffer;
+}
+
+void WriteBufferPool::Detach(WriteBuffer* buffer) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto found = index_.find(buffer->inode());
+    if (found != index_.end()) {
+      std::vector<WriteBuffer*>& buffers = found->second;
+      buffers.erase(std::remove(buffers.begin(), buffers.end(), buffer),
+                    buffers.end());
+      if (buffers.empty()) {
+        index_.erase(found);
+      }
+    }
+    bytes_reserved_ -= buffer_size_;
+    num_buffers_--;
+  }
+  delete buffer;
+}
+
+int WriteBufferPool::FlushInode(const InodeKey& inode) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto found = index_.find(inode);
+  if (found == index_.end()) {
+    return 0;
+  }
+
+  // errors stay pending so that they are reported to the handle which owns
+  // the buffer
+  int result = 0;
+  for (WriteBuffer* buffer : found->second) {
+    int buffer_result = buffer->WriteOut();
+    if (buffer_result < 0) {
+      result = buffer_result;
+    }
+  }
+  return result;
+}
+
+void WriteBufferPool::AdjustSize(const InodeKey& inode, off_t* size) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto found = index_.find(inode);
+  if (found == index_.end()) {
+    return;
+  }
+
+  for (WriteBuffer* buffer : found->second) {
+    *size = std::max(*size, buffer->End());
+  }
+}
+
+WriteBufferPool::Stats WriteBufferPool::GetStats() const {
+  Stats stats;
+  stats.buffers = num_buffers_.load();
+  stats.bytes_reserved = bytes_reserved_.load();
+  stats.refused = refused_.load();
+  return stats;
+}
+
+}  // namespace logfs_fuse
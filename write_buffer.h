@@ -0,0 +1,129 @@
+#pragma once
+
+#include <sys/types.h>
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>  // NOLINT(build/c++11)
+#include <unordered_map>
+#include <vector>
+
+#include "inode_key.h"
+
+namespace logfs_fuse {
+
+/// Write-back buffer which merges small sequential writes to one handle
+/**
+ *  Log files and object files written through the mirror arrive as many
+ *  small write requests. Rather than turning each into a pwrite(2) we
+ *  collect contiguous writes in memory and write them out in large chunks.
+ *
+ *  Buffered data is written out when the buffer fills up, when a write
+ *  isn't contiguous with the buffered data, when a read overlaps it, and
+ *  on flush, fsync and release. When the buffer fills up we write only up
+ *  to the last page boundary and keep the tail, so that the real file sees
+ *  large aligned writes.
+ *
+ *  An error from writing out buffered data is sticky: every later Write()
+ *  fails with it until it is reported by Flush(), which is called from the
+ *  flush and fsync operations so that the error reaches close(2) or
+ *  fsync(2) in the application.
+ */
+class WriteBuffer {
+ public:
+  WriteBuffer(int fd, const InodeKey& inode, size_t capacity);
+
+  /// Buffer @p size bytes of @p buf at @p offset, or write them through
+  /**
+   *  Returns the number of bytes accepted, or -errno.
+   */
+  ssize_t Write(const char* buf, size_t size, off_t offset);
+
+  /// Write out any buffered data which overlaps [offset, offset + size)
+  int FlushRange(off_t offset, size_t size);
+
+  /// Write out all buffered data, leaving any error pending
+  int WriteOut();
+
+  /// Write out all buffered data and report, then clear, any pending error
+  int Flush();
+
+  /// Return the end offset of the buffered data, or zero if there is none
+  off_t End();
+
+  const InodeKey& inode() const {
+    return inode_;
+  }
+
+ private:
+  /// Write out the first @p size buffered bytes. Caller must hold mutex_
+  int WriteOutLocked(size_t size);
+
+  int fd_;
+  InodeKey inode_;
+  size_t capacity_;
+
+  std::mutex mutex_;
+  std::vector<char> data_;
+  off_t start_;  ///< file offset of data_[0]
+  int error_;    ///< errno of a failed write-out not yet reported
+};
+
+/// Creates write buffers within a memory limit and tracks them per inode
+/**
+ *  Other handles on the same inode don't see buffered data, so we keep an
+ *  index of the buffers on each inode. getattr uses it to report the size
+ *  the file will have once buffers are written, and opens and truncates of
+ *  an inode write its buffers out first.
+ */
+class WriteBufferPool {
+ public:
+  /// Snapshot of the pool counters
+  struct Stats {
+    uint64_t buffers;         ///< buffers currently attached
+    uint64_t bytes_reserved;  ///< memory reserved by attached buffers
+    uint64_t refused;         ///< handles left unbuffered by the limit
+  };
+
+  /// A @p buffer_size of zero disables buffering
+  WriteBufferPool(size_t buffer_size, size_t memory_limit);
+  ~WriteBufferPool();
+
+  bool enabled() const {
+    return buffer_size_ > 0;
+  }
+
+  /// Return true if any buffers are attached, cheap enough for every op
+  bool HasBuffers() const {
+    return num_buffers_.load(std::memory_order_relaxed) > 0;
+  }
+
+  /// Create a buffer for writes to @p fd, or NULL if over the memory limit
+  WriteBuffer* Attach(int fd, const InodeKey& inode);
+
+  /// Destroy @p buffer, which must already have been flushed
+  void Detach(WriteBuffer* buffer);
+
+  /// Write out every buffer attached to @p inode
+  int FlushInode(const InodeKey& inode);
+
+  /// If buffers on @p inode extend past *@p size, increase *@p size
+  void AdjustSize(const InodeKey& inode, off_t* size);
+
+  Stats GetStats() const;
+
+ private:
+  typedef std::unordered_map<InodeKey, std::vector<WriteBuffer*>,
+                             InodeKeyHash> Index;
+
+  size_t buffer_size_;
+  size_t memory_limit_;
+
+  std::mutex mutex_;
+  Index index_;
+  std::atomic<uint64_t> num_buffers_;
+  std::atomic<uint64_t> bytes_reserved_;
+  std::atomic<uint64_t> refused_;
+};
+
+}  // namespace logfs_fuse
@@ -0,0 +1,308 @@
+#include "xattr_cache.h"
+
+#include <sys/stat.h>
+#include <sys/xattr.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <utility>
+
+#include "clock.h"
+#include "path_prefix.h"
+#include "request_arena.h"
+#include "snapshot.h"
+#include "stats.h"
+
+namespace logfs_fuse {
+
+// most attribute names we remember for one file
+static const size_t kMaxNamesPerEntry = 64;
+
+const size_t XattrCache::kMaxValueSize;
+const size_t XattrCache::kStripes;
+
+XattrCache::XattrCache(size_t capacity, double ttl_seconds)
+    : capacity_(capacity),
+      ttl_ms_(static_cast<int64_t>(ttl_seconds * 1000)) {
+  std::fill(generations_, generations_ + kStripes, 0);
+}
+
+XattrCache::~XattrCache() {}
+
+XattrCache::Entry* XattrCache::FindLocked(const std::string& path,
+                                          int64_t now_ms) {
+  auto found = index_.find(path);
+  if (found == index_.end()) {
+    return NULL;
+  }
+
+  LruList::iterator entry = found->second;
+  if (entry->expires_ms <= now_ms) {
+    lru_.erase(entry);
+    index_.erase(found);
+    return NULL;
+  }
+
+  lru_.splice(lru_.begin(), lru_, entry);
+  return &*entry;
+}
+
+int XattrCache::CopyOut(const Value& cached, char* value, size_t bufsize) {
+  if (cached.error) {
+    return -cached.error;
+  }
+  if (bufsize == 0) {
+    return cached.value.size();
+  }
+  if (bufsize < cached.value.size()) {
+    return -ERANGE;
+  }
+  memcpy(value, cached.value.data(), cached.value.size());
+  return cached.value.size();
+}
+
+// return true if @p error says the attribute isn't there, rather than that
+// this lookup of it failed
+static bool IsLastingError(int error) {
+  return error == ENODATA || error == ENOTSUP || error == ENOENT;
+}
+
+int XattrCache::Get(const std::string& path, const char* name, char* value,
+                    size_t bufsize) {
+  if (!enabled()) {
+    ssize_t result = TimeBacking([&] {
+      return ::lgetxattr(path.c_str(), name, value, bufsize);
+    });
+    return result < 0 ? -errno : result;
+  }
+
+  int64_t now_ms = CoarseNowMs();
+  bool have_entry = false;
+  uint64_t generation;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    generation = generations_[Stripe(path)];
+    Entry* entry = FindLocked(path, now_ms);
+    if (entry) {
+      have_entry = true;
+      // looking up by a const char* would build a std::string each time
+      ScratchString key;
+      key->assign(name);
+      auto found = entry->values.find(*key);
+      if (found != entry->values.end()) {
+        if (found->second.error) {
+          negative_hits_.Add(1);
+        } else {
+          hits_.Add(1);
+        }
+        return CopyOut(found->second, value, bufsize);
+      }
+    }
+  }
+
+  // fetch into our own buffer so that a size probe fills the cache too
+  misses_.Add(1);
+  char buf[kMaxValueSize];
+  Value cached;
+  cached.error = 0;
+  ssize_t result = TimeBacking([&] {
+    return ::lgetxattr(path.c_str(), name, buf, sizeof(buf));
+  });
+  if (result >= 0) {
+    cached.value.assign(buf, result);
+  } else if (errno == ERANGE) {
+    // too big to cache, let the caller have it directly
+    result = TimeBacking([&] {
+      return ::lgetxattr(path.c_str(), name, value, bufsize);
+    });
+    return result < 0 ? -errno : result;
+  } else if (IsLastingError(errno)) {
+    cached.error = errno;
+  } else {
+    // may be gone on the next try, so it isn't cached
+    return -errno;
+  }
+
+  // a new entry needs to know which inode it describes
+  struct stat st;
+  if (!have_entry &&
+      TimeBacking([&] { return ::lstat(path.c_str(), &st); }) < 0) {
+    return CopyOut(cached, value, bufsize);
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (generations_[Stripe(path)] != generation) {
+    // invalidated while we fetched it, the value may already be stale
+    return CopyOut(cached, value, bufsize);
+  }
+  Entry* entry = FindLocked(path, now_ms);
+  if (!entry && !have_entry) {
+    Entry fresh;
+    fresh.path = path;
+    fresh.inode = InodeKey(st);
+    fresh.expires_ms = now_ms + ttl_ms_;
+    lru_.push_front(fresh);
+    index_[path] = lru_.begin();
+    entry = &lru_.front();
+    while (lru_.size() > capacity_) {
+      index_.erase(lru_.back().path);
+      lru_.pop_back();
+    }
+  }
+  if (entry && entry->values.size() < kMaxNamesPerEntry) {
+    entry->values[name] = cached;
+  }
+  return CopyOut(cached, value, bufsize);
+}
+
+void XattrCache::Validate(const std::string& path, const InodeKey& inode) {
+  if (!enabled()) {
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto found = index_.find(path);
+  if (found != index_.end() && found->second->inode != inode) {
+    generations_[Stripe(path)]++;
+    lru_.erase(found->second);
+    index_.erase(found);
+    invalidations_.Add(1);
+  }
+}
+
+void XattrCache::Invalidate(const std::string& path) {
+  if (!enabled()) {
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  generations_[Stripe(path)]++;
+  auto found = index_.find(path);
+  if (found != index_.end()) {
+    lru_.erase(found->second);
+    index_.erase(found);
+    invalidations_.Add(1);
+  }
+}
+
+void XattrCache::InvalidateBelow(const std::string& dir) {
+  if (!enabled()) {
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  InvalidateAllLocked();
+  for (auto entry = lru_.begin(); entry != lru_.end();) {
+    if (IsBelow(entry->path.data(), entry->path.size(), dir)) {
+      index_.erase(entry->path);
+      entry = lru_.erase(entry);
+      invalidations_.Add(1);
+    } else {
+      ++entry;
+    }
+  }
+}
+
+void XattrCache::InvalidateAllLocked() {
+  // the paths affected aren't known, so every stripe changes
+  for (uint64_t& generation : generations_) {
+    generation++;
+  }
+}
+
+void XattrCache::Clear() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  InvalidateAllLocked();
+  invalidations_.Add(lru_.size());
+  index_.clear();
+  lru_.clear();
+}
+
+void XattrCache::Save(SnapshotWriter* out) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  int64_t now_ms = CoarseNowMs();
+  out->PutU64(lru_.size());
+  // least recently used first, so that Load() rebuilds the same order
+  for (auto entry = lru_.rbegin(); entry != lru_.rend(); ++entry) {
+    out->PutString(entry->path);
+    out->PutU64(entry->inode.dev);
+    out->PutU64(entry->inode.ino);
+    out->PutU64(std::max<int64_t>(entry->expires_ms - now_ms, 0));
+    out->PutU64(entry->values.size());
+    for (const auto& value : entry->values) {
+      out->PutString(value.first);
+      out->PutU64(value.second.error);
+      out->PutString(value.second.value);
+    }
+  }
+}
+
+bool XattrCache::Load(SnapshotReader* in) {
+  loaded_.clear();
+  uint64_t count = 0;
+  if (!in->GetU64(&count)) {
+    return false;
+  }
+
+  int64_t now_ms = CoarseNowMs();
+  for (uint64_t i = 0; i < count; i++) {
+    Entry entry;
+    uint64_t dev = 0, ino = 0, remaining_ms = 0, values = 0;
+    if (!in->GetString(&entry.path) || !in->GetU64(&dev) ||
+        !in->GetU64(&ino) || !in->GetU64(&remaining_ms) ||
+        !in->GetU64(&values)) {
+      loaded_.clear();
+      return false;
+    }
+    entry.inode = InodeKey(dev, ino);
+    entry.expires_ms = now_ms + remaining_ms;
+    for (uint64_t j = 0; j < values; j++) {
+      std::string name;
+      uint64_t error = 0;
+      Value value;
+      if (!in->GetString(&name) || !in->GetU64(&error) ||
+          !in->GetString(&value.value)) {
+        loaded_.clear();
+        return false;
+      }
+      value.error = error;
+      entry.values[name] = value;
+    }
+
+    if (enabled() && remaining_ms > 0) {
+      loaded_.push_back(std::move(entry));
+    }
+  }
+  return true;
+}
+
+void XattrCache::FinishLoad(bool keep) {
+  if (keep) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (Entry& entry : loaded_) {
+      if (index_.count(entry.path)) {
+        // looked up since we started, which is fresher
+        continue;
+      }
+      lru_.push_front(std::move(entry));
+      index_[lru_.front().path] = lru_.begin();
+      while (lru_.size() > capacity_) {
+        index_.erase(lru_.back().path);
+        lru_.pop_back();
+      }
+    }
+  }
+  loaded_.clear();
+}
+
+XattrCache::Stats XattrCache::GetStats() const {
+  Stats stats;
+  stats.hits = hits_.value();
+  stats.negative_hits = negative_hits_.value();
+  stats.misses = misses_.value();
+  stats.invalidations = invalidations_.value();
+  return stats;
+}
+
+}  // namespace logfs_fuse
@@ -0,0 +1,149 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <mutex>  // NOLINT(build/c++11)
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "inode_key.h"
+#include "sharded.h"
+
+namespace logfs_fuse {
+
+class SnapshotReader;
+class SnapshotWriter;
+
+/// Cache of extended attribute lookups, including "no such attribute"
+/**
+ *  The kernel asks for security.capability before every write and for
+ *  other attributes on almost every access, and nearly all of the answers
+ *  are ENODATA. We remember both values and the errors saying an attribute
+ *  or file isn't there (ENODATA, ENOTSUP and ENOENT) per file so that these
+ *  lookups don't reach the real tree. Other errors may be transient and
+ *  are returned without being cached.
+ *
+ *  Entries are keyed by real path, and remember the inode they were filled
+ *  from. Validate() drops an entry when getattr finds a different inode at
+ *  its path, which catches files replaced outside of the mount, since the
+ *  kernel always looks a path up before asking for its attributes. Entries
+ *  also expire after a fixed time so that attributes changed in place
+ *  outside of the mount are eventually seen. Changes made through the
+ *  mount, and those a TreeWatcher sees made outside of it, call
+ *  Invalidate().
+ */
+class XattrCache {
+ public:
+  /// Snapshot of the cache counters
+  struct Stats {
+    uint64_t hits;           ///< lookups answered with a cached value
+    uint64_t negative_hits;  ///< lookups answered with a cached error
+    uint64_t misses;         ///< lookups which went to the real tree
+    uint64_t invalidations;  ///< entries dropped before they expired
+  };
+
+  /// Largest attribute value we keep in the cache
+  static const size_t kMaxValueSize = 4096;
+
+  /// A @p capacity of zero disables the cache
+  XattrCache(size_t capacity, double ttl_seconds);
+  ~XattrCache();
+
+  bool enabled() const {
+    return capacity_ > 0;
+  }
+
+  /// getxattr(2) on @p path with the cache in front of it
+  /**
+   *  Implements the usual size-probe semantics: with a zero @p bufsize
+   *  returns the size of the value, with a @p bufsize too small for it
+   *  returns -ERANGE, otherwise copies the value to @p value and returns its
+   *  size. Returns -errno on failure.
+   */
+  int Get(const std::string& path, const char* name, char* value,
+          size_t bufsize);
+
+  /// Drop the entry for @p path if the file there is no longer @p inode
+  void Validate(const std::string& path, const InodeKey& inode);
+
+  /// Drop the entry for @p path
+  void Invalidate(const std::string& path);
+
+  /// Drop the entries of every path below the directory @p dir, after it
+  /// was renamed
+  void InvalidateBelow(const std::string& dir);
+
+  /// Drop all entries
+  void Clear();
+
+  /// Write the unexpired entries to @p out, for a process taking over
+  void Save(SnapshotWriter* out);
+
+  /// Read back the entries a Save() wrote, keeping the time they had
+  /// left, return false if @p in was truncated
+  /**
+   *  Nothing is added until FinishLoad(), so that the caller can drop what
+   *  was read if the rest of the snapshot turns out to be bad.
+   */
+  bool Load(SnapshotReader* in);
+
+  /// Add what the last Load() read if @p keep, and drop it either way
+  void FinishLoad(bool keep);
+
+  Stats GetStats() const;
+
+ private:
+  /// Cached result of one attribute lookup
+  struct Value {
+    int error;          ///< errno of the lookup, or zero if it succeeded
+    std::string value;  ///< the value, if the lookup succeeded
+  };
+
+  /// Cached attributes of one file
+  struct Entry {
+    std::string path;
+    InodeKey inode;
+    int64_t expires_ms;
+    std::unordered_map<std::string, Value> values;
+  };
+
+  typedef std::list<Entry> LruList;
+
+  /// Return the entry for @p path, or NULL. Caller must hold mutex_
+  Entry* FindLocked(const std::string& path, int64_t now_ms);
+
+  /// Copy @p cached out following getxattr(2) semantics
+  static int CopyOut(const Value& cached, char* value, size_t bufsize);
+
+  /// Number of stripes of generations_
+  static const size_t kStripes = 64;
+
+  /// Return the generation stripe of @p path
+  static size_t Stripe(const std::string& path) {
+    return std::hash<std::string>()(path) % kStripes;
+  }
+
+  /// Count an invalidation of every path. Caller must hold mutex_
+  void InvalidateAllLocked();
+
+  size_t capacity_;
+  int64_t ttl_ms_;
+
+  std::mutex mutex_;
+  LruList lru_;  ///< most recently used at the front
+  std::unordered_map<std::string, LruList::iterator> index_;
+  /// bumped by every invalidation of the paths in each stripe, so that a
+  /// lookup which raced with one doesn't cache what it fetched
+  uint64_t generations_[kStripes];
+
+  std::vector<Entry> loaded_;  ///< read by Load(), not yet added
+
+  ShardedCounter hits_;
+  ShardedCounter negative_hits_;
+  ShardedCounter misses_;
+  ShardedCounter invalidations_;
+};
+
+}  // namespace logfs_fuse
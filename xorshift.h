@@ -0,0 +1,16 @@
+#pragma once
+
+#include <cstdint>
+
+namespace logfs_fuse {
+
+/// Advance the xorshift64 generator @p state, which must not start at
+/// zero, and return its next value. Cheap enough to pick a path per op.
+inline uint64_t NextRandom(uint64_t* state) {
+  *state ^= *state << 13;
+  *state ^= *state >> 7;
+  *state ^= *state << 17;
+  return *state;
+}
+
+}  // namespace logfs_fuse
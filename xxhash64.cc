@@ -0,0 +1,127 @@
+#include "xxhash64.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace logfs_fuse {
+
+static const uint64_t kPrime1 = 0x9E3779B185EBCA87ULL;
+static const uint64_t kPrime2 = 0xC2B2AE3D27D4EB4FULL;
+static const uint64_t kPrime3 = 0x165667B19E3779F9ULL;
+static const uint64_t kPrime4 = 0x85EBCA77C2B2AE63ULL;
+static const uint64_t kPrime5 = 0x27D4EB2F165667C5ULL;
+
+static inline uint64_t RotateLeft(uint64_t value, int bits) {
+  return (value << bits) | (value >> (64 - bits));
+}
+
+// little-endian loads, memcpy keeps them legal on unaligned data
+static inline uint64_t Read64(const unsigned char* data) {
+  uint64_t value;
+  memcpy(&value, data, sizeof(value));
+  return value;
+}
+
+static inline uint32_t Read32(const unsigned char* data) {
+  uint32_t value;
+  memcpy(&value, data, sizeof(value));
+  return value;
+}
+
+static inline uint64_t Round(uint64_t acc, uint64_t input) {
+  acc += input * kPrime2;
+  acc = RotateLeft(acc, 31);
+  return acc * kPrime1;
+}
+
+static inline uint64_t MergeRound(uint64_t acc, uint64_t value) {
+  acc ^= Round(0, value);
+  return acc * kPrime1 + kPrime4;
+}
+
+Xxhash64::Xxhash64(uint64_t seed)
+    : seed_(seed), total_size_(0), buffered_(0) {
+  acc_[0] = seed + kPrime1 + kPrime2;
+  acc_[1] = seed + kPrime2;
+  acc_[2] = seed;
+  acc_[3] = seed - kPrime1;
+}
+
+void Xxhash64::Update(const void* data, size_t size) {
+  const unsigned char* input = static_cast<const unsigned char*>(data);
+  const unsigned char* end = input + size;
+  total_size_ += size;
+
+  // top up a partial stripe first
+  if (buffered_ > 0) {
+    size_t take = std::min(size, sizeof(buffer_) - buffered_);
+    memcpy(buffer_ + buffered_, input, take);
+    buffered_ += take;
+    input += take;
+    if (buffered_ < sizeof(buffer_)) {
+      return;
+    }
+    for (int i = 0; i < 4; i++) {
+      acc_[i] = Round(acc_[i], Read64(buffer_ + 8 * i));
+    }
+    buffered_ = 0;
+  }
+
+  // whole stripes straight from the input
+  while (end - input >= 32) {
+    for (int i = 0; i < 4; i++) {
+      acc_[i] = Round(acc_[i], Read64(input + 8 * i));
+    }
+    input += 32;
+  }
+
+  memcpy(buffer_, input, end - input);
+  buffered_ = end - input;
+}
+
+uint64_t Xxhash64::Digest() const {
+  uint64_t hash;
+  if (total_size_ >= 32) {
+    hash = RotateLeft(acc_[0], 1) + RotateLeft(acc_[1], 7) +
+           RotateLeft(acc_[2], 12) + RotateLeft(acc_[3], 18);
+    for (int i = 0; i < 4; i++) {
+      hash = MergeRound(hash, acc_[i]);
+    }
+  } else {
+    hash = seed_ + kPrime5;
+  }
+  hash += total_size_;
+
+  const unsigned char* input = buffer_;
+  const unsigned char* end = buffer_ + buffered_;
+  while (end - input >= 8) {
+    hash ^= Round(0, Read64(input));
+    hash = RotateLeft(hash, 27) * kPrime1 + kPrime4;
+    input += 8;
+  }
+  if (end - input >= 4) {
+    hash ^= static_cast<uint64_t>(Read32(input)) * kPrime1;
+    hash = RotateLeft(hash, 23) * kPrime2 + kPrime3;
+    input += 4;
+  }
+  while (input < end) {
+    hash ^= (*input) * kPrime5;
+    hash = RotateLeft(hash, 11) * kPrime1;
+    input++;
+  }
+
+  hash ^= hash >> 33;
+  hash *= kPrime2;
+  hash ^= hash >> 29;
+  hash *= kPrime3;
+  hash ^= hash >> 32;
+  return hash;
+}
+
+uint64_t Xxhash64::Hash(const void* data, size_t size, uint64_t seed) {
+  Xxhash64 state(seed);
+  state.Update(data, size);
+  return state.Digest();
+}
+
+}  // namespace logfs_fuse
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace logfs_fuse {
+
+/// Streaming XXH64 hash
+/**
+ *  A straight implementation of the 64 bit xxHash algorithm, which hashes
+ *  at several GB/s per core and so keeps up with reading files from disk.
+ *  Results match the reference XXH64() for the same seed.
+ */
+class Xxhash64 {
+ public:
+  explicit Xxhash64(uint64_t seed = 0);
+
+  /// Hash @p size more bytes at @p data
+  void Update(const void* data, size_t size);
+
+  /// Return the hash of everything passed to Update() so far
+  uint64_t Digest() const;
+
+  /// Return the hash of @p size bytes at @p data
+  static uint64_t Hash(const void* data, size_t size, uint64_t seed = 0);
+
+ private:
+  uint64_t seed_;
+  uint64_t acc_[4];
+  uint64_t total_size_;
+  unsigned char buffer_[32];  ///< a partial stripe
+  size_t buffered_;
+};
+
+}  // namespace logfs_fuse